@@ -3,13 +3,28 @@
 
 #include <wx/cmdline.h>
 #include <wx/stdpaths.h>
+#include <wx/filename.h>
 
 #include <exception>
+#include <thread>
 #include <algorithm>
 #include <fstream>
 #include "./misc/StrCnv.hpp"
+#include "./misc/GarbageCollector.hpp"
+#include "./misc/MemoryPressureMonitor.hpp"
+#include "./misc/ThreadPool.hpp"
+#include "./plugin/ModuleScanBenchmark.hpp"
 #include "./plugin/PluginScanner.hpp"
+#include "./plugin/PluginScanWorker.hpp"
+#include "./plugin/vst3/ParameterListBenchmark.hpp"
 #include "./plugin/vst3/Vst3PluginFactory.hpp"
+#include "./plugin/vst3/Vst3PluginPool.hpp"
+#include "./plugin/sandbox/SandboxChild.hpp"
+#include "./plugin/sandbox/SandboxedVst3Processor.hpp"
+#include "./project/ProjectLoadBenchmark.hpp"
+#include "./project/ProjectSerializer.hpp"
+#include "./processor/MidiMessageBenchmark.hpp"
+#include "./processor/Processor.hpp"
 
 #include "device/AudioDeviceManager.hpp"
 #include "device/MidiDeviceManager.hpp"
@@ -25,6 +40,43 @@ std::string GetPluginDescFileName() {
     return "plugin_list.bin";
 }
 
+//! 起動時に読み込む、PluginDatabase形式のプラグインの一覧
+String GetPluginDatabaseFileName() {
+    return L"plugin_list.db";
+}
+
+//! データベースを置き換えるときに書き込む一時ファイル
+/*! Windowsでは、マップしているファイルは置き換えられないので、
+ *  置き換えに失敗した場合は、このファイルを残しておき、次回の起動時にマップする前に置き換える。
+ */
+String GetPendingPluginDatabaseFileName() {
+    return GetPluginDatabaseFileName() + L".tmp";
+}
+
+//! プラグインを並列に作成するスレッド数の上限
+/*! プラグインの初期化はディスクI/Oやメモリ確保が多いので、
+ *  ハードウェアのスレッド数より少なく抑える。
+ */
+UInt32 const kMaxPluginCreationThreads = 4;
+
+//! メモリの逼迫を確認して、プラグインのプールを縮小するかどうかを決める間隔
+int const kMemoryCheckIntervalMilliseconds = 5 * 1000;
+
+/*! OSからメモリ逼迫の通知を受け取れない環境で使用するしきい値。
+ *  macOSでは、空きメモリの量はメモリ逼迫の目安にならないので使わない。(MemoryPressureMonitorを参照)
+ */
+//! 空きメモリがこれを下回ったら、プールしているプラグインを解放する
+wxMemorySize const kLowMemoryThreshold = wxMemorySize(512) * 1024 * 1024;
+
+//! 解放後、空きメモリがこれを上回ったら、プラグインの補充を再開する
+wxMemorySize const kMemoryRecoveredThreshold = wxMemorySize(1024) * 1024 * 1024;
+
+//! 自動保存の間隔
+int const kAutosaveIntervalMilliseconds = 30 * 1000;
+
+//! オーディオスレッドで発生したパラメータの変更を、プラグインのEditControllerに反映する間隔
+int const kControllerUpdateIntervalMilliseconds = 30;
+
 std::shared_ptr<Sequence> MakeSequence() {
     static auto const tick_to_sample = [](int tick) -> SampleCount {
         return (SampleCount)std::round(tick / 480.0 * 0.5 * kSampleRate);
@@ -79,9 +131,37 @@ struct MyApp::Impl
             std::ofstream ofs(GetPluginDescFileName());
             auto str = ps->Export();
             ofs.write(str.data(), str.length());
+        
+            WriteDatabase(ps->ExportDatabase());
+        }
+        
+        //! 起動時にマップしているファイルを壊さないように、一時ファイルに書き込んでから置き換える。
+        void WriteDatabase(std::string const &data)
+        {
+            auto const path = GetPluginDatabaseFileName();
+            auto const tmp_path = GetPendingPluginDatabaseFileName();
+        
+            {
+                std::ofstream ofs(to_utf8(tmp_path), std::ios::binary | std::ios::trunc);
+                ofs.write(data.data(), data.size());
+                ofs.close();
+                if(!ofs) {
+                    hwm::dout << "Failed to write the plugin database: " << to_utf8(tmp_path) << std::endl;
+                    wxRemoveFile(tmp_path);
+                    return;
+                }
+            }
+        
+            //! スキャナーとカタログは、起動時に読み込んだデータベースをマップしたまま参照している。
+            //! (Windowsでは置き換えに失敗するので、次回の起動時に置き換える)
+            if(wxRenameFile(tmp_path, path, true) == false) {
+                hwm::dout << "The plugin database will be replaced at the next launch: " << to_utf8(path) << std::endl;
+            }
         }
     };
     
+    //! 他のメンバーから参照されるので、最初に作成して最後に破棄する。
+    GarbageCollector gc_;
     std::unique_ptr<AudioDeviceManager> adm_;
     std::unique_ptr<MidiDeviceManager> mdm_;
     std::vector<MidiDevice *> midi_ins_;
@@ -91,12 +171,156 @@ struct MyApp::Impl
     std::vector<std::shared_ptr<Project>> projects_;
     Project * current_project_ = nullptr;
     
+    //! プラグインを非同期に作成するためのスレッドプール
+    //! (factory_list_を参照するので、factory_list_より先に破棄する)
+    std::unique_ptr<ThreadPool> plugin_creation_pool_;
+    //! (factory_list_を参照するので、factory_list_より先に破棄する)
+    std::unique_ptr<Vst3PluginPool> plugin_pool_;
+    //! 0より大きい場合は、作成したプラグインをこの数だけプールするように設定する
+    UInt32 default_plugin_pool_size_ = 0;
     PluginScanner plugin_scanner_;
     PluginListExporter plugin_list_exporter_;
     ResourceHelper resource_helper_;
+    ProjectSerializer project_serializer_;
+    //! wxAppの初期化後に作成する
+    std::unique_ptr<wxTimer> autosave_timer_;
+    std::unique_ptr<wxTimer> controller_update_timer_;
+    std::unique_ptr<wxTimer> memory_check_timer_;
+    MemoryPressureMonitor memory_pressure_monitor_;
+    
+    //! --sandbox-child オプションで指定された共有メモリの名前。
+    //! 空でない場合、このプロセスはサンドボックスプロセスとして動作する。
+    std::string sandbox_shm_name_;
+    bool sandbox_enabled_ = false;
+    
+    //! --scan-module オプションで指定されたモジュールのパス。
+    //! 空でない場合、このプロセスはプラグインスキャンのワーカープロセスとして動作する。
+    String scan_module_path_;
+    
+    //! --benchmark-project-load オプションで指定されたプラグインの数。
+    //! 0より大きい場合は、プロジェクトの読み込み時間を計測して終了する。
+    UInt32 benchmark_num_plugins_ = 0;
+    
+    //! --benchmark-module-scan オプションで指定されたモジュールのパス。
+    //! 空でない場合は、モジュールのスキャン時間を計測して終了する。
+    String benchmark_module_path_;
+    
+    //! --benchmark-parameter-list オプションで指定されたパラメータの数。
+    //! 0より大きい場合は、パラメータ情報のリストの構築と検索の時間を計測して終了する。
+    UInt32 benchmark_num_params_ = 0;
+    
+    //! --benchmark-midi-messages オプションで指定された、1ブロックあたりのMIDIイベントの数。
+    //! 0より大きい場合は、MIDIメッセージの表現による処理時間の違いを計測して終了する。
+    UInt32 benchmark_num_midi_events_ = 0;
+    
+    void Autosave()
+    {
+        auto pj = MyApp::GetInstance()->GetCurrentProject();
+        if(!pj) { return; }
+        
+        //! 前回の保存以降に状態が変化したプラグインだけ、状態を取得し直す。
+        try {
+            project_serializer_.SaveIncrementally(*pj, MyApp::GetInstance()->GetAutosavePath());
+        } catch(std::exception &e) {
+            hwm::dout << "Failed to autosave the project: " << e.what() << std::endl;
+        }
+    }
+    
+    void ApplyPendingControllerUpdates()
+    {
+        auto pj = MyApp::GetInstance()->GetCurrentProject();
+        if(!pj) { return; }
+        
+        for(auto const &node: pj->GetGraph().GetNodes()) {
+            if(auto vst3 = std::dynamic_pointer_cast<Vst3AudioProcessor>(node->GetProcessor())) {
+                vst3->plugin_->ApplyPendingControllerUpdates();
+            } else if(auto sandboxed = std::dynamic_pointer_cast<SandboxedVst3Processor>(node->GetProcessor())) {
+                //! クラッシュやハングアップしたサンドボックスプロセスは、グラフの処理を止めずに再起動する。
+                sandboxed->RestartIfNeeded();
+            }
+        }
+    }
+    
+    /*! OSからメモリ逼迫の通知を受け取れる環境(macOS)では、警告以上の状態の間、プールを縮小する。
+     *  それ以外の環境では、空きメモリの量でヒステリシスをつけて判断する。
+     */
+    void CheckMemoryPressure()
+    {
+        if(memory_pressure_monitor_.IsSupported()) {
+            auto const level = memory_pressure_monitor_.GetLevel();
+            plugin_pool_->SetMemoryPressure(level != MemoryPressureMonitor::Level::kNormal);
+            return;
+        }
+        
+        auto const free_memory = wxGetFreeMemory();
+        //! 空きメモリを取得できない環境では、何もしない
+        if(free_memory < 0) { return; }
+        
+        if(plugin_pool_->IsUnderMemoryPressure()) {
+            plugin_pool_->SetMemoryPressure(free_memory < kMemoryRecoveredThreshold);
+        } else {
+            plugin_pool_->SetMemoryPressure(free_memory < kLowMemoryThreshold);
+        }
+    }
+    
+    using Stage = MyApp::PluginCreationStage;
+    
+    std::unique_ptr<Vst3Plugin> CreateVst3Plugin(PluginDescription const &desc,
+                                                 std::function<void(Stage stage)> const &notify)
+    {
+        hwm::dout << "Load VST3 Module: " << desc.vst3info().filepath() << std::endl;
+        notify(Stage::kLoadingModule);
+        
+        std::shared_ptr<Vst3PluginFactory> factory;
+        try {
+            factory = factory_list_.FindOrCreateFactory(to_wstr(desc.vst3info().filepath()));
+        } catch(std::exception &e) {
+            hwm::dout << "Failed to create a Vst3PluginFactory: " << e.what() << std::endl;
+            return nullptr;
+        }
+        
+        if(!factory) { return nullptr; }
+        
+        auto cid = to_cid(desc.vst3info().cid());
+        assert(cid);
+        
+        notify(Stage::kInstantiating);
+        try {
+            return factory->CreateByID(*cid);
+        } catch(std::exception &e) {
+            hwm::dout << "Failed to create a Vst3Plugin: " << e.what() << std::endl;
+            return nullptr;
+        }
+    }
+    
+    //! プールにインスタンスがあればそれを返し、なければ新たに作成する。
+    std::unique_ptr<Vst3Plugin> AcquireOrCreateVst3Plugin(PluginDescription const &desc,
+                                                          std::function<void(Stage stage)> const &notify)
+    {
+        if(auto plugin = plugin_pool_->Acquire(desc)) {
+            return plugin;
+        }
+        
+        auto plugin = CreateVst3Plugin(desc, notify);
+        if(plugin && default_plugin_pool_size_ > 0 && plugin_pool_->IsPooled(desc) == false) {
+            //! 次回以降は、プールから取り出せるようにする。
+            plugin_pool_->SetPoolSize(desc, default_plugin_pool_size_);
+        }
+        
+        return plugin;
+    }
     
     Impl()
     {
+        auto const num_threads = std::min<UInt32>(std::max<UInt32>(std::thread::hardware_concurrency(), 1),
+                                                  kMaxPluginCreationThreads);
+        plugin_creation_pool_ = std::make_unique<ThreadPool>(num_threads);
+        plugin_pool_ = std::make_unique<Vst3PluginPool>([this](auto const &desc) {
+            return CreateVst3Plugin(desc, [](auto) {});
+        }, [](auto task) {
+            //! プールのインスタンスは、GUIのイベントの合間に、メインスレッドで一つずつ作成する。
+            MyApp::GetInstance()->CallAfter(std::move(task));
+        });
         plugin_scanner_.AddListener(&plugin_list_exporter_);
     }
     
@@ -117,6 +341,37 @@ bool MyApp::OnInit()
 {
     if(!wxApp::OnInit()) { return false; }
     
+    if(pimpl_->sandbox_shm_name_.empty() == false) {
+        //! サンドボックスプロセスとして起動された場合は、デバイスやGUIを初期化せずに、
+        //! プラグインの処理だけを行って終了する。
+        RunSandboxChild(pimpl_->sandbox_shm_name_, [this](auto const &desc) { return CreateVst3Plugin(desc); });
+        pimpl_->factory_list_.Shrink();
+        return false;
+    }
+    
+    if(pimpl_->scan_module_path_.empty() == false) {
+        //! ワーカープロセスとして起動された場合は、モジュールをスキャンして結果を親プロセスに送るだけで終了する。
+        RunPluginScanWorker(pimpl_->scan_module_path_);
+        pimpl_->factory_list_.Shrink();
+        return false;
+    }
+    
+    if(pimpl_->benchmark_module_path_.empty() == false) {
+        RunModuleScanBenchmark(pimpl_->benchmark_module_path_, 20);
+        pimpl_->factory_list_.Shrink();
+        return false;
+    }
+    
+    if(pimpl_->benchmark_num_params_ > 0) {
+        RunParameterListBenchmark(pimpl_->benchmark_num_params_, 20);
+        return false;
+    }
+    
+    if(pimpl_->benchmark_num_midi_events_ > 0) {
+        RunMidiMessageBenchmark(pimpl_->benchmark_num_midi_events_, 200);
+        return false;
+    }
+    
     wxInitAllImageHandlers();
     
     pimpl_->plugin_scanner_.AddDirectories({
@@ -125,17 +380,42 @@ bool MyApp::OnInit()
         L"../../ext/vst3sdk/build_debug/VST3/Debug",
     });
     
-    std::ifstream ifs(GetPluginDescFileName());
-    if(ifs) {
-        std::string dump_data;
-        std::copy(std::istreambuf_iterator<char>(ifs),
-                  std::istreambuf_iterator<char>(),
-                  std::back_inserter(dump_data)
-                  );
-        
-        pimpl_->plugin_scanner_.Import(dump_data);
+    //! データベースはマップするだけなので、プラグインの数に関係なくすぐに読み込める。
+    //! データベースがない場合や、形式が古い場合は、protobuf形式の一覧から読み込む。
+    //! 前回の終了時に置き換えられなかったデータベースがあれば、マップする前に置き換える。
+    if(wxFileExists(GetPendingPluginDatabaseFileName())) {
+        wxRenameFile(GetPendingPluginDatabaseFileName(), GetPluginDatabaseFileName(), true);
+    }
+    
+    auto db = PluginDatabase::Open(GetPluginDatabaseFileName());
+    if(db) {
+        pimpl_->plugin_scanner_.ImportDatabase(std::move(db));
     } else {
-        pimpl_->plugin_scanner_.ScanAsync();
+        std::ifstream ifs(GetPluginDescFileName());
+        if(ifs) {
+            std::string dump_data;
+            std::copy(std::istreambuf_iterator<char>(ifs),
+                      std::istreambuf_iterator<char>(),
+                      std::back_inserter(dump_data)
+                      );
+            
+            pimpl_->plugin_scanner_.Import(dump_data);
+        }
+    }
+    
+    //! モジュールは別プロセスで読み込んで、壊れたモジュールがこのプロセスを巻き込まないようにする。
+    pimpl_->plugin_scanner_.SetWorkerExecutablePath(GetExecutablePath());
+    
+    //! 前回のスキャン結果を読み込んだ場合は、追加や変更のあったモジュールだけがスキャンされる。
+    pimpl_->plugin_scanner_.ScanAsync();
+    
+    if(pimpl_->benchmark_num_plugins_ > 0) {
+        //! ベンチマークでは、スキャンが完了してから、デバイスを開かずに計測する。
+        pimpl_->plugin_scanner_.Wait();
+        auto const descs = pimpl_->plugin_scanner_.GetPluginDescriptions();
+        RunProjectLoadBenchmark(descs, pimpl_->benchmark_num_plugins_, 5);
+        pimpl_->factory_list_.Shrink();
+        return false;
     }
 
     pimpl_->adm_ = std::make_unique<AudioDeviceManager>();
@@ -177,6 +457,9 @@ bool MyApp::OnInit()
         throw std::runtime_error(to_utf8(L"Failed to open the device: " + result.left().error_msg_));
     }
     
+    //! プールしておくプラグインは、デバイスと同じ設定でsetupProcessingを済ませておく。
+    pimpl_->plugin_pool_->SetProcessSetup(kSampleRate, kBlockSize);
+    
     //! start the audio device.
     adm->GetDevice()->Start();
     
@@ -222,11 +505,29 @@ bool MyApp::OnInit()
     frame->Show( true );
     frame->SetFocus();
     frame->SetMinSize(wxSize(400, 300));
+    
+    pimpl_->autosave_timer_ = std::make_unique<wxTimer>();
+    pimpl_->autosave_timer_->Bind(wxEVT_TIMER, [this](auto &ev) { pimpl_->Autosave(); });
+    pimpl_->autosave_timer_->Start(kAutosaveIntervalMilliseconds);
+    
+    pimpl_->controller_update_timer_ = std::make_unique<wxTimer>();
+    pimpl_->controller_update_timer_->Bind(wxEVT_TIMER, [this](auto &ev) { pimpl_->ApplyPendingControllerUpdates(); });
+    pimpl_->controller_update_timer_->Start(kControllerUpdateIntervalMilliseconds);
+    
+    pimpl_->memory_check_timer_ = std::make_unique<wxTimer>();
+    pimpl_->memory_check_timer_->Bind(wxEVT_TIMER, [this](auto &ev) { pimpl_->CheckMemoryPressure(); });
+    pimpl_->memory_check_timer_->Start(kMemoryCheckIntervalMilliseconds);
     return true;
 }
 
 int MyApp::OnExit()
 {
+    pimpl_->autosave_timer_.reset();
+    pimpl_->controller_update_timer_.reset();
+    pimpl_->memory_check_timer_.reset();
+    //! 作成中のプラグインがあれば、完了を待つ。
+    pimpl_->plugin_creation_pool_.reset();
+    pimpl_->plugin_pool_.reset();
     SetCurrentProject(nullptr);
     pimpl_->projects_.clear();
     
@@ -247,25 +548,91 @@ void MyApp::RemoveChangeProjectListener(ChangeProjectListener const *li) { pimpl
 
 std::unique_ptr<Vst3Plugin> MyApp::CreateVst3Plugin(PluginDescription const &desc)
 {
-    hwm::dout << "Load VST3 Module: " << desc.vst3info().filepath() << std::endl;
+    return pimpl_->AcquireOrCreateVst3Plugin(desc, [](auto) {});
+}
+
+std::future<std::unique_ptr<Vst3Plugin>>
+MyApp::CreateVst3PluginAsync(PluginDescription const &desc,
+                             PluginCreationCallback callback,
+                             PluginInitializer initializer)
+{
+    //! コールバックは、呼び出し元のスレッドに関わらず、常に後からメインスレッドで呼び出す。
+    auto notify = [this, desc, callback](PluginCreationStage stage) {
+        if(!callback) { return; }
+        CallAfter([desc, callback, stage] { callback(desc, stage); });
+    };
     
-    std::shared_ptr<Vst3PluginFactory> factory;
-    try {
-        factory = pimpl_->factory_list_.FindOrCreateFactory(to_wstr(desc.vst3info().filepath()));
-    } catch(std::exception &e) {
-        hwm::dout << "Failed to create a Vst3PluginFactory: " << e.what() << std::endl;
-        return nullptr;
-    }
+    auto promise = std::make_shared<std::promise<std::unique_ptr<Vst3Plugin>>>();
+    auto future = promise->get_future();
     
-    auto cid = to_cid(desc.vst3info().cid());
-    assert(cid);
+    auto task = [this, desc, notify, initializer, promise] {
+        auto plugin = pimpl_->AcquireOrCreateVst3Plugin(desc, notify);
+        if(plugin && initializer) {
+            try {
+                initializer(*plugin);
+            } catch(std::exception &e) {
+                hwm::dout << "Failed to initialize a Vst3Plugin: " << e.what() << std::endl;
+            }
+        }
+        
+        auto const succeeded = (plugin != nullptr);
+        promise->set_value(std::move(plugin));
+        notify(succeeded ? PluginCreationStage::kCompleted : PluginCreationStage::kFailed);
+    };
     
-    try {
-        return factory->CreateByID(*cid);
-    } catch(std::exception &e) {
-        hwm::dout << "Failed to create a Vst3Plugin: " << e.what() << std::endl;
-        return nullptr;
+    if(desc.main_thread_only() == false) {
+        pimpl_->plugin_creation_pool_->Submit(std::move(task));
+    } else if(wxIsMainThread()) {
+        task();
+    } else {
+        CallAfter(std::move(task));
     }
+    
+    return future;
+}
+
+std::future<std::shared_ptr<Processor>>
+MyApp::CreateSandboxedProcessorAsync(PluginDescription const &desc, PluginCreationCallback callback)
+{
+    auto notify = [this, desc, callback](PluginCreationStage stage) {
+        if(!callback) { return; }
+        CallAfter([desc, callback, stage] { callback(desc, stage); });
+    };
+    
+    auto promise = std::make_shared<std::promise<std::shared_ptr<Processor>>>();
+    auto future = promise->get_future();
+    
+    pimpl_->plugin_creation_pool_->Submit([desc, notify, promise, executable_path = GetExecutablePath()] {
+        notify(PluginCreationStage::kInstantiating);
+        
+        std::shared_ptr<Processor> proc;
+        try {
+            proc = std::make_shared<SandboxedVst3Processor>(desc, executable_path);
+        } catch(std::exception &e) {
+            hwm::dout << e.what() << std::endl;
+        }
+        
+        auto const succeeded = (proc != nullptr);
+        promise->set_value(std::move(proc));
+        notify(succeeded ? PluginCreationStage::kCompleted : PluginCreationStage::kFailed);
+    });
+    
+    return future;
+}
+
+Vst3PluginPool & MyApp::GetPluginPool()
+{
+    return *pimpl_->plugin_pool_;
+}
+
+bool MyApp::IsPluginSandboxEnabled() const
+{
+    return pimpl_->sandbox_enabled_;
+}
+
+String MyApp::GetExecutablePath() const
+{
+    return wxStandardPaths::Get().GetExecutablePath().ToStdWstring();
 }
 
 void MyApp::RescanPlugins()
@@ -320,6 +687,31 @@ Project * MyApp::GetCurrentProject()
     return pimpl_->current_project_;
 }
 
+void MyApp::SaveProject(String path)
+{
+    auto pj = GetCurrentProject();
+    assert(pj);
+    
+    pimpl_->project_serializer_.Save(*pj, path);
+}
+
+void MyApp::LoadProject(String path)
+{
+    auto pj = GetCurrentProject();
+    assert(pj);
+    
+    pimpl_->project_serializer_.Load(*pj, path);
+}
+
+String MyApp::GetAutosavePath() const
+{
+    wxFileName filename(wxStandardPaths::Get().GetUserDataDir(), L"autosave.hwmproj");
+    if(filename.DirExists() == false) {
+        filename.Mkdir(wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL);
+    }
+    return filename.GetFullPath().ToStdWstring();
+}
+
 void MyApp::ShowSettingDialog()
 {
     auto dialog = CreateSettingDialog(wxGetActiveWindow());
@@ -336,6 +728,14 @@ namespace {
     wxCmdLineEntryDesc const cmdline_descs [] =
     {
         { wxCMD_LINE_SWITCH, "h", "help", "show help", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+        { wxCMD_LINE_SWITCH, nullptr, "sandbox-plugins", "run plugins in separate processes", wxCMD_LINE_VAL_NONE, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "plugin-pool-size", "number of ready-to-use instances kept for each plugin once created", wxCMD_LINE_VAL_NUMBER, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "benchmark-project-load", "measure the time to load a project with the given number of plugins, then exit", wxCMD_LINE_VAL_NUMBER, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "benchmark-module-scan", "measure the time to scan the given plugin module with and without moduleinfo.json, then exit", wxCMD_LINE_VAL_STRING, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "benchmark-parameter-list", "measure the time to build and query a parameter list of the given size, then exit", wxCMD_LINE_VAL_NUMBER, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "benchmark-midi-messages", "measure the time to copy and convert the given number of MIDI events per block, then exit", wxCMD_LINE_VAL_NUMBER, 0 },
+        { wxCMD_LINE_OPTION, nullptr, "sandbox-child", "(internal) run as a sandbox process", wxCMD_LINE_VAL_STRING, wxCMD_LINE_HIDDEN },
+        { wxCMD_LINE_OPTION, nullptr, "scan-module", "(internal) scan a plugin module as a worker process", wxCMD_LINE_VAL_STRING, wxCMD_LINE_HIDDEN },
         { wxCMD_LINE_NONE },
     };
 }
@@ -348,6 +748,43 @@ void MyApp::OnInitCmdLine(wxCmdLineParser& parser)
 
 bool MyApp::OnCmdLineParsed(wxCmdLineParser& parser)
 {
+    pimpl_->sandbox_enabled_ = parser.Found("sandbox-plugins");
+    
+    long pool_size = 0;
+    if(parser.Found("plugin-pool-size", &pool_size)) {
+        pimpl_->default_plugin_pool_size_ = std::max<long>(pool_size, 0);
+    }
+    
+    long benchmark_num_plugins = 0;
+    if(parser.Found("benchmark-project-load", &benchmark_num_plugins)) {
+        pimpl_->benchmark_num_plugins_ = std::max<long>(benchmark_num_plugins, 0);
+    }
+    
+    wxString benchmark_module_path;
+    if(parser.Found("benchmark-module-scan", &benchmark_module_path)) {
+        pimpl_->benchmark_module_path_ = benchmark_module_path.ToStdWstring();
+    }
+    
+    long benchmark_num_params = 0;
+    if(parser.Found("benchmark-parameter-list", &benchmark_num_params)) {
+        pimpl_->benchmark_num_params_ = std::max<long>(benchmark_num_params, 0);
+    }
+    
+    long benchmark_num_midi_events = 0;
+    if(parser.Found("benchmark-midi-messages", &benchmark_num_midi_events)) {
+        pimpl_->benchmark_num_midi_events_ = std::max<long>(benchmark_num_midi_events, 0);
+    }
+    
+    wxString shm_name;
+    if(parser.Found("sandbox-child", &shm_name)) {
+        pimpl_->sandbox_shm_name_ = shm_name.ToStdString();
+    }
+    
+    wxString module_path;
+    if(parser.Found("scan-module", &module_path)) {
+        pimpl_->scan_module_path_ = module_path.ToStdWstring();
+    }
+    
     return true;
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+#include <future>
 #include <memory>
 
 #include "plugin/vst3/Vst3PluginFactory.hpp"
@@ -11,6 +13,8 @@
 
 NS_HWM_BEGIN
 
+class Vst3PluginPool;
+
 class MyApp
 :   public wxApp
 ,   public SingleInstance<MyApp>
@@ -41,6 +45,66 @@ public:
     void RemoveChangeProjectListener(ChangeProjectListener const *li);
     
     std::unique_ptr<Vst3Plugin> CreateVst3Plugin(PluginDescription const &desc);
+    
+    //! 非同期なプラグイン作成の進捗
+    enum class PluginCreationStage
+    {
+        //! プラグインのモジュールを読み込んでいる
+        kLoadingModule,
+        //! プラグインのインスタンスを作成して、初期化している
+        kInstantiating,
+        //! プラグインの作成が完了した
+        kCompleted,
+        //! プラグインの作成に失敗した
+        kFailed,
+    };
+    
+    //! 進捗を通知するコールバック。常にメインスレッドから呼び出される。
+    using PluginCreationCallback = std::function<void(PluginDescription const &desc, PluginCreationStage stage)>;
+    
+    //! 作成したプラグインに対して、作成したスレッド上で続けて行う処理 (状態の復元など)
+    using PluginInitializer = std::function<void(Vst3Plugin &plugin)>;
+    
+    //! プラグインを非同期に作成する。
+    /*! プラグインの作成は、同時に実行されるスレッド数が制限されたスレッドプール上で行われる。
+     *  ただし、desc.main_thread_only()がtrueのプラグインは、メインスレッドで作成する。
+     *  (メインスレッドからこの関数を呼び出した場合は、この関数の中で作成する)
+     *
+     *  kCompletedとkFailedの通知は、返されたfutureが準備完了になった後で行われる。
+     *
+     *  @return 作成したプラグインを受け取るfuture。作成に失敗した場合はnullptrが返る。
+     */
+    std::future<std::unique_ptr<Vst3Plugin>>
+    CreateVst3PluginAsync(PluginDescription const &desc,
+                          PluginCreationCallback callback = nullptr,
+                          PluginInitializer initializer = nullptr);
+    
+    //! プラグインを読み込んだサンドボックスプロセスを非同期に起動して、それを実行するProcessorを作成する。
+    /*! サンドボックスプロセスの起動とプラグインの読み込みには時間がかかることがあるので、
+     *  CreateVst3PluginAsync()と同じスレッドプール上で行う。
+     *  callbackには、kInstantiatingと、kCompletedかkFailedが通知される。
+     *
+     *  @return 作成したSandboxedVst3Processorを受け取るfuture。起動に失敗した場合はnullptrが返る。
+     */
+    std::future<std::shared_ptr<Processor>>
+    CreateSandboxedProcessorAsync(PluginDescription const &desc,
+                                  PluginCreationCallback callback = nullptr);
+    
+    //! 作成済みのプラグインのインスタンスを保持しておくプール
+    /*! CreateVst3Plugin()とCreateVst3PluginAsync()は、プールにインスタンスがあればそれを使用する。
+     *  --plugin-pool-size オプションで1以上の数を指定して起動した場合は、
+     *  一度作成したプラグインを、その数だけプールしておくように自動的に設定する。
+     */
+    Vst3PluginPool & GetPluginPool();
+    
+    //! プラグインを別プロセスで実行するかどうか
+    /*! --sandbox-plugins オプションを指定して起動した場合にtrueを返す。
+     */
+    bool IsPluginSandboxEnabled() const;
+    
+    //! このアプリケーションの実行ファイルのパス
+    //! (サンドボックスプロセスを起動するために使用する)
+    String GetExecutablePath() const;
 
     void RescanPlugins();
     void ForceRescanPlugins();
@@ -52,6 +116,17 @@ public:
     void SetCurrentProject(Project *pj);
     Project * GetCurrentProject();
     
+    //! 現在のプロジェクトをファイルに保存する。
+    //! @throw std::runtime_error
+    void SaveProject(String path);
+    
+    //! ファイルからプロジェクトを読み込んで、現在のプロジェクトの内容を置き換える。
+    //! @throw std::runtime_error
+    void LoadProject(String path);
+    
+    //! 現在のプロジェクトが定期的に自動保存されるファイルのパス
+    String GetAutosavePath() const;
+    
     //! modal
     void ShowSettingDialog();
     
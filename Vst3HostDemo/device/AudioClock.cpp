@@ -0,0 +1,126 @@
+#include "AudioClock.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+NS_HWM_BEGIN
+
+namespace {
+    double const kPi = 3.14159265358979323846;
+    
+    //! 予測値からの誤差がこの時間を超えた場合は、
+    //! ドロップアウトやデバイスの再起動が発生したものとみなして、DLLを初期化し直す。
+    AudioClock::second_t const kMaxError = 0.05;
+}
+
+AudioClock::AudioClock(double bandwidth)
+:   bandwidth_(bandwidth)
+{}
+
+void AudioClock::Reset(double sample_rate, SampleCount block_size)
+{
+    assert(sample_rate > 0);
+    assert(block_size > 0);
+    
+    nominal_sample_rate_ = sample_rate;
+    block_size_ = block_size;
+    initialized_ = false;
+    next_sample_pos_ = 0;
+    time_ = 0;
+    sample_pos_ = 0;
+    sample_period_ = 1.0 / sample_rate;
+    estimated_sample_rate_.store(sample_rate);
+}
+
+void AudioClock::Initialize(second_t now)
+{
+    time_ = now;
+    sample_pos_ = next_sample_pos_;
+    sample_period_ = 1.0 / nominal_sample_rate_;
+    initialized_ = true;
+}
+
+SampleCount AudioClock::Update(second_t now, SampleCount num_samples)
+{
+    if(reset_statistics_requested_.exchange(false)) {
+        num_updates_.store(0);
+        num_resets_.store(0);
+        mean_error_.store(0);
+        m2_error_.store(0);
+        max_error_.store(0);
+    }
+    
+    if(!initialized_) {
+        Initialize(now);
+    } else {
+        auto const elapsed = next_sample_pos_ - sample_pos_;
+        auto const predicted = time_ + elapsed * sample_period_;
+        auto const error = now - predicted;
+    
+        if(std::abs(error) > kMaxError) {
+            num_resets_.fetch_add(1);
+            Initialize(now);
+        } else {
+            //! 二次のDLLの係数。帯域幅はコールバックの周期に対する比で決まる。
+            auto const omega = 2 * kPi * bandwidth_ * block_size_ / nominal_sample_rate_;
+            auto const b = std::sqrt(2.0) * omega;
+            auto const c = omega * omega;
+    
+            time_ = predicted + b * error;
+            sample_period_ += c * error / elapsed;
+            sample_pos_ = next_sample_pos_;
+    
+            AddError(error);
+            estimated_sample_rate_.store(1.0 / sample_period_);
+        }
+    }
+    
+    next_sample_pos_ = sample_pos_ + num_samples;
+    return sample_pos_;
+}
+
+AudioClock::second_t AudioClock::SampleToTime(double sample_pos) const
+{
+    return time_ + (sample_pos - sample_pos_) * sample_period_;
+}
+
+double AudioClock::TimeToSample(second_t time) const
+{
+    return sample_pos_ + (time - time_) / sample_period_;
+}
+
+void AudioClock::AddError(second_t error)
+{
+    //! Welfordの方法で平均と分散を逐次計算する。
+    //! 書き込むのはオーディオスレッドだけなので、個々の値をアトミックに更新すれば十分。
+    auto const n = num_updates_.load() + 1;
+    auto const mean = mean_error_.load();
+    auto const delta = error - mean;
+    auto const new_mean = mean + delta / n;
+    
+    m2_error_.store(m2_error_.load() + delta * (error - new_mean));
+    mean_error_.store(new_mean);
+    max_error_.store(std::max(max_error_.load(), std::abs(error)));
+    num_updates_.store(n);
+}
+
+AudioClock::Statistics AudioClock::GetStatistics() const
+{
+    Statistics stat;
+    stat.num_updates_ = num_updates_.load();
+    stat.num_resets_ = num_resets_.load();
+    stat.mean_error_ = mean_error_.load();
+    stat.stddev_error_ = (stat.num_updates_ > 1)
+    ? std::sqrt(m2_error_.load() / (stat.num_updates_ - 1))
+    : 0;
+    stat.max_error_ = max_error_.load();
+    stat.estimated_sample_rate_ = estimated_sample_rate_.load();
+    return stat;
+}
+
+void AudioClock::ResetStatistics()
+{
+    reset_statistics_requested_.store(true);
+}
+
+NS_HWM_END
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+
+NS_HWM_BEGIN
+
+//! std::chrono::steady_clockの時刻と、オーディオデバイスのサンプル位置とを対応付けるクラス
+/*! オーディオコールバックが呼び出された時刻を、二次の遅延ロックループ(DLL)で平滑化して、
+ *  コールバックの呼び出しタイミングの揺らぎに影響されずに、
+ *  「デバイス上のサンプル位置」と「時刻」とを相互に変換できるようにする。
+ *  DLLはサンプルレートの公称値と実際のデバイスのクロックとのずれ(ドリフト)も推定する。
+ *
+ *  Update()とSampleToTime()/TimeToSample()は、オーディオスレッドから呼び出す。
+ *  GetStatistics()は、任意のスレッドから呼び出せる。
+ */
+class AudioClock final
+{
+public:
+    //! 時刻の単位は秒。(steady_clockのtime_since_epoch()からの時間)
+    using second_t = double;
+    
+    //! コールバックの呼び出し時刻の、DLLの予測値からの誤差の統計
+    struct Statistics
+    {
+        UInt64 num_updates_ = 0;
+        //! 誤差が大きすぎたために、DLLを初期化し直した回数
+        UInt64 num_resets_ = 0;
+        second_t mean_error_ = 0;
+        second_t stddev_error_ = 0;
+        second_t max_error_ = 0;
+        //! 推定したサンプルレート
+        double estimated_sample_rate_ = 0;
+    };
+    
+    //! @param bandwidth DLLの帯域幅(Hz)。小さいほど揺らぎを取り除けるが、ドリフトへの追従が遅くなる。
+    explicit AudioClock(double bandwidth = 0.5);
+    
+    //! 処理の開始時に呼び出して、状態を初期化する。
+    void Reset(double sample_rate, SampleCount block_size);
+    
+    //! オーディオコールバックの先頭で呼び出す。
+    /*! @param now コールバックが呼び出された時刻
+     *  @param num_samples このコールバックで処理するサンプル数
+     *  @return このコールバックの先頭のデバイス上のサンプル位置
+     */
+    SampleCount Update(second_t now, SampleCount num_samples);
+    
+    //! デバイス上のサンプル位置に対応する時刻を返す。
+    second_t SampleToTime(double sample_pos) const;
+    
+    //! 時刻に対応するデバイス上のサンプル位置を返す。
+    double TimeToSample(second_t time) const;
+    
+    Statistics GetStatistics() const;
+    
+    //! 統計をリセットする。
+    //! 実際のリセットは、次のUpdate()の呼び出し時にオーディオスレッド上で行われる。
+    void ResetStatistics();
+    
+private:
+    double bandwidth_ = 0;
+    double nominal_sample_rate_ = 0;
+    SampleCount block_size_ = 0;
+    
+    bool initialized_ = false;
+    //! 次のコールバックの先頭のサンプル位置
+    SampleCount next_sample_pos_ = 0;
+    //! sample_pos_に対応する、平滑化された時刻
+    second_t time_ = 0;
+    SampleCount sample_pos_ = 0;
+    //! 1サンプルあたりの時間の推定値
+    second_t sample_period_ = 0;
+    
+    void Initialize(second_t now);
+    void AddError(second_t error);
+    
+    std::atomic<bool> reset_statistics_requested_ = { false };
+    std::atomic<UInt64> num_updates_ = { 0 };
+    std::atomic<UInt64> num_resets_ = { 0 };
+    std::atomic<double> mean_error_ = { 0 };
+    std::atomic<double> m2_error_ = { 0 };
+    std::atomic<double> max_error_ = { 0 };
+    std::atomic<double> estimated_sample_rate_ = { 0 };
+};
+
+NS_HWM_END
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <mutex>
 #include <portaudio.h>
 
@@ -105,6 +106,17 @@ public:
     double GetSampleRate() const override { return sample_rate_; }
     SampleCount GetBlockSize() const override { return block_size_; }
     
+    SampleCount GetLatency(DeviceIOType io) const override
+    {
+        if(!GetDeviceInfo(io)) { return 0; }
+        
+        auto const info = Pa_GetStreamInfo(stream_);
+        if(!info) { return 0; }
+        
+        auto const latency = (io == DeviceIOType::kInput) ? info->inputLatency : info->outputLatency;
+        return (SampleCount)std::round(latency * sample_rate_);
+    }
+    
     void Start() override
     {
         if(Pa_IsStreamStopped(stream_)) {
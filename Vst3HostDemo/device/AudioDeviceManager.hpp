@@ -55,6 +55,12 @@ public:
     virtual
     SampleCount GetBlockSize() const = 0;
     
+    //! デバイスのレイテンシーをサンプル数で返す。
+    /*! 指定した方向のデバイスが開かれていない場合は0を返す。
+     */
+    virtual
+    SampleCount GetLatency(DeviceIOType io) const = 0;
+    
     //! デバイスのフレーム処理を開始する。
     /*! @note デバイスオープン後、明示的に Start() を呼び出すまでは、デバイスのフレーム処理は開始しない。
      */
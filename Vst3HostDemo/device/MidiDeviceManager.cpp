@@ -4,6 +4,20 @@
 #include "../misc/ArrayRef.hpp"
 #include "../misc/LockFactory.hpp"
 #include "../misc/ThreadSafeRingBuffer.hpp"
+#include "../misc/MPSCQueue.hpp"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 NS_HWM_BEGIN
 
@@ -17,6 +31,13 @@ namespace {
         auto const dur = clock_t::now().time_since_epoch();
         return std::chrono::duration<double>(dur).count();
     }
+    
+    //! get_timestamp()と同じ時間軸の時刻を、clock_tの時刻に変換する。
+    clock_t::time_point to_time_point(double time_stamp)
+    {
+        auto const dur = std::chrono::duration<double>(time_stamp);
+        return clock_t::time_point(std::chrono::duration_cast<clock_t::duration>(dur));
+    }
 }
 
 DeviceMidiMessage DeviceMidiMessage::Create(MidiDevice *device,
@@ -226,9 +247,12 @@ private:
             }
                 
             default:
-                assert(false);
+                //! システムメッセージには未対応
+                return;
         }
         
+        if(m.As<std::monostate>()) { return; }
+        
         on_input_(m);
     }
     
@@ -245,8 +269,6 @@ struct MidiOut
     MidiOut(MidiDeviceInfo const &info)
     :   info_(info)
     {
-        messages_.reserve(2048);
-        
         midi_out_.setErrorCallback(ErrorCallback, this);
         
         int n = -1;
@@ -257,7 +279,7 @@ struct MidiOut
             }
         }
         if(n == -1) { throw std::runtime_error("unknown device"); }
-        midi_out_.openPort(0, to_utf8(info_.name_id_));
+        midi_out_.openPort(n, to_utf8(info_.name_id_));
     }
     
     ~MidiOut()
@@ -273,23 +295,20 @@ struct MidiOut
     
     MidiDeviceInfo const & GetDeviceInfo() const override { return info_; }
     
-    void SendMessages(std::vector<DeviceMidiMessage> const &ms)
+    //! メッセージを一つ送信する。bufは作業用のバッファ
+    /*! RtMidiOut::sendMessage()は一回の呼び出しで完結したメッセージを送ることを前提にしているので、
+     *  ランニングステータスは使用せず、常にステータスバイトを付けて送信する。
+     */
+    void Send(DeviceMidiMessage const &m, std::vector<UInt8> &buf)
     {
-        std::vector<UInt8> buf;
-        buf.reserve(3);
-        for(auto const &m : ms) {
-            bool const successful = m.ToBytes(buf, running_status_);
-            if(!successful) { continue; }
-            midi_out_.sendMessage(&buf);
-        }
+        bool const successful = m.ToBytes(buf);
+        if(!successful) { return; }
+        midi_out_.sendMessage(&buf);
     }
     
 private:
     MidiDeviceInfo info_;
     RtMidiOut midi_out_;
-    
-    std::vector<DeviceMidiMessage> messages_;
-    UInt8 running_status_ = 0;
 
     static
     void ErrorCallback(RtMidiError::Type type, const std::string &errorText, void *userData)
@@ -308,42 +327,270 @@ struct MidiDeviceManager::Impl
     static constexpr int kNumCapacity = 4096;
     Impl()
     :   input_messages_(kNumCapacity)
-    {}
+    ,   output_messages_(kNumCapacity)
+    {
+        scheduler_popped_.reserve(kNumCapacity);
+        scheduler_pending_.reserve(kNumCapacity);
+        scheduler_bytes_.reserve(3);
+    }
     
     using MidiInPtr = std::shared_ptr<MidiIn>;
     using MidiOutPtr = std::shared_ptr<MidiOut>;
 
     std::vector<MidiInPtr> ins_;
     std::vector<MidiOutPtr> outs_;
-    SingleChannelThreadSafeRingBuffer<DeviceMidiMessage> input_messages_;
     
+    //! 各デバイスのRtMidiのコールバックスレッドから追加され、オーディオスレッドから取り出される。
+    MPSCQueue<DeviceMidiMessage> input_messages_;
+    std::atomic<UInt64> num_dropped_inputs_ = { 0 };
+    
+    //! RtMidiのコールバックスレッドから呼び出される。
+    //! メモリ確保もスピンもせず、キューが一杯の場合はメッセージを捨てる。
     void AddMidiMessage(DeviceMidiMessage const &m)
     {
-        std::string str_bytes;
-        std::vector<UInt8> buf(3);
-        m.ToBytes(buf);
-        for(auto b: buf) {
-            str_bytes += " {:02x}"_format((unsigned int)b);
-        }
-        hwm::dout << "[{:03.6f}]:{}"_format(m.time_stamp_, str_bytes) << std::endl;
-        
-        for( ; ; ) {
-            auto result = input_messages_.Push(&m, 1);
-            if(result.error_code() == ThreadSafeRingBufferErrorCode::kTokenUnavailable) { continue; }
-            else { break; }
+        if(!input_messages_.TryPush(m)) {
+            num_dropped_inputs_.fetch_add(1, std::memory_order_relaxed);
         }
     }
     
     LockFactory lf_in_;
     LockFactory lf_out_;
+    
+    //! 送信予約されたメッセージ。time_stamp_は、get_timestamp()と同じ時間軸の絶対時刻
+    SingleChannelThreadSafeRingBuffer<DeviceMidiMessage> output_messages_;
+    std::atomic<UInt64> num_dropped_ = { 0 };
+    
+    std::thread scheduler_;
+    
+    //! スケジューラスレッドを起こすための条件変数。
+    //! scheduler_wakeup_とstop_scheduler_はscheduler_mutex_で保護される。
+    std::mutex scheduler_mutex_;
+    std::condition_variable scheduler_cv_;
+    bool scheduler_wakeup_ = false;
+    bool stop_scheduler_ = false;
+    
+    //! SendMessages()の呼び出し元のスレッドだけがアクセスする。
+    //! 前回の呼び出しでスケジューラスレッドを起こせなかった場合はtrue
+    bool wakeup_pending_ = false;
+    
+    //! 以下はスケジューラスレッドからのみアクセスする。
+    
+    std::vector<DeviceMidiMessage> scheduler_popped_;
+    //! まだ送信時刻になっていないメッセージ。時刻順にソートされている
+    std::vector<DeviceMidiMessage> scheduler_pending_;
+    std::vector<UInt8> scheduler_bytes_;
+    
+    //! ジッターの統計。(lf_stat_で保護される)
+    LockFactory lf_stat_;
+    UInt64 stat_num_sent_ = 0;
+    UInt64 stat_num_late_ = 0;
+    double stat_mean_ = 0;
+    double stat_m2_ = 0;
+    double stat_max_ = 0;
+    
+    void StartScheduler();
+    void StopScheduler();
+    void RunScheduler();
+    
+    //! 新しいメッセージが追加されたことをスケジューラスレッドに通知する。
+    /*! オーディオスレッドから呼び出されるので、ロックの取得は待たない。
+     *  スケジューラスレッドがロックを保持していて通知できなかった場合は、wakeup_pending_を立てて、
+     *  次回のSendMessages()でやり直す。
+     */
+    void WakeScheduler();
+    
+    //! キューに追加されたメッセージをscheduler_pending_に移す。
+    void FetchOutputMessages();
+    
+    //! scheduler_pending_の先頭からnum個のメッセージを送信する。
+    void SendDueMessages(size_t num);
+    
+    void AddJitter(double jitter);
 };
 
+namespace {
+    //! スケジューラスレッドの優先度を、通常のスレッドより高く、オーディオスレッドより低くする。
+    /*! オーディオスレッドはリアルタイムの優先度で動作するので、
+     *  スケジューラスレッドはリアルタイムの優先度の中で最も低いものを使用する。
+     */
+    void raise_thread_priority(std::thread &th)
+    {
+#if defined(_MSC_VER)
+        ::SetThreadPriority(th.native_handle(), THREAD_PRIORITY_HIGHEST);
+#else
+        sched_param param = {};
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        //! 権限がなくて失敗した場合は、通常の優先度のまま動作する。
+        pthread_setschedparam(th.native_handle(), SCHED_FIFO, &param);
+#endif
+    }
+}
+
+void MidiDeviceManager::Impl::StartScheduler()
+{
+    stop_scheduler_ = false;
+    scheduler_wakeup_ = false;
+    wakeup_pending_ = false;
+    scheduler_ = std::thread([this] { RunScheduler(); });
+    raise_thread_priority(scheduler_);
+}
+
+void MidiDeviceManager::Impl::StopScheduler()
+{
+    {
+        std::unique_lock<std::mutex> lock(scheduler_mutex_);
+        stop_scheduler_ = true;
+    }
+    scheduler_cv_.notify_one();
+    
+    if(scheduler_.joinable()) {
+        scheduler_.join();
+    }
+}
+
+void MidiDeviceManager::Impl::WakeScheduler()
+{
+    std::unique_lock<std::mutex> lock(scheduler_mutex_, std::try_to_lock);
+    if(lock.owns_lock() == false) {
+        wakeup_pending_ = true;
+        return;
+    }
+    
+    scheduler_wakeup_ = true;
+    lock.unlock();
+    scheduler_cv_.notify_one();
+    wakeup_pending_ = false;
+}
+
+void MidiDeviceManager::Impl::RunScheduler()
+{
+    std::unique_lock<std::mutex> lock(scheduler_mutex_);
+    
+    for( ; ; ) {
+        //! フラグを下ろしてからキューを確認するので、この後に追加されたメッセージの通知は失われない。
+        scheduler_wakeup_ = false;
+        lock.unlock();
+        
+        FetchOutputMessages();
+        
+        //! この時点で送信時刻になっているメッセージをまとめて送信する。
+        auto const now = get_timestamp();
+        auto const found = std::find_if(scheduler_pending_.begin(), scheduler_pending_.end(),
+                                        [now](auto const &m) { return m.time_stamp_ > now; });
+        if(found != scheduler_pending_.begin()) {
+            SendDueMessages(found - scheduler_pending_.begin());
+        }
+        
+        lock.lock();
+        
+        auto const woken = [this] { return scheduler_wakeup_ || stop_scheduler_; };
+        if(scheduler_pending_.empty()) {
+            //! 送信するメッセージがなければ、次のメッセージが追加されるまでスリープする。
+            scheduler_cv_.wait(lock, woken);
+        } else {
+            //! 次のメッセージの送信時刻までスリープする。
+            //! その前に、より早い時刻のメッセージが追加された場合は起こされる。
+            scheduler_cv_.wait_until(lock, to_time_point(scheduler_pending_.front().time_stamp_), woken);
+        }
+        
+        if(stop_scheduler_) { break; }
+    }
+}
+
+void MidiDeviceManager::Impl::FetchOutputMessages()
+{
+    auto const num = output_messages_.GetNumPoppable();
+    if(num == 0) { return; }
+    
+    scheduler_popped_.resize(num);
+    if(!output_messages_.PopOverwrite(scheduler_popped_.data(), num)) { return; }
+    
+    auto const num_old = scheduler_pending_.size();
+    scheduler_pending_.insert(scheduler_pending_.end(), scheduler_popped_.begin(), scheduler_popped_.end());
+    
+    //! 同時刻のメッセージの順序が入れ替わらないように、stableなマージを使う。
+    auto const by_time = [](auto const &lhs, auto const &rhs) { return lhs.time_stamp_ < rhs.time_stamp_; };
+    std::stable_sort(scheduler_pending_.begin() + num_old, scheduler_pending_.end(), by_time);
+    std::inplace_merge(scheduler_pending_.begin(), scheduler_pending_.begin() + num_old, scheduler_pending_.end(), by_time);
+}
+
+void MidiDeviceManager::Impl::SendDueMessages(size_t num)
+{
+    auto const begin = scheduler_pending_.begin();
+    auto const end = begin + num;
+    
+    //! デバイスごとにまとめて送信する。(デバイス内では時刻順が保たれる)
+    std::stable_sort(begin, end, [](auto const &lhs, auto const &rhs) { return lhs.device_ < rhs.device_; });
+    
+    for(auto it = begin; it != end; ) {
+        auto const device = it->device_;
+        auto const group_end = std::find_if(it, end, [device](auto const &m) { return m.device_ != device; });
+        
+        //! 送信予約のあとでデバイスがクローズされている場合があるので、
+        //! オープンされているデバイスの中から探す。
+        MidiOutPtr out;
+        {
+            auto lock = lf_out_.make_lock();
+            auto found = std::find_if(outs_.begin(), outs_.end(), [device](auto const &p) { return p.get() == device; });
+            if(found != outs_.end()) { out = *found; }
+        }
+        
+        if(out) {
+            for( ; it != group_end; ++it) {
+                try {
+                    out->Send(*it, scheduler_bytes_);
+                } catch(std::exception &e) {
+                    hwm::dout << "failed to send a midi message: " << e.what() << std::endl;
+                    continue;
+                }
+                AddJitter(get_timestamp() - it->time_stamp_);
+            }
+        }
+        
+        it = group_end;
+    }
+    
+    scheduler_pending_.erase(begin, end);
+}
+
+void MidiDeviceManager::Impl::AddJitter(double jitter)
+{
+    auto lock = lf_stat_.make_lock();
+    
+    //! Welfordの方法で平均と分散を逐次計算する。
+    stat_num_sent_ += 1;
+    auto const delta = jitter - stat_mean_;
+    stat_mean_ += delta / stat_num_sent_;
+    stat_m2_ += delta * (jitter - stat_mean_);
+    stat_max_ = std::max(stat_max_, jitter);
+    
+    if(jitter >= MidiOutputStatistics::kLateThreshold) {
+        stat_num_late_ += 1;
+    }
+}
+
 MidiDeviceManager::MidiDeviceManager()
 :   pimpl_(std::make_unique<Impl>())
-{}
+{
+    pimpl_->StartScheduler();
+}
 
 MidiDeviceManager::~MidiDeviceManager()
-{}
+{
+    pimpl_->StopScheduler();
+    
+    auto const stat = GetOutputStatistics();
+    if(stat.num_sent_ > 0 || stat.num_dropped_ > 0) {
+        hwm::dout << "MIDI output jitter: mean {:.3f}ms, stddev {:.3f}ms, max {:.3f}ms, "
+        "late {}/{}, dropped {}"_format(stat.mean_jitter_ * 1000.0,
+                                        stat.stddev_jitter_ * 1000.0,
+                                        stat.max_jitter_ * 1000.0,
+                                        stat.num_late_,
+                                        stat.num_sent_,
+                                        stat.num_dropped_)
+        << std::endl;
+    }
+}
 
 std::vector<MidiDeviceInfo> MidiDeviceManager::Enumerate()
 {
@@ -437,25 +684,69 @@ void MidiDeviceManager::Close(MidiDevice const *device)
 
 //! この瞬間までに取得できたMIDIメッセージを返す。
 //! システムメッセージには未対応。
-double MidiDeviceManager::GetMessages(std::vector<DeviceMidiMessage> &msg)
+size_t MidiDeviceManager::GetMessages(ArrayRef<DeviceMidiMessage> dest)
 {
-    msg.clear();
-    
-    for( ; ; ) {
-        auto num = pimpl_->input_messages_.GetNumPoppable();
-        msg.resize(num);
-        
-        auto result = pimpl_->input_messages_.PopOverwrite(msg.data(), num);
-        if(result) { break; }
+    size_t num = 0;
+    for( ; num < dest.size(); ++num) {
+        if(!pimpl_->input_messages_.TryPop(dest[num])) { break; }
     }
-    return get_timestamp();
+    return num;
+}
+
+UInt64 MidiDeviceManager::GetNumDroppedInputMessages() const
+{
+    return pimpl_->num_dropped_inputs_.load();
 }
 
-//! MIDIメッセージを送信する。
+//! MIDIメッセージの送信を予約する。
 //! システムメッセージには未対応。
 void MidiDeviceManager::SendMessages(std::vector<DeviceMidiMessage> const &msg, double epoch)
 {
+    bool pushed = false;
+    for(auto const &m: msg) {
+        DeviceMidiMessage tmp = m;
+        tmp.time_stamp_ += epoch;
+        
+        //! 呼び出し元のスレッドは一つなので、トークンの取得に失敗することはない。
+        //! 失敗するのはキューが一杯の場合なので、リトライせずに捨てる。
+        if(pimpl_->output_messages_.Push(&tmp, 1)) {
+            pushed = true;
+        } else {
+            pimpl_->num_dropped_.fetch_add(1);
+        }
+    }
+    
+    if(pushed || pimpl_->wakeup_pending_) {
+        pimpl_->WakeScheduler();
+    }
+}
+
+MidiOutputStatistics MidiDeviceManager::GetOutputStatistics() const
+{
+    MidiOutputStatistics stat;
+    stat.num_dropped_ = pimpl_->num_dropped_.load();
+    
+    auto lock = pimpl_->lf_stat_.make_lock();
+    stat.num_sent_ = pimpl_->stat_num_sent_;
+    stat.num_late_ = pimpl_->stat_num_late_;
+    stat.mean_jitter_ = pimpl_->stat_mean_;
+    stat.stddev_jitter_ = (pimpl_->stat_num_sent_ > 1)
+    ? std::sqrt(pimpl_->stat_m2_ / (pimpl_->stat_num_sent_ - 1))
+    : 0;
+    stat.max_jitter_ = pimpl_->stat_max_;
+    return stat;
+}
+
+void MidiDeviceManager::ResetOutputStatistics()
+{
+    pimpl_->num_dropped_.store(0);
     
+    auto lock = pimpl_->lf_stat_.make_lock();
+    pimpl_->stat_num_sent_ = 0;
+    pimpl_->stat_num_late_ = 0;
+    pimpl_->stat_mean_ = 0;
+    pimpl_->stat_m2_ = 0;
+    pimpl_->stat_max_ = 0;
 }
 
 NS_HWM_END
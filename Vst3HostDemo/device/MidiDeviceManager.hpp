@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../misc/SingleInstance.hpp"
+#include "../misc/ArrayRef.hpp"
 #include "../data_type/MidiDataType.hpp"
 #include "./DeviceIOType.hpp"
 #include "./MidiDevice.hpp"
@@ -47,6 +48,24 @@ struct DeviceMidiMessage
     DataType data_;
 };
 
+//! MIDI出力のタイミングの計測結果
+/*! ジッターは、各メッセージを送信した時刻と、送信すべき時刻との差(秒)。
+ */
+struct MidiOutputStatistics
+{
+    //! 送信したメッセージ数
+    UInt64 num_sent_ = 0;
+    //! 送信すべき時刻からkLateThreshold以上遅れて送信したメッセージ数
+    UInt64 num_late_ = 0;
+    //! キューが一杯だったために送信できなかったメッセージ数
+    UInt64 num_dropped_ = 0;
+    double mean_jitter_ = 0;
+    double stddev_jitter_ = 0;
+    double max_jitter_ = 0;
+    
+    static constexpr double kLateThreshold = 0.001;
+};
+
 //! オーディオデバイス側をマスタークロックにして駆動するため、
 //! このクラスには、このクラスを利用する側に向けたコールバックの仕組みは設けない
 class MidiDeviceManager
@@ -63,16 +82,36 @@ public:
     bool IsOpened(MidiDeviceInfo const &info) const;
     void Close(MidiDevice const *device);
     
-    //! この瞬間までに取得できたMIDIメッセージを返す。
-    //! システムメッセージには未対応。
-    //! 現在のタイムスタンプを返す。
-    double GetMessages(std::vector<DeviceMidiMessage> &ms);
+    //! この瞬間までに取得できたMIDIメッセージをdestに書き込み、書き込んだ数を返す。
+    /*! システムメッセージには未対応。
+     *  destに収まらなかったメッセージは、次回の呼び出しで返される。
+     *  オーディオスレッドから呼び出せるように、この関数はメモリ確保もロックもスピンも行わない。
+     *  呼び出し元のスレッドは一つに限る。
+     */
+    size_t GetMessages(ArrayRef<DeviceMidiMessage> dest);
     
-    //! MIDIメッセージを送信する。
-    //! システムメッセージには未対応。
-    //! 各DeviceMidiMessageのtime_stampは、epochからの時間として扱う
+    //! 入力キューが一杯だったために捨てられたMIDI入力の数
+    UInt64 GetNumDroppedInputMessages() const;
+    
+    //! MIDIメッセージの送信を予約する。
+    /*! システムメッセージには未対応。
+     *  各DeviceMidiMessageのtime_stampは、epoch(GetMessages()が返すタイムスタンプと同じ時間軸)からの時間として扱う。
+     *  メッセージはロックフリーのキューに追加され、スケジューラスレッドがその時刻になった時点でデバイスに送信する。
+     *
+     *  オーディオスレッドから呼び出せるように、この関数はメモリ確保もロック待ちも行わない。
+     *  スケジューラスレッドへの通知に失敗した場合は次回の呼び出しでやり直すので、
+     *  送信するメッセージがない場合も、オーディオのブロックごとに呼び出すこと。
+     *  呼び出し元のスレッドは一つに限る。
+     *  キューが一杯の場合、追加できなかったメッセージは捨てられ、MidiOutputStatistics::num_dropped_に計上される。
+     */
     void SendMessages(std::vector<DeviceMidiMessage> const &ms, double epoch = 0);
     
+    //! MIDI出力のタイミングの計測結果を返す。
+    MidiOutputStatistics GetOutputStatistics() const;
+    
+    //! MIDI出力のタイミングの計測結果をリセットする。
+    void ResetOutputStatistics();
+    
 private:
     struct Impl;
     std::unique_ptr<Impl> pimpl_;
@@ -0,0 +1,597 @@
+#include "WaveFile.hpp"
+
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../misc/StrCnv.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+    
+    UInt16 const kWaveFormatPCM = 0x0001;
+    UInt16 const kWaveFormatIEEEFloat = 0x0003;
+    UInt16 const kWaveFormatExtensible = 0xFFFE;
+    
+    //! RF64ファイルで、実際のサイズがds64チャンクに書かれていることを表す値
+    UInt32 const kRF64SizePlaceholder = 0xFFFFFFFF;
+    
+    //! 一度に読み込む最大のバイト数
+    size_t const kMaxBytesToReadAtOnce = 1024 * 1024;
+    
+    UInt16 read_u16(unsigned char const *p) { return p[0] | (p[1] << 8); }
+    UInt32 read_u32(unsigned char const *p) { return read_u16(p) | ((UInt32)read_u16(p + 2) << 16); }
+    UInt64 read_u64(unsigned char const *p) { return read_u32(p) | ((UInt64)read_u32(p + 4) << 32); }
+    
+    bool is_id(unsigned char const *p, char const *id) { return std::memcmp(p, id, 4) == 0; }
+    
+    void write_u16(unsigned char *p, UInt16 x) { p[0] = x & 0xFF; p[1] = (x >> 8) & 0xFF; }
+    void write_u32(unsigned char *p, UInt32 x) { write_u16(p, x & 0xFFFF); write_u16(p + 2, x >> 16); }
+    void write_u64(unsigned char *p, UInt64 x) { write_u32(p, x & 0xFFFFFFFF); write_u32(p + 4, x >> 32); }
+    void write_id(unsigned char *p, char const *id) { std::memcpy(p, id, 4); }
+    
+    //! @return 読み込んだバイト数
+    size_t pread_all(int fd, void *buf, size_t size, UInt64 offset)
+    {
+        auto p = static_cast<char *>(buf);
+        size_t total = 0;
+        while(total < size) {
+            auto const n = ::pread(fd, p + total, size - total, offset + total);
+            if(n < 0 && errno == EINTR) { continue; }
+            if(n <= 0) { break; }
+            total += n;
+        }
+        return total;
+    }
+    
+    //! @return すべて書き込めたかどうか
+    bool pwrite_all(int fd, void const *buf, size_t size, UInt64 offset)
+    {
+        auto p = static_cast<char const *>(buf);
+        size_t total = 0;
+        while(total < size) {
+            auto const n = ::pwrite(fd, p + total, size - total, offset + total);
+            if(n < 0 && errno == EINTR) { continue; }
+            if(n <= 0) { return false; }
+            total += n;
+        }
+        return true;
+    }
+    
+    float to_float(WaveSampleFormat format, unsigned char const *p)
+    {
+        switch(format) {
+            case WaveSampleFormat::kInt16:
+                return (Int16)read_u16(p) / 32768.0f;
+            case WaveSampleFormat::kInt24:
+                return ((Int32)(read_u32(p - 1) & 0xFFFFFF00) >> 8) / 8388608.0f;
+            case WaveSampleFormat::kInt32:
+                return (Int32)read_u32(p) / 2147483648.0f;
+            case WaveSampleFormat::kFloat32: {
+                auto const bits = read_u32(p);
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+            }
+            case WaveSampleFormat::kFloat64: {
+                auto const bits = read_u64(p);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return (float)value;
+            }
+        }
+        
+        assert(false);
+        return 0;
+    }
+}
+
+UInt32 WaveFormat::GetBytesPerFrame() const
+{
+    UInt32 bytes_per_sample = 0;
+    switch(sample_format_) {
+        case WaveSampleFormat::kInt16: bytes_per_sample = 2; break;
+        case WaveSampleFormat::kInt24: bytes_per_sample = 3; break;
+        case WaveSampleFormat::kInt32: bytes_per_sample = 4; break;
+        case WaveSampleFormat::kFloat32: bytes_per_sample = 4; break;
+        case WaveSampleFormat::kFloat64: bytes_per_sample = 8; break;
+    }
+    
+    return bytes_per_sample * num_channels_;
+}
+
+struct WaveFileReader::Impl
+{
+    String path_;
+    int fd_ = -1;
+    WaveFormat format_;
+    UInt64 data_offset_ = 0;
+    SampleCount num_frames_ = 0;
+    //! 読み込んだバイト列を一時的に保持するバッファ。
+    //! 24bit整数の変換で先頭の1バイト前を参照するので、1バイト余分に確保して、先頭から1バイト目以降を使用する。
+    std::vector<unsigned char> read_buffer_;
+    
+    void ParseHeader();
+};
+
+void WaveFileReader::Impl::ParseHeader()
+{
+    unsigned char header[12];
+    if(pread_all(fd_, header, sizeof(header), 0) != sizeof(header)) {
+        throw std::runtime_error("file is too short");
+    }
+    
+    bool const is_rf64 = is_id(header, "RF64") || is_id(header, "BW64");
+    if(!is_rf64 && !is_id(header, "RIFF")) { throw std::runtime_error("not a riff file"); }
+    if(!is_id(header + 8, "WAVE")) { throw std::runtime_error("not a wave file"); }
+    
+    UInt64 rf64_data_size = 0;
+    bool fmt_found = false;
+    bool data_found = false;
+    UInt64 data_size = 0;
+    UInt64 pos = sizeof(header);
+    
+    for( ; ; ) {
+        unsigned char chunk_header[8];
+        if(pread_all(fd_, chunk_header, sizeof(chunk_header), pos) != sizeof(chunk_header)) { break; }
+        pos += sizeof(chunk_header);
+        
+        UInt64 chunk_size = read_u32(chunk_header + 4);
+        
+        if(is_id(chunk_header, "ds64")) {
+            unsigned char ds64[24];
+            if(chunk_size < sizeof(ds64) || pread_all(fd_, ds64, sizeof(ds64), pos) != sizeof(ds64)) {
+                throw std::runtime_error("invalid ds64 chunk");
+            }
+            rf64_data_size = read_u64(ds64 + 8);
+        } else if(is_id(chunk_header, "fmt ")) {
+            unsigned char fmt[40] = {};
+            auto const size_to_read = std::min<UInt64>(chunk_size, sizeof(fmt));
+            if(size_to_read < 16 || pread_all(fd_, fmt, size_to_read, pos) != size_to_read) {
+                throw std::runtime_error("invalid fmt chunk");
+            }
+            
+            auto format_tag = read_u16(fmt);
+            if(format_tag == kWaveFormatExtensible) {
+                if(size_to_read < 26) { throw std::runtime_error("invalid fmt chunk"); }
+                // SubFormat GUIDの先頭2バイトがフォーマットタグを表す
+                format_tag = read_u16(fmt + 24);
+            }
+            
+            format_.num_channels_ = read_u16(fmt + 2);
+            format_.sample_rate_ = read_u32(fmt + 4);
+            auto const bits_per_sample = read_u16(fmt + 14);
+            
+            if(format_tag == kWaveFormatPCM && bits_per_sample == 16) {
+                format_.sample_format_ = WaveSampleFormat::kInt16;
+            } else if(format_tag == kWaveFormatPCM && bits_per_sample == 24) {
+                format_.sample_format_ = WaveSampleFormat::kInt24;
+            } else if(format_tag == kWaveFormatPCM && bits_per_sample == 32) {
+                format_.sample_format_ = WaveSampleFormat::kInt32;
+            } else if(format_tag == kWaveFormatIEEEFloat && bits_per_sample == 32) {
+                format_.sample_format_ = WaveSampleFormat::kFloat32;
+            } else if(format_tag == kWaveFormatIEEEFloat && bits_per_sample == 64) {
+                format_.sample_format_ = WaveSampleFormat::kFloat64;
+            } else {
+                throw std::runtime_error("unsupported sample format");
+            }
+            
+            if(format_.num_channels_ == 0) { throw std::runtime_error("invalid channel count"); }
+            fmt_found = true;
+        } else if(is_id(chunk_header, "data")) {
+            data_offset_ = pos;
+            data_size = chunk_size;
+            if(is_rf64 && chunk_size == kRF64SizePlaceholder) {
+                data_size = rf64_data_size;
+            }
+            data_found = true;
+        }
+        
+        if(fmt_found && data_found) { break; }
+        
+        // チャンクは2バイト境界に揃えられている
+        pos += chunk_size + (chunk_size % 2);
+    }
+    
+    if(!fmt_found || !data_found) { throw std::runtime_error("fmt or data chunk not found"); }
+    
+    num_frames_ = data_size / format_.GetBytesPerFrame();
+}
+
+WaveFileReader::WaveFileReader(String path)
+:   pimpl_(std::make_unique<Impl>())
+{
+    pimpl_->path_ = path;
+    pimpl_->fd_ = ::open(to_utf8(path).c_str(), O_RDONLY);
+    if(pimpl_->fd_ < 0) {
+        throw std::runtime_error("cannot open the file");
+    }
+    
+    try {
+        pimpl_->ParseHeader();
+    } catch(...) {
+        ::close(pimpl_->fd_);
+        throw;
+    }
+    
+    // ストリーミング再生のために、OSに先読みを促す。
+#if defined(F_RDAHEAD)
+    ::fcntl(pimpl_->fd_, F_RDAHEAD, 1);
+#elif defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(pimpl_->fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+    auto const bpf = pimpl_->format_.GetBytesPerFrame();
+    pimpl_->read_buffer_.resize(kMaxBytesToReadAtOnce / bpf * bpf + 1);
+}
+
+WaveFileReader::~WaveFileReader()
+{
+    ::close(pimpl_->fd_);
+}
+
+String WaveFileReader::GetPath() const
+{
+    return pimpl_->path_;
+}
+
+WaveFormat const & WaveFileReader::GetFormat() const
+{
+    return pimpl_->format_;
+}
+
+UInt32 WaveFileReader::GetNumChannels() const
+{
+    return pimpl_->format_.num_channels_;
+}
+
+double WaveFileReader::GetSampleRate() const
+{
+    return pimpl_->format_.sample_rate_;
+}
+
+SampleCount WaveFileReader::GetNumFrames() const
+{
+    return pimpl_->num_frames_;
+}
+
+SampleCount WaveFileReader::Read(SampleCount pos, float * const * dest, UInt32 num_dest_channels, SampleCount length)
+{
+    auto const &format = pimpl_->format_;
+    auto const bpf = format.GetBytesPerFrame();
+    auto const bps = bpf / format.num_channels_;
+    auto const max_frames_at_once = (SampleCount)((pimpl_->read_buffer_.size() - 1) / bpf);
+    auto *buf = pimpl_->read_buffer_.data() + 1;
+    
+    if(pos < 0 || pos >= pimpl_->num_frames_) { return 0; }
+    length = std::min(length, pimpl_->num_frames_ - pos);
+    
+    SampleCount num_read = 0;
+    while(num_read < length) {
+        auto const num_to_read = std::min(length - num_read, max_frames_at_once);
+        auto const bytes = pread_all(pimpl_->fd_, buf, num_to_read * bpf,
+                                     pimpl_->data_offset_ + (pos + num_read) * bpf);
+        auto const frames = (SampleCount)(bytes / bpf);
+        
+        for(UInt32 ch = 0; ch < num_dest_channels; ++ch) {
+            auto ch_dest = dest[ch] + num_read;
+            if(ch >= format.num_channels_) {
+                std::fill_n(ch_dest, frames, 0.0f);
+                continue;
+            }
+            
+            auto src = buf + ch * bps;
+            for(SampleCount i = 0; i < frames; ++i) {
+                ch_dest[i] = to_float(format.sample_format_, src);
+                src += bpf;
+            }
+        }
+        
+        num_read += frames;
+        if(frames < num_to_read) { break; }
+    }
+    
+    return num_read;
+}
+
+namespace {
+    
+    //! ダイレクトI/Oで要求されるアライメント。
+    //! WaveFileWriterのヘッダーのサイズと、ファイルへの書き込みの単位もこれに揃える。
+    size_t const kBlockSize = 4096;
+    
+    //! WaveFileWriterが書き出すヘッダーのサイズ。
+    //! データ部分がブロック境界から始まるように、末尾をJUNKチャンクで埋める。
+    size_t const kWriterHeaderSize = kBlockSize;
+    
+    //! WaveFileWriterが一度に書き込む最小のバイト数
+    size_t const kMinStagingBufferSize = 1024 * 1024;
+    
+    size_t round_up(size_t x, size_t align) { return (x + align - 1) / align * align; }
+    size_t round_down(size_t x, size_t align) { return x / align * align; }
+    
+    struct AlignedBufferDeleter {
+        void operator()(unsigned char *p) const { std::free(p); }
+    };
+    
+    using AlignedBuffer = std::unique_ptr<unsigned char[], AlignedBufferDeleter>;
+    
+    //! @throw std::bad_alloc
+    AlignedBuffer allocate_aligned_buffer(size_t size)
+    {
+        void *p = nullptr;
+        if(::posix_memalign(&p, kBlockSize, size) != 0) { throw std::bad_alloc(); }
+        std::memset(p, 0, size);
+        return AlignedBuffer(static_cast<unsigned char *>(p));
+    }
+    
+    //! data_sizeバイトのデータを持つファイルのヘッダーを作成する。
+    /*! データサイズが32bitで表せない場合は、RF64形式のヘッダーになる。
+     *  @param dest kWriterHeaderSizeバイトの領域
+     */
+    void make_header(unsigned char *dest, WaveFormat const &format, UInt64 data_size)
+    {
+        std::memset(dest, 0, kWriterHeaderSize);
+        
+        auto const bpf = format.GetBytesPerFrame();
+        UInt64 const riff_size = kWriterHeaderSize - 8 + data_size;
+        bool const is_rf64 = (riff_size >= kRF64SizePlaceholder);
+        
+        write_id(dest, is_rf64 ? "RF64" : "RIFF");
+        write_u32(dest + 4, is_rf64 ? kRF64SizePlaceholder : (UInt32)riff_size);
+        write_id(dest + 8, "WAVE");
+        
+        //! RF64の場合はds64チャンクとして使用する領域。
+        write_id(dest + 12, is_rf64 ? "ds64" : "JUNK");
+        write_u32(dest + 16, 28);
+        if(is_rf64) {
+            write_u64(dest + 20, riff_size);
+            write_u64(dest + 28, data_size);
+            write_u64(dest + 36, data_size / bpf);
+            write_u32(dest + 44, 0);
+        }
+        
+        write_id(dest + 48, "fmt ");
+        write_u32(dest + 52, 16);
+        write_u16(dest + 56, kWaveFormatIEEEFloat);
+        write_u16(dest + 58, format.num_channels_);
+        write_u32(dest + 60, (UInt32)format.sample_rate_);
+        write_u32(dest + 64, (UInt32)format.sample_rate_ * bpf);
+        write_u16(dest + 68, bpf);
+        write_u16(dest + 70, 32);
+        
+        size_t const data_header_pos = kWriterHeaderSize - 8;
+        write_id(dest + 72, "JUNK");
+        write_u32(dest + 76, data_header_pos - 80);
+        
+        write_id(dest + data_header_pos, "data");
+        write_u32(dest + data_header_pos + 4, is_rf64 ? kRF64SizePlaceholder : (UInt32)data_size);
+    }
+}
+
+struct WaveFileWriter::Impl
+{
+    String path_;
+    int fd_ = -1;
+    WaveFormat format_;
+    SampleCount num_frames_ = 0;
+    bool failed_ = false;
+    
+    AlignedBuffer header_;
+    
+    //! ファイルに書き込む前のインターリーブされたデータを保持するバッファ。
+    //! ブロック境界に揃えた単位でファイルに書き込み、端数は次の書き込みまで残しておく。
+    AlignedBuffer staging_;
+    size_t staging_size_ = 0;
+    size_t staging_used_ = 0;
+    //! 次にstaging_の先頭を書き込むファイル上の位置。常にkBlockSizeの倍数になる。
+    UInt64 file_pos_ = 0;
+    
+    bool WriteHeader();
+    
+    //! staging_のうち、ブロック境界に揃った部分をファイルに書き込む。
+    //! is_final_blockがtrueの場合は、端数を0で埋めて残りのデータをすべて書き込む。
+    bool Flush(bool is_final_block);
+};
+
+bool WaveFileWriter::Impl::WriteHeader()
+{
+    make_header(header_.get(), format_, (UInt64)num_frames_ * format_.GetBytesPerFrame());
+    return pwrite_all(fd_, header_.get(), kWriterHeaderSize, 0);
+}
+
+bool WaveFileWriter::Impl::Flush(bool is_final_block)
+{
+    auto const bytes = is_final_block
+    ? round_up(staging_used_, kBlockSize)
+    : round_down(staging_used_, kBlockSize);
+    
+    if(bytes == 0) { return true; }
+    
+    if(is_final_block) {
+        std::memset(staging_.get() + staging_used_, 0, bytes - staging_used_);
+    }
+    
+    if(pwrite_all(fd_, staging_.get(), bytes, file_pos_) == false) {
+        return false;
+    }
+    
+    if(is_final_block) {
+        staging_used_ = 0;
+    } else {
+        file_pos_ += bytes;
+        staging_used_ -= bytes;
+        std::memmove(staging_.get(), staging_.get() + bytes, staging_used_);
+    }
+    
+    return true;
+}
+
+WaveFileWriter::WaveFileWriter(String path,
+                               UInt32 num_channels,
+                               double sample_rate,
+                               SampleCount num_preallocated_frames,
+                               bool use_direct_io)
+:   pimpl_(std::make_unique<Impl>())
+{
+    assert(num_channels > 0);
+    assert(sample_rate > 0);
+    
+    pimpl_->path_ = path;
+    pimpl_->format_.num_channels_ = num_channels;
+    pimpl_->format_.sample_rate_ = sample_rate;
+    pimpl_->format_.sample_format_ = WaveSampleFormat::kFloat32;
+    
+    auto const bpf = pimpl_->format_.GetBytesPerFrame();
+    pimpl_->header_ = allocate_aligned_buffer(kWriterHeaderSize);
+    pimpl_->staging_size_ = round_up(std::max<size_t>(kMinStagingBufferSize, bpf * 16), kBlockSize);
+    pimpl_->staging_ = allocate_aligned_buffer(pimpl_->staging_size_);
+    
+    auto const path_utf8 = to_utf8(path);
+    int const flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+    
+#if defined(O_DIRECT)
+    //! ファイルシステムがO_DIRECTをサポートしていない場合は、通常の書き込みにフォールバックする。
+    if(use_direct_io) {
+        fd = ::open(path_utf8.c_str(), flags | O_DIRECT, 0644);
+    }
+#endif
+    
+    if(fd < 0) {
+        fd = ::open(path_utf8.c_str(), flags, 0644);
+    }
+    
+    if(fd < 0) {
+        throw std::runtime_error("cannot create the file");
+    }
+    
+#if defined(F_NOCACHE)
+    if(use_direct_io) {
+        ::fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
+    
+    pimpl_->fd_ = fd;
+    
+    if(num_preallocated_frames > 0) {
+        auto const size = (off_t)(kWriterHeaderSize + num_preallocated_frames * bpf);
+#if defined(F_PREALLOCATE)
+        fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size, 0 };
+        if(::fcntl(fd, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;
+            ::fcntl(fd, F_PREALLOCATE, &store);
+        }
+#elif defined(FALLOC_FL_KEEP_SIZE)
+        //! ファイルサイズは変えずにブロックだけを確保しておく。
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+#endif
+    }
+    
+    if(pimpl_->WriteHeader() == false) {
+        ::close(fd);
+        throw std::runtime_error("cannot write the header");
+    }
+    
+    pimpl_->file_pos_ = kWriterHeaderSize;
+}
+
+WaveFileWriter::~WaveFileWriter()
+{
+    Close();
+}
+
+String WaveFileWriter::GetPath() const
+{
+    return pimpl_->path_;
+}
+
+WaveFormat const & WaveFileWriter::GetFormat() const
+{
+    return pimpl_->format_;
+}
+
+UInt32 WaveFileWriter::GetNumChannels() const
+{
+    return pimpl_->format_.num_channels_;
+}
+
+SampleCount WaveFileWriter::GetNumFrames() const
+{
+    return pimpl_->num_frames_;
+}
+
+bool WaveFileWriter::Write(float const * const * src, UInt32 num_src_channels, SampleCount length)
+{
+    if(IsClosed() || pimpl_->failed_) { return false; }
+    
+    auto const num_channels = pimpl_->format_.num_channels_;
+    auto const bpf = pimpl_->format_.GetBytesPerFrame();
+    if(!src) { num_src_channels = 0; }
+    
+    SampleCount num_written = 0;
+    while(num_written < length) {
+        auto const num_storable = (SampleCount)((pimpl_->staging_size_ - pimpl_->staging_used_) / bpf);
+        if(num_storable == 0) {
+            if(pimpl_->Flush(false) == false) {
+                pimpl_->failed_ = true;
+                return false;
+            }
+            continue;
+        }
+        
+        auto const n = std::min(length - num_written, num_storable);
+        
+        //! staging_used_は常にbpfの倍数とkBlockSizeの倍数の差なので、floatの境界に揃っている。
+        //! (ここでは、リトルエンディアンの環境を前提にしている)
+        auto dest = reinterpret_cast<float *>(pimpl_->staging_.get() + pimpl_->staging_used_);
+        for(UInt32 ch = 0; ch < num_channels; ++ch) {
+            auto ch_dest = dest + ch;
+            if(ch < num_src_channels) {
+                auto ch_src = src[ch] + num_written;
+                for(SampleCount i = 0; i < n; ++i) { ch_dest[i * num_channels] = ch_src[i]; }
+            } else {
+                for(SampleCount i = 0; i < n; ++i) { ch_dest[i * num_channels] = 0; }
+            }
+        }
+        
+        pimpl_->staging_used_ += n * bpf;
+        num_written += n;
+    }
+    
+    pimpl_->num_frames_ += length;
+    return true;
+}
+
+bool WaveFileWriter::Close()
+{
+    if(IsClosed()) { return !pimpl_->failed_; }
+    
+    auto const data_size = (UInt64)pimpl_->num_frames_ * pimpl_->format_.GetBytesPerFrame();
+    
+    //! 最後のブロックは0で埋めて書き込み、ファイルサイズは後から実際のサイズに切り詰める。
+    //! こうすると、ダイレクトI/Oのアライメントの制約を満たしたまま端数を書き込める。
+    bool ok = !pimpl_->failed_
+    && pimpl_->Flush(true)
+    && pimpl_->WriteHeader()
+    && ::ftruncate(pimpl_->fd_, (off_t)(kWriterHeaderSize + data_size)) == 0;
+    
+    ::close(pimpl_->fd_);
+    pimpl_->fd_ = -1;
+    pimpl_->failed_ = !ok;
+    
+    return ok;
+}
+
+bool WaveFileWriter::IsClosed() const
+{
+    return pimpl_->fd_ < 0;
+}
+
+NS_HWM_END
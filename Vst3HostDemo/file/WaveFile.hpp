@@ -0,0 +1,107 @@
+#pragma once
+
+#include <memory>
+
+NS_HWM_BEGIN
+
+//! Waveファイルのサンプルフォーマット
+enum class WaveSampleFormat
+{
+    kInt16,
+    kInt24,
+    kInt32,
+    kFloat32,
+    kFloat64,
+};
+
+struct WaveFormat
+{
+    UInt32 num_channels_ = 0;
+    double sample_rate_ = 0;
+    WaveSampleFormat sample_format_ = WaveSampleFormat::kFloat32;
+    
+    //! 1フレーム(全チャンネル分の1サンプル)のバイト数
+    UInt32 GetBytesPerFrame() const;
+};
+
+//! WAV/RF64ファイルを読み込むクラス
+/*! ファイルはpread()でランダムアクセスされるので、
+ *  読み込みのたびにファイル位置をシークする必要はない。
+ */
+class WaveFileReader
+{
+public:
+    //! @throw std::runtime_error ファイルを開けなかったり、サポートしていない形式のファイルだった場合
+    explicit
+    WaveFileReader(String path);
+    ~WaveFileReader();
+    
+    String GetPath() const;
+    WaveFormat const & GetFormat() const;
+    UInt32 GetNumChannels() const;
+    double GetSampleRate() const;
+    SampleCount GetNumFrames() const;
+    
+    //! posフレーム目から最大lengthフレームを読み込み、チャンネルごとに分けてdestに書き込む。
+    /*! destのチャンネル数がファイルのチャンネル数より多い場合、余ったチャンネルには0が書き込まれる。
+     *  内部のバッファを使用するので、同じWaveFileReaderに対して複数のスレッドから同時に呼び出してはならない。
+     *  @return 読み込んだフレーム数。ファイルの終端に達した場合はlengthより小さくなる。
+     */
+    SampleCount Read(SampleCount pos, float * const * dest, UInt32 num_dest_channels, SampleCount length);
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+//! 32bit浮動小数点のWAVファイルを書き出すクラス
+/*! ヘッダーにはRF64のds64チャンク用の領域をJUNKチャンクとして確保しておき、
+ *  Close()の時点でデータサイズが4GBを超えていた場合は、RF64形式のヘッダーに書き換える。
+ *
+ *  ヘッダーは4096バイトに揃えてあり、データ部分はブロック境界から始まる。
+ *  ファイルへの書き込みは常にブロック境界に揃えたサイズで行われるので、
+ *  ページキャッシュを経由しないダイレクトI/O(O_DIRECT/F_NOCACHE)でも書き込める。
+ */
+class WaveFileWriter
+{
+public:
+    //! @param num_preallocated_frames 書き込み開始前にディスク上に確保しておくフレーム数。
+    //! 長時間の録音で、書き込み中にファイルシステムがブロックを割り当てるコストを避けるために使用する。
+    //! @param use_direct_io ダイレクトI/Oを使用するかどうか。
+    //! ファイルシステムがダイレクトI/Oをサポートしていない場合は、通常の書き込みになる。
+    //! @throw std::runtime_error ファイルを作成できなかった場合
+    WaveFileWriter(String path,
+                   UInt32 num_channels,
+                   double sample_rate,
+                   SampleCount num_preallocated_frames = 0,
+                   bool use_direct_io = false);
+    
+    //! Close()されていなければ、Close()を呼び出す。
+    ~WaveFileWriter();
+    
+    String GetPath() const;
+    WaveFormat const & GetFormat() const;
+    UInt32 GetNumChannels() const;
+    
+    //! これまでに書き込んだフレーム数
+    SampleCount GetNumFrames() const;
+    
+    //! チャンネルごとに分かれたsrcのデータを、lengthフレーム分書き込む。
+    /*! srcのチャンネル数がファイルのチャンネル数より少ない場合、足りないチャンネルには0が書き込まれる。
+     *  srcにnullptrを渡した場合は、すべてのチャンネルに0が書き込まれる。
+     *  @return 書き込みに成功したかどうか。一度失敗すると、それ以降の書き込みはすべて失敗する。
+     */
+    bool Write(float const * const * src, UInt32 num_src_channels, SampleCount length);
+    
+    //! 残りのデータを書き込み、ヘッダーを確定してファイルを閉じる。
+    /*! @return 書き込みに成功したかどうか
+     */
+    bool Close();
+    bool IsClosed() const;
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
@@ -517,18 +517,25 @@ private:
     wxPanel         *graph_panel_ = nullptr;
 };
 
+wxString const kProjectFileWildcard = "Project files (*.hwmproj)|*.hwmproj";
+
 enum
 {
     ID_Play = 1,
     ID_RescanPlugin,
     ID_ForceRescanPlugin,
-    ID_Setting
+    ID_Setting,
+    ID_OpenProject,
+    ID_SaveProject,
 };
 
 MyFrame::MyFrame(const wxString& title, const wxPoint& pos, const wxSize& size)
 : wxFrame(NULL, wxID_ANY, title, pos, size)
 {
     wxMenu *menuFile = new wxMenu;
+    menuFile->Append(ID_OpenProject, "&Open Project...\tCTRL-O", "Open Project");
+    menuFile->Append(ID_SaveProject, "&Save Project...\tCTRL-S", "Save Project");
+    menuFile->AppendSeparator();
     menuFile->Append(ID_RescanPlugin, "&Rescan Plugins", "Rescan Plugins");
     menuFile->Append(ID_ForceRescanPlugin, "&Clear and Rescan Plugins", "Clear and Rescan Plugins");
     menuFile->AppendSeparator();
@@ -556,6 +563,8 @@ MyFrame::MyFrame(const wxString& title, const wxPoint& pos, const wxSize& size)
     Bind(wxEVT_COMMAND_MENU_SELECTED, [this](auto &ev) { MyApp::GetInstance()->ForceRescanPlugins(); }, ID_ForceRescanPlugin);
     Bind(wxEVT_COMMAND_MENU_SELECTED, [this](auto &ev) { MyApp::GetInstance()->ShowSettingDialog(); }, ID_Setting);
     Bind(wxEVT_COMMAND_MENU_SELECTED, [this](auto &ev) { OnPlay(ev); }, ID_Play);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, [this](auto &ev) { OnOpenProject(); }, ID_OpenProject);
+    Bind(wxEVT_COMMAND_MENU_SELECTED, [this](auto &ev) { OnSaveProject(); }, ID_SaveProject);
     
     Bind(wxEVT_MENU, [this](auto &ev) { OnAbout(ev); }, wxID_ABOUT);
     
@@ -597,6 +606,30 @@ void MyFrame::OnPlay(wxCommandEvent &ev)
     tp.SetPlaying(ev.IsChecked());
 }
 
+void MyFrame::OnOpenProject()
+{
+    wxFileDialog dialog(this, "Open Project", "", "", kProjectFileWildcard, wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+    if(dialog.ShowModal() != wxID_OK) { return; }
+    
+    try {
+        MyApp::GetInstance()->LoadProject(dialog.GetPath().ToStdWstring());
+    } catch(std::exception &e) {
+        wxMessageBox(e.what(), "Failed to open the project", wxOK | wxICON_ERROR);
+    }
+}
+
+void MyFrame::OnSaveProject()
+{
+    wxFileDialog dialog(this, "Save Project", "", "", kProjectFileWildcard, wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if(dialog.ShowModal() != wxID_OK) { return; }
+    
+    try {
+        MyApp::GetInstance()->SaveProject(dialog.GetPath().ToStdWstring());
+    } catch(std::exception &e) {
+        wxMessageBox(e.what(), "Failed to save the project", wxOK | wxICON_ERROR);
+    }
+}
+
 void MyFrame::OnTimer()
 {
 }
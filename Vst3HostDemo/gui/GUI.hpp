@@ -20,6 +20,8 @@ private:
     void OnAbout(wxCommandEvent& event);
     void OnPlay(wxCommandEvent& event);
     void OnEnableInputs(wxCommandEvent& event);
+    void OnOpenProject();
+    void OnSaveProject();
     void OnTimer();
     
 private:
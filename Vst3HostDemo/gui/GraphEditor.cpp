@@ -1,10 +1,12 @@
 #include "GraphEditor.hpp"
 
-#include <tuple>
+#include <algorithm>
+#include <wx/weakref.h>
 
 #include "../App.hpp"
 #include "./PluginEditor.hpp"
 #include "../plugin/PluginScanner.hpp"
+#include "../misc/StrCnv.hpp"
 #include "./Util.hpp"
 #include "../resource/ResourceHelper.hpp"
 
@@ -361,6 +363,7 @@ bool Intersect(wxPoint a1, wxPoint a2, wxPoint b1, wxPoint b2)
 class GraphEditor
 :   public wxPanel
 ,   public NodeComponent::Callback
+,   public GraphProcessor::Listener
 {
 public:
     wxCursor scissors_;
@@ -390,6 +393,11 @@ public:
         Bind(wxEVT_MOUSE_CAPTURE_LOST, [this](auto &ev) { OnReleaseMouse(); });
     }
     
+    ~GraphEditor()
+    {
+        RemoveGraph();
+    }
+    
     void OnLeftDown(wxMouseEvent const &ev)
     {
         if(ev.GetModifiers() == wxMOD_SHIFT) {
@@ -493,30 +501,25 @@ public:
         auto menu_plugins = new wxMenu();
         const int kPluginIDStart = 1000;
         
-        auto ps = PluginScanner::GetInstance();
-        auto descs = ps->GetPluginDescriptions();
-        
-        static auto get_category_number = [](auto const &desc) {
-            return IsEffectPlugin(desc) + IsInstrumentPlugin(desc) * 2;
-        };
-        std::sort(descs.begin(),
-                  descs.end(),
-                  [](auto const &lhs, auto &rhs) {
-                      return
-                      std::tuple<int, std::string const &>(get_category_number(lhs), lhs.name())
-                      <
-                      std::tuple<int, std::string const &>(get_category_number(rhs), lhs.name());
-                  });
-        
-        for(int i = 0; i < descs.size(); ++i) {
-            auto const &desc = descs[i];
+        //! カタログは名前順のリストを持っているので、カテゴリで安定ソートすれば、カテゴリごとに名前順に並ぶ。
+        auto catalog = PluginScanner::GetInstance()->GetCatalog();
+        auto const sorted_by_name = catalog->GetEntriesSortedByName();
+        std::vector<PluginCatalog::Entry const *> entries(sorted_by_name.begin(), sorted_by_name.end());
+        std::stable_sort(entries.begin(),
+                         entries.end(),
+                         [](auto const *lhs, auto const *rhs) {
+                             return lhs->GetCategoryNumber() < rhs->GetCategoryNumber();
+                         });
+        
+        for(int i = 0; i < entries.size(); ++i) {
+            auto const *entry = entries[i];
             std::string plugin_name;
-            if(IsEffectPlugin(desc) && IsInstrumentPlugin(desc)) { plugin_name = "[Fx|Inst] "; }
-            else if(IsEffectPlugin(desc)) { plugin_name = "[Fx] "; }
-            else if(IsInstrumentPlugin(desc)) { plugin_name = "[Inst] "; }
+            if(entry->is_effect_ && entry->is_instrument_) { plugin_name = "[Fx|Inst] "; }
+            else if(entry->is_effect_) { plugin_name = "[Fx] "; }
+            else if(entry->is_instrument_) { plugin_name = "[Inst] "; }
             else { plugin_name = "[Unknown] "; }
         
-            plugin_name += desc.name();
+            plugin_name += entry->GetName();
             menu_plugins->Append(kPluginIDStart + i, plugin_name);
         }
         
@@ -527,8 +530,9 @@ public:
             auto const id = ev.GetId();
             if(id >= kPluginIDStart) {
                 auto const index = id - kPluginIDStart;
-                assert(index < descs.size());
-                AddNode(descs[index], pos);
+                assert(index < entries.size());
+                //! PluginDescriptionは、選択されたプラグインのものだけを展開する。
+                AddNode(entries[index]->ToDescription(), pos);
             }
         });
         
@@ -538,12 +542,107 @@ public:
     void AddNode(PluginDescription const &desc, wxPoint pt)
     {
         auto app = MyApp::GetInstance();
-        auto proc = std::make_shared<Vst3AudioProcessor>(app->CreateVst3Plugin(desc));
+        
+        //! プラグインの作成には時間がかかることがあるので、UIを止めないようにバックグラウンドで作成する。
+        //! (サンドボックスプロセスの起動も、プラグインの読み込みを待つので同様)
+        //! 作成が終わるまでは、ノードを追加する位置に進捗を表示する。
+        auto pending = std::make_shared<PendingPlugin>();
+        pending->name_ = to_wstr(desc.name());
+        pending->pos_ = pt;
+        pending_plugins_.push_back(pending);
+        Refresh();
+        
+        wxWeakRef<GraphEditor> self(this);
+        auto on_progress = [self, pending, desc](auto const &, auto stage) {
+            if(!self) { return; }
+            
+            using Stage = MyApp::PluginCreationStage;
+            pending->stage_ = stage;
+            
+            if(stage == Stage::kCompleted || stage == Stage::kFailed) {
+                self->OnPluginCreated(pending, desc);
+            } else {
+                self->Refresh();
+            }
+        };
+        
+        if(app->IsPluginSandboxEnabled()) {
+            pending->processor_future_ = app->CreateSandboxedProcessorAsync(desc, on_progress);
+        } else {
+            pending->future_ = app->CreateVst3PluginAsync(desc, on_progress);
+        }
+    }
+    
+    void AddNode(std::shared_ptr<Processor> proc, wxPoint pt)
+    {
+        if(!graph_) { return; }
+        
         auto node = graph_->AddNode(proc);
         
-        auto nc = std::make_unique<NodeComponent>(this, node.get(), this);
-        nc->MoveConstrained(pt);
+        //! NodeComponentは、OnAfterNodeIsAdded()で作成されている。
+        if(auto nc = FindNodeComponent(node.get())) {
+            nc->MoveConstrained(pt);
+        }
+    }
+    
+    //! 作成中のプラグイン
+    struct PendingPlugin
+    {
+        String name_;
+        wxPoint pos_;
+        MyApp::PluginCreationStage stage_ = MyApp::PluginCreationStage::kLoadingModule;
+        std::future<std::unique_ptr<Vst3Plugin>> future_;
+        //! サンドボックスプロセスで実行する場合は、こちらを使用する
+        std::future<std::shared_ptr<Processor>> processor_future_;
+    };
+    
+    void OnPluginCreated(std::shared_ptr<PendingPlugin> pending, PluginDescription const &desc)
+    {
+        pending_plugins_.erase(std::remove(pending_plugins_.begin(), pending_plugins_.end(), pending),
+                               pending_plugins_.end());
+        Refresh();
+        
+        std::shared_ptr<Processor> proc;
+        if(pending->processor_future_.valid()) {
+            proc = pending->processor_future_.get();
+        } else if(std::shared_ptr<Vst3Plugin> plugin = pending->future_.get()) {
+            proc = std::make_shared<Vst3AudioProcessor>(desc, std::move(plugin));
+        }
+        
+        if(!proc) { return; }
+        AddNode(proc, pending->pos_);
+    }
+    
+    NodeComponent * FindNodeComponent(GraphProcessor::Node const *node) const
+    {
+        auto found = std::find_if(node_components_.begin(), node_components_.end(),
+                                  [node](auto const &nc) { return nc->node_ == node; });
+        if(found == node_components_.end()) { return nullptr; }
+        return found->get();
+    }
+    
+    //! プロジェクトの読み込みなどによって、このクラスを経由せずにグラフが変更された場合も、
+    //! NodeComponentをグラフのノードと対応させる。
+    void OnAfterNodeIsAdded(GraphProcessor::Node *node) override
+    {
+        if(FindNodeComponent(node)) { return; }
+        
+        auto nc = std::make_unique<NodeComponent>(this, node, this);
         node_components_.push_back(std::move(nc));
+        Refresh();
+    }
+    
+    void OnBeforeNodeIsRemoved(GraphProcessor::Node *node) override
+    {
+        auto found = std::find_if(node_components_.begin(), node_components_.end(),
+                                  [node](auto const &nc) { return nc->node_ == node; });
+        if(found == node_components_.end()) { return; }
+        
+        auto nc = std::move(*found);
+        node_components_.erase(found);
+        // RemoveNode()と同様に、リストから取り除いたあとでデストラクタを実行する。
+        nc.reset();
+        Refresh();
     }
 
     //! return true if removed.
@@ -579,10 +678,13 @@ public:
             auto nc = std::make_unique<NodeComponent>(this, node.get(), this);
             node_components_.push_back(std::move(nc));
         }
+        
+        graph_->AddListener(this);
     }
     
     void RemoveGraph()
     {
+        if(graph_) { graph_->RemoveListener(this); }
         node_components_.clear();
         graph_ = nullptr;
     }
@@ -686,6 +788,7 @@ private:
     using NodeComponentPtr = std::unique_ptr<NodeComponent>;
     std::vector<NodeComponentPtr> node_components_;
     GraphProcessor *graph_ = nullptr;
+    std::vector<std::shared_ptr<PendingPlugin>> pending_plugins_;
     
     struct LineSetting {
         wxPoint begin_;
@@ -762,6 +865,14 @@ private:
                         dragging_line_->end_
                         );
         }
+        
+        dc.SetTextForeground(wxColour(200, 200, 200));
+        for(auto const &pending: pending_plugins_) {
+            auto const label = (pending->stage_ == MyApp::PluginCreationStage::kLoadingModule
+                                ? L"Loading module: "
+                                : L"Initializing: ");
+            dc.DrawText(label + pending->name_, pending->pos_);
+        }
     }
 };
 
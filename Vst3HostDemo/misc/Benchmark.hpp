@@ -0,0 +1,34 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+NS_HWM_BEGIN
+
+//! ベンチマークの計測に使用するクロック
+using BenchmarkClock = std::chrono::steady_clock;
+
+inline
+double ToMilliseconds(BenchmarkClock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+//! 計測した所要時間(ミリ秒)の最小値、中央値、最大値を出力する。
+inline
+void PrintBenchmarkTimes(std::string const &label, std::vector<double> times)
+{
+    if(times.empty()) { return; }
+
+    std::sort(times.begin(), times.end());
+    hwm::dout << "{}: min {:.3f}ms, median {:.3f}ms, max {:.3f}ms ({} runs)"_format(label,
+                                                                                   times.front(),
+                                                                                   times[times.size() / 2],
+                                                                                   times.back(),
+                                                                                   times.size())
+    << std::endl;
+}
+
+NS_HWM_END
@@ -0,0 +1,422 @@
+#include "ChildProcess.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "./ScopeExit.hpp"
+#include "./StrCnv.hpp"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <io.h>
+#include <stdio.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
+
+NS_HWM_BEGIN
+
+namespace {
+    //! パイプの作成から子プロセスの起動までを排他する。
+    /*! 同時に起動された他の子プロセスに、パイプの書き込み側を継承させないようにするため。
+     *  (書き込み側を継承されると、子プロセスが終了してもパイプが閉じられない)
+     */
+    std::mutex & GetSpawnMutex()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
+    
+    //! 残り時間を、ミリ秒単位で切り上げて返す。
+    int GetRemainingMilliseconds(std::chrono::steady_clock::time_point deadline)
+    {
+        auto const remaining = deadline - std::chrono::steady_clock::now();
+        if(remaining <= std::chrono::steady_clock::duration::zero()) { return 0; }
+        
+        return (int)std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+    }
+}
+
+#if defined(_MSC_VER)
+
+struct ChildProcess::Impl
+{
+    PROCESS_INFORMATION pi_ = {};
+    //! 子プロセスの標準出力を読み込むパイプ
+    HANDLE output_ = nullptr;
+};
+
+namespace {
+    //! CommandLineToArgvW()と同じ規則で解釈されるように、引数をクオートする。
+    std::wstring quote_argument(std::wstring const &arg)
+    {
+        if(arg.empty() == false && arg.find_first_of(L" \t\"") == std::wstring::npos) {
+            return arg;
+        }
+    
+        std::wstring result = L"\"";
+        size_t num_backslashes = 0;
+        for(auto c: arg) {
+            if(c == L'\\') {
+                ++num_backslashes;
+                continue;
+            }
+    
+            if(c == L'"') {
+                result.append(num_backslashes * 2 + 1, L'\\');
+            } else {
+                result.append(num_backslashes, L'\\');
+            }
+            num_backslashes = 0;
+            result.push_back(c);
+        }
+        result.append(num_backslashes * 2, L'\\');
+        result.push_back(L'"');
+        return result;
+    }
+}
+
+std::unique_ptr<ChildProcess> ChildProcess::Start(String const &path,
+                                                  std::vector<String> const &args,
+                                                  bool capture_output)
+{
+    std::wstring cmdline = quote_argument(path);
+    for(auto const &arg: args) {
+        cmdline += L" " + quote_argument(arg);
+    }
+    
+    std::unique_ptr<ChildProcess> child(new ChildProcess());
+    
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    
+    std::unique_lock<std::mutex> lock(GetSpawnMutex());
+    
+    HANDLE write_end = nullptr;
+    if(capture_output) {
+        SECURITY_ATTRIBUTES sa = {};
+        sa.nLength = sizeof(sa);
+        sa.bInheritHandle = TRUE;
+        if(!CreatePipe(&child->pimpl_->output_, &write_end, &sa, 0)) { return nullptr; }
+        SetHandleInformation(child->pimpl_->output_, HANDLE_FLAG_INHERIT, 0);
+    
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = write_end;
+        si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    }
+    
+    auto const result = CreateProcessW(path.c_str(), &cmdline[0], nullptr, nullptr, capture_output,
+                                       0, nullptr, nullptr, &si, &child->pimpl_->pi_);
+    if(write_end) { CloseHandle(write_end); }
+    if(!result) {
+        child->pimpl_->pi_ = {};
+        return nullptr;
+    }
+    
+    return child;
+}
+
+ChildProcess::~ChildProcess()
+{
+    if(pimpl_->pi_.hProcess) {
+        if(IsRunning()) { Terminate(); }
+        CloseHandle(pimpl_->pi_.hThread);
+        CloseHandle(pimpl_->pi_.hProcess);
+    }
+    if(pimpl_->output_) { CloseHandle(pimpl_->output_); }
+}
+
+UInt32 ChildProcess::GetProcessID() const
+{
+    return pimpl_->pi_.dwProcessId;
+}
+
+bool ChildProcess::IsRunning()
+{
+    return WaitForSingleObject(pimpl_->pi_.hProcess, 0) == WAIT_TIMEOUT;
+}
+
+void ChildProcess::Terminate()
+{
+    TerminateProcess(pimpl_->pi_.hProcess, 1);
+    WaitForSingleObject(pimpl_->pi_.hProcess, INFINITE);
+}
+
+bool ChildProcess::Wait(UInt32 timeout_ms)
+{
+    return WaitForSingleObject(pimpl_->pi_.hProcess, timeout_ms) == WAIT_OBJECT_0;
+}
+
+bool ChildProcess::ReadOutput(std::string &dest, UInt32 timeout_ms)
+{
+    assert(pimpl_->output_);
+    
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    char buffer[4096];
+    for( ; ; ) {
+        //! ReadFile()はタイムアウトを指定できないので、読み込めるデータがあるときだけ読み込む。
+        DWORD available = 0;
+        if(!PeekNamedPipe(pimpl_->output_, nullptr, 0, nullptr, &available, nullptr)) {
+            //! ERROR_BROKEN_PIPE : 子プロセスが書き込み側を閉じた
+            return true;
+        }
+    
+        if(available > 0) {
+            DWORD num_read = 0;
+            if(!ReadFile(pimpl_->output_, buffer, std::min<DWORD>(available, sizeof(buffer)), &num_read, nullptr)) {
+                return true;
+            }
+            dest.append(buffer, num_read);
+            continue;
+        }
+    
+        if(GetRemainingMilliseconds(deadline) == 0) { return false; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+UInt32 ChildProcess::GetCurrentProcessID()
+{
+    return ::GetCurrentProcessId();
+}
+
+bool ChildProcess::IsProcessRunning(UInt32 pid)
+{
+    auto handle = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    if(!handle) { return false; }
+    
+    auto const running = (WaitForSingleObject(handle, 0) == WAIT_TIMEOUT);
+    CloseHandle(handle);
+    return running;
+}
+
+std::unique_ptr<ParentOutput> ParentOutput::TakeStandardOutput()
+{
+    auto const output = GetStdHandle(STD_OUTPUT_HANDLE);
+    if(output == nullptr || output == INVALID_HANDLE_VALUE) { return nullptr; }
+    
+    std::unique_ptr<ParentOutput> po(new ParentOutput());
+    po->handle_ = output;
+    
+    //! 以降の標準出力への書き込みは、標準エラー出力に出力する。
+    SetStdHandle(STD_OUTPUT_HANDLE, GetStdHandle(STD_ERROR_HANDLE));
+    _dup2(_fileno(stderr), _fileno(stdout));
+    return po;
+}
+
+ParentOutput::~ParentOutput()
+{
+    CloseHandle(handle_);
+}
+
+bool ParentOutput::Write(void const *data, size_t size)
+{
+    auto p = static_cast<char const *>(data);
+    while(size > 0) {
+        DWORD written = 0;
+        if(!WriteFile(handle_, p, (DWORD)std::min<size_t>(size, 64 * 1024), &written, nullptr)) {
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+#else
+
+struct ChildProcess::Impl
+{
+    //! 回収済みのプロセスIDにシグナルを送らないように、pid_とexited_へのアクセスを排他する。
+    std::mutex mtx_;
+    pid_t pid_ = -1;
+    bool exited_ = false;
+    //! 子プロセスの標準出力を読み込むパイプ
+    int output_ = -1;
+    
+    //! 終了した子プロセスを回収する。
+    bool Reap(int options)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return ReapLocked(options);
+    }
+    
+    //! @pre mtx_がロックされていること
+    bool ReapLocked(int options)
+    {
+        if(exited_) { return true; }
+    
+        int status = 0;
+        for( ; ; ) {
+            auto const result = waitpid(pid_, &status, options);
+            if(result == pid_) { exited_ = true; return true; }
+            if(result < 0 && errno == EINTR) { continue; }
+            //! 子プロセスが見つからない場合も、終了したものとして扱う。
+            if(result < 0) { exited_ = true; return true; }
+            return false;
+        }
+    }
+};
+
+std::unique_ptr<ChildProcess> ChildProcess::Start(String const &path,
+                                                  std::vector<String> const &args,
+                                                  bool capture_output)
+{
+    std::vector<std::string> args_utf8;
+    args_utf8.push_back(to_utf8(path));
+    for(auto const &arg: args) { args_utf8.push_back(to_utf8(arg)); }
+    
+    std::vector<char *> argv;
+    for(auto &arg: args_utf8) { argv.push_back(&arg[0]); }
+    argv.push_back(nullptr);
+    
+    std::unique_ptr<ChildProcess> child(new ChildProcess());
+    
+    std::unique_lock<std::mutex> lock(GetSpawnMutex());
+    
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    HWM_SCOPE_EXIT([&] { posix_spawn_file_actions_destroy(&actions); });
+    
+    int fds[2] = { -1, -1 };
+    if(capture_output) {
+        if(pipe(fds) != 0) { return nullptr; }
+        //! 子プロセスには、標準出力に付け替えた書き込み側だけを継承させる。
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        child->pimpl_->output_ = fds[0];
+    }
+    
+    auto const result = posix_spawn(&child->pimpl_->pid_, argv[0], &actions, nullptr, argv.data(), environ);
+    if(fds[1] != -1) { close(fds[1]); }
+    if(result != 0) {
+        child->pimpl_->exited_ = true;
+        return nullptr;
+    }
+    
+    return child;
+}
+
+ChildProcess::~ChildProcess()
+{
+    if(IsRunning()) { Terminate(); }
+    if(pimpl_->output_ != -1) { close(pimpl_->output_); }
+}
+
+UInt32 ChildProcess::GetProcessID() const
+{
+    return (UInt32)pimpl_->pid_;
+}
+
+bool ChildProcess::IsRunning()
+{
+    return pimpl_->Reap(WNOHANG) == false;
+}
+
+void ChildProcess::Terminate()
+{
+    std::lock_guard<std::mutex> lock(pimpl_->mtx_);
+    if(pimpl_->exited_) { return; }
+    
+    kill(pimpl_->pid_, SIGKILL);
+    pimpl_->ReapLocked(0);
+}
+
+bool ChildProcess::Wait(UInt32 timeout_ms)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for( ; ; ) {
+        if(pimpl_->Reap(WNOHANG)) { return true; }
+        if(std::chrono::steady_clock::now() >= deadline) { return false; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+bool ChildProcess::ReadOutput(std::string &dest, UInt32 timeout_ms)
+{
+    assert(pimpl_->output_ != -1);
+    
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    char buffer[4096];
+    for( ; ; ) {
+        pollfd pfd = {};
+        pfd.fd = pimpl_->output_;
+        pfd.events = POLLIN;
+    
+        auto const result = poll(&pfd, 1, GetRemainingMilliseconds(deadline));
+        if(result < 0 && errno == EINTR) { continue; }
+        if(result < 0) { return true; }
+        if(result == 0) { return false; }
+    
+        auto const num_read = read(pimpl_->output_, buffer, sizeof(buffer));
+        if(num_read < 0 && errno == EINTR) { continue; }
+        //! 0 : 子プロセスが書き込み側を閉じた
+        if(num_read <= 0) { return true; }
+        dest.append(buffer, num_read);
+    }
+}
+
+UInt32 ChildProcess::GetCurrentProcessID()
+{
+    return (UInt32)getpid();
+}
+
+bool ChildProcess::IsProcessRunning(UInt32 pid)
+{
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+std::unique_ptr<ParentOutput> ParentOutput::TakeStandardOutput()
+{
+    fflush(stdout);
+    
+    auto const fd = dup(STDOUT_FILENO);
+    if(fd == -1) { return nullptr; }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    
+    //! 以降の標準出力への書き込みは、標準エラー出力に出力する。
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    
+    std::unique_ptr<ParentOutput> po(new ParentOutput());
+    po->fd_ = fd;
+    return po;
+}
+
+ParentOutput::~ParentOutput()
+{
+    close(fd_);
+}
+
+bool ParentOutput::Write(void const *data, size_t size)
+{
+    auto p = static_cast<char const *>(data);
+    while(size > 0) {
+        auto const written = write(fd_, p, size);
+        if(written < 0 && errno == EINTR) { continue; }
+        if(written <= 0) { return false; }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+#endif
+
+ChildProcess::ChildProcess()
+:   pimpl_(std::make_unique<Impl>())
+{}
+
+NS_HWM_END
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+NS_HWM_BEGIN
+
+//! 子プロセスを起動して、その状態を監視するクラス
+/*! 子プロセスの標準入出力は、親プロセスのものをそのまま引き継ぐ。
+ *  ただし、capture_outputを指定して起動した場合は、子プロセスの標準出力をパイプで受け取る。
+ *  オブジェクトの破棄時に子プロセスが実行中の場合は、強制終了する。
+ */
+class ChildProcess final
+{
+public:
+    //! 子プロセスを起動する。
+    //! @return 起動に失敗した場合はnullptr
+    //! @param capture_output trueの場合は、子プロセスの標準出力をReadOutput()で読み込めるようにする。
+    static std::unique_ptr<ChildProcess> Start(String const &path,
+                                               std::vector<String> const &args,
+                                               bool capture_output = false);
+    
+    ~ChildProcess();
+    
+    ChildProcess(ChildProcess const &) = delete;
+    ChildProcess & operator=(ChildProcess const &) = delete;
+    
+    UInt32 GetProcessID() const;
+    
+    //! 子プロセスが実行中かどうか
+    bool IsRunning();
+    
+    //! 子プロセスを強制終了して、終了を待機する。
+    /*! 他のスレッドがReadOutput()やWait()で待機している間にも呼び出せる。
+     *  (子プロセスが終了すると、それらの関数は待機をやめて戻る)
+     */
+    void Terminate();
+    
+    //! 子プロセスの終了を、最大でtimeout_ms待機する。
+    //! @return タイムアウトした場合はfalse
+    bool Wait(UInt32 timeout_ms);
+    
+    //! 子プロセスが標準出力を閉じるまで、出力をdestに追加する。
+    /*! capture_outputを指定して起動した場合だけ使用できる。
+     *  @return 最大でtimeout_ms待機しても、子プロセスが標準出力を閉じなかった場合はfalse
+     */
+    bool ReadOutput(std::string &dest, UInt32 timeout_ms);
+    
+    //! 現在のプロセスのプロセスID
+    static UInt32 GetCurrentProcessID();
+    
+    //! 指定したプロセスIDのプロセスが実行中かどうか
+    /*! 子プロセスから親プロセスの終了を検出するために使用する。
+     */
+    static bool IsProcessRunning(UInt32 pid);
+    
+private:
+    ChildProcess();
+    
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+//! 子プロセス側で、親プロセスにデータを送るための出力
+/*! capture_outputを指定して起動された子プロセスで使用する。
+ */
+class ParentOutput final
+{
+public:
+    //! 標準出力を、親プロセスへの出力専用にする。
+    /*! 標準出力の出力先を複製してから、標準出力を標準エラー出力に付け替える。
+     *  これ以降にプラグインなどが標準出力に書き込んだ内容は、標準エラー出力に出力されるので、
+     *  親プロセスへの出力と混ざらない。
+     *  @return 失敗した場合はnullptr
+     */
+    static std::unique_ptr<ParentOutput> TakeStandardOutput();
+    
+    ~ParentOutput();
+    
+    ParentOutput(ParentOutput const &) = delete;
+    ParentOutput & operator=(ParentOutput const &) = delete;
+    
+    //! @return すべて書き込めた場合はtrue
+    bool Write(void const *data, size_t size);
+    
+private:
+    ParentOutput() {}
+    
+#if defined(_MSC_VER)
+    void *handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+NS_HWM_END
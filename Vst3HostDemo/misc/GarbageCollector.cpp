@@ -0,0 +1,196 @@
+#include "GarbageCollector.hpp"
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+#include <chrono>
+#include <vector>
+
+NS_HWM_BEGIN
+
+namespace {
+    //! 現在のスレッドで実行中のリアルタイム処理の区間のネスト数
+    thread_local int tls_realtime_section_depth;
+    //! 現在のスレッドで実行中のリアルタイム処理の区間が使用しているスロット
+    thread_local int tls_realtime_section_slot = -1;
+    
+    //! 同時に実行できるリアルタイム処理の区間の数
+    int const kMaxRealtimeSections = 64;
+    
+    //! 回収処理を行う間隔
+    std::chrono::milliseconds const kCollectionInterval { 50 };
+    
+    //! スロットが使用されていないことを表す値
+    UInt64 const kInactiveSlot = 0;
+}
+
+struct GarbageCollector::Impl
+{
+    struct Garbage
+    {
+        std::shared_ptr<void const> object_;
+        //! Retire()した時点でのepoch_の値
+        UInt64 epoch_ = 0;
+        Garbage *next_ = nullptr;
+    };
+    
+    //! 実行中のリアルタイム処理の区間が、開始時に読み込んだepoch_の値を記録する。
+    //! 他のスロットと同じキャッシュラインに載らないようにする。
+    struct alignas(64) Slot
+    {
+        std::atomic<UInt64> epoch_ = { kInactiveSlot };
+    };
+    
+    //! Retire()のたびにインクリメントされる。
+    //! (kInactiveSlotと区別できるように、1から始める)
+    std::atomic<UInt64> epoch_ = { 1 };
+    std::array<Slot, kMaxRealtimeSections> slots_;
+    
+    //! Retire()されたオブジェクトのリスト。(lock-free stack)
+    std::atomic<Garbage *> retired_ = { nullptr };
+    
+    //! 回収スレッドだけがアクセスする。
+    std::vector<Garbage *> pending_;
+    
+    std::thread th_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    
+    void Push(Garbage *g)
+    {
+        auto head = retired_.load();
+        do {
+            g->next_ = head;
+        } while(retired_.compare_exchange_weak(head, g) == false);
+    }
+    
+    void Collect()
+    {
+        for(auto g = retired_.exchange(nullptr); g; ) {
+            auto next = g->next_;
+            pending_.push_back(g);
+            g = next;
+        }
+        
+        auto const oldest = GetOldestSectionEpoch();
+        auto removed = std::remove_if(pending_.begin(), pending_.end(), [oldest](Garbage *g) {
+            //! リタイアした時点より後に開始した区間からは、もう参照されていない。
+            if(g->epoch_ >= oldest) {
+                return false;
+            }
+            
+            delete g;
+            return true;
+        });
+        pending_.erase(removed, pending_.end());
+    }
+    
+    //! 実行中のリアルタイム処理の区間のうち、最も古いものが開始したときのエポック。
+    //! 実行中の区間がない場合は、UInt64の最大値
+    UInt64 GetOldestSectionEpoch() const
+    {
+        UInt64 oldest = std::numeric_limits<UInt64>::max();
+        for(auto const &slot: slots_) {
+            auto const epoch = slot.epoch_.load();
+            if(epoch != kInactiveSlot) {
+                oldest = std::min(oldest, epoch);
+            }
+        }
+        return oldest;
+    }
+    
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        for( ; ; ) {
+            cv_.wait_for(lock, kCollectionInterval, [this] { return stop_; });
+            if(stop_) { break; }
+            
+            lock.unlock();
+            Collect();
+            lock.lock();
+        }
+    }
+};
+
+GarbageCollector::GarbageCollector()
+:   pimpl_(std::make_unique<Impl>())
+{
+    pimpl_->th_ = std::thread([this] { pimpl_->Run(); });
+}
+
+GarbageCollector::~GarbageCollector()
+{
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        pimpl_->stop_ = true;
+    }
+    pimpl_->cv_.notify_one();
+    pimpl_->th_.join();
+    
+    assert(pimpl_->GetOldestSectionEpoch() == std::numeric_limits<UInt64>::max());
+    pimpl_->Collect();
+    assert(pimpl_->pending_.empty());
+}
+
+void GarbageCollector::RetireImpl(std::shared_ptr<void const> p)
+{
+    assert(IsInRealtimeSection() == false);
+    
+    auto g = new Impl::Garbage();
+    g->object_ = std::move(p);
+    //! これより前に開始した区間は、オブジェクトを参照している可能性がある。
+    g->epoch_ = pimpl_->epoch_.fetch_add(1);
+    pimpl_->Push(g);
+}
+
+void GarbageCollector::WaitForRealtimeSections()
+{
+    assert(IsInRealtimeSection() == false);
+    
+    auto const epoch = pimpl_->epoch_.fetch_add(1);
+    while(pimpl_->GetOldestSectionEpoch() <= epoch) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void GarbageCollector::EnterRealtimeSection()
+{
+    if(tls_realtime_section_depth++ > 0) { return; }
+    
+    //! 空いているスロットに、現在のエポックを記録する。
+    auto const epoch = pimpl_->epoch_.load();
+    for( ; ; ) {
+        for(int i = 0; i < kMaxRealtimeSections; ++i) {
+            auto expected = kInactiveSlot;
+            if(pimpl_->slots_[i].epoch_.compare_exchange_strong(expected, epoch)) {
+                tls_realtime_section_slot = i;
+                return;
+            }
+        }
+        
+        assert(false && "too many realtime sections are running at the same time");
+        std::this_thread::yield();
+    }
+}
+
+void GarbageCollector::LeaveRealtimeSection()
+{
+    assert(tls_realtime_section_depth > 0);
+    if(--tls_realtime_section_depth > 0) { return; }
+    
+    assert(tls_realtime_section_slot >= 0);
+    pimpl_->slots_[tls_realtime_section_slot].epoch_.store(kInactiveSlot);
+    tls_realtime_section_slot = -1;
+}
+
+bool GarbageCollector::IsInRealtimeSection()
+{
+    return tls_realtime_section_depth > 0;
+}
+
+NS_HWM_END
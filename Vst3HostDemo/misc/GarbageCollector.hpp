@@ -0,0 +1,102 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <cassert>
+
+#include "./SingleInstance.hpp"
+
+NS_HWM_BEGIN
+
+//! リアルタイムスレッドから参照される可能性があるオブジェクトを、
+//! 参照されなくなった後にバックグラウンドスレッド上で解放するためのクラス
+/*! リアルタイムスレッドは、ScopedRealtimeSectionで処理の区間を通知する。
+ *  Retire()されたオブジェクトは、Retire()の呼び出し時点で実行中だったリアルタイム処理の区間が
+ *  終了するまで保持され、その後バックグラウンドスレッド上で解放される。
+ *
+ *  複数のリアルタイムスレッドが同時に区間を実行してもよい。
+ *  実行中の区間は、それぞれ開始時のエポックをスロットに記録し、回収スレッドはすべてのスロットを調べる。
+ *  (同時に実行できる区間の数は、kMaxRealtimeSectionsまで)
+ *
+ *  使用するときは、まずリアルタイムスレッドから対象のオブジェクトが見えないようにしてから
+ *  (e.g., アトミックに公開しているポインタを差し替えてから) Retire()を呼び出すこと。
+ */
+class GarbageCollector final
+:   public SingleInstance<GarbageCollector>
+{
+public:
+    GarbageCollector();
+    
+    //! @pre リアルタイム処理の区間の外で呼び出すこと
+    ~GarbageCollector();
+    
+    //! オブジェクトをリタイアする。
+    /*! この関数はロックフリーだが、内部でメモリ確保を行うので、リアルタイムスレッドからは呼び出さないこと。
+     */
+    template<class T>
+    void Retire(std::shared_ptr<T> p)
+    {
+        if(!p) { return; }
+        RetireImpl(std::shared_ptr<void const>(std::move(p)));
+    }
+    
+    //! Retire()を呼び出す前に実行中だったリアルタイム処理の区間が、すべて終了するまで待機する。
+    /*! リアルタイムスレッドから参照されなくなったことを保証してから
+     *  リソースを破棄したい場合に使用する。
+     *  @pre リアルタイムスレッドから呼び出さないこと
+     */
+    void WaitForRealtimeSections();
+    
+    //! リアルタイム処理の区間の開始と終了を通知する。
+    //! 通常はScopedRealtimeSectionを利用する。
+    void EnterRealtimeSection();
+    void LeaveRealtimeSection();
+    
+    //! 現在のスレッドがリアルタイム処理の区間を実行中かどうか
+    static
+    bool IsInRealtimeSection();
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+    
+    void RetireImpl(std::shared_ptr<void const> p);
+};
+
+//! GarbageCollectorが作成されていれば、オブジェクトをリタイアする。
+//! 作成されていない場合は、この場で解放する。
+template<class T>
+void RetireObject(std::shared_ptr<T> p)
+{
+    if(auto gc = GarbageCollector::GetInstance()) {
+        gc->Retire(std::move(p));
+    }
+}
+
+//! リアルタイム処理の区間を表すRAIIクラス
+class ScopedRealtimeSection
+{
+public:
+    ScopedRealtimeSection()
+    :   gc_(GarbageCollector::GetInstance())
+    {
+        if(gc_) { gc_->EnterRealtimeSection(); }
+    }
+    
+    ~ScopedRealtimeSection()
+    {
+        if(gc_) { gc_->LeaveRealtimeSection(); }
+    }
+    
+    ScopedRealtimeSection(ScopedRealtimeSection const &) = delete;
+    ScopedRealtimeSection & operator=(ScopedRealtimeSection const &) = delete;
+    
+private:
+    GarbageCollector *gc_ = nullptr;
+};
+
+NS_HWM_END
+
+//! リアルタイム処理の区間の中でオブジェクトが破棄されていないことをチェックする
+#define HWM_ASSERT_NOT_IN_REALTIME_SECTION() \
+assert(hwm::GarbageCollector::IsInRealtimeSection() == false && "must not be destroyed on the realtime thread")
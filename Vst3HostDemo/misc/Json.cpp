@@ -0,0 +1,335 @@
+#include "Json.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+NS_HWM_BEGIN
+
+namespace {
+    JsonValue const kNullValue;
+    std::string const kEmptyString;
+    JsonValue::Array const kEmptyArray;
+    JsonValue::Object const kEmptyObject;
+    
+    //! 不正なファイルでスタックを使い果たさないように、ネストの深さを制限する。
+    int const kMaxDepth = 256;
+    
+    class Parser
+    {
+    public:
+        Parser(std::string const &text)
+        :   p_(text.data())
+        ,   end_(text.data() + text.size())
+        ,   begin_(text.data())
+        {}
+    
+        std::optional<JsonValue> Parse(std::string *error)
+        {
+            JsonValue value;
+            if(ParseValue(value, 0)) {
+                SkipWhitespaces();
+                if(p_ == end_) { return value; }
+                SetError("unexpected trailing characters");
+            }
+    
+            if(error) { *error = error_; }
+            return std::nullopt;
+        }
+    
+    private:
+        char const *p_;
+        char const *end_;
+        char const *begin_;
+        std::string error_;
+    
+        bool SetError(char const *msg)
+        {
+            if(error_.empty()) {
+                error_ = std::string(msg) + " at offset " + std::to_string(p_ - begin_);
+            }
+            return false;
+        }
+    
+        void SkipWhitespaces()
+        {
+            while(p_ != end_) {
+                auto const c = *p_;
+                if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                    ++p_;
+                } else if(c == '/' && p_ + 1 != end_ && p_[1] == '/') {
+                    while(p_ != end_ && *p_ != '\n') { ++p_; }
+                } else if(c == '/' && p_ + 1 != end_ && p_[1] == '*') {
+                    p_ += 2;
+                    while(p_ != end_ && !(*p_ == '*' && p_ + 1 != end_ && p_[1] == '/')) { ++p_; }
+                    p_ = (p_ == end_ ? end_ : p_ + 2);
+                } else if(c == '\xEF' && end_ - p_ >= 3 && p_[1] == '\xBB' && p_[2] == '\xBF') {
+                    //! UTF-8 BOM
+                    p_ += 3;
+                } else {
+                    break;
+                }
+            }
+        }
+    
+        bool Consume(char const *word)
+        {
+            auto const len = std::strlen(word);
+            if((size_t)(end_ - p_) < len || std::memcmp(p_, word, len) != 0) { return false; }
+            p_ += len;
+            return true;
+        }
+    
+        bool ParseValue(JsonValue &value, int depth)
+        {
+            if(depth > kMaxDepth) { return SetError("too deeply nested"); }
+    
+            SkipWhitespaces();
+            if(p_ == end_) { return SetError("unexpected end of text"); }
+    
+            switch(*p_) {
+                case '{': return ParseObject(value, depth);
+                case '[': return ParseArray(value, depth);
+                case '"':
+                case '\'': {
+                    std::string s;
+                    if(ParseString(s) == false) { return false; }
+                    value = JsonValue(std::move(s));
+                    return true;
+                }
+                case 't':
+                    if(Consume("true")) { value = JsonValue(true); return true; }
+                    break;
+                case 'f':
+                    if(Consume("false")) { value = JsonValue(false); return true; }
+                    break;
+                case 'n':
+                    if(Consume("null")) { value = JsonValue(); return true; }
+                    break;
+                default:
+                    return ParseNumber(value);
+            }
+    
+            return SetError("unexpected token");
+        }
+    
+        bool ParseNumber(JsonValue &value)
+        {
+            auto const start = p_;
+            while(p_ != end_ && *p_ != '\0' && std::strchr("+-0123456789.eE", *p_)) { ++p_; }
+            if(start == p_) { return SetError("unexpected token"); }
+    
+            std::string const str(start, p_);
+            char *parsed_end = nullptr;
+            auto const n = std::strtod(str.c_str(), &parsed_end);
+            if(parsed_end != str.c_str() + str.size()) {
+                p_ = start;
+                return SetError("invalid number");
+            }
+    
+            value = JsonValue(n);
+            return true;
+        }
+    
+        static
+        void AppendUtf8(std::string &dest, UInt32 cp)
+        {
+            if(cp < 0x80) {
+                dest.push_back((char)cp);
+            } else if(cp < 0x800) {
+                dest.push_back((char)(0xC0 | (cp >> 6)));
+                dest.push_back((char)(0x80 | (cp & 0x3F)));
+            } else if(cp < 0x10000) {
+                dest.push_back((char)(0xE0 | (cp >> 12)));
+                dest.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                dest.push_back((char)(0x80 | (cp & 0x3F)));
+            } else {
+                dest.push_back((char)(0xF0 | (cp >> 18)));
+                dest.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+                dest.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                dest.push_back((char)(0x80 | (cp & 0x3F)));
+            }
+        }
+    
+        bool ParseHex4(UInt32 &cp)
+        {
+            if(end_ - p_ < 4) { return SetError("invalid unicode escape"); }
+    
+            cp = 0;
+            for(int i = 0; i < 4; ++i, ++p_) {
+                auto const c = *p_;
+                cp <<= 4;
+                if('0' <= c && c <= '9')        { cp |= c - '0'; }
+                else if('a' <= c && c <= 'f')   { cp |= c - 'a' + 10; }
+                else if('A' <= c && c <= 'F')   { cp |= c - 'A' + 10; }
+                else { return SetError("invalid unicode escape"); }
+            }
+            return true;
+        }
+    
+        bool ParseString(std::string &dest)
+        {
+            auto const quote = *p_++;
+            for( ; ; ) {
+                if(p_ == end_) { return SetError("unterminated string"); }
+    
+                auto const c = *p_++;
+                if(c == quote) { return true; }
+                if(c != '\\') {
+                    dest.push_back(c);
+                    continue;
+                }
+    
+                if(p_ == end_) { return SetError("unterminated string"); }
+                auto const e = *p_++;
+                switch(e) {
+                    case '"': case '\'': case '\\': case '/':
+                        dest.push_back(e);
+                        break;
+                    case 'b': dest.push_back('\b'); break;
+                    case 'f': dest.push_back('\f'); break;
+                    case 'n': dest.push_back('\n'); break;
+                    case 'r': dest.push_back('\r'); break;
+                    case 't': dest.push_back('\t'); break;
+                    case 'u': {
+                        UInt32 cp = 0;
+                        if(ParseHex4(cp) == false) { return false; }
+                        //! サロゲートペア
+                        if(0xD800 <= cp && cp < 0xDC00 && end_ - p_ >= 6 && p_[0] == '\\' && p_[1] == 'u') {
+                            p_ += 2;
+                            UInt32 low = 0;
+                            if(ParseHex4(low) == false) { return false; }
+                            if(0xDC00 <= low && low < 0xE000) {
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                            } else {
+                                AppendUtf8(dest, cp);
+                                cp = low;
+                            }
+                        }
+                        AppendUtf8(dest, cp);
+                        break;
+                    }
+                    default:
+                        return SetError("invalid escape sequence");
+                }
+            }
+        }
+    
+        bool ParseArray(JsonValue &value, int depth)
+        {
+            ++p_;
+            JsonValue::Array array;
+            for( ; ; ) {
+                SkipWhitespaces();
+                if(p_ == end_) { return SetError("unterminated array"); }
+                //! 空の配列と、末尾のカンマ
+                if(*p_ == ']') { ++p_; break; }
+    
+                JsonValue elem;
+                if(ParseValue(elem, depth + 1) == false) { return false; }
+                array.push_back(std::move(elem));
+    
+                SkipWhitespaces();
+                if(p_ != end_ && *p_ == ',') { ++p_; continue; }
+                if(p_ != end_ && *p_ == ']') { ++p_; break; }
+                return SetError("expected ',' or ']'");
+            }
+    
+            value = JsonValue(std::move(array));
+            return true;
+        }
+    
+        bool ParseObject(JsonValue &value, int depth)
+        {
+            ++p_;
+            JsonValue::Object object;
+            for( ; ; ) {
+                SkipWhitespaces();
+                if(p_ == end_) { return SetError("unterminated object"); }
+                //! 空のオブジェクトと、末尾のカンマ
+                if(*p_ == '}') { ++p_; break; }
+    
+                if(*p_ != '"' && *p_ != '\'') { return SetError("expected a string key"); }
+                std::string key;
+                if(ParseString(key) == false) { return false; }
+    
+                SkipWhitespaces();
+                if(p_ == end_ || *p_ != ':') { return SetError("expected ':'"); }
+                ++p_;
+    
+                JsonValue member;
+                if(ParseValue(member, depth + 1) == false) { return false; }
+                object.emplace_back(std::move(key), std::move(member));
+    
+                SkipWhitespaces();
+                if(p_ != end_ && *p_ == ',') { ++p_; continue; }
+                if(p_ != end_ && *p_ == '}') { ++p_; break; }
+                return SetError("expected ',' or '}'");
+            }
+    
+            value = JsonValue(std::move(object));
+            return true;
+        }
+    };
+}
+
+bool JsonValue::AsBool(bool default_value) const
+{
+    return IsBool() ? std::get<bool>(data_) : default_value;
+}
+
+double JsonValue::AsNumber(double default_value) const
+{
+    return IsNumber() ? std::get<double>(data_) : default_value;
+}
+
+std::string const & JsonValue::AsString() const
+{
+    return IsString() ? std::get<std::string>(data_) : kEmptyString;
+}
+
+JsonValue::Array const & JsonValue::AsArray() const
+{
+    return IsArray() ? std::get<Array>(data_) : kEmptyArray;
+}
+
+JsonValue::Object const & JsonValue::AsObject() const
+{
+    return IsObject() ? std::get<Object>(data_) : kEmptyObject;
+}
+
+JsonValue const & JsonValue::operator[](std::string const &key) const
+{
+    for(auto const &member: AsObject()) {
+        if(member.first == key) { return member.second; }
+    }
+    return kNullValue;
+}
+
+JsonValue const & JsonValue::operator[](size_t index) const
+{
+    auto const &array = AsArray();
+    return index < array.size() ? array[index] : kNullValue;
+}
+
+bool JsonValue::HasMember(std::string const &key) const
+{
+    auto const &object = AsObject();
+    return std::any_of(object.begin(), object.end(), [&key](auto const &member) {
+        return member.first == key;
+    });
+}
+
+size_t JsonValue::size() const
+{
+    if(IsArray()) { return std::get<Array>(data_).size(); }
+    if(IsObject()) { return std::get<Object>(data_).size(); }
+    return 0;
+}
+
+std::optional<JsonValue> ParseJson(std::string const &text, std::string *error)
+{
+    return Parser(text).Parse(error);
+}
+
+NS_HWM_END
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+NS_HWM_BEGIN
+
+//! JSONの値
+/*! 読み込み専用。存在しないキーやインデックスを参照した場合は、nullの値を返すので、
+ *  value["a"]["b"][0] のように、途中の値の有無を確認せずに参照できる。
+ */
+class JsonValue
+{
+public:
+    enum class Type
+    {
+        kNull,
+        kBool,
+        kNumber,
+        kString,
+        kArray,
+        kObject,
+    };
+    
+    using Array = std::vector<JsonValue>;
+    //! 出現順を保持するために、mapではなくvectorで保持する。
+    using Object = std::vector<std::pair<std::string, JsonValue>>;
+    
+    JsonValue() {}
+    explicit JsonValue(bool b) : data_(b) {}
+    explicit JsonValue(double n) : data_(n) {}
+    explicit JsonValue(std::string s) : data_(std::move(s)) {}
+    explicit JsonValue(Array a) : data_(std::move(a)) {}
+    explicit JsonValue(Object o) : data_(std::move(o)) {}
+    
+    Type GetType() const { return static_cast<Type>(data_.index()); }
+    
+    bool IsNull() const { return GetType() == Type::kNull; }
+    bool IsBool() const { return GetType() == Type::kBool; }
+    bool IsNumber() const { return GetType() == Type::kNumber; }
+    bool IsString() const { return GetType() == Type::kString; }
+    bool IsArray() const { return GetType() == Type::kArray; }
+    bool IsObject() const { return GetType() == Type::kObject; }
+    
+    //! 型が異なる場合は、default_valueを返す。
+    bool AsBool(bool default_value = false) const;
+    double AsNumber(double default_value = 0) const;
+    
+    //! 文字列でない場合は空文字列を返す。
+    std::string const & AsString() const;
+    //! 配列でない場合は空の配列を返す。
+    Array const & AsArray() const;
+    //! オブジェクトでない場合は空のオブジェクトを返す。
+    Object const & AsObject() const;
+    
+    //! オブジェクトのメンバーを参照する。存在しない場合はnullの値を返す。
+    JsonValue const & operator[](std::string const &key) const;
+    JsonValue const & operator[](char const *key) const { return (*this)[std::string(key)]; }
+    //! 配列の要素を参照する。存在しない場合はnullの値を返す。
+    JsonValue const & operator[](size_t index) const;
+    
+    bool HasMember(std::string const &key) const;
+    
+    //! 配列とオブジェクトの要素数。それ以外の場合は0
+    size_t size() const;
+    
+private:
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object> data_ = nullptr;
+};
+
+//! JSONの文字列を解析する。
+/*! 手書きされたファイルも読み込めるように、JSON5の一部の記法も受け付ける。
+ *  - 行コメント(//)と、ブロックコメント
+ *  - 配列とオブジェクトの末尾のカンマ
+ *  - シングルクォートで囲まれた文字列
+ *
+ *  @param error 解析に失敗した場合に、エラーの内容を受け取る。(nullptrでもよい)
+ *  @return 解析に失敗した場合はstd::nullopt
+ */
+std::optional<JsonValue> ParseJson(std::string const &text, std::string *error = nullptr);
+
+NS_HWM_END
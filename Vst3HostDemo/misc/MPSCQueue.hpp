@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cassert>
+
+NS_HWM_BEGIN
+
+//! 容量固定の、ロックフリーなMultiple-Producer Single-Consumerキュー
+/*! 各スロットにシーケンス番号を持たせて、
+ *  複数のスレッドからのTryPush()を、CAS一回でスロットの確保に成功したスレッドだけが書き込むようにする。
+ *  (Dmitry Vyukovのbounded MPMC queueの、取り出し側を一つのスレッドに限定したもの)
+ *
+ *  TryPush()とTryPop()はメモリ確保もロックも行わず、キューが一杯/空の場合もスピンせずにすぐに失敗を返す。
+ *  TryPop()を呼び出すスレッドは一つに限る。
+ *
+ *  @tparam T コピー代入可能な型
+ */
+template<class T>
+class MPSCQueue final
+{
+public:
+    //! @param capacity キューの容量。2の冪乗に切り上げられる。
+    explicit MPSCQueue(UInt32 capacity)
+    {
+        UInt32 n = 1;
+        while(n < capacity) { n <<= 1; }
+    
+        capacity_ = n;
+        mask_ = n - 1;
+        cells_ = std::make_unique<Cell[]>(n);
+        for(UInt32 i = 0; i < n; ++i) {
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    MPSCQueue(MPSCQueue const &) = delete;
+    MPSCQueue & operator=(MPSCQueue const &) = delete;
+    
+    UInt32 GetCapacity() const { return capacity_; }
+    
+    //! キューに要素を追加する。キューが一杯の場合はfalseを返す。
+    bool TryPush(T const &value)
+    {
+        auto pos = tail_.load(std::memory_order_relaxed);
+        for( ; ; ) {
+            auto &cell = cells_[pos & mask_];
+            auto const seq = cell.seq_.load(std::memory_order_acquire);
+            auto const diff = (Int64)seq - (Int64)pos;
+    
+            if(diff == 0) {
+                //! このスロットは空いている。確保できたら書き込む。
+                if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value_ = value;
+                    cell.seq_.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                //! 取り出しが追いついていない。
+                return false;
+            } else {
+                //! 他のスレッドが先にこのスロットを確保した。
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    //! キューから要素を取り出す。キューが空の場合や、
+    //! 先頭のスロットへの書き込みがまだ完了していない場合はfalseを返す。
+    bool TryPop(T &value)
+    {
+        auto &cell = cells_[head_ & mask_];
+        auto const seq = cell.seq_.load(std::memory_order_acquire);
+        if((Int64)seq - (Int64)(head_ + 1) < 0) { return false; }
+    
+        value = cell.value_;
+        cell.seq_.store(head_ + capacity_, std::memory_order_release);
+        head_ += 1;
+        return true;
+    }
+    
+private:
+    struct Cell
+    {
+        std::atomic<UInt64> seq_;
+        T value_;
+    };
+    
+    UInt32 capacity_ = 0;
+    UInt64 mask_ = 0;
+    std::unique_ptr<Cell[]> cells_;
+    
+    //! producerとconsumerが書き込む変数を、別のキャッシュラインに配置する。
+    alignas(64) std::atomic<UInt64> tail_ = { 0 };
+    //! consumerのスレッドからのみアクセスする。
+    alignas(64) UInt64 head_ = 0;
+};
+
+NS_HWM_END
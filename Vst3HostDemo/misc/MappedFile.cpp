@@ -0,0 +1,82 @@
+#include "MappedFile.hpp"
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "StrCnv.hpp"
+
+NS_HWM_BEGIN
+
+#if defined(_MSC_VER)
+
+std::unique_ptr<MappedFile> MappedFile::Open(String const &path)
+{
+    auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) { return nullptr; }
+    
+    LARGE_INTEGER file_size = {};
+    if(GetFileSizeEx(file, &file_size) == FALSE || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    
+    //! マッピングオブジェクトがファイルを参照し続けるので、ファイルのハンドルは閉じてよい。
+    auto handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!handle) { return nullptr; }
+    
+    auto data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+    if(!data) { CloseHandle(handle); return nullptr; }
+    
+    std::unique_ptr<MappedFile> mf(new MappedFile());
+    mf->data_ = static_cast<char const *>(data);
+    mf->size_ = (size_t)file_size.QuadPart;
+    mf->handle_ = handle;
+    return mf;
+}
+
+MappedFile::~MappedFile()
+{
+    UnmapViewOfFile(data_);
+    CloseHandle(handle_);
+}
+
+#else
+
+std::unique_ptr<MappedFile> MappedFile::Open(String const &path)
+{
+    auto fd = open(to_utf8(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return nullptr; }
+    
+    struct stat st = {};
+    if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    
+    //! マップした領域はファイルを参照し続けるので、ファイルディスクリプタは閉じてよい。
+    auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) { return nullptr; }
+    
+    std::unique_ptr<MappedFile> mf(new MappedFile());
+    mf->data_ = static_cast<char const *>(data);
+    mf->size_ = (size_t)st.st_size;
+    return mf;
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<char *>(data_), size_);
+}
+
+#endif
+
+NS_HWM_END
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+
+NS_HWM_BEGIN
+
+//! 読み込み専用でメモリにマップしたファイル
+/*! ファイルの内容は、ページ単位で必要になったときに読み込まれるので、
+ *  Open()のコストはファイルのサイズに依存しない。
+ *  マップしている間も、他のプロセスによるファイルの置き換え(リネーム)は、マップしている内容に影響しない。
+ *  (Windowsでは、マップしている間はファイルを置き換えられない)
+ */
+class MappedFile final
+{
+public:
+    //! @return ファイルが存在しない場合や、空のファイルの場合など、マップできなかった場合はnullptr
+    static std::unique_ptr<MappedFile> Open(String const &path);
+    
+    ~MappedFile();
+    
+    MappedFile(MappedFile const &) = delete;
+    MappedFile & operator=(MappedFile const &) = delete;
+    
+    char const * data() const { return data_; }
+    size_t size() const { return size_; }
+    
+private:
+    MappedFile() {}
+    
+    char const *data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_MSC_VER)
+    void *handle_ = nullptr;
+#endif
+};
+
+NS_HWM_END
@@ -0,0 +1,77 @@
+#include "MemoryPressureMonitor.hpp"
+
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#endif
+
+NS_HWM_BEGIN
+
+#if defined(__APPLE__)
+
+MemoryPressureMonitor::MemoryPressureMonitor()
+{
+    auto queue = dispatch_queue_create("MemoryPressureMonitor", DISPATCH_QUEUE_SERIAL);
+    if(!queue) { return; }
+    
+    auto source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE,
+                                         0,
+                                         DISPATCH_MEMORYPRESSURE_NORMAL
+                                         | DISPATCH_MEMORYPRESSURE_WARN
+                                         | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                         queue);
+    if(!source) {
+        dispatch_release(queue);
+        return;
+    }
+    
+    queue_ = queue;
+    source_ = source;
+    
+    //! ブロック構文を使わずに済むように、コンテキストとC関数でハンドラを設定する。
+    dispatch_set_context(source, this);
+    dispatch_source_set_event_handler_f(source, &MemoryPressureMonitor::OnPressureChanged);
+    dispatch_resume(source);
+}
+
+MemoryPressureMonitor::~MemoryPressureMonitor()
+{
+    if(!source_) { return; }
+    
+    auto source = static_cast<dispatch_source_t>(source_);
+    auto queue = static_cast<dispatch_queue_t>(queue_);
+    
+    dispatch_source_cancel(source);
+    //! ハンドラはシリアルキューで実行されるので、空のタスクを同期実行して、
+    //! 実行中のハンドラがthisを参照し終えるのを待つ。
+    dispatch_sync_f(queue, nullptr, [](void *) {});
+    
+    dispatch_release(source);
+    dispatch_release(queue);
+}
+
+void MemoryPressureMonitor::OnPressureChanged(void *context)
+{
+    auto self = static_cast<MemoryPressureMonitor *>(context);
+    auto const flags = dispatch_source_get_data(static_cast<dispatch_source_t>(self->source_));
+    
+    auto level = Level::kNormal;
+    if(flags & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+        level = Level::kCritical;
+    } else if(flags & DISPATCH_MEMORYPRESSURE_WARN) {
+        level = Level::kWarning;
+    }
+    
+    self->level_.store(level, std::memory_order_relaxed);
+}
+
+#else
+
+MemoryPressureMonitor::MemoryPressureMonitor()
+{}
+
+MemoryPressureMonitor::~MemoryPressureMonitor()
+{}
+
+#endif
+
+NS_HWM_END
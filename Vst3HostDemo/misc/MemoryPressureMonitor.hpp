@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+NS_HWM_BEGIN
+
+//! OSが通知するメモリ逼迫の状態を監視する
+/*! macOSでは、DISPATCH_SOURCE_TYPE_MEMORYPRESSUREのディスパッチソースで、システムのメモリ逼迫の通知を受け取る。
+ *  macOSはファイルキャッシュや圧縮メモリで空きメモリを使い切るように動作するので、
+ *  空きメモリの量では、メモリが逼迫しているかどうかを判断できない。
+ *
+ *  その他の環境では、逼迫の通知を受け取れないので、IsSupported()はfalseを返す。
+ *  (呼び出し側で、空きメモリの量などから判断する)
+ *
+ *  GetLevel()はどのスレッドからも呼び出せる。
+ */
+class MemoryPressureMonitor final
+{
+public:
+    enum class Level
+    {
+        kNormal,
+        kWarning,
+        kCritical,
+    };
+    
+    MemoryPressureMonitor();
+    ~MemoryPressureMonitor();
+    
+    MemoryPressureMonitor(MemoryPressureMonitor const &) = delete;
+    MemoryPressureMonitor & operator=(MemoryPressureMonitor const &) = delete;
+    
+    //! この環境でメモリ逼迫の通知を受け取れるかどうか
+    bool IsSupported() const { return source_ != nullptr; }
+    
+    //! 最後に通知された状態。通知を受け取るまでは(IsSupported() == falseの場合も)kNormal
+    Level GetLevel() const { return level_.load(std::memory_order_relaxed); }
+    
+private:
+    std::atomic<Level> level_ = { Level::kNormal };
+    //! macOSでは、dispatch_source_t
+    void *source_ = nullptr;
+    //! macOSでは、ハンドラを実行するシリアルキュー(dispatch_queue_t)
+    void *queue_ = nullptr;
+    
+#if defined(__APPLE__)
+    static void OnPressureChanged(void *context);
+#endif
+};
+
+NS_HWM_END
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+NS_HWM_BEGIN
+
+//! 一つの書き込みスレッドと複数の読み込みスレッドの間で、小さな値を共有するためのシーケンスロック
+/*! Store()はロックもスピンもせずに完了する(wait-free)ので、リアルタイムスレッドから書き込める。
+ *  Load()は、書き込み中の値を読み込んだ場合に読み込みをやり直す。
+ *
+ *  値はUInt64単位のアトミック変数に分割して保持するので、
+ *  書き込み中の値を読み込んでもデータ競合にはならない。(読み込んだ値はシーケンス番号の比較で破棄される)
+ *
+ *  @tparam T トリビアルにコピー可能な型
+ */
+template<class T>
+class SeqLock final
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    
+public:
+    SeqLock(T const &value = T{})
+    {
+        Store(value);
+    }
+    
+    SeqLock(SeqLock const &) = delete;
+    SeqLock & operator=(SeqLock const &) = delete;
+    
+    //! 値を書き込む。
+    //! @pre 同時に複数のスレッドから呼び出さないこと
+    void Store(T const &value)
+    {
+        std::array<UInt64, kNumWords> buf = {};
+        std::memcpy(buf.data(), reinterpret_cast<unsigned char const *>(&value), sizeof(T));
+    
+        auto const seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    
+        for(size_t i = 0; i < kNumWords; ++i) {
+            words_[i].store(buf[i], std::memory_order_relaxed);
+        }
+    
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+    
+    //! 値を読み込む。
+    T Load() const
+    {
+        std::array<UInt64, kNumWords> buf;
+    
+        for( ; ; ) {
+            auto const seq1 = seq_.load(std::memory_order_acquire);
+            if(seq1 & 1) {
+                //! 書き込み中
+                std::this_thread::yield();
+                continue;
+            }
+    
+            for(size_t i = 0; i < kNumWords; ++i) {
+                buf[i] = words_[i].load(std::memory_order_relaxed);
+            }
+    
+            std::atomic_thread_fence(std::memory_order_acquire);
+            auto const seq2 = seq_.load(std::memory_order_relaxed);
+            if(seq1 == seq2) { break; }
+        }
+    
+        //! Tがトリビアルでない(デフォルトメンバ初期化子を持つなど)場合も、
+        //! トリビアルにコピー可能であればバイト列としてコピーしてよいので、unsigned charとして書き込む。
+        T value;
+        std::memcpy(reinterpret_cast<unsigned char *>(&value), buf.data(), sizeof(T));
+        return value;
+    }
+    
+private:
+    static constexpr size_t kNumWords = (sizeof(T) + sizeof(UInt64) - 1) / sizeof(UInt64);
+    
+    std::atomic<UInt64> seq_ = { 0 };
+    std::array<std::atomic<UInt64>, kNumWords> words_ = {};
+};
+
+NS_HWM_END
@@ -0,0 +1,239 @@
+#include "SharedMemory.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+NS_HWM_BEGIN
+
+#if defined(_MSC_VER)
+
+namespace {
+    std::wstring to_object_name(std::string const &name)
+    {
+        return std::wstring(L"Local\\") + std::wstring(name.begin(), name.end());
+    }
+}
+
+std::unique_ptr<SharedMemory> SharedMemory::Create(std::string const &name, size_t size)
+{
+    auto handle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                     (DWORD)((UInt64)size >> 32), (DWORD)(size & 0xFFFFFFFF),
+                                     to_object_name(name).c_str());
+    if(!handle) { return nullptr; }
+    
+    auto data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!data) { CloseHandle(handle); return nullptr; }
+    
+    std::unique_ptr<SharedMemory> shm(new SharedMemory());
+    shm->name_ = name;
+    shm->data_ = data;
+    shm->size_ = size;
+    shm->is_owner_ = true;
+    shm->handle_ = handle;
+    std::memset(data, 0, size);
+    return shm;
+}
+
+std::unique_ptr<SharedMemory> SharedMemory::Open(std::string const &name, size_t size)
+{
+    auto handle = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, to_object_name(name).c_str());
+    if(!handle) { return nullptr; }
+    
+    auto data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!data) { CloseHandle(handle); return nullptr; }
+    
+    std::unique_ptr<SharedMemory> shm(new SharedMemory());
+    shm->name_ = name;
+    shm->data_ = data;
+    shm->size_ = size;
+    shm->handle_ = handle;
+    return shm;
+}
+
+SharedMemory::~SharedMemory()
+{
+    //! Windowsでは、すべてのハンドルが閉じられた時点で共有メモリが削除される。
+    UnmapViewOfFile(data_);
+    CloseHandle(handle_);
+}
+
+std::unique_ptr<InterProcessSemaphore> InterProcessSemaphore::Create(std::string const &name)
+{
+    auto handle = CreateSemaphoreW(nullptr, 0, LONG_MAX, to_object_name(name).c_str());
+    if(!handle) { return nullptr; }
+    
+    std::unique_ptr<InterProcessSemaphore> sem(new InterProcessSemaphore());
+    sem->name_ = name;
+    sem->handle_ = handle;
+    sem->is_owner_ = true;
+    return sem;
+}
+
+std::unique_ptr<InterProcessSemaphore> InterProcessSemaphore::Open(std::string const &name)
+{
+    auto handle = OpenSemaphoreW(SEMAPHORE_ALL_ACCESS, FALSE, to_object_name(name).c_str());
+    if(!handle) { return nullptr; }
+    
+    std::unique_ptr<InterProcessSemaphore> sem(new InterProcessSemaphore());
+    sem->name_ = name;
+    sem->handle_ = handle;
+    return sem;
+}
+
+InterProcessSemaphore::~InterProcessSemaphore()
+{
+    CloseHandle(handle_);
+}
+
+void InterProcessSemaphore::Post()
+{
+    ReleaseSemaphore(handle_, 1, nullptr);
+}
+
+bool InterProcessSemaphore::Wait(UInt32 timeout_ms)
+{
+    return WaitForSingleObject(handle_, timeout_ms) == WAIT_OBJECT_0;
+}
+
+#else
+
+namespace {
+    //! POSIXの共有メモリとセマフォの名前は、'/'から始める必要がある。
+    std::string to_object_name(std::string const &name)
+    {
+        return "/" + name;
+    }
+}
+
+std::unique_ptr<SharedMemory> SharedMemory::Create(std::string const &name, size_t size)
+{
+    auto const object_name = to_object_name(name);
+    auto fd = shm_open(object_name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if(fd < 0) { return nullptr; }
+    
+    //! ftruncate()で拡張した領域はゼロで初期化される。
+    if(ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(object_name.c_str());
+        return nullptr;
+    }
+    
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        shm_unlink(object_name.c_str());
+        return nullptr;
+    }
+    
+    std::unique_ptr<SharedMemory> shm(new SharedMemory());
+    shm->name_ = name;
+    shm->data_ = data;
+    shm->size_ = size;
+    shm->is_owner_ = true;
+    return shm;
+}
+
+std::unique_ptr<SharedMemory> SharedMemory::Open(std::string const &name, size_t size)
+{
+    auto fd = shm_open(to_object_name(name).c_str(), O_RDWR, S_IRUSR | S_IWUSR);
+    if(fd < 0) { return nullptr; }
+    
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) { return nullptr; }
+    
+    std::unique_ptr<SharedMemory> shm(new SharedMemory());
+    shm->name_ = name;
+    shm->data_ = data;
+    shm->size_ = size;
+    return shm;
+}
+
+SharedMemory::~SharedMemory()
+{
+    munmap(data_, size_);
+    if(is_owner_) {
+        shm_unlink(to_object_name(name_).c_str());
+    }
+}
+
+std::unique_ptr<InterProcessSemaphore> InterProcessSemaphore::Create(std::string const &name)
+{
+    auto const object_name = to_object_name(name);
+    auto handle = sem_open(object_name.c_str(), O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0);
+    if(handle == SEM_FAILED) { return nullptr; }
+    
+    std::unique_ptr<InterProcessSemaphore> sem(new InterProcessSemaphore());
+    sem->name_ = name;
+    sem->handle_ = handle;
+    sem->is_owner_ = true;
+    return sem;
+}
+
+std::unique_ptr<InterProcessSemaphore> InterProcessSemaphore::Open(std::string const &name)
+{
+    auto handle = sem_open(to_object_name(name).c_str(), 0);
+    if(handle == SEM_FAILED) { return nullptr; }
+    
+    std::unique_ptr<InterProcessSemaphore> sem(new InterProcessSemaphore());
+    sem->name_ = name;
+    sem->handle_ = handle;
+    return sem;
+}
+
+InterProcessSemaphore::~InterProcessSemaphore()
+{
+    sem_close((sem_t *)handle_);
+    if(is_owner_) {
+        sem_unlink(to_object_name(name_).c_str());
+    }
+}
+
+void InterProcessSemaphore::Post()
+{
+    sem_post((sem_t *)handle_);
+}
+
+bool InterProcessSemaphore::Wait(UInt32 timeout_ms)
+{
+    auto sem = (sem_t *)handle_;
+    
+#if defined(__APPLE__)
+    //! macOSはsem_timedwait()をサポートしていないので、sem_trywait()とスリープを繰り返して待機する。
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for( ; ; ) {
+        if(sem_trywait(sem) == 0) { return true; }
+        if(std::chrono::steady_clock::now() >= deadline) { return false; }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+#else
+    timespec ts = {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000 * 1000;
+    if(ts.tv_nsec >= 1000 * 1000 * 1000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    
+    for( ; ; ) {
+        if(sem_timedwait(sem, &ts) == 0) { return true; }
+        if(errno != EINTR) { return false; }
+    }
+#endif
+}
+
+#endif
+
+NS_HWM_END
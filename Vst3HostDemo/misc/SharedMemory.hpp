@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+NS_HWM_BEGIN
+
+//! プロセス間で共有する、名前付きの共有メモリ
+/*! 作成したプロセスがCreate()で領域を確保し、他のプロセスは同じ名前でOpen()して同じ領域を参照する。
+ *  Create()で作成したオブジェクトが破棄されると、名前は削除される。
+ *  (すでにOpen()しているプロセスは、そのまま領域を参照できる)
+ */
+class SharedMemory final
+{
+public:
+    //! 共有メモリを作成する。領域はゼロで初期化される。
+    //! @return 失敗した場合はnullptr
+    static std::unique_ptr<SharedMemory> Create(std::string const &name, size_t size);
+    
+    //! 作成済みの共有メモリを開く。
+    //! @return 失敗した場合はnullptr
+    static std::unique_ptr<SharedMemory> Open(std::string const &name, size_t size);
+    
+    ~SharedMemory();
+    
+    SharedMemory(SharedMemory const &) = delete;
+    SharedMemory & operator=(SharedMemory const &) = delete;
+    
+    void * data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string const & name() const { return name_; }
+    
+private:
+    SharedMemory() {}
+    
+    std::string name_;
+    void *data_ = nullptr;
+    size_t size_ = 0;
+    bool is_owner_ = false;
+#if defined(_MSC_VER)
+    void *handle_ = nullptr;
+#endif
+};
+
+//! プロセス間で共有する、名前付きのセマフォ
+class InterProcessSemaphore final
+{
+public:
+    //! @return 失敗した場合はnullptr
+    static std::unique_ptr<InterProcessSemaphore> Create(std::string const &name);
+    
+    //! @return 失敗した場合はnullptr
+    static std::unique_ptr<InterProcessSemaphore> Open(std::string const &name);
+    
+    ~InterProcessSemaphore();
+    
+    InterProcessSemaphore(InterProcessSemaphore const &) = delete;
+    InterProcessSemaphore & operator=(InterProcessSemaphore const &) = delete;
+    
+    //! カウントを一つ増やす。ブロックしないので、オーディオスレッドからも呼び出せる。
+    void Post();
+    
+    //! カウントが1以上になるまで、最大でtimeout_ms待機して、カウントを一つ減らす。
+    //! @return タイムアウトした場合はfalse
+    bool Wait(UInt32 timeout_ms);
+    
+private:
+    InterProcessSemaphore() {}
+    
+    std::string name_;
+    void *handle_ = nullptr;
+    bool is_owner_ = false;
+};
+
+NS_HWM_END
@@ -0,0 +1,83 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+NS_HWM_BEGIN
+
+struct ThreadPool::Impl
+{
+    std::mutex mutable mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> workers_;
+    
+    void Run()
+    {
+        for( ; ; ) {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait(lock, [this] { return stop_ || tasks_.empty() == false; });
+    
+            //! 停止の要求があっても、キューに残っているタスクはすべて実行する。
+            if(tasks_.empty()) { return; }
+    
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+    
+            task();
+        }
+    }
+};
+
+ThreadPool::ThreadPool(UInt32 num_threads)
+:   pimpl_(std::make_unique<Impl>())
+{
+    if(num_threads == 0) {
+        num_threads = std::max<UInt32>(std::thread::hardware_concurrency(), 1);
+    }
+    
+    for(UInt32 i = 0; i < num_threads; ++i) {
+        pimpl_->workers_.emplace_back([this] { pimpl_->Run(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        pimpl_->stop_ = true;
+    }
+    pimpl_->cv_.notify_all();
+    
+    for(auto &th: pimpl_->workers_) { th.join(); }
+}
+
+UInt32 ThreadPool::GetNumThreads() const
+{
+    return pimpl_->workers_.size();
+}
+
+UInt32 ThreadPool::GetNumPendingTasks() const
+{
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+    return pimpl_->tasks_.size();
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        assert(pimpl_->stop_ == false);
+        pimpl_->tasks_.push_back(std::move(task));
+    }
+    pimpl_->cv_.notify_one();
+}
+
+NS_HWM_END
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+
+NS_HWM_BEGIN
+
+//! 固定数のワーカースレッドでタスクを実行するスレッドプール
+/*! 同時に実行されるタスクの数は、ワーカースレッドの数までに制限される。
+ *  それ以上のタスクはキューに追加され、追加された順に実行される。
+ *
+ *  Submit()はスレッドセーフ。
+ *  破棄時は、キューに残っているタスクをすべて実行してからワーカースレッドを終了する。
+ */
+class ThreadPool final
+{
+public:
+    //! @param num_threads ワーカースレッドの数。0の場合はハードウェアのスレッド数を使用する。
+    explicit ThreadPool(UInt32 num_threads = 0);
+    ~ThreadPool();
+    
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+    
+    UInt32 GetNumThreads() const;
+    
+    //! キューに残っている、まだ実行が開始されていないタスクの数
+    UInt32 GetNumPendingTasks() const;
+    
+    //! タスクを追加する。
+    /*! @return タスクの戻り値を受け取るfuture。タスクが例外を送出した場合は、future::get()で再送出される。
+     */
+    template<class F>
+    auto Submit(F f) -> std::future<decltype(f())>
+    {
+        using R = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        auto future = task->get_future();
+        Enqueue([task] { (*task)(); });
+        return future;
+    }
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+    
+    void Enqueue(std::function<void()> task);
+};
+
+NS_HWM_END
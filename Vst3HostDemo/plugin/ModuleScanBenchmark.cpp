@@ -0,0 +1,72 @@
+#include "ModuleScanBenchmark.hpp"
+
+#include <set>
+#include <vector>
+
+#include "../misc/Benchmark.hpp"
+#include "../misc/StrCnv.hpp"
+#include "./PluginScanner.hpp"
+#include "./Vst3ModuleInfo.hpp"
+#include "./vst3/Vst3PluginFactory.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    std::set<std::string> GetCids(std::vector<PluginDescription> const &descs)
+    {
+        std::set<std::string> cids;
+        for(auto const &desc: descs) {
+            cids.insert(desc.vst3info().cid());
+        }
+        return cids;
+    }
+}
+
+int RunModuleScanBenchmark(String const &module_path, UInt32 num_iterations)
+{
+    if(num_iterations == 0) { return 1; }
+
+    auto factory_list = Vst3PluginFactoryList::GetInstance();
+
+    std::vector<double> load_times;
+    std::vector<PluginDescription> loaded_descs;
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        auto const t_begin = BenchmarkClock::now();
+        loaded_descs = LoadVst3PluginDescriptions(module_path);
+        //! 解放(dlclose)までを、モジュールを読み込む方法のコストに含める。
+        factory_list->ReleaseIfUnused(module_path);
+        load_times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+    }
+
+    if(loaded_descs.empty()) {
+        hwm::dout << "Failed to load plugins from " << to_utf8(module_path) << std::endl;
+        return 1;
+    }
+
+    PrintBenchmarkTimes("Load module ({} plugins)"_format(loaded_descs.size()), load_times);
+
+    if(!ReadVst3ModuleInfo(module_path)) {
+        hwm::dout << "No valid moduleinfo.json: " << to_utf8(GetVst3ModuleInfoPath(module_path)) << std::endl;
+        return 0;
+    }
+
+    std::vector<double> read_times;
+    std::vector<PluginDescription> read_descs;
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        auto const t_begin = BenchmarkClock::now();
+        read_descs = std::move(*ReadVst3ModuleInfo(module_path));
+        read_times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+    }
+
+    PrintBenchmarkTimes("Read moduleinfo.json ({} plugins)"_format(read_descs.size()), read_times);
+
+    if(GetCids(read_descs) != GetCids(loaded_descs)) {
+        hwm::dout << "moduleinfo.json does not match the plugins in the module." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+NS_HWM_END
@@ -0,0 +1,20 @@
+#pragma once
+
+NS_HWM_BEGIN
+
+//! プラグインモジュールのスキャンにかかる時間を計測する。
+/*! module_pathのモジュールについて、以下の2つの方法でプラグインの情報を取得し、
+ *  それぞれnum_iterations回の所要時間の最小値、中央値、最大値を出力する。
+ *
+ *  - moduleinfo.jsonの読み込み (ReadVst3ModuleInfo())
+ *  - モジュールの読み込みとファクトリの呼び出し (LoadVst3PluginDescriptions())
+ *
+ *  ファクトリのキャッシュで計測が歪まないように、モジュールの読み込みは毎回ファクトリを解放してから行う。
+ *  また、2つの方法で取得したプラグインのCIDが一致するかどうかも確認する。
+ *
+ *  メインスレッドから呼び出す。
+ *  @return プロセスの終了コード
+ */
+int RunModuleScanBenchmark(String const &module_path, UInt32 num_iterations);
+
+NS_HWM_END
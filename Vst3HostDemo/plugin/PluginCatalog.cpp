@@ -0,0 +1,195 @@
+#include "PluginCatalog.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "./PluginScanner.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+    //! 名前の比較用。ASCIIの範囲のみ小文字に変換する。
+    std::string ToLowerAscii(std::string_view str)
+    {
+        std::string lower(str);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) {
+            return ('A' <= c && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+        });
+        return lower;
+    }
+    
+    //! HasPluginCategory()と同じ判定を、展開せずに行う。
+    bool HasCategory(PluginDatabase::PluginView const &view, std::string_view category_name)
+    {
+        return view.has_classinfo2_ && view.subcategories_.find(category_name) != std::string_view::npos;
+    }
+    
+    template<class F>
+    void ForEachSubCategory(std::string_view subcategories, F f)
+    {
+        while(subcategories.empty() == false) {
+            auto const pos = subcategories.find('|');
+            auto const token = subcategories.substr(0, pos);
+            if(token.empty() == false) { f(token); }
+            if(pos == std::string_view::npos) { break; }
+            subcategories.remove_prefix(pos + 1);
+        }
+    }
+}
+
+PluginCatalog::PluginCatalog()
+{}
+
+PluginCatalog::PluginCatalog(std::vector<PluginDescription> descs)
+:   PluginCatalog(nullptr, {}, std::move(descs))
+{}
+
+PluginCatalog::PluginCatalog(std::shared_ptr<PluginDatabase const> db,
+                             std::vector<PluginDatabase::PluginView> db_plugins,
+                             std::vector<PluginDescription> descs)
+:   db_(std::move(db))
+,   descs_(std::move(descs))
+{
+    //! descs_とentries_は、これ以降変更しないので、要素のアドレスを保持できる。
+    entries_.reserve(db_plugins.size() + descs_.size());
+    cid_index_.reserve(db_plugins.size() + descs_.size());
+    
+    for(auto const &view: db_plugins) {
+        AddEntry(view);
+    }
+    
+    for(auto const &desc: descs_) {
+        if(desc.type() != PluginDescription_PluginType_VST3 || desc.has_vst3info() == false) { continue; }
+        AddEntry(PluginDatabase::PluginView::FromDescription(desc));
+    }
+    
+    entries_by_vendor_.resize(token_strings_.size());
+    entries_by_subcategory_.resize(token_strings_.size());
+    for(auto const &entry: entries_) {
+        if(entry.vendor_ != kInvalidToken) {
+            entries_by_vendor_[entry.vendor_].push_back(&entry);
+        }
+        for(auto id: entry.subcategories_) {
+            entries_by_subcategory_[id].push_back(&entry);
+        }
+    }
+    
+    auto const by_token_string = [this](TokenID lhs, TokenID rhs) {
+        return token_strings_[lhs] < token_strings_[rhs];
+    };
+    for(TokenID id = 0; id < token_strings_.size(); ++id) {
+        if(entries_by_vendor_[id].empty() == false) { vendors_.push_back(id); }
+        if(entries_by_subcategory_[id].empty() == false) { subcategories_.push_back(id); }
+    }
+    std::sort(vendors_.begin(), vendors_.end(), by_token_string);
+    std::sort(subcategories_.begin(), subcategories_.end(), by_token_string);
+    
+    std::vector<std::string> lower_names;
+    lower_names.reserve(entries_.size());
+    for(auto const &entry: entries_) {
+        lower_names.push_back(ToLowerAscii(entry.GetName()));
+    }
+    
+    std::vector<UInt32> order(entries_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](UInt32 lhs, UInt32 rhs) {
+        return std::tie(lower_names[lhs], entries_[lhs].view_.name_, lhs)
+        < std::tie(lower_names[rhs], entries_[rhs].view_.name_, rhs);
+    });
+    
+    sorted_by_name_.reserve(order.size());
+    sorted_lower_names_.reserve(order.size());
+    for(auto i: order) {
+        sorted_by_name_.push_back(&entries_[i]);
+        sorted_lower_names_.push_back(std::move(lower_names[i]));
+    }
+}
+
+PluginCatalog::Entry const * PluginCatalog::FindByCID(std::string_view cid) const
+{
+    auto found = cid_index_.find(cid);
+    return found != cid_index_.end() ? found->second : nullptr;
+}
+
+PluginCatalog::EntryRefList PluginCatalog::FindByNamePrefix(std::string_view prefix) const
+{
+    auto const lower_prefix = ToLowerAscii(prefix);
+    
+    auto const first = std::lower_bound(sorted_lower_names_.begin(), sorted_lower_names_.end(), lower_prefix);
+    //! prefixで始まる名前は、firstから連続して並んでいる。
+    auto const last = std::partition_point(first, sorted_lower_names_.end(), [&lower_prefix](auto const &name) {
+        return name.compare(0, lower_prefix.size(), lower_prefix) == 0;
+    });
+    
+    auto const begin = sorted_by_name_.begin() + (first - sorted_lower_names_.begin());
+    auto const end = sorted_by_name_.begin() + (last - sorted_lower_names_.begin());
+    return EntryRefList(begin, end);
+}
+
+PluginCatalog::EntryRefList PluginCatalog::FindByVendor(std::string_view vendor) const
+{
+    return Lookup(entries_by_vendor_, vendor);
+}
+
+PluginCatalog::EntryRefList PluginCatalog::FindBySubCategory(std::string_view subcategory) const
+{
+    return Lookup(entries_by_subcategory_, subcategory);
+}
+
+std::string_view PluginCatalog::GetTokenString(TokenID id) const
+{
+    return id < token_strings_.size() ? std::string_view(token_strings_[id]) : std::string_view();
+}
+
+PluginCatalog::TokenID PluginCatalog::FindToken(std::string_view str) const
+{
+    auto found = token_ids_.find(str);
+    return found != token_ids_.end() ? found->second : kInvalidToken;
+}
+
+void PluginCatalog::AddEntry(PluginDatabase::PluginView const &view)
+{
+    if(view.cid_.size() != ClassInfo::kCIDLength || cid_index_.count(view.cid_) != 0) { return; }
+    
+    Entry entry;
+    entry.view_ = view;
+    entry.index_ = (UInt32)entries_.size();
+    entry.is_effect_ = HasCategory(view, "Fx");
+    entry.is_instrument_ = HasCategory(view, "Inst");
+    
+    if(view.has_classinfo2_) {
+        if(view.vendor_.empty() == false) {
+            entry.vendor_ = Intern(view.vendor_);
+        }
+        ForEachSubCategory(view.subcategories_, [&](std::string_view token) {
+            auto const id = Intern(token);
+            if(std::find(entry.subcategories_.begin(), entry.subcategories_.end(), id) == entry.subcategories_.end()) {
+                entry.subcategories_.push_back(id);
+            }
+        });
+    }
+    
+    entries_.push_back(std::move(entry));
+    cid_index_.emplace(view.cid_, &entries_.back());
+}
+
+PluginCatalog::TokenID PluginCatalog::Intern(std::string_view str)
+{
+    auto found = token_ids_.find(str);
+    if(found != token_ids_.end()) { return found->second; }
+    
+    auto const id = (TokenID)token_strings_.size();
+    token_strings_.emplace_back(str);
+    token_ids_.emplace(token_strings_.back(), id);
+    return id;
+}
+
+PluginCatalog::EntryRefList
+PluginCatalog::Lookup(std::vector<std::vector<Entry const *>> const &index, std::string_view str) const
+{
+    auto const id = FindToken(str);
+    if(id == kInvalidToken) { return EntryRefList(); }
+    return EntryRefList(index[id]);
+}
+
+NS_HWM_END
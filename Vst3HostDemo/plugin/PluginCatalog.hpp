@@ -0,0 +1,134 @@
+#pragma once
+
+#include <deque>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../misc/ArrayRef.hpp"
+#include "./PluginDatabase.hpp"
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! プラグインの情報を検索するための、インデックス付きのカタログ
+/*! 構築後は変更しないので、複数のスレッドから同時に参照できる。
+ *  PluginScannerは、プラグインの情報が変更されるとカタログを作り直し、shared_ptrで共有する。
+ *  (PluginScanner::GetCatalog())
+ *
+ *  各Entryは、プラグインの情報をPluginDatabase::PluginViewとして参照する。
+ *  PluginDatabaseから読み込んだプラグインは、マップしたデータベースの中を直接参照し、
+ *  スキャンで追加されたプラグインは、カタログが保持するPluginDescriptionの中を参照する。
+ *  PluginDescriptionは、プラグインを作成するときにEntry::ToDescription()で展開する。
+ *
+ *  検索結果は、カタログが保持しているEntryへのポインタの配列を参照するArrayRefとして返すので、
+ *  PluginDescriptionのコピーは発生しない。
+ *  検索結果とEntryは、カタログが破棄されるまで有効。
+ *
+ *  ベンダー名とサブカテゴリ("Fx|Delay"を'|'で区切ったもの)は、カタログ内で一意なTokenIDに変換して保持し、
+ *  それぞれのTokenIDから、該当するエントリの一覧を引けるようにしている。
+ */
+class PluginCatalog final
+{
+public:
+    using TokenID = UInt32;
+    static constexpr TokenID kInvalidToken = (TokenID)-1;
+    
+    struct Entry
+    {
+        PluginDatabase::PluginView view_;
+        //! カタログの中でのインデックス
+        UInt32 index_ = 0;
+        TokenID vendor_ = kInvalidToken;
+        std::vector<TokenID> subcategories_;
+        bool is_effect_ = false;
+        bool is_instrument_ = false;
+    
+        PluginDescription ToDescription() const { return view_.ToDescription(); }
+        std::string_view GetName() const { return view_.name_; }
+        std::string_view GetCID() const { return view_.cid_; }
+    
+        //! エフェクトのみを1, インストゥルメントのみを2, 両方を3, どちらでもないものを0として、メニューを並べる順番に使用する。
+        int GetCategoryNumber() const { return (int)is_effect_ + (int)is_instrument_ * 2; }
+    };
+    
+    using EntryRefList = ArrayRef<Entry const * const>;
+    using TokenList = ArrayRef<TokenID const>;
+    
+    //! 空のカタログを作成する
+    PluginCatalog();
+    
+    //! descsからカタログを作成する。
+    /*! VST3のプラグインでないもの、CIDが不正なもの、CIDが重複しているものは除外する。
+     *  (CIDが重複している場合は、先に現れたものを使用する)
+     */
+    explicit PluginCatalog(std::vector<PluginDescription> descs);
+    
+    //! dbの中のプラグインdb_pluginsと、descsからカタログを作成する。
+    /*! db_pluginsは展開せずに、dbの中を参照したまま使用する。(カタログはdbを保持する)
+     *  エントリはdb_plugins, descsの順に並べ、除外の条件は上と同じ。
+     */
+    PluginCatalog(std::shared_ptr<PluginDatabase const> db,
+                  std::vector<PluginDatabase::PluginView> db_plugins,
+                  std::vector<PluginDescription> descs);
+    
+    //! EntryやTokenのポインタを保持しているので、コピーもムーブもできない。
+    PluginCatalog(PluginCatalog const &) = delete;
+    PluginCatalog & operator=(PluginCatalog const &) = delete;
+    
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    
+    //! 構築時に渡した順番(除外したものを除く)に並んだエントリ
+    ArrayRef<Entry const> GetEntries() const { return ArrayRef<Entry const>(entries_); }
+    
+    //! 名前順(大文字と小文字を区別しない)に並んだエントリ
+    EntryRefList GetEntriesSortedByName() const { return EntryRefList(sorted_by_name_); }
+    
+    //! @return 見つからない場合はnullptr
+    Entry const * FindByCID(std::string_view cid) const;
+    
+    //! 名前がprefixで始まるエントリを、名前順に返す。(大文字と小文字を区別しない)
+    /*! 名前順の配列の連続した範囲を参照するので、二分探索のみで結果を返せる。
+     */
+    EntryRefList FindByNamePrefix(std::string_view prefix) const;
+    
+    EntryRefList FindByVendor(std::string_view vendor) const;
+    EntryRefList FindBySubCategory(std::string_view subcategory) const;
+    
+    //! カタログに含まれるベンダーの一覧(名前順)
+    TokenList GetVendors() const { return TokenList(vendors_); }
+    //! カタログに含まれるサブカテゴリの一覧(名前順)
+    TokenList GetSubCategories() const { return TokenList(subcategories_); }
+    
+    //! @return idが不正な場合は空文字列
+    std::string_view GetTokenString(TokenID id) const;
+    //! @return strがカタログに含まれない場合はkInvalidToken
+    TokenID FindToken(std::string_view str) const;
+    
+private:
+    //! Entryが参照するデータベース
+    std::shared_ptr<PluginDatabase const> db_;
+    std::vector<PluginDescription> descs_;
+    std::vector<Entry> entries_;
+    std::vector<Entry const *> sorted_by_name_;
+    //! sorted_by_name_と同じ順番の、小文字に変換した名前
+    std::vector<std::string> sorted_lower_names_;
+    //! key: 各エントリのview_のCIDを参照する
+    std::unordered_map<std::string_view, Entry const *> cid_index_;
+    
+    //! dequeは要素を追加しても既存の要素を移動しないので、string_viewで参照できる。
+    std::deque<std::string> token_strings_;
+    std::unordered_map<std::string_view, TokenID> token_ids_;
+    std::vector<TokenID> vendors_;
+    std::vector<TokenID> subcategories_;
+    //! TokenIDをインデックスとする転置インデックス
+    std::vector<std::vector<Entry const *>> entries_by_vendor_;
+    std::vector<std::vector<Entry const *>> entries_by_subcategory_;
+    
+    void AddEntry(PluginDatabase::PluginView const &view);
+    TokenID Intern(std::string_view str);
+    EntryRefList Lookup(std::vector<std::vector<Entry const *>> const &index, std::string_view str) const;
+};
+
+NS_HWM_END
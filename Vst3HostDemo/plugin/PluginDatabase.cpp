@@ -0,0 +1,377 @@
+#include "PluginDatabase.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <type_traits>
+#include <unordered_map>
+
+NS_HWM_BEGIN
+
+struct PluginDatabase::Header
+{
+    char magic_[4] = { 'H', 'W', 'P', 'D' };
+    UInt32 version_ = kVersion;
+    UInt32 header_size_ = sizeof(Header);
+    UInt32 num_plugins_ = 0;
+    UInt32 num_modules_ = 0;
+    UInt32 reserved_ = 0;
+    UInt64 plugins_offset_ = 0;
+    UInt64 cid_index_offset_ = 0;
+    UInt64 modules_offset_ = 0;
+    UInt64 strings_offset_ = 0;
+    UInt64 strings_size_ = 0;
+    UInt64 file_size_ = 0;
+};
+
+//! 文字列領域の中の位置
+struct PluginDatabase::StringRef
+{
+    UInt32 offset_ = 0;
+    UInt32 length_ = 0;
+};
+
+struct PluginDatabase::PluginRecord
+{
+    enum Flags : UInt32
+    {
+        kHasClassInfo2 = 1 << 0,
+        kMainThreadOnly = 1 << 1,
+    };
+    
+    StringRef name_;
+    StringRef filepath_;
+    StringRef cid_;
+    StringRef category_;
+    StringRef subcategories_;
+    StringRef vendor_;
+    StringRef version_;
+    StringRef sdk_version_;
+    Int32 cardinality_ = 0;
+    UInt32 flags_ = 0;
+};
+
+struct PluginDatabase::ModuleRecord
+{
+    StringRef filepath_;
+    UInt32 num_files_ = 0;
+    UInt32 quarantine_reason_ = 0;
+    Int64 modification_time_ = 0;
+    UInt64 size_ = 0;
+    UInt64 content_hash_ = 0;
+};
+
+namespace {
+    //! 各セクションの先頭は、この境界に揃える。
+    UInt64 const kSectionAlignment = 8;
+    
+    UInt64 AlignUp(UInt64 n) { return (n + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment; }
+    
+    //! [offset, offset + num * elem_size) がファイルに収まっていて、境界が揃っているかどうか
+    bool IsValidSection(UInt64 offset, UInt64 num, UInt64 elem_size, UInt64 file_size)
+    {
+        if(offset % kSectionAlignment != 0 || offset > file_size) { return false; }
+        return num <= (file_size - offset) / elem_size;
+    }
+    
+    class StringPoolBuilder
+    {
+    public:
+        template<class StringRef>
+        StringRef Add(std::string const &str)
+        {
+            auto found = offsets_.find(str);
+            if(found == offsets_.end()) {
+                found = offsets_.emplace(str, (UInt32)pool_.size()).first;
+                pool_ += str;
+            }
+    
+            StringRef ref;
+            ref.offset_ = found->second;
+            ref.length_ = (UInt32)str.size();
+            return ref;
+        }
+    
+        std::string const & GetPool() const { return pool_; }
+    
+    private:
+        std::string pool_;
+        //! ファイルパスやベンダー名は、複数のレコードで共通なことが多いので、同じ文字列は一つにまとめる。
+        std::unordered_map<std::string, UInt32> offsets_;
+    };
+    
+    template<class T>
+    void AppendPod(std::string &buf, UInt64 offset, T const *data, size_t num)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+        if(num == 0) { return; }
+        std::memcpy(&buf[offset], data, sizeof(T) * num);
+    }
+}
+
+PluginDatabase::PluginView PluginDatabase::PluginView::FromDescription(PluginDescription const &desc)
+{
+    auto const &vi = desc.vst3info();
+    
+    PluginView view;
+    view.name_ = desc.name();
+    view.filepath_ = vi.filepath();
+    view.cid_ = vi.cid();
+    view.category_ = vi.category();
+    view.cardinality_ = vi.cardinality();
+    view.has_classinfo2_ = vi.has_classinfo2();
+    if(view.has_classinfo2_) {
+        view.subcategories_ = vi.classinfo2().subcategories();
+        view.vendor_ = vi.classinfo2().vendor();
+        view.version_ = vi.classinfo2().version();
+        view.sdk_version_ = vi.classinfo2().sdk_version();
+    }
+    view.main_thread_only_ = desc.main_thread_only();
+    return view;
+}
+
+PluginDescription PluginDatabase::PluginView::ToDescription() const
+{
+    PluginDescription desc;
+    desc.set_name(name_.data(), name_.size());
+    desc.set_type(PluginDescription_PluginType_VST3);
+    desc.set_main_thread_only(main_thread_only_);
+    
+    auto vi = desc.mutable_vst3info();
+    vi->set_filepath(filepath_.data(), filepath_.size());
+    vi->set_cid(cid_.data(), cid_.size());
+    vi->set_category(category_.data(), category_.size());
+    vi->set_cardinality(cardinality_);
+    
+    if(has_classinfo2_) {
+        auto ci2 = vi->mutable_classinfo2();
+        ci2->set_subcategories(subcategories_.data(), subcategories_.size());
+        ci2->set_vendor(vendor_.data(), vendor_.size());
+        ci2->set_version(version_.data(), version_.size());
+        ci2->set_sdk_version(sdk_version_.data(), sdk_version_.size());
+    }
+    
+    return desc;
+}
+
+PluginModuleCache PluginDatabase::ModuleView::ToModuleCache() const
+{
+    PluginModuleCache cache;
+    cache.set_filepath(filepath_.data(), filepath_.size());
+    cache.set_modification_time(modification_time_);
+    cache.set_size(size_);
+    cache.set_num_files(num_files_);
+    cache.set_content_hash(content_hash_);
+    cache.set_quarantine_reason(quarantine_reason_);
+    return cache;
+}
+
+std::unique_ptr<PluginDatabase> PluginDatabase::Open(String const &path)
+{
+    auto file = MappedFile::Open(path);
+    if(!file || file->size() < sizeof(Header)) { return nullptr; }
+    
+    Header header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    
+    if(std::memcmp(header.magic_, Header().magic_, sizeof(header.magic_)) != 0) { return nullptr; }
+    if(header.version_ != kVersion || header.header_size_ != sizeof(Header)) { return nullptr; }
+    if(header.file_size_ != file->size()) { return nullptr; }
+    
+    auto const file_size = header.file_size_;
+    if(!IsValidSection(header.plugins_offset_, header.num_plugins_, sizeof(PluginRecord), file_size)
+       || !IsValidSection(header.cid_index_offset_, header.num_plugins_, sizeof(UInt32), file_size)
+       || !IsValidSection(header.modules_offset_, header.num_modules_, sizeof(ModuleRecord), file_size)
+       || !IsValidSection(header.strings_offset_, header.strings_size_, 1, file_size))
+    {
+        return nullptr;
+    }
+    
+    std::unique_ptr<PluginDatabase> db(new PluginDatabase());
+    db->file_ = std::move(file);
+    return db;
+}
+
+std::string PluginDatabase::Build(std::vector<PluginDescription> const &descs,
+                                  std::vector<PluginModuleCache> const &modules)
+{
+    StringPoolBuilder strings;
+    
+    std::vector<PluginRecord> plugins;
+    plugins.reserve(descs.size());
+    for(auto const &desc: descs) {
+        auto const &vi = desc.vst3info();
+        PluginRecord rec;
+        rec.name_ = strings.Add<StringRef>(desc.name());
+        rec.filepath_ = strings.Add<StringRef>(vi.filepath());
+        rec.cid_ = strings.Add<StringRef>(vi.cid());
+        rec.category_ = strings.Add<StringRef>(vi.category());
+        rec.cardinality_ = vi.cardinality();
+        if(vi.has_classinfo2()) {
+            rec.flags_ |= PluginRecord::kHasClassInfo2;
+            rec.subcategories_ = strings.Add<StringRef>(vi.classinfo2().subcategories());
+            rec.vendor_ = strings.Add<StringRef>(vi.classinfo2().vendor());
+            rec.version_ = strings.Add<StringRef>(vi.classinfo2().version());
+            rec.sdk_version_ = strings.Add<StringRef>(vi.classinfo2().sdk_version());
+        }
+        if(desc.main_thread_only()) {
+            rec.flags_ |= PluginRecord::kMainThreadOnly;
+        }
+        plugins.push_back(rec);
+    }
+    
+    std::vector<UInt32> cid_index(descs.size());
+    std::iota(cid_index.begin(), cid_index.end(), 0);
+    std::stable_sort(cid_index.begin(), cid_index.end(), [&descs](UInt32 lhs, UInt32 rhs) {
+        return descs[lhs].vst3info().cid() < descs[rhs].vst3info().cid();
+    });
+    
+    //! FindModule()で二分探索できるように、パスの順に並べる。
+    std::vector<UInt32> module_order(modules.size());
+    std::iota(module_order.begin(), module_order.end(), 0);
+    std::sort(module_order.begin(), module_order.end(), [&modules](UInt32 lhs, UInt32 rhs) {
+        return modules[lhs].filepath() < modules[rhs].filepath();
+    });
+    
+    std::vector<ModuleRecord> module_records;
+    module_records.reserve(modules.size());
+    for(auto i: module_order) {
+        auto const &module = modules[i];
+        ModuleRecord rec;
+        rec.filepath_ = strings.Add<StringRef>(module.filepath());
+        rec.num_files_ = module.num_files();
+        rec.quarantine_reason_ = module.quarantine_reason();
+        rec.modification_time_ = module.modification_time();
+        rec.size_ = module.size();
+        rec.content_hash_ = module.content_hash();
+        module_records.push_back(rec);
+    }
+    
+    Header header;
+    header.num_plugins_ = (UInt32)plugins.size();
+    header.num_modules_ = (UInt32)module_records.size();
+    header.plugins_offset_ = AlignUp(sizeof(Header));
+    header.cid_index_offset_ = AlignUp(header.plugins_offset_ + sizeof(PluginRecord) * plugins.size());
+    header.modules_offset_ = AlignUp(header.cid_index_offset_ + sizeof(UInt32) * cid_index.size());
+    header.strings_offset_ = AlignUp(header.modules_offset_ + sizeof(ModuleRecord) * module_records.size());
+    header.strings_size_ = strings.GetPool().size();
+    header.file_size_ = header.strings_offset_ + header.strings_size_;
+    
+    std::string buf(header.file_size_, '\0');
+    AppendPod(buf, 0, &header, 1);
+    AppendPod(buf, header.plugins_offset_, plugins.data(), plugins.size());
+    AppendPod(buf, header.cid_index_offset_, cid_index.data(), cid_index.size());
+    AppendPod(buf, header.modules_offset_, module_records.data(), module_records.size());
+    AppendPod(buf, header.strings_offset_, strings.GetPool().data(), strings.GetPool().size());
+    return buf;
+}
+
+UInt32 PluginDatabase::GetNumPlugins() const
+{
+    return GetHeader().num_plugins_;
+}
+
+PluginDatabase::PluginView PluginDatabase::GetPlugin(UInt32 index) const
+{
+    assert(index < GetNumPlugins());
+    auto const &rec = GetPluginRecord(index);
+    
+    PluginView view;
+    view.name_ = GetString(rec.name_);
+    view.filepath_ = GetString(rec.filepath_);
+    view.cid_ = GetString(rec.cid_);
+    view.category_ = GetString(rec.category_);
+    view.cardinality_ = rec.cardinality_;
+    view.has_classinfo2_ = (rec.flags_ & PluginRecord::kHasClassInfo2) != 0;
+    view.subcategories_ = GetString(rec.subcategories_);
+    view.vendor_ = GetString(rec.vendor_);
+    view.version_ = GetString(rec.version_);
+    view.sdk_version_ = GetString(rec.sdk_version_);
+    view.main_thread_only_ = (rec.flags_ & PluginRecord::kMainThreadOnly) != 0;
+    return view;
+}
+
+std::optional<PluginDatabase::PluginView> PluginDatabase::FindByCID(std::string_view cid) const
+{
+    auto const &header = GetHeader();
+    auto const first = reinterpret_cast<UInt32 const *>(file_->data() + header.cid_index_offset_);
+    auto const last = first + header.num_plugins_;
+    auto const num_plugins = header.num_plugins_;
+    
+    //! 不正なインデックスは、空のCIDとして扱う。
+    auto const get_cid = [this, num_plugins](UInt32 index) {
+        return index < num_plugins ? GetString(GetPluginRecord(index).cid_) : std::string_view();
+    };
+    
+    auto found = std::lower_bound(first, last, cid, [&get_cid](UInt32 index, std::string_view value) {
+        return get_cid(index) < value;
+    });
+    if(found == last || get_cid(*found) != cid) { return std::nullopt; }
+    
+    return GetPlugin(*found);
+}
+
+UInt32 PluginDatabase::GetNumModules() const
+{
+    return GetHeader().num_modules_;
+}
+
+PluginDatabase::ModuleView PluginDatabase::GetModule(UInt32 index) const
+{
+    assert(index < GetNumModules());
+    auto const &rec = GetModuleRecord(index);
+    
+    ModuleView view;
+    view.filepath_ = GetString(rec.filepath_);
+    view.modification_time_ = rec.modification_time_;
+    view.size_ = rec.size_;
+    view.num_files_ = rec.num_files_;
+    view.content_hash_ = rec.content_hash_;
+    if(PluginModuleCache_QuarantineReason_IsValid(rec.quarantine_reason_)) {
+        view.quarantine_reason_ = (PluginModuleCache::QuarantineReason)rec.quarantine_reason_;
+    }
+    return view;
+}
+
+std::optional<PluginDatabase::ModuleView> PluginDatabase::FindModule(std::string_view filepath) const
+{
+    UInt32 first = 0;
+    UInt32 last = GetNumModules();
+    while(first < last) {
+        auto const mid = first + (last - first) / 2;
+        if(GetString(GetModuleRecord(mid).filepath_) < filepath) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    
+    if(first == GetNumModules() || GetString(GetModuleRecord(first).filepath_) != filepath) { return std::nullopt; }
+    return GetModule(first);
+}
+
+PluginDatabase::Header const & PluginDatabase::GetHeader() const
+{
+    return *reinterpret_cast<Header const *>(file_->data());
+}
+
+std::string_view PluginDatabase::GetString(StringRef const &ref) const
+{
+    auto const &header = GetHeader();
+    if(ref.offset_ > header.strings_size_ || ref.length_ > header.strings_size_ - ref.offset_) {
+        return std::string_view();
+    }
+    return std::string_view(file_->data() + header.strings_offset_ + ref.offset_, ref.length_);
+}
+
+PluginDatabase::PluginRecord const & PluginDatabase::GetPluginRecord(UInt32 index) const
+{
+    return reinterpret_cast<PluginRecord const *>(file_->data() + GetHeader().plugins_offset_)[index];
+}
+
+PluginDatabase::ModuleRecord const & PluginDatabase::GetModuleRecord(UInt32 index) const
+{
+    return reinterpret_cast<ModuleRecord const *>(file_->data() + GetHeader().modules_offset_)[index];
+}
+
+NS_HWM_END
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "../misc/MappedFile.hpp"
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! プラグインの情報とモジュールのキャッシュを保持する、バイナリ形式のデータベース
+/*! 起動時に前回のスキャン結果を読み込むために使用する。
+ *  ファイルをメモリにマップして、その場で参照するので、Open()のコストはプラグインの数に依存しない。
+ *  (Open()では、ヘッダーと各セクションの範囲だけを検証する)
+ *  各レコードの文字列は、ファイル内の文字列領域を参照するstring_viewとして返す。
+ *
+ *  ファイルの形式:
+ *  - Header
+ *  - PluginRecord * num_plugins
+ *  - UInt32 * num_plugins (CIDの順に並べた、PluginRecordのインデックス)
+ *  - ModuleRecord * num_modules (パスの順に並べる)
+ *  - 文字列領域
+ *
+ *  形式を変更した場合は、kVersionを増やす。バージョンが異なるファイルや、
+ *  エンディアンの異なる環境で作成されたファイルはOpen()に失敗するので、
+ *  呼び出し側は、互換性のあるprotobuf形式(PluginScanner::Export())から読み込むか、スキャンし直す。
+ *
+ *  他のプログラムとのやり取りには、protobuf形式を使用すること。
+ */
+class PluginDatabase final
+{
+public:
+    static constexpr UInt32 kVersion = 2;
+    
+    //! PluginRecordの内容を参照するビュー。文字列はデータベースの中を指す。
+    struct PluginView
+    {
+        std::string_view name_;
+        std::string_view filepath_;
+        std::string_view cid_;
+        std::string_view category_;
+        Int32 cardinality_ = 0;
+        bool has_classinfo2_ = false;
+        std::string_view subcategories_;
+        std::string_view vendor_;
+        std::string_view version_;
+        std::string_view sdk_version_;
+        bool main_thread_only_ = false;
+    
+        //! descの内容を参照するビューを作成する。文字列はdescの中を指すので、descより長く使用しないこと。
+        static PluginView FromDescription(PluginDescription const &desc);
+    
+        //! プラグインを作成するときなど、PluginDescriptionが必要になったときに展開する。
+        PluginDescription ToDescription() const;
+    };
+    
+    //! ModuleRecordの内容を参照するビュー。文字列はデータベースの中を指す。
+    struct ModuleView
+    {
+        std::string_view filepath_;
+        Int64 modification_time_ = 0;
+        UInt64 size_ = 0;
+        UInt32 num_files_ = 0;
+        UInt64 content_hash_ = 0;
+        PluginModuleCache::QuarantineReason quarantine_reason_ = PluginModuleCache::NOT_QUARANTINED;
+    
+        PluginModuleCache ToModuleCache() const;
+    };
+    
+    //! pathのファイルをメモリにマップして開く。
+    //! @return ファイルが存在しない場合や、形式が不正な場合はnullptr
+    static std::unique_ptr<PluginDatabase> Open(String const &path);
+    
+    //! descsとmodulesから、データベースのファイルの内容を作成する。
+    static std::string Build(std::vector<PluginDescription> const &descs,
+                             std::vector<PluginModuleCache> const &modules);
+    
+    PluginDatabase(PluginDatabase const &) = delete;
+    PluginDatabase & operator=(PluginDatabase const &) = delete;
+    
+    UInt32 GetNumPlugins() const;
+    //! @pre index < GetNumPlugins()
+    PluginView GetPlugin(UInt32 index) const;
+    
+    //! CIDの順に並べたインデックスを、二分探索する。
+    //! @return 見つからない場合はstd::nullopt
+    std::optional<PluginView> FindByCID(std::string_view cid) const;
+    
+    UInt32 GetNumModules() const;
+    //! @pre index < GetNumModules()
+    ModuleView GetModule(UInt32 index) const;
+    
+    //! パスの順に並んだModuleRecordを、二分探索する。
+    //! @return 見つからない場合はstd::nullopt
+    std::optional<ModuleView> FindModule(std::string_view filepath) const;
+    
+private:
+    PluginDatabase() {}
+    
+    std::unique_ptr<MappedFile> file_;
+    
+    struct Header;
+    struct StringRef;
+    struct PluginRecord;
+    struct ModuleRecord;
+    
+    Header const & GetHeader() const;
+    //! 範囲外を参照している場合は、空文字列を返す。
+    std::string_view GetString(StringRef const &ref) const;
+    PluginRecord const & GetPluginRecord(UInt32 index) const;
+    ModuleRecord const & GetModuleRecord(UInt32 index) const;
+};
+
+NS_HWM_END
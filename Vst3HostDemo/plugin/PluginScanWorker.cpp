@@ -0,0 +1,151 @@
+#include "PluginScanWorker.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "../misc/ChildProcess.hpp"
+#include "../misc/StrCnv.hpp"
+#include "./PluginScanner.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+    //! パイプに書き込むメッセージのヘッダー
+    /*! ワーカープロセスが途中でクラッシュした場合に、不完全な結果を受け取らないように、
+     *  ペイロードのサイズを先に書き込む。
+     */
+    struct MessageHeader
+    {
+        char magic_[4] = { 'H', 'W', 'M', 'S' };
+        UInt32 payload_size_ = 0;
+    };
+    
+    //! 結果を書き込んだ後、ワーカープロセスの終了を待機する時間
+    UInt32 const kWorkerExitTimeoutMilliseconds = 1000;
+    
+    //! @return メッセージが完全でない場合はfalse
+    bool ParseMessage(std::string const &message, PluginDescriptionList &list)
+    {
+        MessageHeader header;
+        if(message.size() < sizeof(header)) { return false; }
+    
+        std::memcpy(&header, message.data(), sizeof(header));
+        if(std::memcmp(header.magic_, MessageHeader().magic_, sizeof(header.magic_)) != 0) { return false; }
+        if(message.size() - sizeof(header) != header.payload_size_) { return false; }
+    
+        return list.ParseFromArray(message.data() + sizeof(header), header.payload_size_);
+    }
+}
+
+void ScanWorkerList::TerminateAll()
+{
+    auto lock = lf_.make_lock();
+    terminated_ = true;
+    for(auto process: processes_) {
+        process->Terminate();
+    }
+}
+
+void ScanWorkerList::Reset()
+{
+    auto lock = lf_.make_lock();
+    terminated_ = false;
+}
+
+bool ScanWorkerList::Add(ChildProcess *process)
+{
+    auto lock = lf_.make_lock();
+    if(terminated_) {
+        process->Terminate();
+        return false;
+    }
+    
+    processes_.push_back(process);
+    return true;
+}
+
+bool ScanWorkerList::Remove(ChildProcess *process)
+{
+    auto lock = lf_.make_lock();
+    processes_.erase(std::remove(processes_.begin(), processes_.end(), process), processes_.end());
+    return terminated_ == false;
+}
+
+ModuleScanResult ScanModuleInWorkerProcess(String const &executable_path,
+                                           String const &module_path,
+                                           UInt32 timeout_ms,
+                                           ScanWorkerList *workers)
+{
+    ModuleScanResult result;
+    
+    auto process = ChildProcess::Start(executable_path, { L"--scan-module", module_path }, true);
+    if(!process) {
+        hwm::dout << "Failed to start a scanner worker process." << std::endl;
+        result.status_ = ModuleScanResult::Status::kFailedToStart;
+        return result;
+    }
+    
+    std::string message;
+    bool const registered = (workers == nullptr || workers->Add(process.get()));
+    bool const completed = registered && process->ReadOutput(message, timeout_ms);
+    if(workers && workers->Remove(process.get()) == false) {
+        //! 強制終了された場合は、出力が不完全なので使用しない。
+        result.status_ = ModuleScanResult::Status::kAborted;
+        return result;
+    }
+    
+    if(completed == false) {
+        hwm::wdout << L"Plugin scan timed out: " << module_path << std::endl;
+        process->Terminate();
+        result.status_ = ModuleScanResult::Status::kTimedOut;
+        return result;
+    }
+    
+    //! 結果を書き込んだ後の、モジュールの解放中にクラッシュした場合は、結果をそのまま使用する。
+    if(process->Wait(kWorkerExitTimeoutMilliseconds) == false) {
+        process->Terminate();
+    }
+    
+    PluginDescriptionList list;
+    if(ParseMessage(message, list) == false) {
+        hwm::wdout << L"Plugin scan crashed: " << module_path << std::endl;
+        result.status_ = ModuleScanResult::Status::kCrashed;
+        return result;
+    }
+    
+    for(auto const &desc: list.list()) {
+        result.descs_.push_back(desc);
+    }
+    result.status_ = ModuleScanResult::Status::kSucceeded;
+    return result;
+}
+
+int RunPluginScanWorker(String const &module_path)
+{
+    //! モジュールを読み込む前に、標準出力を親プロセスへの出力専用にする。
+    auto output = ParentOutput::TakeStandardOutput();
+    if(!output) {
+        hwm::dout << "Failed to take the standard output." << std::endl;
+        return 1;
+    }
+    
+    PluginDescriptionList list;
+    for(auto const &desc: LoadVst3PluginDescriptions(module_path)) {
+        list.add_list()->CopyFrom(desc);
+    }
+    
+    auto const payload = list.SerializeAsString();
+    MessageHeader header;
+    header.payload_size_ = payload.size();
+    
+    if(output->Write(&header, sizeof(header)) == false
+       || output->Write(payload.data(), payload.size()) == false)
+    {
+        return 1;
+    }
+    
+    return 0;
+}
+
+NS_HWM_END
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <plugin_desc.pb.h>
+#include "../misc/LockFactory.hpp"
+
+NS_HWM_BEGIN
+
+class ChildProcess;
+
+//! ワーカープロセスでのモジュールのスキャン結果
+struct ModuleScanResult
+{
+    enum class Status
+    {
+        //! スキャンが完了した。(モジュールの読み込みに失敗した場合も含む)
+        kSucceeded,
+        //! ワーカープロセスが結果を返さずに終了した
+        kCrashed,
+        //! ワーカープロセスが制限時間内に結果を返さなかった
+        kTimedOut,
+        //! ワーカープロセスを起動できなかった
+        kFailedToStart,
+        //! ScanWorkerList::TerminateAll()によって、ワーカープロセスを強制終了した
+        kAborted,
+    };
+    
+    Status status_ = Status::kFailedToStart;
+    std::vector<PluginDescription> descs_;
+};
+
+//! 実行中のワーカープロセスの一覧
+/*! スキャンを中止するときに、実行中のワーカープロセスの完了やタイムアウトを待たずに強制終了するために使用する。
+ *  すべての関数はスレッドセーフ。
+ */
+class ScanWorkerList final
+{
+public:
+    //! 実行中のワーカープロセスをすべて強制終了する。
+    //! Reset()を呼び出すまでは、これ以降に追加されたワーカープロセスもすぐに強制終了する。
+    void TerminateAll();
+    
+    //! TerminateAll()を呼び出す前の状態に戻す。
+    void Reset();
+    
+    //! ワーカープロセスを追加する。
+    //! @return TerminateAll()が呼び出された後で、processを強制終了した場合はfalse
+    bool Add(ChildProcess *process);
+    
+    //! ワーカープロセスを取り除く。
+    //! @return TerminateAll()が呼び出された後の場合はfalse
+    bool Remove(ChildProcess *process);
+    
+private:
+    LockFactory lf_;
+    std::vector<ChildProcess *> processes_;
+    bool terminated_ = false;
+};
+
+//! ワーカープロセスを起動して、モジュールをスキャンする。
+/*! ワーカープロセスは、スキャン結果をシリアライズしたPluginDescriptionListとして、パイプ(標準出力)に書き込む。
+ *  timeout_ms以内に結果が返らない場合は、ワーカープロセスを強制終了する。
+ *
+ *  @param executable_path --scan-module オプションを受け付ける実行ファイル
+ *  @param workers 空でない場合は、実行中のワーカープロセスをここに登録する。
+ */
+ModuleScanResult ScanModuleInWorkerProcess(String const &executable_path,
+                                           String const &module_path,
+                                           UInt32 timeout_ms,
+                                           ScanWorkerList *workers = nullptr);
+
+//! ワーカープロセスとして、module_pathのモジュールをスキャンして、結果を親プロセスに送る。
+//! @return プロセスの終了コード
+int RunPluginScanWorker(String const &module_path);
+
+NS_HWM_END
@@ -1,13 +1,25 @@
 #include "PluginScanner.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <set>
 #include <thread>
+#include <unordered_set>
 #include <wx/dir.h>
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
 #include <plugin_desc.pb.h>
 
 #include "../misc/ScopeExit.hpp"
 #include "../misc/StrCnv.hpp"
 #include "../misc/ListenerService.hpp"
+#include "../misc/ThreadPool.hpp"
+#include "./PluginScanWorker.hpp"
+#include "./Vst3ModuleInfo.hpp"
 #include <pluginterfaces/vst/ivstaudioprocessor.h>
 
 NS_HWM_BEGIN
@@ -21,101 +33,629 @@ std::optional<ClassInfo::CID> to_cid(std::string str)
     return cid;
 }
 
-template<class Container>
-bool Contains(Container &c, ClassInfo::CID const &cid) {
-    return std::any_of(c.begin(), c.end(), [&cid](PluginDescription const &desc) {
-        return
-        desc.type() == PluginDescription_PluginType_VST3
-        && desc.has_vst3info()
-        && *to_cid(desc.vst3info().cid()) == cid;
-    });
+namespace {
+    //! ワーカープロセスで一つのモジュールをスキャンするときの制限時間
+    /*! ライセンスの確認などで読み込みに時間がかかるプラグインもあるので、長めにしておく。
+     */
+    UInt32 const kModuleScanTimeoutMilliseconds = 30 * 1000;
+    
+    //! スキャンを行うスレッドの数。(同時に起動するワーカープロセスの最大数)
+    /*! ワーカープロセスの完了やディスクI/Oを待つ時間が長いので、コア数が少ない環境でも最低限の数は確保する。
+     */
+    UInt32 GetNumScanThreads()
+    {
+        return std::max<UInt32>(std::thread::hardware_concurrency(), 4);
+    }
+    
+    //! モジュールを構成するファイルの、更新日時とサイズの要約
+    /*! 前回のスキャン時と一致すれば、モジュールは変更されていないとみなす。
+     */
+    struct ModuleFingerprint
+    {
+        Int64 modification_time_ = 0;
+        UInt64 size_ = 0;
+        UInt32 num_files_ = 0;
+    
+        bool IsSameAs(PluginModuleCache const &cache) const
+        {
+            return modification_time_ == cache.modification_time()
+            && size_ == cache.size()
+            && num_files_ == cache.num_files();
+        }
+    };
+    
+    //! バンドル内の、モジュールのバイナリのパス
+    //! (VST3 SDKのドキュメントの "VST 3 Locations / Format" を参照)
+    wxString GetModuleBinaryPath(wxString const &bundle_path)
+    {
+        wxFileName const bundle(bundle_path, wxEmptyString);
+        auto const name = wxFileName(bundle_path).GetName();
+    #if defined(_MSC_VER)
+        return bundle.GetPathWithSep() + L"Contents\\x86_64-win\\" + name + L".vst3";
+    #elif defined(__APPLE__)
+        return bundle.GetPathWithSep() + L"Contents/MacOS/" + name;
+    #else
+        return bundle.GetPathWithSep() + L"Contents/x86_64-linux/" + name + L".so";
+    #endif
+    }
+    
+    //! モジュールの変更を検出するために調べるファイルの一覧 (ソート済み)
+    /*! 単一のファイルのモジュールはそのファイルだけを返す。
+     *  バンドルの場合は、バイナリとメタデータのファイルだけを調べることで、
+     *  大量のリソースファイルを持つバンドルでも、ファイルを列挙せずに済むようにする。
+     *  バイナリが規定の位置にないバンドルは、バンドル内のすべてのファイルを返す。
+     */
+    std::vector<wxString> ListModuleFiles(wxString const &module_path)
+    {
+        std::vector<wxString> files;
+        if(wxDirExists(module_path) == false) {
+            if(wxFileExists(module_path)) { files.push_back(module_path); }
+            return files;
+        }
+    
+        auto const binary_path = GetModuleBinaryPath(module_path);
+        if(wxFileExists(binary_path)) {
+            wxFileName const bundle(module_path, wxEmptyString);
+            files.push_back(binary_path);
+            for(auto const &metadata: { L"Contents/Info.plist", L"Contents/Resources/moduleinfo.json" }) {
+                wxFileName const path(bundle.GetPathWithSep() + metadata);
+                if(path.FileExists()) { files.push_back(path.GetFullPath()); }
+            }
+        } else {
+            wxArrayString found;
+            wxDir::GetAllFiles(module_path, &found, wxEmptyString, wxDIR_FILES|wxDIR_DIRS|wxDIR_HIDDEN);
+            files.assign(found.begin(), found.end());
+        }
+    
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+    
+    ModuleFingerprint GetModuleFingerprint(std::vector<wxString> const &files)
+    {
+        ModuleFingerprint fp;
+        for(auto const &file: files) {
+            wxStructStat st;
+            if(wxStat(file, &st) != 0) { continue; }
+    
+            fp.modification_time_ = std::max<Int64>(fp.modification_time_, st.st_mtime);
+            fp.size_ += st.st_size;
+            fp.num_files_ += 1;
+        }
+        return fp;
+    }
+    
+    //! 64bit FNV-1a
+    struct ContentHasher
+    {
+        UInt64 value_ = 14695981039346656037ull;
+    
+        void Update(void const *data, size_t size)
+        {
+            auto p = static_cast<unsigned char const *>(data);
+            for(size_t i = 0; i < size; ++i) {
+                value_ ^= p[i];
+                value_ *= 1099511628211ull;
+            }
+        }
+    };
+    
+    //! モジュールを構成するファイルの、相対パスと内容のハッシュ
+    /*! 更新日時だけが変わった(内容は変わっていない)モジュールを、読み込み直さないようにするために使用する。
+     */
+    UInt64 GetModuleContentHash(wxString const &module_path, std::vector<wxString> const &files)
+    {
+        ContentHasher hasher;
+        std::vector<char> buffer(64 * 1024);
+    
+        for(auto const &file: files) {
+            auto const relative_path = to_utf8(file.Mid(module_path.length()).ToStdWstring());
+            hasher.Update(relative_path.data(), relative_path.size() + 1);
+    
+            wxFile f(file);
+            if(f.IsOpened() == false) { continue; }
+    
+            for( ; ; ) {
+                auto const num_read = f.Read(buffer.data(), buffer.size());
+                if(num_read == wxInvalidOffset || num_read == 0) { break; }
+                hasher.Update(buffer.data(), num_read);
+            }
+        }
+    
+        return hasher.value_;
+    }
+    
+    bool IsVst3Module(wxString const &name)
+    {
+        return name.EndsWith(L".vst3");
+    }
+    
+    //! @param overridden PluginScanner::Impl::overridden_modules_
+    bool IsOverridden(std::unordered_set<std::string> const &overridden, std::string_view filepath)
+    {
+        return overridden.empty() == false && overridden.count(std::string(filepath)) != 0;
+    }
 }
 
 struct PluginScanner::Impl
 {
+    //! 一回のスキャンの間だけ使用するデータ
+    struct ScanSession
+    {
+        ScanSession()
+        :   pool_(GetNumScanThreads())
+        {}
+    
+        LockFactory lf_;
+        std::condition_variable cv_;
+        UInt32 num_pending_tasks_ = 0;
+        //! スキャン中に見つかったモジュール
+        std::set<String> found_modules_;
+        UInt32 num_loaded_modules_ = 0;
+        //! num_loaded_modules_のうち、moduleinfo.jsonから情報を取得したもの
+        UInt32 num_module_info_modules_ = 0;
+        UInt32 num_quarantined_modules_ = 0;
+        //! タスクがこのオブジェクトを参照するので、最初に破棄する
+        ThreadPool pool_;
+    
+        template<class F>
+        void Submit(F f)
+        {
+            {
+                auto lock = lf_.make_lock();
+                num_pending_tasks_ += 1;
+            }
+    
+            pool_.Submit([this, f = std::move(f)] {
+                try {
+                    f();
+                } catch(std::exception &e) {
+                    hwm::dout << "Failed to scan plugins: " << e.what() << std::endl;
+                }
+    
+                auto lock = lf_.make_lock();
+                num_pending_tasks_ -= 1;
+                if(num_pending_tasks_ == 0) { cv_.notify_all(); }
+            });
+        }
+    
+        void WaitForAllTasks()
+        {
+            auto lock = lf_.make_lock();
+            cv_.wait(lock, [this] { return num_pending_tasks_ == 0; });
+        }
+    };
+    
+    //! ロックの外でプラグインの情報を参照するための、ある時点の状態
+    /*! db_は変更しないので、コピーせずに共有する。
+     */
+    struct Snapshot
+    {
+        std::shared_ptr<PluginDatabase const> db_;
+        std::unordered_set<std::string> overridden_modules_;
+        std::vector<PluginDescription> pds_;
+        //! TakeSnapshot()でwith_modulesにtrueを指定したときのみ
+        std::map<String, PluginModuleCache> module_cache_;
+    
+        //! db_の中のプラグインのうち、使用するもの
+        std::vector<PluginDatabase::PluginView> GetDatabasePlugins() const
+        {
+            std::vector<PluginDatabase::PluginView> views;
+            if(!db_) { return views; }
+    
+            auto const num_plugins = db_->GetNumPlugins();
+            views.reserve(num_plugins);
+            for(UInt32 i = 0; i < num_plugins; ++i) {
+                auto const view = db_->GetPlugin(i);
+                if(IsOverridden(overridden_modules_, view.filepath_) == false) {
+                    views.push_back(view);
+                }
+            }
+            return views;
+        }
+    
+        //! db_の中のプラグインも含めて、すべてのプラグインの情報を展開する。
+        std::vector<PluginDescription> GetPluginDescriptions() const
+        {
+            auto const views = GetDatabasePlugins();
+    
+            std::vector<PluginDescription> descs;
+            descs.reserve(views.size() + pds_.size());
+            for(auto const &view: views) {
+                descs.push_back(view.ToDescription());
+            }
+            descs.insert(descs.end(), pds_.begin(), pds_.end());
+            return descs;
+        }
+    
+        //! db_の中のモジュールも含めて、すべてのモジュールのキャッシュを展開する。
+        std::vector<PluginModuleCache> GetModuleCaches() const
+        {
+            std::vector<PluginModuleCache> modules;
+            for(auto const &entry: module_cache_) {
+                modules.push_back(entry.second);
+            }
+    
+            if(!db_) { return modules; }
+    
+            auto const num_modules = db_->GetNumModules();
+            for(UInt32 i = 0; i < num_modules; ++i) {
+                auto const view = db_->GetModule(i);
+                if(IsOverridden(overridden_modules_, view.filepath_)) { continue; }
+                if(module_cache_.count(to_wstr(std::string(view.filepath_))) != 0) { continue; }
+                modules.push_back(view.ToModuleCache());
+            }
+            return modules;
+        }
+    };
+    
     Impl()
     {
         scanning_ = false;
+        aborted_ = false;
     }
     
     std::vector<String> path_to_scan_;
     LockFactory lf_;
+    //! ImportDatabase()で渡されたデータベース。
+    /*! 展開せずに、マップした内容をそのまま参照する。
+     *  pds_とmodule_cache_は、db_に含まれていないものと、スキャンなどでdb_から変更されたものだけを保持する。
+     */
+    std::shared_ptr<PluginDatabase const> db_;
+    //! db_の中のレコード(モジュールのキャッシュと、そのモジュールのプラグイン)を使用しないモジュールのパス
+    //! (スキャンで読み込み直したモジュールや、削除されたモジュール)
+    std::unordered_set<std::string> overridden_modules_;
     std::vector<PluginDescription> pds_;
+    //! pds_に含まれるプラグインのCID
+    std::unordered_set<std::string> cids_;
+    //! pds_かoverridden_modules_が変更されるたびに増やす
+    UInt64 generation_ = 0;
+    //! generation_の時点のプラグインの情報から作成したカタログ。(まだ作成していなければnullptr)
+    std::shared_ptr<PluginCatalog const> catalog_;
+    UInt64 catalog_generation_ = 0;
+    //! key: モジュールのパス
+    std::map<String, PluginModuleCache> module_cache_;
+    //! 空でない場合は、このプログラムをワーカープロセスとして起動して、モジュールをスキャンする。
+    String worker_executable_path_;
     std::thread th_;
     std::atomic<bool> scanning_;
+    std::atomic<bool> aborted_;
+    //! Abort()で、実行中のワーカープロセスを強制終了するために使用する。
+    ScanWorkerList workers_;
     ListenerService<PluginScanner::Listener> listeners_;
-};
-
-class PluginScanner::Traverser
-:   public wxDirTraverser
-{
-public:
-    Traverser(PluginScanner &owner)
-    :   owner_(owner)
-    {}
     
-    wxDirTraverseResult OnFile(wxString const &filename) override
+    void Scan(PluginScanner *owner)
     {
-        return wxDIR_CONTINUE;
+        auto const start_time = std::chrono::steady_clock::now();
+    
+        auto const path_to_scan = owner->GetDirectories();
+    
+        ScanSession session;
+        for(auto const &path: path_to_scan) {
+            session.Submit([this, owner, &session, path] { WalkDirectory(owner, session, path); });
+        }
+        session.WaitForAllTasks();
+    
+        if(aborted_ == false) {
+            RemoveMissingModules(session);
+        }
+    
+        auto const elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time);
+        hwm::dout << "Scanned " << session.found_modules_.size() << " plugin modules ("
+        << session.num_loaded_modules_ << " loaded, "
+        << session.num_module_info_modules_ << " from moduleinfo.json, "
+        << session.num_quarantined_modules_ << " quarantined) in " << elapsed.count() << " ms." << std::endl;
     }
     
-    wxDirTraverseResult OnDir(wxString const &dirname) override
+    //! dirを走査して、見つかったモジュールとサブディレクトリを、それぞれ別のタスクとして処理する。
+    void WalkDirectory(PluginScanner *owner, ScanSession &session, wxString const &dir_path)
     {
-        if(dirname.EndsWith(L"vst3") == false) {
-            return wxDIR_CONTINUE;
+        if(aborted_ || wxDirExists(dir_path) == false) { return; }
+    
+        wxDir dir(dir_path);
+        if(dir.IsOpened() == false) { return; }
+    
+        wxString name;
+        for(bool found = dir.GetFirst(&name, wxEmptyString, wxDIR_FILES|wxDIR_DIRS);
+            found;
+            found = dir.GetNext(&name))
+        {
+            auto const path = dir.GetNameWithSep() + name;
+            if(IsVst3Module(name)) {
+                session.Submit([this, owner, &session, path] { ScanModule(owner, session, path); });
+            } else if(wxDirExists(path)) {
+                session.Submit([this, owner, &session, path] { WalkDirectory(owner, session, path); });
+            }
         }
-        
-        auto factory_list = Vst3PluginFactoryList::GetInstance();
-        auto factory = factory_list->FindOrCreateFactory(dirname.ToStdWstring());
-        
-        if(!factory) {
-            return wxDIR_CONTINUE;
+    }
+    
+    void ScanModule(PluginScanner *owner, ScanSession &session, wxString const &module_path)
+    {
+        if(aborted_) { return; }
+    
+        auto const key = module_path.ToStdWstring();
+        {
+            auto lock = session.lf_.make_lock();
+            session.found_modules_.insert(key);
         }
-        
-        auto const num = factory->GetComponentCount();
-        for(int i = 0; i < num; ++i) {
-            auto info = factory->GetComponentInfo(i);
-            
-            //! カテゴリがkVstAudioEffectClassでないComponentは、オーディオプラグインではないので無視する。
-            if(info.category() != hwm::to_wstr(kVstAudioEffectClass)) {
-                continue;
+    
+        auto const files = ListModuleFiles(module_path);
+        auto const fp = GetModuleFingerprint(files);
+    
+        std::optional<UInt64> content_hash;
+        {
+            auto lock = lf_.make_lock();
+            auto const cache = FindModuleCache(key);
+            if(cache) {
+                if(fp.IsSameAs(*cache)) { return; }
+    
+                //! 更新日時だけが変わっている場合は、内容を比較する。
+                if(fp.size_ == cache->size() && fp.num_files_ == cache->num_files()) {
+                    auto const cached_hash = cache->content_hash();
+                    lock.unlock();
+    
+                    content_hash = GetModuleContentHash(module_path, files);
+                    if(*content_hash == cached_hash) {
+                        lock.lock();
+                        UpdateModuleCache(key, fp, cached_hash);
+                        return;
+                    }
+                }
+            }
+        }
+    
+        if(!content_hash) {
+            content_hash = GetModuleContentHash(module_path, files);
+        }
+    
+        auto quarantine_reason = PluginModuleCache::NOT_QUARANTINED;
+        std::vector<PluginDescription> descs;
+    
+        //! moduleinfo.jsonがあれば、モジュールを読み込まずにプラグインの情報を取得する。
+        auto module_info = ReadVst3ModuleInfo(key);
+        auto const worker_path = GetWorkerExecutablePath();
+        if(module_info) {
+            descs = std::move(*module_info);
+        } else if(worker_path.empty()) {
+            descs = LoadVst3PluginDescriptions(key);
+        } else {
+            //! 壊れたモジュールがこのプロセスをクラッシュさせたりハングさせたりしないように、
+            //! ワーカープロセスの中で読み込む。
+            auto result = ScanModuleInWorkerProcess(worker_path, key, kModuleScanTimeoutMilliseconds, &workers_);
+            switch(result.status_) {
+                case ModuleScanResult::Status::kSucceeded:
+                    descs = std::move(result.descs_);
+                    break;
+                case ModuleScanResult::Status::kCrashed:
+                    quarantine_reason = PluginModuleCache::CRASHED;
+                    break;
+                case ModuleScanResult::Status::kTimedOut:
+                    quarantine_reason = PluginModuleCache::TIMED_OUT;
+                    break;
+                case ModuleScanResult::Status::kFailedToStart:
+                case ModuleScanResult::Status::kAborted:
+                    //! モジュールの問題ではないので、隔離もキャッシュもせずに、次回のスキャンで再試行する。
+                    return;
             }
-            
-            auto lock = owner_.pimpl_->lf_.make_lock();
-            auto &pds = owner_.pimpl_->pds_;
-            
-            if(Contains(pds, info.cid())) { continue; }
-            
-            PluginDescription desc;
-            desc.set_name(to_utf8(info.name()));
-            desc.set_type(PluginDescription_PluginType_VST3);
-            auto vi = desc.mutable_vst3info();
-            vi->set_filepath(dirname.ToUTF8());
-            std::string const cid(info.cid().begin(), info.cid().end());
-            vi->set_cid(cid);
-            vi->set_category(to_utf8(info.category()));
-            vi->set_cardinality(info.cardinality());
-            
-            if(info.has_classinfo2()) {
-                auto ci2 = std::make_unique<PluginDescription_Vst3Info_ClassInfo2>();
-                ci2->set_subcategories(to_utf8(info.classinfo2().sub_categories()));
-                ci2->set_vendor(to_utf8(info.classinfo2().vendor()));
-                ci2->set_version(to_utf8(info.classinfo2().version()));
-                ci2->set_sdk_version(to_utf8(info.classinfo2().sdk_version()));
-                vi->set_allocated_classinfo2(ci2.release());
+        }
+    
+        auto lock = lf_.make_lock();
+        auto const filepath = to_utf8(key);
+        RemovePluginDescriptionsIf([&filepath](auto const &desc) {
+            return desc.vst3info().filepath() == filepath;
+        });
+        OverrideDatabaseModule(filepath);
+    
+        for(auto &desc: descs) {
+            AddPluginDescription(std::move(desc));
+        }
+    
+        //! 読み込みに失敗したモジュールも、変更されるまでは読み込み直さないようにキャッシュしておく。
+        //! 隔離したモジュールも、変更されるまではスキャンしない。
+        UpdateModuleCache(key, fp, *content_hash);
+        module_cache_[key].set_quarantine_reason(quarantine_reason);
+        lock.unlock();
+    
+        {
+            auto lock = session.lf_.make_lock();
+            session.num_loaded_modules_ += 1;
+            if(module_info) {
+                session.num_module_info_modules_ += 1;
             }
-            
-            pds.push_back(desc);
-        
-            owner_.pimpl_->listeners_.Invoke([this](auto *li) {
-                li->OnScanningProgressUpdated(&owner_);
+            if(quarantine_reason != PluginModuleCache::NOT_QUARANTINED) {
+                session.num_quarantined_modules_ += 1;
+            }
+            //! 複数のスレッドから同時にリスナーを呼び出さないように、sessionのロック中に呼び出す。
+            listeners_.Invoke([owner](auto *li) {
+                li->OnScanningProgressUpdated(owner);
             });
         }
-        return wxDIR_CONTINUE;
     }
     
-private:
-    PluginScanner &owner_;
+    String GetWorkerExecutablePath() const
+    {
+        auto lock = lf_.make_lock();
+        return worker_executable_path_;
+    }
+    
+    //! keyのモジュールのキャッシュ。module_cache_になければ、db_から探す。
+    //! @pre lf_がロックされていること
+    std::optional<PluginModuleCache> FindModuleCache(String const &key) const
+    {
+        auto found = module_cache_.find(key);
+        if(found != module_cache_.end()) { return found->second; }
+        if(!db_) { return std::nullopt; }
+    
+        auto const filepath = to_utf8(key);
+        if(IsOverridden(overridden_modules_, filepath)) { return std::nullopt; }
+    
+        auto const view = db_->FindModule(filepath);
+        if(!view) { return std::nullopt; }
+        return view->ToModuleCache();
+    }
+    
+    //! db_の中の、filepathのモジュールのキャッシュとプラグインを、これ以降使用しないようにする。
+    //! @pre lf_がロックされていること
+    void OverrideDatabaseModule(std::string const &filepath)
+    {
+        if(!db_) { return; }
+        if(overridden_modules_.insert(filepath).second) { generation_ += 1; }
+    }
+    
+    //! @pre lf_がロックされていること
+    Snapshot TakeSnapshot(bool with_modules) const
+    {
+        Snapshot snapshot;
+        snapshot.db_ = db_;
+        snapshot.overridden_modules_ = overridden_modules_;
+        snapshot.pds_ = pds_;
+        if(with_modules) { snapshot.module_cache_ = module_cache_; }
+        return snapshot;
+    }
+    
+    //! @pre lf_がロックされていること
+    void UpdateModuleCache(String const &key, ModuleFingerprint const &fp, UInt64 content_hash)
+    {
+        auto found = module_cache_.find(key);
+        if(found == module_cache_.end()) {
+            //! db_のキャッシュがあれば、隔離の状態を引き継ぐ。
+            auto cache = FindModuleCache(key);
+            found = module_cache_.emplace(key, cache ? std::move(*cache) : PluginModuleCache()).first;
+        }
+    
+        auto &cache = found->second;
+        cache.set_filepath(to_utf8(key));
+        cache.set_modification_time(fp.modification_time_);
+        cache.set_size(fp.size_);
+        cache.set_num_files(fp.num_files_);
+        cache.set_content_hash(content_hash);
+    }
+    
+    //! 削除されたモジュールの情報を破棄する。
+    void RemoveMissingModules(ScanSession const &session)
+    {
+        auto lock = lf_.make_lock();
+    
+        std::set<std::string> removed;
+        for(auto it = module_cache_.begin(); it != module_cache_.end(); ) {
+            if(session.found_modules_.count(it->first) == 0
+               && wxFileExists(it->first) == false
+               && wxDirExists(it->first) == false)
+            {
+                removed.insert(it->second.filepath());
+                it = module_cache_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    
+        if(db_) {
+            auto const num_modules = db_->GetNumModules();
+            for(UInt32 i = 0; i < num_modules; ++i) {
+                auto const view = db_->GetModule(i);
+                if(IsOverridden(overridden_modules_, view.filepath_)) { continue; }
+    
+                std::string filepath(view.filepath_);
+                auto const key = to_wstr(filepath);
+                if(session.found_modules_.count(key) == 0
+                   && wxFileExists(key) == false
+                   && wxDirExists(key) == false)
+                {
+                    removed.insert(std::move(filepath));
+                }
+            }
+        }
+    
+        if(removed.empty()) { return; }
+    
+        for(auto const &filepath: removed) {
+            OverrideDatabaseModule(filepath);
+        }
+        RemovePluginDescriptionsIf([&removed](auto const &desc) {
+            return removed.count(desc.vst3info().filepath()) != 0;
+        });
+    }
+    
+    //! db_の内容を、pds_とmodule_cache_に展開して、db_を手放す。
+    /*! ImportDatabase()で、データベースを別のものに置き換えるときだけ使用する。
+     *  @pre lf_がロックされていること
+     */
+    void MaterializeDatabase()
+    {
+        if(!db_) { return; }
+    
+        auto db = std::move(db_);
+        auto overridden = std::move(overridden_modules_);
+        overridden_modules_.clear();
+    
+        //! db_の中のプラグインを、スキャンで追加されたものより前に並べる。
+        std::vector<PluginDescription> pds;
+        pds.swap(pds_);
+        cids_.clear();
+    
+        auto const num_plugins = db->GetNumPlugins();
+        pds_.reserve(num_plugins + pds.size());
+        for(UInt32 i = 0; i < num_plugins; ++i) {
+            auto const view = db->GetPlugin(i);
+            if(IsOverridden(overridden, view.filepath_) == false) {
+                AddPluginDescription(view.ToDescription());
+            }
+        }
+        for(auto &desc: pds) {
+            AddPluginDescription(std::move(desc));
+        }
+    
+        //! module_cache_にすでにあるものは、db_のものより新しいので上書きしない。
+        auto const num_modules = db->GetNumModules();
+        for(UInt32 i = 0; i < num_modules; ++i) {
+            auto const view = db->GetModule(i);
+            if(IsOverridden(overridden, view.filepath_)) { continue; }
+            module_cache_.emplace(to_wstr(std::string(view.filepath_)), view.ToModuleCache());
+        }
+    
+        generation_ += 1;
+    }
+    
+    //! db_の中で使用しているプラグインに、cidのものがあるかどうか
+    //! @pre lf_がロックされていること
+    bool IsInDatabase(std::string const &cid) const
+    {
+        if(!db_) { return false; }
+    
+        auto const view = db_->FindByCID(cid);
+        return view && IsOverridden(overridden_modules_, view->filepath_) == false;
+    }
+    
+    //! CIDが不正なものと、すでに同じCIDのプラグインがあるもの(db_の中のものを含む)は追加しない。
+    //! @pre lf_がロックされていること
+    bool AddPluginDescription(PluginDescription desc)
+    {
+        if(desc.type() != PluginDescription_PluginType_VST3 || desc.has_vst3info() == false) { return false; }
+    
+        auto const &cid = desc.vst3info().cid();
+        if(!to_cid(cid) || IsInDatabase(cid) || cids_.insert(cid).second == false) { return false; }
+    
+        pds_.push_back(std::move(desc));
+        generation_ += 1;
+        return true;
+    }
+    
+    //! @pre lf_がロックされていること
+    template<class Pred>
+    void RemovePluginDescriptionsIf(Pred pred)
+    {
+        //! remove_ifでは取り除く要素の内容が保たれないので、stable_partitionで末尾に寄せてからCIDを削除する。
+        auto const it = std::stable_partition(pds_.begin(), pds_.end(), [&pred](auto const &desc) {
+            return !pred(desc);
+        });
+        if(it == pds_.end()) { return; }
+    
+        std::for_each(it, pds_.end(), [this](auto const &desc) {
+            cids_.erase(desc.vst3info().cid());
+        });
+        pds_.erase(it, pds_.end());
+        generation_ += 1;
+    }
 };
 
 PluginScanner::PluginScanner()
@@ -123,7 +663,9 @@ PluginScanner::PluginScanner()
 {}
 
 PluginScanner::~PluginScanner()
-{}
+{
+    Abort();
+}
 
 std::vector<String> const & PluginScanner::GetDirectories() const
 {
@@ -154,24 +696,61 @@ void PluginScanner::ClearDirectories()
 std::vector<PluginDescription> PluginScanner::GetPluginDescriptions() const
 {
     auto lock = pimpl_->lf_.make_lock();
-    return pimpl_->pds_;
+    auto const snapshot = pimpl_->TakeSnapshot(false);
+    lock.unlock();
+    
+    return snapshot.GetPluginDescriptions();
+}
+
+std::shared_ptr<PluginCatalog const> PluginScanner::GetCatalog() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    if(pimpl_->catalog_ && pimpl_->catalog_generation_ == pimpl_->generation_) {
+        return pimpl_->catalog_;
+    }
+    
+    auto const generation = pimpl_->generation_;
+    auto snapshot = pimpl_->TakeSnapshot(false);
+    lock.unlock();
+    
+    //! スキャン中のスレッドを待たせないように、カタログはロックの外で作成する。
+    //! データベースの中のプラグインは展開せずに、マップした内容をカタログから参照する。
+    auto catalog = std::make_shared<PluginCatalog const>(snapshot.db_,
+                                                         snapshot.GetDatabasePlugins(),
+                                                         std::move(snapshot.pds_));
+    
+    lock.lock();
+    if(pimpl_->generation_ == generation) {
+        pimpl_->catalog_ = catalog;
+        pimpl_->catalog_generation_ = generation;
+    }
+    return catalog;
 }
 
 void PluginScanner::ClearPluginDescriptions()
 {
     auto lock = pimpl_->lf_.make_lock();
+    pimpl_->db_.reset();
+    pimpl_->overridden_modules_.clear();
     pimpl_->pds_.clear();
+    pimpl_->cids_.clear();
+    pimpl_->generation_ += 1;
+    pimpl_->module_cache_.clear();
 }
 
 std::string PluginScanner::Export()
 {
-    PluginDescriptionList list;
+    auto lock = pimpl_->lf_.make_lock();
+    auto const snapshot = pimpl_->TakeSnapshot(true);
+    lock.unlock();
     
-    auto pds = GetPluginDescriptions();
+    PluginDescriptionList list;
+    for(auto &pd: snapshot.GetPluginDescriptions()) {
+        *list.add_list() = std::move(pd);
+    }
     
-    for(auto pd: pds) {
-        auto dest = list.add_list();
-        dest->CopyFrom(pd);
+    for(auto &module: snapshot.GetModuleCaches()) {
+        *list.add_module_cache() = std::move(module);
     }
     
     return list.SerializeAsString();
@@ -181,28 +760,66 @@ void PluginScanner::Import(std::string const &str)
 {
     PluginDescriptionList pd_list;
     pd_list.ParseFromString(str);
-
-    std::vector<PluginDescription> new_list;
-    for(auto &x: pd_list.list()) {
-        PluginDescription desc;
-        desc.CopyFrom(x);
-        new_list.push_back(desc);
-    }
     
     auto lock = pimpl_->lf_.make_lock();
     
-    auto &pds = pimpl_->pds_;
+    for(auto &x: *pd_list.mutable_list()) {
+        pimpl_->AddPluginDescription(std::move(x));
+    }
     
-    for(auto &x: pd_list.list()) {
-        if(x.type() == PluginDescription_PluginType_VST3) {
-            if(x.has_vst3info() == false) { continue; }
-            auto maybe_cid = to_cid(x.vst3info().cid());
-            if(!maybe_cid || Contains(pds, *maybe_cid)) { continue; }
-            pds.push_back(x);
-        }
+    for(auto &x: *pd_list.mutable_module_cache()) {
+        auto key = to_wstr(x.filepath());
+        pimpl_->module_cache_[key] = std::move(x);
     }
 }
 
+std::string PluginScanner::ExportDatabase()
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto const snapshot = pimpl_->TakeSnapshot(true);
+    lock.unlock();
+    
+    return PluginDatabase::Build(snapshot.GetPluginDescriptions(), snapshot.GetModuleCaches());
+}
+
+void PluginScanner::ImportDatabase(std::unique_ptr<PluginDatabase const> db)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    //! 前のデータベースの内容を失わないように、先に展開しておく。(起動時に一度だけ呼び出す場合は何もしない)
+    pimpl_->MaterializeDatabase();
+    pimpl_->db_ = std::move(db);
+    pimpl_->generation_ += 1;
+}
+
+void PluginScanner::SetWorkerExecutablePath(String const &path)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    pimpl_->worker_executable_path_ = path;
+}
+
+std::vector<PluginModuleCache> PluginScanner::GetQuarantinedModules() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto const snapshot = pimpl_->TakeSnapshot(true);
+    lock.unlock();
+    
+    auto modules = snapshot.GetModuleCaches();
+    modules.erase(std::remove_if(modules.begin(), modules.end(), [](auto const &module) {
+        return module.quarantine_reason() == PluginModuleCache::NOT_QUARANTINED;
+    }), modules.end());
+    return modules;
+}
+
+void PluginScanner::ReleaseFromQuarantine(String const &module_path)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto const cache = pimpl_->FindModuleCache(module_path);
+    if(!cache || cache->quarantine_reason() == PluginModuleCache::NOT_QUARANTINED) { return; }
+    
+    pimpl_->module_cache_.erase(module_path);
+    pimpl_->OverrideDatabaseModule(cache->filepath());
+}
+
 void PluginScanner::AddListener(Listener *li)
 {
     pimpl_->listeners_.AddListener(li);
@@ -219,29 +836,20 @@ void PluginScanner::ScanAsync()
     if(pimpl_->scanning_.compare_exchange_strong(expected, true) == false) {
         return;
     }
-
+    
     Wait();
+    pimpl_->aborted_ = false;
+    pimpl_->workers_.Reset();
     
     pimpl_->th_ = std::thread([this] {
         pimpl_->listeners_.Invoke([this](auto *li) {
             li->OnScanningStarted(this);
         });
-        
-        auto path_to_scan = GetDirectories();
-        
-        Traverser tr(*this);
-        for(auto path: path_to_scan) {
-            wxDir dir(path);
-            
-            try {
-                dir.Traverse(tr);
-            } catch(std::exception &e) {
-                hwm::dout << "Failed to traverse plugin directories: " << e.what() << std::endl;
-            }
-        }
-        
+    
+        pimpl_->Scan(this);
+    
         pimpl_->scanning_ = false;
-
+    
         pimpl_->listeners_.Invoke([this](auto *li) {
             li->OnScanningFinished(this);
         });
@@ -255,6 +863,61 @@ void PluginScanner::Wait()
     }
 }
 
+void PluginScanner::Abort()
+{
+    pimpl_->aborted_ = true;
+    //! 実行中のワーカープロセスは、結果やタイムアウトを待たずに強制終了する。
+    pimpl_->workers_.TerminateAll();
+    Wait();
+}
+
+std::vector<PluginDescription> LoadVst3PluginDescriptions(String const &module_path)
+{
+    std::vector<PluginDescription> descs;
+    
+    auto const &path = module_path;
+    auto factory_list = Vst3PluginFactoryList::GetInstance();
+    auto factory = factory_list->FindOrCreateFactory(path);
+    if(!factory) { return descs; }
+    
+    auto const num = factory->GetComponentCount();
+    for(int i = 0; i < num; ++i) {
+        auto info = factory->GetComponentInfo(i);
+    
+        //! カテゴリがkVstAudioEffectClassでないComponentは、オーディオプラグインではないので無視する。
+        if(info.category() != hwm::to_wstr(kVstAudioEffectClass)) {
+            continue;
+        }
+    
+        PluginDescription desc;
+        desc.set_name(to_utf8(info.name()));
+        desc.set_type(PluginDescription_PluginType_VST3);
+        auto vi = desc.mutable_vst3info();
+        vi->set_filepath(to_utf8(module_path));
+        std::string const cid(info.cid().begin(), info.cid().end());
+        vi->set_cid(cid);
+        vi->set_category(to_utf8(info.category()));
+        vi->set_cardinality(info.cardinality());
+    
+        if(info.has_classinfo2()) {
+            auto ci2 = std::make_unique<PluginDescription_Vst3Info_ClassInfo2>();
+            ci2->set_subcategories(to_utf8(info.classinfo2().sub_categories()));
+            ci2->set_vendor(to_utf8(info.classinfo2().vendor()));
+            ci2->set_version(to_utf8(info.classinfo2().version()));
+            ci2->set_sdk_version(to_utf8(info.classinfo2().sdk_version()));
+            vi->set_allocated_classinfo2(ci2.release());
+        }
+    
+        descs.push_back(desc);
+    }
+    
+    //! スキャンのためだけに読み込んだモジュールは、読み込んだままにしない。
+    factory.reset();
+    factory_list->ReleaseIfUnused(path);
+    
+    return descs;
+}
+
 bool HasPluginCategory(PluginDescription const &desc, std::string category_name)
 {
     if(desc.vst3info().has_classinfo2()) {
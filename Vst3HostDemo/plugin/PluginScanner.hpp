@@ -5,6 +5,8 @@
 #include "../misc/LockFactory.hpp"
 #include "../misc/SingleInstance.hpp"
 #include "./vst3/Vst3PluginFactory.hpp"
+#include "./PluginCatalog.hpp"
+#include "./PluginDatabase.hpp"
 #include <plugin_desc.pb.h>
 
 NS_HWM_BEGIN
@@ -20,12 +22,53 @@ struct PluginScanner
     void SetDirectories(std::vector<String> const &dirs);
     void ClearDirectories();
     
+    //! すべてのプラグインの情報を展開して返す。
+    /*! データベースから読み込んだプラグインも展開するので、一覧の表示や検索にはGetCatalog()を使用すること。
+     */
     std::vector<PluginDescription> GetPluginDescriptions() const;
+    
+    //! 現在のプラグインの情報から作成したカタログ
+    /*! プラグインの情報が変更されていなければ、前回と同じカタログを返す。
+     *  返したカタログは、その後にスキャンなどでプラグインの情報が変更されても変化しない。
+     */
+    std::shared_ptr<PluginCatalog const> GetCatalog() const;
+    
+    //! プラグインの情報と、モジュールのキャッシュをすべて破棄する。
+    //! (次回のスキャンでは、すべてのモジュールを読み込み直す)
     void ClearPluginDescriptions();
 
+    //! プラグインの情報とモジュールのキャッシュを、PluginDescriptionListとしてシリアライズする。
     std::string Export();
     void Import(std::string const &str);
     
+    //! プラグインの情報とモジュールのキャッシュを、PluginDatabaseの形式で書き出す。
+    //! (起動時の読み込み用。他のプログラムとのやり取りには、Export()を使用すること)
+    std::string ExportDatabase();
+    
+    //! PluginDatabase::Open()で開いたデータベースを読み込む。
+    /*! この関数ではデータベースを保持するだけなので、すぐに返る。
+     *  データベースの内容は展開せずに、マップしたまま参照する。
+     *  (スキャンやカタログはデータベースを直接参照し、PluginDescriptionはプラグインを作成するときに展開する)
+     *  スキャンで追加や変更があったプラグインとモジュールだけを、データベースとは別に保持する。
+     *  データベースのファイルは、スキャナーとカタログが破棄されるまでマップしたままになる。
+     */
+    void ImportDatabase(std::unique_ptr<PluginDatabase const> db);
+    
+    //! モジュールを別プロセスでスキャンするときに起動する実行ファイル
+    /*! 空でない場合、各モジュールはこの実行ファイルを --scan-module オプション付きで起動した
+     *  ワーカープロセスの中で読み込まれる。
+     *  モジュールの読み込み中にワーカープロセスがクラッシュしたりタイムアウトしたりした場合は、
+     *  そのモジュールを隔離リストに追加し、モジュールが変更されるまでは再びスキャンしない。
+     *  空の場合は、このプロセスの中でモジュールを読み込む。
+     */
+    void SetWorkerExecutablePath(String const &path);
+    
+    //! 隔離されているモジュールの一覧
+    std::vector<PluginModuleCache> GetQuarantinedModules() const;
+    
+    //! モジュールを隔離リストから外す。次回のスキャンで再びスキャンされる。
+    void ReleaseFromQuarantine(String const &module_path);
+    
     struct Listener
     {
     protected:
@@ -47,12 +90,18 @@ struct PluginScanner
     void AddListener(Listener *li);
     void RemoveListener(Listener const *li);
     
+    //! バックグラウンドでプラグインをスキャンする。
+    /*! ディレクトリの走査とモジュールの読み込みは、スレッドプール上で並列に行う。
+     *  前回のスキャンから変更されていないモジュール(パス、更新日時、サイズ、内容のハッシュで判定)は、
+     *  読み込まずにキャッシュしてある情報を使用する。
+     *  OnScanningProgressUpdatedは、スキャンを行うスレッドから呼び出される。
+     */
     void ScanAsync();
     void Wait();
+    //! 実行中のスキャンを中断する。(完了を待機する)
     void Abort();
     
 private:
-    class Traverser;
     struct Impl;
     std::unique_ptr<Impl> pimpl_;
 };
@@ -63,4 +112,9 @@ bool IsInstrumentPlugin(PluginDescription const &desc);
 
 std::optional<ClassInfo::CID> to_cid(std::string str);
 
+//! このプロセスの中でモジュールを読み込んで、含まれているプラグインの情報を返す。
+/*! 読み込んだモジュールは、プラグインが作成されていなければ解放する。
+ */
+std::vector<PluginDescription> LoadVst3PluginDescriptions(String const &module_path);
+
 NS_HWM_END
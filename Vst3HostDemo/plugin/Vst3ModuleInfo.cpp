@@ -0,0 +1,124 @@
+#include "Vst3ModuleInfo.hpp"
+
+#include <wx/file.h>
+#include <wx/filename.h>
+
+#include "../misc/Json.hpp"
+#include "../misc/StrCnv.hpp"
+#include "./vst3/Vst3PluginFactory.hpp"
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+
+NS_HWM_BEGIN
+
+namespace {
+    //! 不正なファイルを読み込まないように、サイズを制限する。
+    wxFileOffset const kMaxModuleInfoSize = 16 * 1024 * 1024;
+    
+    int HexToInt(char c)
+    {
+        if('0' <= c && c <= '9') { return c - '0'; }
+        if('a' <= c && c <= 'f') { return c - 'a' + 10; }
+        if('A' <= c && c <= 'F') { return c - 'A' + 10; }
+        return -1;
+    }
+    
+    //! "84E8DE5F92554F5396FAE4133C935A18" のような32桁の16進数の文字列を、CIDのバイト列に変換する。
+    /*! moduleinfo.jsonのCIDは、ファクトリが返すPClassInfo::cidのバイト列を、先頭から順に16進数で表したもの。
+     */
+    std::optional<std::string> ParseCID(std::string const &str)
+    {
+        if(str.size() != ClassInfo::kCIDLength * 2) { return std::nullopt; }
+    
+        std::string cid;
+        for(size_t i = 0; i < str.size(); i += 2) {
+            auto const hi = HexToInt(str[i]);
+            auto const lo = HexToInt(str[i + 1]);
+            if(hi < 0 || lo < 0) { return std::nullopt; }
+            cid.push_back((char)(hi * 16 + lo));
+        }
+        return cid;
+    }
+    
+    //! PClassInfo2::subCategoriesと同じく、'|'区切りの文字列にする。
+    std::string JoinSubCategories(JsonValue const &value)
+    {
+        if(value.IsString()) { return value.AsString(); }
+    
+        std::string joined;
+        for(auto const &elem: value.AsArray()) {
+            if(joined.empty() == false) { joined += "|"; }
+            joined += elem.AsString();
+        }
+        return joined;
+    }
+}
+
+String GetVst3ModuleInfoPath(String const &module_path)
+{
+    wxFileName const bundle(module_path, wxEmptyString);
+    return (bundle.GetPathWithSep() + L"Contents/Resources/moduleinfo.json").ToStdWstring();
+}
+
+std::optional<std::vector<PluginDescription>>
+ParseVst3ModuleInfo(std::string const &json, String const &module_path)
+{
+    std::string error;
+    auto root = ParseJson(json, &error);
+    if(!root) {
+        hwm::dout << "Failed to parse moduleinfo.json: " << error << std::endl;
+        return std::nullopt;
+    }
+    
+    auto const &classes = (*root)["Classes"];
+    if(classes.IsArray() == false) { return std::nullopt; }
+    
+    auto const &factory_vendor = (*root)["Factory Info"]["Vendor"].AsString();
+    
+    std::vector<PluginDescription> descs;
+    for(auto const &cls: classes.AsArray()) {
+        //! カテゴリがkVstAudioEffectClassでないクラスは、オーディオプラグインではないので無視する。
+        if(cls["Category"].AsString() != kVstAudioEffectClass) { continue; }
+    
+        //! CIDが読めないクラスがある場合は、ファイル全体を信用せずに、モジュールの読み込みに任せる。
+        auto cid = ParseCID(cls["CID"].AsString());
+        if(!cid) { return std::nullopt; }
+    
+        PluginDescription desc;
+        desc.set_name(cls["Name"].AsString());
+        desc.set_type(PluginDescription_PluginType_VST3);
+        auto vi = desc.mutable_vst3info();
+        vi->set_filepath(to_utf8(module_path));
+        vi->set_cid(*cid);
+        vi->set_category(cls["Category"].AsString());
+        vi->set_cardinality((Int32)cls["Cardinality"].AsNumber(Steinberg::PClassInfo::kManyInstances));
+    
+        auto ci2 = vi->mutable_classinfo2();
+        ci2->set_subcategories(JoinSubCategories(cls["Sub Categories"]));
+        ci2->set_vendor(cls.HasMember("Vendor") ? cls["Vendor"].AsString() : factory_vendor);
+        ci2->set_version(cls["Version"].AsString());
+        ci2->set_sdk_version(cls["SDKVersion"].AsString());
+    
+        descs.push_back(std::move(desc));
+    }
+    
+    return descs;
+}
+
+std::optional<std::vector<PluginDescription>> ReadVst3ModuleInfo(String const &module_path)
+{
+    auto const path = GetVst3ModuleInfoPath(module_path);
+    if(wxFileExists(path) == false) { return std::nullopt; }
+    
+    wxFile file(path);
+    if(file.IsOpened() == false) { return std::nullopt; }
+    
+    auto const length = file.Length();
+    if(length < 0 || length > kMaxModuleInfoSize) { return std::nullopt; }
+    
+    std::string json(length, '\0');
+    if(file.Read(&json[0], length) != length) { return std::nullopt; }
+    
+    return ParseVst3ModuleInfo(json, module_path);
+}
+
+NS_HWM_END
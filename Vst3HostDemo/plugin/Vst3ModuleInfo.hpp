@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! VST3のバンドルに含まれる、moduleinfo.jsonのパス
+String GetVst3ModuleInfoPath(String const &module_path);
+
+//! moduleinfo.jsonの内容から、モジュールに含まれるプラグインの情報を作成する。
+/*! moduleinfo.jsonは、VST3 SDK 3.7.5以降でビルドされたバンドルに含まれる、
+ *  ファクトリとクラスの情報を記述したファイル。
+ *  これを使用すると、モジュールを読み込まずに(ファクトリを呼び出さずに)プラグインの情報を取得できる。
+ *
+ *  @param module_path PluginDescriptionのfilepathに設定するモジュールのパス
+ *  @return 内容が不正な場合はstd::nullopt
+ */
+std::optional<std::vector<PluginDescription>>
+ParseVst3ModuleInfo(std::string const &json, String const &module_path);
+
+//! module_pathのバンドルのmoduleinfo.jsonを読み込んで、プラグインの情報を作成する。
+//! @return moduleinfo.jsonがない場合や、内容が不正な場合はstd::nullopt
+std::optional<std::vector<PluginDescription>> ReadVst3ModuleInfo(String const &module_path);
+
+NS_HWM_END
@@ -0,0 +1,177 @@
+#include "SandboxChild.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "../../misc/ChildProcess.hpp"
+#include "../../misc/GarbageCollector.hpp"
+#include "../../misc/SharedMemory.hpp"
+#include "../../misc/StrCnv.hpp"
+#include "./SandboxProtocol.hpp"
+
+NS_HWM_BEGIN
+
+using namespace Sandbox;
+
+namespace {
+    //! リクエストがない間に、ホストプロセスの終了を確認する間隔
+    UInt32 const kHostCheckIntervalMilliseconds = 500;
+    
+    //! オーディオスレッドで発生したパラメータの変更を、EditControllerに反映する間隔
+    auto const kControllerUpdateInterval = std::chrono::milliseconds(30);
+    
+    void WritePluginInfo(Vst3Plugin &plugin, PluginInfo &info)
+    {
+        info.num_inputs_ = std::min<UInt32>(plugin.GetNumInputs(), kMaxChannels);
+        info.num_outputs_ = std::min<UInt32>(plugin.GetNumOutputs(), kMaxChannels);
+        info.has_event_output_ = plugin.HasEventOutput();
+    
+        auto const name = to_utf8(plugin.GetEffectName());
+        auto const length = std::min<size_t>(name.size(), kMaxNameLength - 1);
+        std::memcpy(info.name_, name.data(), length);
+        info.name_[length] = '\0';
+    }
+    
+    //! 共有メモリ上のバッファを直接参照して、1ブロック分の処理を行う。
+    void ProcessBlock(Vst3Plugin &plugin, PluginInfo const &info, BlockData &block)
+    {
+        for(UInt32 i = 0; i < block.num_parameter_changes_; ++i) {
+            auto const &pc = block.parameter_changes_[i];
+            plugin.EnqueueParameterChange(pc.id_, pc.value_);
+        }
+    
+        float const *input_heads[kMaxChannels];
+        float *output_heads[kMaxChannels];
+        for(UInt32 ch = 0; ch < kMaxChannels; ++ch) {
+            input_heads[ch] = block.input_audio_[ch];
+            output_heads[ch] = block.output_audio_[ch];
+        }
+    
+        auto const num_samples = std::min(block.num_samples_, kMaxBlockSize);
+        auto const num_input_midi_messages = std::min(block.num_input_midi_messages_, kMaxMidiMessages);
+    
+        ProcessInfo pi;
+        pi.time_info_ = &block.transport_;
+        pi.input_audio_buffer_ = BufferRef<float const>(input_heads, info.num_inputs_, num_samples);
+        pi.output_audio_buffer_ = BufferRef<float>(output_heads, info.num_outputs_, num_samples);
+        pi.input_midi_buffer_.buffer_ = ArrayRef<ProcessInfo::MidiMessage const>(
+            block.input_midi_messages_,
+            block.input_midi_messages_ + num_input_midi_messages
+        );
+        pi.input_midi_buffer_.num_used_ = num_input_midi_messages;
+        pi.output_midi_buffer_.buffer_ = ArrayRef<ProcessInfo::MidiMessage>(block.output_midi_messages_);
+        pi.output_midi_buffer_.num_used_ = 0;
+    
+        pi.output_audio_buffer_.fill(0);
+        {
+            //! UpdateMidiControllerTable()などでリタイアされたオブジェクトは、
+            //! この区間を抜けるまでGarbageCollectorによって解放されない。
+            ScopedRealtimeSection rt_section;
+            auto const start = std::chrono::steady_clock::now();
+            plugin.Process(pi);
+            block.process_time_us_ = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+    
+        block.num_output_midi_messages_ = pi.output_midi_buffer_.num_used_;
+    }
+}
+
+int RunSandboxChild(std::string const &shm_name, SandboxPluginCreator create)
+{
+    auto shm = SharedMemory::Open(shm_name, sizeof(SharedBlock));
+    if(!shm) {
+        hwm::dout << "Failed to open the shared memory: " << shm_name << std::endl;
+        return 1;
+    }
+    
+    auto sem = InterProcessSemaphore::Open(GetRequestSemaphoreName(shm_name));
+    if(!sem) {
+        hwm::dout << "Failed to open the semaphore: " << GetRequestSemaphoreName(shm_name) << std::endl;
+        return 1;
+    }
+    
+    auto &sb = *static_cast<SharedBlock *>(shm->data());
+    if(sb.version_ != kProtocolVersion) {
+        hwm::dout << "Sandbox protocol version mismatch: " << sb.version_ << std::endl;
+        sb.child_state_.store(ChildState::kFailed, std::memory_order_release);
+        return 1;
+    }
+    
+    PluginDescription desc;
+    std::unique_ptr<Vst3Plugin> plugin;
+    if(desc.ParseFromArray(sb.description_, std::min(sb.description_size_, kMaxDescriptionSize))) {
+        plugin = create(desc);
+    }
+    
+    if(!plugin) {
+        sb.child_state_.store(ChildState::kFailed, std::memory_order_release);
+        return 1;
+    }
+    
+    WritePluginInfo(*plugin, sb.plugin_info_);
+    sb.child_state_.store(ChildState::kReady, std::memory_order_release);
+    
+    auto last_controller_update = std::chrono::steady_clock::now();
+    
+    for(bool quit = false; quit == false; ) {
+        auto const now = std::chrono::steady_clock::now();
+        if(now - last_controller_update >= kControllerUpdateInterval) {
+            plugin->ApplyPendingControllerUpdates();
+            last_controller_update = now;
+        }
+    
+        if(sem->Wait(kHostCheckIntervalMilliseconds) == false) {
+            if(ChildProcess::IsProcessRunning(sb.host_process_id_) == false) {
+                hwm::dout << "The host process has exited." << std::endl;
+                break;
+            }
+            continue;
+        }
+    
+        auto const seq = sb.request_seq_.load(std::memory_order_acquire);
+        if(seq == sb.response_seq_.load(std::memory_order_relaxed)) {
+            //! 応答済みのリクエスト
+            continue;
+        }
+    
+        bool succeeded = true;
+        switch(sb.request_type_) {
+            case RequestType::kResume:
+                if(plugin->IsResumed()) { plugin->Suspend(); }
+                plugin->SetSamplingRate(sb.setup_.sample_rate_);
+                plugin->SetBlockSize(std::min(sb.setup_.block_size_, kMaxBlockSize));
+                plugin->Resume();
+                succeeded = plugin->IsResumed();
+                break;
+            case RequestType::kSuspend:
+                if(plugin->IsResumed()) { plugin->Suspend(); }
+                break;
+            case RequestType::kProcess:
+                if(plugin->IsResumed()) {
+                    ProcessBlock(*plugin, sb.plugin_info_, sb.block_);
+                } else {
+                    sb.block_.num_output_midi_messages_ = 0;
+                    succeeded = false;
+                }
+                break;
+            case RequestType::kQuit:
+                quit = true;
+                break;
+            default:
+                succeeded = false;
+                break;
+        }
+    
+        sb.succeeded_ = succeeded;
+        sb.block_.response_time_ns_
+        = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        sb.response_seq_.store(seq, std::memory_order_release);
+    }
+    
+    if(plugin->IsResumed()) { plugin->Suspend(); }
+    plugin.reset();
+    return 0;
+}
+
+NS_HWM_END
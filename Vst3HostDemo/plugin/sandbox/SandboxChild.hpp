@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "../vst3/Vst3Plugin.hpp"
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+using SandboxPluginCreator = std::function<std::unique_ptr<Vst3Plugin>(PluginDescription const &desc)>;
+
+//! サンドボックスプロセスのメインループ
+/*! ホストプロセスが作成した共有メモリを開いてプラグインを読み込み、
+ *  ホストからのリクエストを処理する。
+ *  kQuitリクエストを受け取るか、ホストプロセスの終了を検出すると戻る。
+ *
+ *  @param shm_name ホストプロセスが作成した共有メモリの名前
+ *  @param create プラグインを作成する関数
+ *  @return プロセスの終了コード
+ */
+int RunSandboxChild(std::string const &shm_name, SandboxPluginCreator create);
+
+NS_HWM_END
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+#include "../../processor/ProcessInfo.hpp"
+#include "../../transport/TransportInfo.hpp"
+
+NS_HWM_BEGIN
+
+//! プラグインを別プロセス(サンドボックス)で実行するときに、
+//! ホストプロセスとサンドボックスプロセスの間で共有するデータの定義
+/*! 二つのプロセスは、一つの共有メモリ(SharedBlock)と一つのセマフォでやり取りする。
+ *
+ *  ホストは、リクエストの内容を共有メモリに書き込んでから request_seq_ をインクリメントし、
+ *  セマフォをPostしてサンドボックスプロセスを起こす。
+ *  サンドボックスプロセスは、リクエストを処理して結果を共有メモリに書き込んでから、
+ *  response_seq_ を request_seq_ と同じ値に更新する。
+ *  ホストのオーディオスレッドは応答を待機せず、次のブロックの開始時に response_seq_ を確認して、
+ *  前のブロックの結果を受け取る。
+ *
+ *  共有メモリにはポインタを含めず、固定長の配列だけを配置する。
+ */
+namespace Sandbox {
+    
+    //! 共有メモリの内容が変わったときに更新する
+    UInt32 const kProtocolVersion = 3;
+    
+    UInt32 const kMaxChannels = 32;
+    UInt32 const kMaxBlockSize = 4096;
+    UInt32 const kMaxMidiMessages = 2048;
+    UInt32 const kMaxParameterChanges = 1024;
+    UInt32 const kMaxDescriptionSize = 64 * 1024;
+    UInt32 const kMaxNameLength = 256;
+    
+    enum class RequestType : UInt32
+    {
+        kNone,
+        //! setup_の内容で、プラグインの処理を開始する
+        kResume,
+        //! プラグインの処理を停止する
+        kSuspend,
+        //! 1ブロック分のオーディオ処理を行う
+        kProcess,
+        //! サンドボックスプロセスを終了する
+        kQuit,
+    };
+    
+    enum class ChildState : UInt32
+    {
+        //! プラグインを読み込み中
+        kStarting,
+        //! プラグインを読み込んで、リクエストを受け付けられる状態
+        kReady,
+        //! プラグインの読み込みに失敗した
+        kFailed,
+    };
+    
+    struct ParameterChange
+    {
+        UInt32 id_ = 0;
+        double value_ = 0;
+    };
+    
+    //! プラグインの情報。サンドボックスプロセスが、プラグインの読み込み後に書き込む。
+    struct PluginInfo
+    {
+        UInt32 num_inputs_ = 0;
+        UInt32 num_outputs_ = 0;
+        bool has_event_output_ = false;
+        //! UTF-8, null終端
+        char name_[kMaxNameLength] = {};
+    };
+    
+    //! kResume時の設定。ホストが書き込む。
+    struct SetupInfo
+    {
+        double sample_rate_ = 44100;
+        UInt32 block_size_ = 0;
+    };
+    
+    //! kProcess時のデータ
+    struct BlockData
+    {
+        TransportInfo transport_;
+        UInt32 num_samples_ = 0;
+    
+        UInt32 num_input_midi_messages_ = 0;
+        ProcessInfo::MidiMessage input_midi_messages_[kMaxMidiMessages];
+    
+        UInt32 num_output_midi_messages_ = 0;
+        ProcessInfo::MidiMessage output_midi_messages_[kMaxMidiMessages];
+        //! サンドボックスプロセスでの処理時間 [us]。サンドボックスプロセスが書き込む。
+        double process_time_us_ = 0;
+        //! サンドボックスプロセスが応答した時刻。サンドボックスプロセスが書き込む。
+        //! (steady_clockのエポックからの経過時間 [ns]。steady_clockはシステム全体で共通の単調増加の時計なので、
+        //!  ホストの時刻と比較して、リクエストの往復にかかった時間を求められる)
+        Int64 response_time_ns_ = 0;
+    
+        UInt32 num_parameter_changes_ = 0;
+        ParameterChange parameter_changes_[kMaxParameterChanges];
+    
+        float input_audio_[kMaxChannels][kMaxBlockSize];
+        float output_audio_[kMaxChannels][kMaxBlockSize];
+    };
+    
+    struct SharedBlock
+    {
+        UInt32 version_ = kProtocolVersion;
+        //! ホストのプロセスID。サンドボックスプロセスが、ホストの終了を検出するために使用する。
+        UInt32 host_process_id_ = 0;
+        std::atomic<ChildState> child_state_ = { ChildState::kStarting };
+    
+        std::atomic<UInt64> request_seq_ = { 0 };
+        std::atomic<UInt64> response_seq_ = { 0 };
+        RequestType request_type_ = RequestType::kNone;
+        //! リクエストの処理に成功したかどうか
+        bool succeeded_ = false;
+    
+        //! 読み込むプラグインの、シリアライズされたPluginDescription
+        UInt32 description_size_ = 0;
+        char description_[kMaxDescriptionSize];
+    
+        PluginInfo plugin_info_;
+        SetupInfo setup_;
+        BlockData block_;
+    };
+    
+    static_assert(std::atomic<UInt64>::is_always_lock_free,
+                  "the sequence numbers must be lock-free to be shared between processes");
+    static_assert(std::atomic<ChildState>::is_always_lock_free,
+                  "the child state must be lock-free to be shared between processes");
+    static_assert(std::is_trivially_copyable<TransportInfo>::value,
+                  "TransportInfo must be trivially copyable to be placed in shared memory");
+    
+    //! 共有メモリの名前から、リクエストを通知するセマフォの名前を作成する。
+    //! (macOSでは、セマフォの名前は31文字以内にする必要がある)
+    inline
+    std::string GetRequestSemaphoreName(std::string const &shm_name)
+    {
+        return shm_name + "r";
+    }
+}
+
+NS_HWM_END
@@ -0,0 +1,536 @@
+#include "SandboxedVst3Processor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "../../misc/ChildProcess.hpp"
+#include "../../misc/GarbageCollector.hpp"
+#include "../../misc/MPSCQueue.hpp"
+#include "../../misc/SeqLock.hpp"
+#include "../../misc/SharedMemory.hpp"
+#include "../../misc/StrCnv.hpp"
+#include "./SandboxProtocol.hpp"
+
+NS_HWM_BEGIN
+
+using namespace Sandbox;
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+    
+    //! サンドボックスプロセスがプラグインを読み込むまで待機する時間
+    auto const kLaunchTimeout = std::chrono::seconds(30);
+    
+    //! kResume/kSuspendなど、メインスレッドから送るリクエストの応答を待機する時間
+    auto const kControlRequestTimeout = std::chrono::seconds(5);
+    
+    //! 再起動に失敗したときに、次に再起動を試みるまでの間隔
+    auto const kRestartInterval = std::chrono::seconds(1);
+    
+    //! この時間の間、応答のないブロックが続いた場合は、サンドボックスプロセスがハングアップしたものとみなす
+    double const kStallTimeoutSeconds = 2.0;
+    
+    UInt32 const kParameterChangeQueueCapacity = 4096;
+    
+    std::string MakeSharedMemoryName()
+    {
+        static std::atomic<UInt32> counter = { 0 };
+        return "hwm{}_{}"_format(ChildProcess::GetCurrentProcessID(), counter.fetch_add(1));
+    }
+}
+
+struct SandboxedVst3Processor::Impl
+{
+    //! 一つのサンドボックスプロセスとの接続
+    struct Connection
+    {
+        std::unique_ptr<SharedMemory> shm_;
+        std::unique_ptr<InterProcessSemaphore> request_sem_;
+        std::unique_ptr<ChildProcess> process_;
+        SharedBlock *sb_ = nullptr;
+    
+        //! 応答しなくなっているか、リクエストの処理に失敗した
+        std::atomic<bool> broken_ = { false };
+        //! オーディオスレッドからのみアクセスする
+        UInt64 num_consecutive_misses_ = 0;
+        //! 結果をまだ受け取っていないkProcessリクエストがある
+        bool has_pending_block_ = false;
+        //! 最後にkProcessリクエストを送った時刻
+        clock_type::time_point request_time_;
+    
+        //! プロセスの終了を待機するので、起動済みの接続はImpl::Dispose()でワーカースレッドに渡して破棄する。
+        ~Connection()
+        {
+            HWM_ASSERT_NOT_IN_REALTIME_SECTION();
+            Quit();
+        }
+    
+        //! 終了を依頼して、応答しない場合は強制終了する。
+        void Quit()
+        {
+            if(!process_) { return; }
+    
+            if(process_->IsRunning() && SendRequest(RequestType::kQuit)) {
+                process_->Wait(1000);
+            }
+            process_.reset();
+        }
+    
+        //! 前回のリクエストへの応答を待機する。
+        bool WaitForResponse(clock_type::duration timeout)
+        {
+            auto const deadline = clock_type::now() + timeout;
+            for( ; ; ) {
+                auto const seq = sb_->request_seq_.load(std::memory_order_relaxed);
+                if(sb_->response_seq_.load(std::memory_order_acquire) == seq) { return true; }
+                if(clock_type::now() >= deadline || process_->IsRunning() == false) { return false; }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    
+        //! メインスレッドからリクエストを送って、その応答を待機する。
+        //! @pre オーディオスレッドからこの接続が参照されていないこと
+        bool SendRequest(RequestType type, clock_type::duration timeout = kControlRequestTimeout)
+        {
+            if(WaitForResponse(timeout) == false) { return false; }
+    
+            sb_->request_type_ = type;
+            auto const seq = sb_->request_seq_.load(std::memory_order_relaxed) + 1;
+            sb_->request_seq_.store(seq, std::memory_order_release);
+            request_sem_->Post();
+    
+            if(WaitForResponse(timeout) == false) { return false; }
+            return sb_->succeeded_;
+        }
+    };
+    
+    using ConnectionPtr = std::shared_ptr<Connection>;
+    
+    //! ワーカースレッドで行っている再起動
+    struct PendingLaunch
+    {
+        //! 起動時に設定した処理の状態
+        bool is_processing_ = false;
+        double sample_rate_ = 44100;
+        SampleCount block_size_ = 0;
+    
+        //! done_がtrueになった後は、メインスレッドからアクセスする
+        ConnectionPtr connection_;
+        std::atomic<bool> done_ = { false };
+    };
+    
+    PluginDescription desc_;
+    String executable_path_;
+    //! 最初に起動したサンドボックスプロセスから取得したプラグインの情報
+    PluginInfo plugin_info_;
+    
+    //! メインスレッドからアクセスする
+    ConnectionPtr connection_;
+    //! オーディオスレッドからアクセスする
+    std::atomic<Connection *> published_connection_ = { nullptr };
+    
+    MPSCQueue<Sandbox::ParameterChange> parameter_change_queue_ { kParameterChangeQueueCapacity };
+    
+    //! メインスレッドからアクセスする
+    bool is_processing_ = false;
+    double sample_rate_ = 44100;
+    SampleCount block_size_ = 0;
+    clock_type::time_point next_restart_time_;
+    std::shared_ptr<PendingLaunch> pending_launch_;
+    std::atomic<UInt64> stall_threshold_ = { 0 };
+    std::atomic<UInt32> num_restarts_ = { 0 };
+    
+    //! オーディオスレッドで集計した統計情報
+    Statistics rt_statistics_;
+    SeqLock<Statistics> statistics_;
+    
+    //! 古いプロセスの終了や、新しいプロセスの起動を行うワーカースレッド
+    /*! メインスレッドからアクセスする。終了したスレッドは次にスレッドを開始するときにjoinし、
+     *  実行中のスレッドはImplの破棄時にjoinする。
+     */
+    struct WorkerThread
+    {
+        std::thread thread_;
+        std::shared_ptr<std::atomic<bool>> done_;
+    };
+    std::vector<WorkerThread> worker_threads_;
+    
+    ~Impl()
+    {
+        for(auto &w: worker_threads_) { w.thread_.join(); }
+    }
+    
+    template<class F>
+    void StartWorkerThread(F f)
+    {
+        auto finished = std::remove_if(worker_threads_.begin(), worker_threads_.end(), [](auto &w) {
+            if(w.done_->load(std::memory_order_acquire) == false) { return false; }
+            w.thread_.join();
+            return true;
+        });
+        worker_threads_.erase(finished, worker_threads_.end());
+    
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::thread th([f = std::move(f), done]() mutable {
+            f();
+            done->store(true, std::memory_order_release);
+        });
+        worker_threads_.push_back(WorkerThread { std::move(th), std::move(done) });
+    }
+    
+    //! 接続を破棄する。
+    /*! プロセスの終了の待機でメインスレッドを止めないように、ワーカースレッドで破棄する。
+     *  オーディオスレッドから参照されている可能性がある場合は、
+     *  それまでに開始していたリアルタイム処理の区間が終了するのを待ってから破棄する。
+     */
+    void Dispose(ConnectionPtr c)
+    {
+        if(!c) { return; }
+    
+        StartWorkerThread([c = std::move(c)]() mutable {
+            if(auto gc = GarbageCollector::GetInstance()) { gc->WaitForRealtimeSections(); }
+            c.reset();
+        });
+    }
+    
+    //! サンドボックスプロセスを起動して、プラグインの読み込みが完了するまで待機する。
+    //! 最大でkLaunchTimeoutの間ブロックするので、再起動のときはワーカースレッドから呼び出す。
+    static
+    ConnectionPtr Launch(PluginDescription const &desc, String const &executable_path)
+    {
+        auto c = std::make_shared<Connection>();
+        auto const name = MakeSharedMemoryName();
+    
+        c->shm_ = SharedMemory::Create(name, sizeof(SharedBlock));
+        if(!c->shm_) {
+            hwm::dout << "Failed to create the shared memory: " << name << std::endl;
+            return nullptr;
+        }
+    
+        c->sb_ = new(c->shm_->data()) SharedBlock();
+        c->sb_->host_process_id_ = ChildProcess::GetCurrentProcessID();
+    
+        std::string desc_data;
+        desc.SerializeToString(&desc_data);
+        if(desc_data.size() > kMaxDescriptionSize) {
+            hwm::dout << "The plugin description is too large: " << desc_data.size() << std::endl;
+            return nullptr;
+        }
+        std::memcpy(c->sb_->description_, desc_data.data(), desc_data.size());
+        c->sb_->description_size_ = desc_data.size();
+    
+        c->request_sem_ = InterProcessSemaphore::Create(GetRequestSemaphoreName(name));
+        if(!c->request_sem_) {
+            hwm::dout << "Failed to create the semaphore: " << GetRequestSemaphoreName(name) << std::endl;
+            return nullptr;
+        }
+    
+        c->process_ = ChildProcess::Start(executable_path, { L"--sandbox-child", to_wstr(name) });
+        if(!c->process_) {
+            hwm::wdout << L"Failed to start the sandbox process: " << executable_path << std::endl;
+            return nullptr;
+        }
+    
+        auto const deadline = clock_type::now() + kLaunchTimeout;
+        for( ; ; ) {
+            auto const state = c->sb_->child_state_.load(std::memory_order_acquire);
+            if(state == ChildState::kReady) { break; }
+    
+            if(state == ChildState::kFailed
+               || c->process_->IsRunning() == false
+               || clock_type::now() >= deadline)
+            {
+                hwm::dout << "Failed to load the plugin in the sandbox process: " << desc.name() << std::endl;
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    
+        return c;
+    }
+    
+    //! 接続を差し替える。古い接続は、オーディオスレッドから参照されなくなった後に破棄される。
+    void Publish(ConnectionPtr c)
+    {
+        auto old = std::move(connection_);
+        connection_ = std::move(c);
+        published_connection_.store(connection_.get(), std::memory_order_release);
+        Dispose(std::move(old));
+    }
+    
+    void OnBlockMissed(Connection &c)
+    {
+        rt_statistics_.num_missed_blocks_ += 1;
+        statistics_.Store(rt_statistics_);
+    
+        c.num_consecutive_misses_ += 1;
+        if(c.num_consecutive_misses_ >= stall_threshold_.load(std::memory_order_relaxed)) {
+            c.broken_.store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    void OnBlockProcessed(Connection &c, double process_time_us, double round_trip_time_us)
+    {
+        auto const overhead_us = std::max(round_trip_time_us - process_time_us, 0.0);
+    
+        auto &st = rt_statistics_;
+        st.num_processed_blocks_ += 1;
+        auto const n = (double)st.num_processed_blocks_;
+        st.mean_process_time_us_ += (process_time_us - st.mean_process_time_us_) / n;
+        st.max_process_time_us_ = std::max(st.max_process_time_us_, process_time_us);
+        st.mean_round_trip_time_us_ += (round_trip_time_us - st.mean_round_trip_time_us_) / n;
+        st.max_round_trip_time_us_ = std::max(st.max_round_trip_time_us_, round_trip_time_us);
+        st.mean_overhead_us_ += (overhead_us - st.mean_overhead_us_) / n;
+        st.max_overhead_us_ = std::max(st.max_overhead_us_, overhead_us);
+        statistics_.Store(st);
+    
+        c.num_consecutive_misses_ = 0;
+    }
+};
+
+SandboxedVst3Processor::SandboxedVst3Processor(PluginDescription const &desc, String const &executable_path)
+:   pimpl_(std::make_unique<Impl>())
+{
+    pimpl_->desc_ = desc;
+    pimpl_->executable_path_ = executable_path;
+    
+    auto c = Impl::Launch(desc, executable_path);
+    if(!c) {
+        throw std::runtime_error("Failed to load the plugin in the sandbox process: " + desc.name());
+    }
+    
+    pimpl_->plugin_info_ = c->sb_->plugin_info_;
+    pimpl_->Publish(std::move(c));
+}
+
+SandboxedVst3Processor::~SandboxedVst3Processor()
+{
+    //! 接続の破棄と、実行中の再起動の完了を待機する。
+    pimpl_->Publish(nullptr);
+    pimpl_.reset();
+}
+
+String SandboxedVst3Processor::GetName() const
+{
+    return to_wstr(std::string(pimpl_->plugin_info_.name_));
+}
+
+PluginDescription const & SandboxedVst3Processor::GetDescription() const
+{
+    return pimpl_->desc_;
+}
+
+void SandboxedVst3Processor::OnStartProcessing(double sample_rate, SampleCount block_size)
+{
+    pimpl_->is_processing_ = true;
+    pimpl_->sample_rate_ = sample_rate;
+    pimpl_->block_size_ = std::min<SampleCount>(block_size, kMaxBlockSize);
+    
+    auto const stall_threshold = kStallTimeoutSeconds * sample_rate / std::max<SampleCount>(block_size, 1);
+    pimpl_->stall_threshold_ = std::max<UInt64>(1, (UInt64)stall_threshold);
+    
+    auto c = pimpl_->connection_.get();
+    if(!c) { return; }
+    
+    c->sb_->setup_.sample_rate_ = sample_rate;
+    c->sb_->setup_.block_size_ = (UInt32)pimpl_->block_size_;
+    if(c->SendRequest(RequestType::kResume) == false) {
+        //! RestartIfNeeded()で再起動される。
+        c->broken_ = true;
+    }
+}
+
+void SandboxedVst3Processor::OnStopProcessing()
+{
+    pimpl_->is_processing_ = false;
+    
+    auto c = pimpl_->connection_.get();
+    if(!c) { return; }
+    
+    if(c->SendRequest(RequestType::kSuspend) == false) {
+        c->broken_ = true;
+    }
+}
+
+void SandboxedVst3Processor::Process(ProcessInfo &pi)
+{
+    //! 接続がない場合や応答がない場合は、何もしない。
+    //! (出力バッファは、GraphProcessorによって無音にクリアされている)
+    auto c = pimpl_->published_connection_.load(std::memory_order_acquire);
+    if(!c || c->broken_.load(std::memory_order_relaxed)) { return; }
+    
+    auto &sb = *c->sb_;
+    auto const seq = sb.request_seq_.load(std::memory_order_relaxed);
+    if(sb.response_seq_.load(std::memory_order_acquire) != seq) {
+        //! 前のブロックの処理がまだ終わっていない。
+        //! 遅れて届いた結果は、次のブロックとずれるので使用しない。
+        c->has_pending_block_ = false;
+        pimpl_->OnBlockMissed(*c);
+        return;
+    }
+    
+    auto const &info = pimpl_->plugin_info_;
+    auto &block = sb.block_;
+    
+    //! 応答を待たずに、前のブロックで送ったリクエストの結果を出力する。
+    //! (オーディオスレッドを待機させない代わりに、1ブロック分のレイテンシーが生じる)
+    //! (間にkResume/kSuspendが送られた場合は、その応答で上書きされているので使用しない)
+    if(c->has_pending_block_) {
+        c->has_pending_block_ = false;
+    
+        auto const response_time
+        = clock_type::time_point(std::chrono::duration_cast<clock_type::duration>(std::chrono::nanoseconds(block.response_time_ns_)));
+        auto const round_trip_time_us = std::chrono::duration<double, std::micro>(response_time - c->request_time_).count();
+        pimpl_->OnBlockProcessed(*c, block.process_time_us_, round_trip_time_us);
+    
+        if(sb.request_type_ == RequestType::kProcess && sb.succeeded_) {
+            auto &dest_audio = pi.output_audio_buffer_;
+            auto const num_output_channels = std::min<UInt32>(info.num_outputs_, dest_audio.channels());
+            auto const num_output_samples = std::min<UInt32>(block.num_samples_, dest_audio.samples());
+            for(UInt32 ch = 0; ch < num_output_channels; ++ch) {
+                std::copy_n(block.output_audio_[ch], num_output_samples, dest_audio.get_channel_data(ch));
+            }
+    
+            auto &dest_midi = pi.output_midi_buffer_;
+            auto const num_output_midi_messages = std::min<UInt32>(block.num_output_midi_messages_,
+                                                                   dest_midi.buffer_.size() - dest_midi.num_used_);
+            std::copy_n(block.output_midi_messages_,
+                        num_output_midi_messages,
+                        dest_midi.buffer_.begin() + dest_midi.num_used_);
+            dest_midi.num_used_ += num_output_midi_messages;
+        }
+    }
+    
+    assert(pi.time_info_);
+    block.transport_ = *pi.time_info_;
+    auto const num_samples = std::min<UInt32>(pi.time_info_->GetSmpDuration(), kMaxBlockSize);
+    block.num_samples_ = num_samples;
+    
+    auto &src_audio = pi.input_audio_buffer_;
+    for(UInt32 ch = 0; ch < info.num_inputs_; ++ch) {
+        if(ch < src_audio.channels()) {
+            std::copy_n(src_audio.get_channel_data(ch), num_samples, block.input_audio_[ch]);
+        } else {
+            std::fill_n(block.input_audio_[ch], num_samples, 0.0f);
+        }
+    }
+    
+    auto const &src_midi = pi.input_midi_buffer_;
+    auto const num_input_midi_messages = std::min(src_midi.num_used_, kMaxMidiMessages);
+    std::copy_n(src_midi.buffer_.begin(), num_input_midi_messages, block.input_midi_messages_);
+    block.num_input_midi_messages_ = num_input_midi_messages;
+    
+    UInt32 num_parameter_changes = 0;
+    for( ; num_parameter_changes < kMaxParameterChanges; ++num_parameter_changes) {
+        if(pimpl_->parameter_change_queue_.TryPop(block.parameter_changes_[num_parameter_changes]) == false) {
+            break;
+        }
+    }
+    block.num_parameter_changes_ = num_parameter_changes;
+    
+    sb.request_type_ = RequestType::kProcess;
+    c->request_time_ = clock_type::now();
+    sb.request_seq_.store(seq + 1, std::memory_order_release);
+    c->request_sem_->Post();
+    c->has_pending_block_ = true;
+}
+
+SampleCount SandboxedVst3Processor::GetLatencySample() const
+{
+    return pimpl_->block_size_;
+}
+
+UInt32 SandboxedVst3Processor::GetAudioChannelCount(BusDirection dir) const
+{
+    if(dir == BusDirection::kInputSide) { return pimpl_->plugin_info_.num_inputs_; }
+    else                                { return pimpl_->plugin_info_.num_outputs_; }
+}
+
+UInt32 SandboxedVst3Processor::GetMidiChannelCount(BusDirection dir) const
+{
+    if(dir == BusDirection::kInputSide) { return 1; }
+    else                                { return pimpl_->plugin_info_.has_event_output_ ? 1 : 0; }
+}
+
+void SandboxedVst3Processor::EnqueueParameterChange(UInt32 id, double value)
+{
+    Sandbox::ParameterChange pc;
+    pc.id_ = id;
+    pc.value_ = value;
+    pimpl_->parameter_change_queue_.TryPush(pc);
+}
+
+bool SandboxedVst3Processor::RestartIfNeeded()
+{
+    if(auto pending = pimpl_->pending_launch_) {
+        if(pending->done_.load(std::memory_order_acquire) == false) { return false; }
+        pimpl_->pending_launch_.reset();
+    
+        auto new_connection = std::move(pending->connection_);
+        if(!new_connection) { return false; }
+    
+        if(pending->is_processing_ != pimpl_->is_processing_
+           || (pimpl_->is_processing_ && (pending->sample_rate_ != pimpl_->sample_rate_
+                                          || pending->block_size_ != pimpl_->block_size_)))
+        {
+            //! 起動中に処理の開始や停止が行われた場合は、設定が合わないので、すぐに起動し直す。
+            pimpl_->next_restart_time_ = clock_type::time_point();
+            pimpl_->Dispose(std::move(new_connection));
+            return false;
+        }
+    
+        pimpl_->Publish(std::move(new_connection));
+        pimpl_->num_restarts_.fetch_add(1);
+        return true;
+    }
+    
+    auto c = pimpl_->connection_.get();
+    if(c && c->process_->IsRunning() && c->broken_.load() == false) { return false; }
+    
+    auto const now = clock_type::now();
+    if(now < pimpl_->next_restart_time_) { return false; }
+    pimpl_->next_restart_time_ = now + kRestartInterval;
+    
+    hwm::dout << "Restart the sandbox process: " << pimpl_->desc_.name() << std::endl;
+    
+    //! 古いプロセスは、オーディオスレッドから参照されないようにしてから破棄する。
+    pimpl_->Publish(nullptr);
+    
+    //! プラグインの読み込みには時間がかかることがあるので、メインスレッドを止めないように、
+    //! ワーカースレッドで起動する。完了後に呼び出されたときに、新しい接続に切り替える。
+    auto pending = std::make_shared<Impl::PendingLaunch>();
+    pending->is_processing_ = pimpl_->is_processing_;
+    pending->sample_rate_ = pimpl_->sample_rate_;
+    pending->block_size_ = pimpl_->block_size_;
+    pimpl_->pending_launch_ = pending;
+    
+    pimpl_->StartWorkerThread([pending, desc = pimpl_->desc_, executable_path = pimpl_->executable_path_] {
+        auto new_connection = Impl::Launch(desc, executable_path);
+        if(new_connection && pending->is_processing_) {
+            auto &setup = new_connection->sb_->setup_;
+            setup.sample_rate_ = pending->sample_rate_;
+            setup.block_size_ = (UInt32)pending->block_size_;
+            if(new_connection->SendRequest(RequestType::kResume) == false) {
+                new_connection.reset();
+            }
+        }
+    
+        pending->connection_ = std::move(new_connection);
+        pending->done_.store(true, std::memory_order_release);
+    });
+    
+    return false;
+}
+
+SandboxedVst3Processor::Statistics SandboxedVst3Processor::GetStatistics() const
+{
+    auto st = pimpl_->statistics_.Load();
+    st.num_restarts_ = pimpl_->num_restarts_.load();
+    return st;
+}
+
+NS_HWM_END
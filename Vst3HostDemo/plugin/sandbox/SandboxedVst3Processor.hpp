@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+
+#include "../../processor/Processor.hpp"
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! プラグインを別プロセス(サンドボックスプロセス)で実行するProcessor
+/*! サンドボックスプロセスは、ホストと同じ実行ファイルを --sandbox-child オプション付きで起動したもの。
+ *  オーディオ、MIDI、パラメータの変更は、共有メモリを経由してブロックごとにやり取りする。
+ *  (詳細はSandboxProtocol.hppを参照)
+ *
+ *  オーディオスレッドはサンドボックスプロセスの応答を待たずに、あるブロックで送ったリクエストの結果を
+ *  次のブロックで出力する。そのため、1ブロック分のレイテンシーが生じる。
+ *  次のブロックまでに応答がない場合、そのブロックは無音として扱う。
+ *  プラグインがクラッシュやハングアップした場合は、RestartIfNeeded()でサンドボックスプロセスを再起動する。
+ *  再起動はグラフの処理とメインスレッドを止めずに、ワーカースレッドで行われる。再起動中のブロックは無音になる。
+ *
+ *  プラグインのエディタとプラグインの状態の保存・復元には対応していない。
+ *  再起動したプラグインは、デフォルトの状態から処理を再開する。
+ */
+class SandboxedVst3Processor
+:   public Processor
+{
+public:
+    //! サンドボックスプロセスを起動して、プラグインを読み込む。
+    /*! 読み込みが完了するまでブロックするので、GUIから作成する場合は、
+     *  MyApp::CreateSandboxedProcessorAsync()でバックグラウンドスレッドから作成する。
+     *  @param desc 読み込むプラグイン
+     *  @param executable_path サンドボックスプロセスとして起動する実行ファイルのパス
+     *  @throw std::runtime_error サンドボックスプロセスの起動か、プラグインの読み込みに失敗した
+     */
+    SandboxedVst3Processor(PluginDescription const &desc, String const &executable_path);
+    
+    //! サンドボックスプロセスの終了処理と、実行中の再起動が完了するまで待機してから破棄する。
+    ~SandboxedVst3Processor();
+    
+    String GetName() const override;
+    
+    void OnStartProcessing(double sample_rate, SampleCount block_size) override;
+    void Process(ProcessInfo &pi) override;
+    void OnStopProcessing() override;
+    
+    //! 1ブロック分のレイテンシーを返す。
+    SampleCount GetLatencySample() const override;
+    
+    UInt32 GetAudioChannelCount(BusDirection dir) const override;
+    UInt32 GetMidiChannelCount(BusDirection dir) const override;
+    
+    bool HasEditor() const override { return false; }
+    
+    PluginDescription const & GetDescription() const;
+    
+    //! パラメータの変更を、次のブロックでサンドボックスプロセスに送る。
+    void EnqueueParameterChange(UInt32 id, double value);
+    
+    //! サンドボックスプロセスが終了しているか、応答しなくなっている場合に再起動する。
+    /*! メインスレッドから定期的に呼び出す。
+     *  新しいサンドボックスプロセスはワーカースレッドで起動し、この関数はその完了を待たずに戻る。
+     *  起動が完了した後の呼び出しで、新しいプロセスに切り替える。
+     *  @return 新しいプロセスに切り替えた場合はtrue
+     */
+    bool RestartIfNeeded();
+    
+    //! ブロックごとの往復にかかった時間などの統計情報
+    struct Statistics
+    {
+        //! 時間内に処理が完了したブロック数
+        UInt64 num_processed_blocks_ = 0;
+        //! 時間内に処理が完了せず、無音として扱ったブロック数
+        UInt64 num_missed_blocks_ = 0;
+        //! 時間内に処理が完了したブロックの、サンドボックスプロセスでの処理時間の平均と最大値 [us]
+        double mean_process_time_us_ = 0;
+        double max_process_time_us_ = 0;
+        //! 時間内に処理が完了したブロックの、リクエストを送ってからサンドボックスプロセスが応答するまでの時間の平均と最大値 [us]
+        double mean_round_trip_time_us_ = 0;
+        double max_round_trip_time_us_ = 0;
+        //! 往復の時間から処理時間を除いた、プロセス間のやり取りにかかった時間の平均と最大値 [us]
+        //! (セマフォによる起床の遅れや、プロセスの切り替えにかかった時間)
+        double mean_overhead_us_ = 0;
+        double max_overhead_us_ = 0;
+        //! サンドボックスプロセスを再起動した回数
+        UInt32 num_restarts_ = 0;
+    };
+    
+    //! 統計情報を取得する。オーディオスレッドで処理中でも呼び出せる。
+    Statistics GetStatistics() const;
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
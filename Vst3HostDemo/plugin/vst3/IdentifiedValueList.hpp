@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <type_traits>
 #include <vector>
 
 NS_HWM_BEGIN
@@ -12,6 +13,11 @@ struct DefaultExtractor
     id_type operator()(T const &info) const { return info.id_; }
 };
 
+//! IDで要素を検索できるリスト
+/*! GetIndexByID()はオーディオスレッドからも呼び出されるので、
+ *  IDからインデックスを引くテーブルは、ノードを確保しないオープンアドレス法のハッシュテーブルにしている。
+ *  (線形探索で、負荷率は1/2以下に保つ)
+ */
 template<class T, class Extractor = DefaultExtractor<T>>
 class IdentifiedValueList
 {
@@ -24,6 +30,8 @@ public:
     using id_type = decltype(std::declval<extractor_type>()(std::declval<T>()));
     typedef size_t size_type;
     
+    static_assert(std::is_integral<id_type>::value, "id_type must be an integral type");
+    
     T const & GetItemByID(id_type id) const
     {
         return list_[GetIndexByID(id)];
@@ -38,21 +46,38 @@ public:
     //! @return (size_type)-1 if not found.
     size_type GetIndexByID(id_type id) const
     {
-        auto found = std::find_if(list_.begin(),
-                                  list_.end(),
-                                  [id](auto &x) { return Extractor{}(x) == id; }
-                                  );
-        if(found == list_.end()) { return -1; }
-        else { return found - list_.begin(); }
+        if(slots_.empty()) { return -1; }
+        
+        auto const mask = slots_.size() - 1;
+        for(auto i = GetHash(id) & mask; ; i = (i + 1) & mask) {
+            auto const &slot = slots_[i];
+            if(slot.index_ == kEmptySlot) { return -1; }
+            if(slot.id_ == id) { return slot.index_; }
+        }
     }
     
     void AddItem(T const &item)
     {
         auto new_id = Extractor{}(item);
-        assert(GetIndexByID(new_id) == -1);
+        assert(GetIndexByID(new_id) == (size_type)-1); // id should be unique.
+        
+        if((list_.size() + 1) * 2 > slots_.size()) {
+            Rehash(std::max<size_type>(kMinNumSlots, slots_.size() * 2));
+        }
+        
+        InsertSlot(new_id, list_.size());
         list_.push_back(item);
     }
     
+    void reserve(size_type n)
+    {
+        list_.reserve(n);
+        
+        auto num_slots = kMinNumSlots;
+        while(num_slots < n * 2) { num_slots *= 2; }
+        if(num_slots > slots_.size()) { Rehash(num_slots); }
+    }
+    
     size_type size() const { return list_.size(); }
     bool empty() const { return list_.empty(); }
     
@@ -60,7 +85,45 @@ public:
     const_iterator end() const { return list_.end(); }
     
 private:
+    struct Slot
+    {
+        id_type id_ = id_type();
+        //! 空きスロットの場合はkEmptySlot
+        size_type index_ = kEmptySlot;
+    };
+    
+    static constexpr size_type kEmptySlot = (size_type)-1;
+    //! 2のべき乗
+    static constexpr size_type kMinNumSlots = 16;
+    
     std::vector<T> list_;
+    //! IDからlist_上のインデックスを引くためのテーブル。サイズは2のべき乗。
+    std::vector<Slot> slots_;
+    
+    //! 連続したIDや、下位ビットが揃ったIDが同じ位置に集まらないように、フィボナッチハッシュで散らす。
+    static size_t GetHash(id_type id)
+    {
+        auto const h = (UInt64)id * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ (h >> 32));
+    }
+    
+    //! @pre slots_に空きスロットがあること
+    void InsertSlot(id_type id, size_type index)
+    {
+        auto const mask = slots_.size() - 1;
+        auto i = GetHash(id) & mask;
+        while(slots_[i].index_ != kEmptySlot) { i = (i + 1) & mask; }
+        slots_[i].id_ = id;
+        slots_[i].index_ = index;
+    }
+    
+    void Rehash(size_type num_slots)
+    {
+        slots_.assign(num_slots, Slot());
+        for(size_type i = 0; i < list_.size(); ++i) {
+            InsertSlot(Extractor{}(list_[i]), i);
+        }
+    }
 };
 
 NS_HWM_END
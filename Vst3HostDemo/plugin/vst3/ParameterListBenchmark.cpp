@@ -0,0 +1,111 @@
+#include "ParameterListBenchmark.hpp"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../../misc/Benchmark.hpp"
+#include "./Vst3Plugin.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    using ParameterInfo = Vst3Plugin::ParameterInfo;
+    using ParameterInfoList = IdentifiedValueList<ParameterInfo>;
+    using ParamID = Vst3Plugin::ParamID;
+
+    //! 実際のプラグインと同様に、連続しない重複のないIDを作る。
+    std::vector<ParamID> MakeParamIDs(UInt32 num_params)
+    {
+        std::mt19937 rng(0);
+        std::unordered_set<ParamID> used;
+        std::vector<ParamID> ids;
+        ids.reserve(num_params);
+        while(ids.size() < num_params) {
+            auto const id = (ParamID)rng();
+            if(used.insert(id).second) { ids.push_back(id); }
+        }
+        return ids;
+    }
+
+    ParameterInfoList MakeParameterInfoList(std::vector<ParamID> const &ids)
+    {
+        ParameterInfoList list;
+        list.reserve(ids.size());
+        for(size_t i = 0; i < ids.size(); ++i) {
+            ParameterInfo pi;
+            pi.id_ = ids[i];
+            pi.title_ = L"Parameter " + std::to_wstring(i);
+            pi.short_title_ = L"P" + std::to_wstring(i);
+            pi.step_count_ = 0;
+            pi.default_normalized_value_ = 0.5;
+            pi.unit_id_ = 0;
+            list.AddItem(pi);
+        }
+        return list;
+    }
+
+    //! ハッシュテーブルを導入する前のGetIndexByID()と同じ線形探索。比較用。
+    size_t FindIndexLinearly(ParameterInfoList const &list, ParamID id)
+    {
+        auto found = std::find_if(list.begin(), list.end(), [id](auto const &pi) { return pi.id_ == id; });
+        if(found == list.end()) { return -1; }
+        return found - list.begin();
+    }
+}
+
+int RunParameterListBenchmark(UInt32 num_params, UInt32 num_iterations)
+{
+    if(num_params == 0 || num_iterations == 0) { return 1; }
+
+    auto const ids = MakeParamIDs(num_params);
+
+    std::vector<double> load_times;
+    ParameterInfoList list;
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        auto const t_begin = BenchmarkClock::now();
+        list = MakeParameterInfoList(ids);
+        load_times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+    }
+
+    PrintBenchmarkTimes("Load {} parameters"_format(num_params), load_times);
+
+    auto queries = ids;
+    std::shuffle(queries.begin(), queries.end(), std::mt19937(1));
+
+    std::vector<double> hashed_times;
+    std::vector<size_t> hashed_indices(queries.size());
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        auto const t_begin = BenchmarkClock::now();
+        for(size_t q = 0; q < queries.size(); ++q) {
+            hashed_indices[q] = list.GetIndexByID(queries[q]);
+        }
+        hashed_times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+    }
+
+    PrintBenchmarkTimes("Query {} IDs (hash table)"_format(queries.size()), hashed_times);
+
+    std::vector<double> linear_times;
+    std::vector<size_t> linear_indices(queries.size());
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        auto const t_begin = BenchmarkClock::now();
+        for(size_t q = 0; q < queries.size(); ++q) {
+            linear_indices[q] = FindIndexLinearly(list, queries[q]);
+        }
+        linear_times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+    }
+
+    PrintBenchmarkTimes("Query {} IDs (linear search)"_format(queries.size()), linear_times);
+
+    if(hashed_indices != linear_indices) {
+        hwm::dout << "The hash table returned different indices from the linear search." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+NS_HWM_END
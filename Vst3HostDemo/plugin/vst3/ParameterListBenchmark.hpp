@@ -0,0 +1,15 @@
+#pragma once
+
+NS_HWM_BEGIN
+
+//! パラメータ情報のリスト(IdentifiedValueList)の構築とIDによる検索にかかる時間を計測する。
+/*! ランダムなIDを持つnum_params個のパラメータ情報でリストを構築し、全IDをシャッフルした順で検索する。
+ *  検索は、ハッシュテーブルによるGetIndexByID()と、比較用の線形探索の両方で行い、
+ *  それぞれnum_iterations回の所要時間の最小値、中央値、最大値を出力する。
+ *  また、2つの方法で検索したインデックスが一致するかどうかも確認する。
+ *
+ *  @return プロセスの終了コード
+ */
+int RunParameterListBenchmark(UInt32 num_params, UInt32 num_iterations);
+
+NS_HWM_END
@@ -105,6 +105,7 @@ tresult PLUGIN_API Vst3Plugin::HostContext::restartComponent (int32 flags)
 tresult PLUGIN_API Vst3Plugin::HostContext::setDirty (TBool state)
 {
     hwm::dout << "Plugin has dirty [{}]"_format(state != 0) << std::endl;
+    if(state && plugin_) { plugin_->SetDirty(true); }
     return kResultOk;
 }
 
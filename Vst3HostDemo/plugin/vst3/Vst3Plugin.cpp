@@ -1,6 +1,7 @@
 #include "Vst3Plugin.hpp"
 #include "Vst3PluginImpl.hpp"
 #include "Vst3HostContext.hpp"
+#include "../../misc/GarbageCollector.hpp"
 
 #include <cassert>
 #include <memory>
@@ -21,6 +22,8 @@ Vst3Plugin::Vst3Plugin(std::unique_ptr<Impl> pimpl,
 
 Vst3Plugin::~Vst3Plugin()
 {
+    //! プラグインのアンロードをオーディオスレッド上で行わないようにする。
+    HWM_ASSERT_NOT_IN_REALTIME_SECTION();
     assert(IsEditorOpened() == false);
     
 	pimpl_.reset();
@@ -50,7 +53,12 @@ size_t Vst3Plugin::GetNumInputs() const
 
 size_t Vst3Plugin::GetNumOutputs() const
 {
-	return pimpl_->GetBusesInfo(Vst::BusDirections::kInput).GetNumActiveChannels();
+	return pimpl_->GetBusesInfo(Vst::BusDirections::kOutput).GetNumActiveChannels();
+}
+
+bool Vst3Plugin::HasEventOutput() const
+{
+    return pimpl_->HasEventOutput();
 }
 
 UInt32  Vst3Plugin::GetNumParams() const
@@ -142,6 +150,12 @@ bool Vst3Plugin::SetSpeakerArrangement(BusDirection dir, UInt32 index, SpeakerAr
     return pimpl_->GetBusesInfo(dir).SetSpeakerArrangement(index, arr);
 }
 
+void Vst3Plugin::SetupProcessing()
+{
+	assert(!IsResumed());
+	pimpl_->SetupProcessing();
+}
+
 void Vst3Plugin::Resume()
 {
 	pimpl_->Resume();
@@ -216,6 +230,17 @@ void Vst3Plugin::SetProgramIndex(UInt32 index, UnitID id)
 void Vst3Plugin::EnqueueParameterChange(Vst::ParamID id, Vst::ParamValue value)
 {
 	pimpl_->PushBackParameterChange(id, value);
+    pimpl_->SetDirty(true);
+}
+
+UInt64 Vst3Plugin::GetNumDroppedParameterChanges() const
+{
+    return pimpl_->GetNumDroppedParameterChanges();
+}
+
+void Vst3Plugin::ApplyPendingControllerUpdates()
+{
+    pimpl_->ApplyPendingControllerUpdates();
 }
 
 void Vst3Plugin::RestartComponent(Steinberg::int32 flags)
@@ -223,6 +248,56 @@ void Vst3Plugin::RestartComponent(Steinberg::int32 flags)
 	pimpl_->RestartComponent(flags);
 }
 
+std::optional<std::vector<char>> Vst3Plugin::GetComponentState()
+{
+    return pimpl_->GetComponentState();
+}
+
+std::optional<std::vector<char>> Vst3Plugin::GetControllerState()
+{
+    return pimpl_->GetControllerState();
+}
+
+bool Vst3Plugin::SetComponentState(std::vector<char> const &data)
+{
+    return pimpl_->SetComponentState(data);
+}
+
+bool Vst3Plugin::SetControllerState(std::vector<char> const &data)
+{
+    return pimpl_->SetControllerState(data);
+}
+
+Vst3Plugin::StateSnapshotPtr Vst3Plugin::TakeStateSnapshot()
+{
+    return pimpl_->TakeStateSnapshot();
+}
+
+bool Vst3Plugin::ApplyStateSnapshot(StateSnapshotPtr const &snapshot)
+{
+    return pimpl_->ApplyStateSnapshot(snapshot);
+}
+
+std::shared_future<bool> Vst3Plugin::ApplyStateSnapshotAsync(StateSnapshotPtr snapshot)
+{
+    return pimpl_->ApplyStateSnapshotAsync(std::move(snapshot));
+}
+
+Vst3StateSnapshotCache & Vst3Plugin::GetStateSnapshotCache()
+{
+    return pimpl_->GetStateSnapshotCache();
+}
+
+bool Vst3Plugin::IsDirty() const
+{
+    return pimpl_->IsDirty();
+}
+
+void Vst3Plugin::SetDirty(bool dirty)
+{
+    pimpl_->SetDirty(dirty);
+}
+
 void Vst3Plugin::Process(ProcessInfo &pi)
 {
     pimpl_->Process(pi);
@@ -2,8 +2,10 @@
 
 #include <array>
 #include <memory>
+#include <vector>
 
 #include <functional>
+#include <future>
 
 #include <pluginterfaces/vst/ivstcomponent.h>
 #include <pluginterfaces/vst/ivstaudioprocessor.h>
@@ -18,6 +20,8 @@
 
 NS_HWM_BEGIN
 
+class Vst3StateSnapshotCache;
+
 struct Vst3Note
 {
     enum class Type {
@@ -166,6 +170,23 @@ public:
         SpeakerArrangement speaker_ = Steinberg::Vst::SpeakerArr::kEmpty;
         bool is_active_ = false;
     };
+    
+    //! プラグインの状態のスナップショット
+    struct StateSnapshot
+    {
+        //! IComponent::getState()で取得した状態
+        std::vector<char> component_state_;
+        //! IEditController::getState()で取得した状態。コントローラがない場合は無効値
+        std::optional<std::vector<char>> controller_state_;
+        
+        //! データの合計サイズ(バイト)
+        size_t GetSize() const
+        {
+            return component_state_.size() + (controller_state_ ? controller_state_->size() : 0);
+        }
+    };
+    
+    using StateSnapshotPtr = std::shared_ptr<StateSnapshot const>;
 
 public:
 	Vst3Plugin(std::unique_ptr<Impl> pimpl,
@@ -181,6 +202,9 @@ public:
 	size_t	GetNumInputs() const;
     size_t  GetNumOutputs() const;
     
+    //! ノートなどのイベントを出力するかどうか
+    bool    HasEventOutput() const;
+    
     UInt32  GetNumParams() const;
     ParameterInfo const & GetParameterInfoByIndex(UInt32 index) const;
     ParameterInfo const & GetParameterInfoByID(ParamID id) const;
@@ -206,6 +230,11 @@ public:
     SpeakerArrangement GetSpeakerArrangementForBus(BusDirection dir, UInt32 index) const;
     bool SetSpeakerArrangement(BusDirection dir, UInt32 index, SpeakerArrangement arr);
     
+	//! 現在のサンプリングレートとブロックサイズで、setupProcessingを済ませておく。
+	/*! 続けて同じ設定でResume()を呼び出した場合は、setupProcessingの呼び出しが省略される。
+	 *  @pre IsResumed() == false
+	 */
+	void	SetupProcessing();
 	void	Resume();
 	void	Suspend();
 	bool	IsResumed() const;
@@ -244,9 +273,65 @@ public:
 	//! パラメータの変更を次回の再生フレームでAudioProcessorに送信して適用するために、
 	//! 変更する情報をキューに貯める
 	void	EnqueueParameterChange(Steinberg::Vst::ParamID id, Steinberg::Vst::ParamValue value);
+    
+    //! キューが一杯だったために破棄したパラメータの変更の数
+    UInt64  GetNumDroppedParameterChanges() const;
+    
+    //! オーディオスレッドで発生したパラメータの変更を、EditControllerに反映する。
+    /*! Process()の中でMIDIのコントロールチェンジなどから変換したパラメータの変更や、
+     *  プラグインが出力したパラメータの変更(メーターなど)は、
+     *  オーディオスレッド上ではEditControllerに通知せずにキューに貯めておく。
+     *  メインスレッドからこの関数を定期的に呼び出して、それらの変更をEditControllerに反映すること。
+     */
+    void    ApplyPendingControllerUpdates();
 
 	void	RestartComponent(Steinberg::int32 flag);
-    
+
+    //! IComponent::getState()で取得したプラグインの状態を返す。
+    //! 取得に失敗した場合は無効値が返る。
+    std::optional<std::vector<char>> GetComponentState();
+
+    //! IEditController::getState()で取得したコントローラの状態を返す。
+    //! コントローラがないか、取得に失敗した場合は無効値が返る。
+    std::optional<std::vector<char>> GetControllerState();
+
+    //! GetComponentState()で取得した状態をプラグインに適用する。
+    //! コントローラがある場合は、IEditController::setComponentState()でコントローラにも同じ状態を反映する。
+    bool    SetComponentState(std::vector<char> const &data);
+
+    //! GetControllerState()で取得した状態をコントローラに適用する。
+    bool    SetControllerState(std::vector<char> const &data);
+    
+    //! 現在のプラグインとコントローラの状態のスナップショットを作成する。
+    //! 状態の取得に失敗した場合はnullptrが返る。
+    StateSnapshotPtr TakeStateSnapshot();
+    
+    //! スナップショットをプラグインとコントローラに適用する。
+    /*! IComponent::setState()はオーディオスレッドを止めずに呼び出し、読み込みが終わるまでは古い状態で処理を続ける。
+     *  読み込み後、それより前に送られたパラメータの変更を処理フレームの境界で破棄する。
+     *  (その間だけ処理を止めるので、このプラグインが無音を出力するのは長くても1フレーム)
+     *  @pre メインスレッドから呼び出すこと
+     */
+    bool    ApplyStateSnapshot(StateSnapshotPtr const &snapshot);
+    
+    //! スナップショットの適用を、バックグラウンドスレッドで行う。
+    /*! IComponent::setState()は、ApplyStateSnapshot()と同様に、バックグラウンドスレッドから呼び出す。
+     *  コントローラへの反映は、その後のApplyPendingControllerUpdates()の呼び出し時にメインスレッドで行う。
+     *  複数回呼び出した場合は、呼び出した順に適用される。
+     *  @return 適用に成功したかどうかを受け取るためのfuture
+     */
+    std::shared_future<bool> ApplyStateSnapshotAsync(StateSnapshotPtr snapshot);
+    
+    //! このプラグインのために事前に読み込んだスナップショットを保持するキャッシュ
+    Vst3StateSnapshotCache & GetStateSnapshotCache();
+
+    //! 最後にSetDirty(false)されてから、プラグインの状態が変化した可能性があるかどうか
+    /*! パラメータやプログラムの変更、プラグインからのsetDirty()/restartComponent()の通知によってtrueになる。
+     *  プロジェクトの自動保存で、状態を取得し直す必要があるプラグインを判定するために使用する。
+     */
+    bool    IsDirty() const;
+    void    SetDirty(bool dirty);
+
     template<class T>
     struct ProcessBufferInfo
     {
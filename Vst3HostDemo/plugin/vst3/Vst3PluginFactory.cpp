@@ -4,7 +4,9 @@
 #include <memory>
 #include <stdexcept>
 #include <vector>
+#include <future>
 #include <map>
+#include <mutex>
 
 #include <pluginterfaces/base/ftypes.h>
 #include "Vst3Utils.hpp"
@@ -134,17 +136,22 @@ public:
 		return factory_.get();
 	}
     
+    //! プラグインは複数のスレッドから並列に作成/破棄されることがあるので、
+    //! loaded_plugins_へのアクセスはmtx_で保護する。
     void OnVst3PluginIsCreated(Vst3Plugin const *p) {
+        auto lock = std::unique_lock(mtx_);
         loaded_plugins_.push_back(p);
     }
         
     void OnVst3PluginIsDestructed(Vst3Plugin const *p) {
+        auto lock = std::unique_lock(mtx_);
         auto found = std::find(loaded_plugins_.begin(), loaded_plugins_.end(), p);
         assert(found != loaded_plugins_.end());
         loaded_plugins_.erase(found);
     }
     
     UInt32 GetNumLoadedPlugins() const {
+        auto lock = std::unique_lock(mtx_);
         return loaded_plugins_.size();
     }
 
@@ -158,6 +165,7 @@ private:
 	FactoryInfo				factory_info_;
 	std::vector<ClassInfo>	class_info_list_;
     std::vector<Vst3Plugin const *> loaded_plugins_;
+    mutable std::mutex mtx_;
 };
 
 String FormatCid(ClassInfo::CID const &cid)
@@ -349,8 +357,15 @@ UInt32 Vst3PluginFactory::GetNumLoadedPlugins() const {
 class Vst3PluginFactoryList::Impl
 {
 public:
+    using FactoryPtr = std::shared_ptr<Vst3PluginFactory>;
+    
     LockFactory lf_;
-    std::map<String, std::shared_ptr<Vst3PluginFactory>> table_;
+    std::map<String, FactoryPtr> table_;
+    //! 読み込み中のモジュール
+    /*! モジュールの読み込みはロックの外で行い、異なるモジュールは並列に読み込めるようにする。
+     *  同じモジュールを読み込もうとしたスレッドは、先に読み込みを始めたスレッドの完了を待つ。
+     */
+    std::map<String, std::shared_future<FactoryPtr>> loading_;
 };
 
 Vst3PluginFactoryList::Vst3PluginFactoryList()
@@ -365,24 +380,43 @@ std::shared_ptr<Vst3PluginFactory> Vst3PluginFactoryList::FindOrCreateFactory(St
     auto lock = pimpl_->lf_.make_lock();
     
     auto found = pimpl_->table_.find(module_path);
-    if(found == pimpl_->table_.end()) {
-        std::shared_ptr<Vst3PluginFactory> factory;
-        try {
-            factory = std::make_shared<Vst3PluginFactory>(module_path);
-        } catch(std::exception &e) {
-            hwm::dout << "Failed to create Vst3PluginFactory: " << e.what() << std::endl;
-            return {};
-        }
-        
-        found = pimpl_->table_.emplace(module_path, factory).first;
+    if(found != pimpl_->table_.end()) {
+        return found->second;
+    }
+    
+    auto loading = pimpl_->loading_.find(module_path);
+    if(loading != pimpl_->loading_.end()) {
+        auto f = loading->second;
+        lock.unlock();
+        return f.get();
+    }
+    
+    std::promise<Impl::FactoryPtr> promise;
+    pimpl_->loading_.emplace(module_path, promise.get_future().share());
+    lock.unlock();
+    
+    Impl::FactoryPtr factory;
+    try {
+        factory = std::make_shared<Vst3PluginFactory>(module_path);
+    } catch(std::exception &e) {
+        hwm::dout << "Failed to create Vst3PluginFactory: " << e.what() << std::endl;
+    }
+    
+    lock.lock();
+    if(factory) {
+        pimpl_->table_.emplace(module_path, factory);
     }
+    pimpl_->loading_.erase(module_path);
+    lock.unlock();
     
-    return found->second;
+    promise.set_value(factory);
+    return factory;
 }
 
 void Vst3PluginFactoryList::Shrink()
 {
-    std::map<String, std::shared_ptr<Vst3PluginFactory>> tmp;
+    //! プラグインは複数のスレッドから作成されるので、テーブルの更新はロックして行う。
+    auto lock = pimpl_->lf_.make_lock();
     
     for(auto it = pimpl_->table_.begin(), end = pimpl_->table_.end();
         it != end;
@@ -396,4 +430,23 @@ void Vst3PluginFactoryList::Shrink()
     }
 }
 
+bool Vst3PluginFactoryList::ReleaseIfUnused(String const &module_path)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    
+    auto found = pimpl_->table_.find(module_path);
+    if(found == pimpl_->table_.end()) { return false; }
+    
+    //! ファクトリのコピーはロック中のFindOrCreateFactory()からしか取得できないので、
+    //! ここで参照がテーブルだけなら、プラグインを作成中のスレッドもない。
+    if(found->second.use_count() != 1 || found->second->GetNumLoadedPlugins() != 0) {
+        return false;
+    }
+    
+    auto factory = std::move(found->second);
+    pimpl_->table_.erase(found);
+    lock.unlock();
+    return true;
+}
+
 NS_HWM_END
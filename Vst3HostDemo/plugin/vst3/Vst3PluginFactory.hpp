@@ -126,6 +126,10 @@ public:
     //! Unload factories which not having any plugins.
     void Shrink();
     
+    //! module_pathのファクトリが、プラグインを作成しておらず、他から参照もされていなければ解放する。
+    //! @return 解放した場合はtrue
+    bool ReleaseIfUnused(String const &module_path);
+    
 private:
     class Impl;
     std::unique_ptr<Impl> pimpl_;
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <numeric>
+#include <cmath>
 #include <cassert>
 #include <memory>
 #include <stdexcept>
@@ -14,6 +15,7 @@
 
 #include "../../misc/StrCnv.hpp"
 #include "../../misc/ScopeExit.hpp"
+#include "../../misc/GarbageCollector.hpp"
 #include "Vst3Utils.hpp"
 #include "Vst3Plugin.hpp"
 #include "Vst3PluginFactory.hpp"
@@ -218,7 +220,6 @@ Vst3Plugin::Impl::Impl(IPluginFactory *factory,
 	,	is_processing_started_(false)
 	,	block_size_(2048)
 	,	sampling_rate_(44100)
-	,	has_editor_(false)
 	,	status_(Status::kInvalid)
 {
     assert(host_context);
@@ -227,10 +228,17 @@ Vst3Plugin::Impl::Impl(IPluginFactory *factory,
 
     input_events_.setMaxSize(128);
     output_events_.setMaxSize(128);
+    deferred_midi_messages_.reserve(kDeferredMidiMessageCapacity);
 }
 
 Vst3Plugin::Impl::~Impl()
 {
+    //! バックグラウンドスレッドで適用中の状態があれば、完了を待つ。
+    auto lock = lf_pending_state_.make_lock();
+    auto pending = pending_state_apply_;
+    lock.unlock();
+    if(pending.valid()) { pending.wait(); }
+    
 	UnloadPlugin();
 }
 
@@ -386,13 +394,22 @@ void Vst3Plugin::Impl::SetProgramIndex(UInt32 index, Vst::UnitID unit_id)
     
     GetEditController()->setParamNormalized(unit_info.program_change_param_, normalized_value);
     PushBackParameterChange(unit_info.program_change_param_, normalized_value);
+    SetDirty(true);
 }
 
 bool Vst3Plugin::Impl::HasEditor() const
 {
 	assert(component_);
 	//assert(is_resumed_);
-	return has_editor_.get();
+    
+    //! PlugViewは、プラグインの初期化時ではなく、最初にエディタの有無を問い合わせたときに作成する。
+    //! (プラグインの初期化はワーカースレッドで行われることがあるが、
+    //! PlugViewの作成はメインスレッドで行われることを前提にしているプラグインが多いため)
+    if(!has_editor_) {
+        assert(wxIsMainThread());
+        has_editor_ = edit_controller_ && (CreatePlugView() == kResultOk);
+    }
+	return *has_editor_;
 }
 
 bool Vst3Plugin::Impl::OpenEditor(WindowHandle parent, IPlugFrame *plug_frame)
@@ -462,11 +479,9 @@ bool operator!=(Vst::ProcessSetup const &x, Vst::ProcessSetup const &y)
     return !(x == y);
 }
 
-void Vst3Plugin::Impl::Resume()
+void Vst3Plugin::Impl::SetupProcessing()
 {
 	assert(status_ == Status::kInitialized || status_ == Status::kSetupDone);
-
-	tresult res;
     
     Vst::ProcessSetup new_setup = {};
     new_setup.maxSamplesPerBlock = block_size_;
@@ -475,7 +490,7 @@ void Vst3Plugin::Impl::Resume()
     new_setup.processMode = Vst::ProcessModes::kRealtime;
     
     if(new_setup != applied_process_setup_) {
-        res = GetAudioProcessor()->setupProcessing(new_setup);
+        auto res = GetAudioProcessor()->setupProcessing(new_setup);
         if(res != kResultOk && res != kNotImplemented) {
             throw Error(res, "setupProcessing failed");
         } else {
@@ -484,11 +499,24 @@ void Vst3Plugin::Impl::Resume()
     }
 
     status_ = Status::kSetupDone;
+}
+
+void Vst3Plugin::Impl::Resume()
+{
+	assert(status_ == Status::kInitialized || status_ == Status::kSetupDone);
+
+	tresult res;
+    
+    SetupProcessing();
     
-    auto prepare_bus_buffers = [&](AudioBusesInfo &buses, UInt32 block_size, Buffer<float> &buffer) {
+    auto prepare_bus_buffers = [&](AudioBusesInfo &buses, UInt32 block_size,
+                                   Buffer<float> &buffer, std::vector<float *> &channels)
+    {
         buffer.resize(buses.GetNumChannels(), block_size);
+        buffer.fill(0);
+        channels.assign(buffer.data(), buffer.data() + buffer.channels());
         
-        auto data = buffer.data();
+        auto data = channels.data();
         auto *bus_buffers = buses.GetBusBuffers();
         for(int i = 0; i < buses.GetNumBuses(); ++i) {
             auto &buffer = bus_buffers[i];
@@ -503,8 +531,8 @@ void Vst3Plugin::Impl::Resume()
         }
     };
     
-    prepare_bus_buffers(input_buses_info_, block_size_, input_buffer_);
-    prepare_bus_buffers(output_buses_info_, block_size_, output_buffer_);
+    prepare_bus_buffers(input_buses_info_, block_size_, input_buffer_, input_channels_);
+    prepare_bus_buffers(output_buses_info_, block_size_, output_buffer_, output_channels_);
 
 	res = GetComponent()->setActive(true);
 	if(res != kResultOk && res != kNotImplemented) {
@@ -558,13 +586,20 @@ void Vst3Plugin::Impl::SetSamplingRate(int sampling_rate)
 
 void Vst3Plugin::Impl::RestartComponent(Steinberg::int32 flags)
 {
+    //! MIDIのコントローラとパラメータの対応が変更された
+    if((flags & Vst::RestartFlags::kMidiCCAssignmentChanged)) {
+        UpdateMidiControllerTable();
+    }
+    
 	//! `Controller`側のパラメータが変更された
 	if((flags & Vst::RestartFlags::kParamValuesChanged)) {
 
-		// nothing to do
+		SetDirty(true);
 
 	} else if((flags & Vst::RestartFlags::kReloadComponent)) {
 
+		SetDirty(true);
+
 		hwm::dout << "Should reload component" << std::endl;
 
         tresult res;
@@ -579,13 +614,162 @@ void Vst3Plugin::Impl::RestartComponent(Steinberg::int32 flags)
 			Resume();
 		}
 
+		stream.seek(0, Steinberg::IBStream::IStreamSeekMode::kIBSeekSet, 0);
 		res = component_->setState(&stream);
         ShowError(res, L"setState");
 	}
 }
 
-void Vst3Plugin::Impl::Process(ProcessInfo pi)
+std::optional<std::vector<char>> Vst3Plugin::Impl::GetComponentState()
+{
+    auto lock = lf_state_.make_lock();
+    
+    Steinberg::MemoryStream stream;
+    auto res = component_->getState(&stream);
+    ShowError(res, L"getState");
+    if(res != kResultOk) { return std::nullopt; }
+    
+    return std::vector<char>(stream.getData(), stream.getData() + stream.getSize());
+}
+
+std::optional<std::vector<char>> Vst3Plugin::Impl::GetControllerState()
+{
+    if(!edit_controller_) { return std::nullopt; }
+    
+    Steinberg::MemoryStream stream;
+    auto res = edit_controller_->getState(&stream);
+    ShowError(res, L"getState(controller)");
+    if(res != kResultOk) { return std::nullopt; }
+    
+    return std::vector<char>(stream.getData(), stream.getData() + stream.getSize());
+}
+
+bool Vst3Plugin::Impl::SetComponentState(std::vector<char> const &data)
+{
+    if(ApplyComponentState(data) == false) { return false; }
+    
+    ApplyComponentStateToController(data);
+    SetDirty(true);
+    return true;
+}
+
+bool Vst3Plugin::Impl::ApplyComponentState(std::vector<char> const &data)
+{
+    auto lock = lf_state_.make_lock();
+    
+    //! VST3では、setState()とprocess()の間の排他はプラグイン側の責任なので、
+    //! 状態の読み込みはオーディオスレッドを止めずに行う。読み込みが終わるまでは、古い状態で処理が続く。
+    //! MemoryStreamは、外部のメモリを渡して作成した場合はそのメモリを書き換えない。
+    Steinberg::MemoryStream stream(const_cast<char *>(data.data()), data.size());
+    auto res = component_->setState(&stream);
+    ShowError(res, L"setState");
+    if(res != kResultOk) { return false; }
+    
+    //! 読み込みより前に送られたパラメータの変更は、古い状態に対するものなので、
+    //! 次の処理フレームで新しい状態を上書きしないように、フレームの境界で破棄する。
+    //! バイパスするのはこの破棄の間だけなので、無音になるのは長くても1フレーム。
+    //! (バイパス中はオーディオスレッドがキューを参照しないので、このスレッドから取り出してよい)
+    auto bypass = MakeScopedBypassRequest(state_bypass_, true);
+    ParameterChange pc;
+    while(parameter_change_queue_.TryPop(pc)) {}
+    
+    return true;
+}
+
+void Vst3Plugin::Impl::ApplyComponentStateToController(std::vector<char> const &data)
+{
+    if(!edit_controller_) { return; }
+    
+    Steinberg::MemoryStream stream(const_cast<char *>(data.data()), data.size());
+    auto res = edit_controller_->setComponentState(&stream);
+    ShowError(res, L"setComponentState");
+}
+
+Vst3Plugin::StateSnapshotPtr Vst3Plugin::Impl::TakeStateSnapshot()
+{
+    auto component_state = GetComponentState();
+    if(!component_state) { return nullptr; }
+    
+    auto snapshot = std::make_shared<StateSnapshot>();
+    snapshot->component_state_ = std::move(*component_state);
+    snapshot->controller_state_ = GetControllerState();
+    return snapshot;
+}
+
+bool Vst3Plugin::Impl::ApplyStateSnapshot(StateSnapshotPtr const &snapshot)
+{
+    if(!snapshot) { return false; }
+    if(SetComponentState(snapshot->component_state_) == false) { return false; }
+    
+    if(snapshot->controller_state_) {
+        SetControllerState(*snapshot->controller_state_);
+    }
+    
+    return true;
+}
+
+std::shared_future<bool> Vst3Plugin::Impl::ApplyStateSnapshotAsync(StateSnapshotPtr snapshot)
+{
+    auto lock = lf_pending_state_.make_lock();
+    
+    //! 前回呼び出された適用処理の完了を待ってから適用することで、呼び出し順に適用されるようにする。
+    auto prev = pending_state_apply_;
+    auto f = std::async(std::launch::async, [this, prev, snapshot = std::move(snapshot)] {
+        if(prev.valid()) { prev.wait(); }
+        if(!snapshot) { return false; }
+        if(ApplyComponentState(snapshot->component_state_) == false) { return false; }
+        
+        auto lock = lf_pending_state_.make_lock();
+        pending_controller_snapshot_ = snapshot;
+        lock.unlock();
+        
+        SetDirty(true);
+        return true;
+    }).share();
+    
+    pending_state_apply_ = f;
+    return f;
+}
+
+bool Vst3Plugin::Impl::SetControllerState(std::vector<char> const &data)
 {
+    if(!edit_controller_) { return false; }
+    
+    Steinberg::MemoryStream stream(const_cast<char *>(data.data()), data.size());
+    auto res = edit_controller_->setState(&stream);
+    ShowError(res, L"setState(controller)");
+    if(res != kResultOk) { return false; }
+    
+    SetDirty(true);
+    return true;
+}
+
+bool Vst3Plugin::Impl::IsDirty() const
+{
+    return is_dirty_.load();
+}
+
+void Vst3Plugin::Impl::SetDirty(bool dirty)
+{
+    is_dirty_.store(dirty);
+}
+
+void Vst3Plugin::Impl::Process(ProcessInfo &pi)
+{
+    //! 状態の適用後に古いパラメータの変更を破棄している間は、プラグインの処理を行わない。
+    //! (出力バッファは、GraphProcessorによって無音にクリアされている)
+    auto guard = MakeScopedBypassGuard(state_bypass_);
+    if(!guard) {
+        //! 届いたMIDIメッセージを捨てると、ノートオフを取りこぼしてノートが鳴り続けてしまうので、
+        //! 次に処理するフレームの先頭で渡す。
+        for(auto m: pi.input_midi_buffer_.buffer_) {
+            if(deferred_midi_messages_.size() == deferred_midi_messages_.capacity()) { break; }
+            m.offset_ = 0;
+            deferred_midi_messages_.push_back(m);
+        }
+        return;
+    }
+    
     assert(pi.time_info_);
     auto &ti = *pi.time_info_;
 	Vst::ProcessContext process_context = {};
@@ -607,12 +791,12 @@ void Vst3Plugin::Impl::Process(ProcessInfo pi)
 
     input_events_.clear();
     output_events_.clear();
-    input_params_.clearQueue();
+    ClearParameterChanges();
     output_params_.clearQueue();
-    input_buffer_.fill();
-    output_buffer_.fill();
     
-    for(auto &m: pi.input_midi_buffer_.buffer_) {
+    auto const *cc_table = published_midi_controller_table_.load(std::memory_order_acquire);
+    
+    auto add_midi_message = [&](ProcessInfo::MidiMessage const &m) {
         Vst::Event e;
         e.busIndex = 0;
         e.sampleOffset = m.offset_;
@@ -621,71 +805,113 @@ void Vst3Plugin::Impl::Process(ProcessInfo pi)
         
         using namespace MidiDataType;
         
-        auto midi_map = [this](int channel, int offset, int cc, Vst::ParamValue value) {
-            if(!midi_mapping_) { return; }
-            Vst::ParamID param_id = 0;
-            auto result = midi_mapping_->getMidiControllerAssignment(0, channel, cc, param_id);
-            if(result == kResultOk) {
-                PushBackParameterChange(param_id, value, offset);
-                edit_controller_->setParamNormalized(param_id, value);
-            }
+        auto midi_map = [this, cc_table](int channel, int offset, int cc, Vst::ParamValue value) {
+            if(!cc_table) { return; }
+            auto const param_id = (*cc_table)[channel][cc];
+            if(param_id == Vst::kNoParamId) { return; }
+            
+            AddParameterChange(param_id, value, offset);
+            
+            //! EditControllerへの反映は、メインスレッドで行う。
+            ParameterChange pc;
+            pc.id_ = param_id;
+            pc.value_ = value;
+            controller_update_queue_.TryPush(pc);
         };
         
-        if(auto note_on = m.As<NoteOn>()) {
-            e.type = Vst::Event::kNoteOnEvent;
-            e.noteOn.channel = m.channel_;
-            e.noteOn.pitch = note_on->pitch_;
-            e.noteOn.velocity = note_on->velocity_ / 127.0;
-            e.noteOn.length = 0;
-            e.noteOn.tuning = 0;
-            e.noteOn.noteId = -1;
-            input_events_.addEvent(e);
-        } else if(auto note_off = m.As<NoteOff>()){
-            e.type = Vst::Event::kNoteOffEvent;
-            e.noteOff.channel = m.channel_;
-            e.noteOff.pitch = note_off->pitch_;
-            e.noteOff.velocity = note_off->off_velocity_ / 127.0;
-            e.noteOff.tuning = 0;
-            e.noteOff.noteId = -1;
-            input_events_.addEvent(e);
-        } else if(auto poly_press = m.As<PolyphonicKeyPressure>()) {
-            e.type = Vst::Event::kPolyPressureEvent;
-            e.polyPressure.channel = m.channel_;
-            e.polyPressure.pitch = poly_press->pitch_;
-            e.polyPressure.pressure = poly_press->value_ / 127.0;
-            e.polyPressure.noteId = -1;
-            input_events_.addEvent(e);
-        } else if(auto cc = m.As<ControlChange>()) {
-            midi_map(m.channel_, m.offset_, cc->control_number_, cc->data_ / 128.0);
-        } else if(auto cp = m.As<ChannelPressure>()) {
-            midi_map(m.channel_, m.offset_, Vst::ControllerNumbers::kAfterTouch, cp->value_ / 128.0);
-        } else if(auto pb = m.As<PitchBendChange>()) {
-            midi_map(m.channel_, m.offset_, Vst::ControllerNumbers::kPitchBend,
-                     ((pb->value_msb_ << 7) | pb->value_lsb_) / 16384.0);
+        //! ステータスバイトに対するswitchで、メッセージの種類ごとに変換する。
+        switch(m.GetMessageType()) {
+            case kNoteOn:
+                //! ベロシティ0のノートオンは、ノートオフとして扱う。
+                if(m.data2_ > 0) {
+                    e.type = Vst::Event::kNoteOnEvent;
+                    e.noteOn.channel = m.GetChannel();
+                    e.noteOn.pitch = m.data1_;
+                    e.noteOn.velocity = m.data2_ / 127.0;
+                    e.noteOn.length = 0;
+                    e.noteOn.tuning = 0;
+                    e.noteOn.noteId = -1;
+                } else {
+                    e.type = Vst::Event::kNoteOffEvent;
+                    e.noteOff.channel = m.GetChannel();
+                    e.noteOff.pitch = m.data1_;
+                    e.noteOff.velocity = 64 / 127.0;
+                    e.noteOff.tuning = 0;
+                    e.noteOff.noteId = -1;
+                }
+                input_events_.addEvent(e);
+                break;
+            case kNoteOff:
+                e.type = Vst::Event::kNoteOffEvent;
+                e.noteOff.channel = m.GetChannel();
+                e.noteOff.pitch = m.data1_;
+                e.noteOff.velocity = m.data2_ / 127.0;
+                e.noteOff.tuning = 0;
+                e.noteOff.noteId = -1;
+                input_events_.addEvent(e);
+                break;
+            case kPolyphonicKeyPressure:
+                e.type = Vst::Event::kPolyPressureEvent;
+                e.polyPressure.channel = m.GetChannel();
+                e.polyPressure.pitch = m.data1_;
+                e.polyPressure.pressure = m.data2_ / 127.0;
+                e.polyPressure.noteId = -1;
+                input_events_.addEvent(e);
+                break;
+            case kControlChange:
+                midi_map(m.GetChannel(), m.offset_, m.data1_, m.data2_ / 128.0);
+                break;
+            case kChannelPressure:
+                midi_map(m.GetChannel(), m.offset_, Vst::ControllerNumbers::kAfterTouch, m.data1_ / 128.0);
+                break;
+            case kPitchBendChange:
+                midi_map(m.GetChannel(), m.offset_, Vst::ControllerNumbers::kPitchBend,
+                         ((m.data2_ << 7) | m.data1_) / 16384.0);
+                break;
+            default:
+                break;
         }
-    }
+    };
+    
+    //! バイパス中に届いたメッセージは、今回のフレームのメッセージより先に渡す。
+    for(auto const &m: deferred_midi_messages_) { add_midi_message(m); }
+    deferred_midi_messages_.clear();
+    
+    for(auto const &m: pi.input_midi_buffer_.buffer_) { add_midi_message(m); }
 	
-    auto copy_buffer = [&](BufferRef<const float> src, BufferRef<float> dest,
-                           SampleCount length_to_copy)
+    //! 各バスのチャンネルのバッファを、呼び出し元のバッファを直接指すように更新する。
+    //! これによって、入力と出力のコピーとクリアを省く。
+    //! 呼び出し元のバッファと各バスのチャンネルは、アクティブなバスのチャンネルを先頭から順に対応付ける。
+    //! 非アクティブなバスのチャンネルや、呼び出し元のバッファに対応するチャンネルがない場合は、内部のバッファを使用する。
+    auto const num_samples = pi.time_info_->GetSmpDuration();
+    
+    auto assign_channels = [num_samples](AudioBusesInfo &buses, std::vector<float *> &channels,
+                                         Buffer<float> &fallback, auto ref, bool clear_fallback)
     {
-        size_t const min_ch = std::min(src.channels(), dest.channels());
-        if(min_ch == 0) { return; }
-
-        assert(src.samples() >= length_to_copy);
-        assert(dest.samples() >= length_to_copy);
-        
-        for(size_t ch = 0; ch < min_ch; ++ch) {
-            std::copy_n(src.get_channel_data(ch),
-                        length_to_copy,
-                        dest.get_channel_data(ch));
+        UInt32 ch = 0;
+        UInt32 num_assigned = 0;
+        for(size_t bus = 0; bus < buses.GetNumBuses(); ++bus) {
+            auto const is_active = buses.IsActive(bus);
+            auto const num_channels = buses.GetBusInfo(bus).channel_count_;
+            for(Int32 i = 0; i < num_channels; ++i, ++ch) {
+                if(is_active && num_assigned < ref.channels()) {
+                    channels[ch] = const_cast<float *>(ref.get_channel_data(num_assigned));
+                    num_assigned += 1;
+                } else {
+                    channels[ch] = fallback.data()[ch];
+                    if(clear_fallback) { std::fill_n(channels[ch], num_samples, 0.0f); }
+                }
+            }
         }
     };
     
-    copy_buffer(pi.input_audio_buffer_, input_buffer_,
-                pi.time_info_->GetSmpDuration()
-                );
+    //! 入力側の内部バッファは無音にしておく必要がある。
+    //! 出力側の内部バッファに書き込まれたデータは使用しないので、クリアしない。
+    //! 呼び出し元の出力バッファは、GraphProcessorによって無音にクリアされている。
+    assign_channels(input_buses_info_, input_channels_, input_buffer_, pi.input_audio_buffer_, true);
+    assign_channels(output_buses_info_, output_channels_, output_buffer_, pi.output_audio_buffer_, false);
 
-	PopFrontParameterChanges(input_params_);
+	PopFrontParameterChanges();
 
 	Vst::ProcessData process_data;
 	process_data.processContext = &process_context;
@@ -703,61 +929,211 @@ void Vst3Plugin::Impl::Process(ProcessInfo pi)
 
 	auto const res = GetAudioProcessor()->process(process_data);
     
-    static bool kOutputParameter = false;
-    
     if(res != kResultOk) {
         hwm::dout << "process failed: {}"_format(tresult_to_string(res)) << std::endl;
     }
     
-    copy_buffer(output_buffer_, pi.output_audio_buffer_,
-                pi.time_info_->GetSmpDuration()
-                );
+    PopOutputEvents(pi.output_midi_buffer_);
+    PopOutputParameterChanges();
+}
 
-	for(int i = 0; i < output_params_.getParameterCount(); ++i) {
-		auto *queue = output_params_.getParameterData(i);
-		if(queue && queue->getPointCount() > 0 && kOutputParameter) {
-            hwm::dout << "Output parameter count [{}] : {}"_format(i, queue->getPointCount()) << std::endl;
-		}
-	}
+void Vst3Plugin::Impl::PopOutputEvents(ProcessInfo::MidiBufferInfo<ProcessInfo::MidiMessage> &dest)
+{
+    using namespace MidiDataType;
+    using MidiMessage = ProcessInfo::MidiMessage;
+    
+    auto to_7bit = [](double value) -> UInt8 {
+        return (UInt8)std::min<long>(std::max<long>(std::lround(value * 127), 0), 127);
+    };
+    
+    auto const num_events = output_events_.getEventCount();
+    for(Steinberg::int32 i = 0; i < num_events; ++i) {
+        //! 出力先のバッファは事前に確保されているので、溢れたイベントは破棄する。
+        if(dest.num_used_ >= dest.buffer_.size()) { break; }
+        
+        Vst::Event e;
+        if(output_events_.getEvent(i, e) != kResultOk) { continue; }
+        
+        auto const offset = (UInt32)std::max<Steinberg::int32>(e.sampleOffset, 0);
+        auto &m = dest.buffer_[dest.num_used_];
+        
+        switch(e.type) {
+            case Vst::Event::kNoteOnEvent:
+                //! ベロシティ0のノートオンはノートオフとして扱われるので、最小値を1にする。
+                m = MidiMessage(offset, kNoteOn | (e.noteOn.channel & 0x0F), e.noteOn.pitch & 0x7F,
+                                std::max<UInt8>(to_7bit(e.noteOn.velocity), 1));
+                break;
+            case Vst::Event::kNoteOffEvent:
+                m = MidiMessage(offset, kNoteOff | (e.noteOff.channel & 0x0F), e.noteOff.pitch & 0x7F,
+                                to_7bit(e.noteOff.velocity));
+                break;
+            case Vst::Event::kPolyPressureEvent:
+                m = MidiMessage(offset, kPolyphonicKeyPressure | (e.polyPressure.channel & 0x0F),
+                                e.polyPressure.pitch & 0x7F, to_7bit(e.polyPressure.pressure));
+                break;
+            case Vst::Event::kLegacyMIDICCOutEvent: {
+                auto const &cc = e.midiCCOut;
+                auto const ch = cc.channel & 0x0F;
+                if(cc.controlNumber == Vst::ControllerNumbers::kAfterTouch) {
+                    m = MidiMessage(offset, kChannelPressure | ch, cc.value & 0x7F);
+                } else if(cc.controlNumber == Vst::ControllerNumbers::kPitchBend) {
+                    m = MidiMessage(offset, kPitchBendChange | ch, cc.value & 0x7F, cc.value2 & 0x7F);
+                } else if(cc.controlNumber < 128) {
+                    m = MidiMessage(offset, kControlChange | ch, cc.controlNumber, cc.value & 0x7F);
+                } else {
+                    continue;
+                }
+                break;
+            }
+            default:
+                continue;
+        }
+        
+        dest.num_used_ += 1;
+    }
+}
+
+void Vst3Plugin::Impl::PopOutputParameterChanges()
+{
+    //! メーターなどの出力パラメータは、各キューの最後の値だけをEditControllerに反映する。
+    auto const num_params = output_params_.getParameterCount();
+    for(Steinberg::int32 i = 0; i < num_params; ++i) {
+        auto *queue = output_params_.getParameterData(i);
+        if(!queue) { continue; }
+        
+        auto const num_points = queue->getPointCount();
+        if(num_points == 0) { continue; }
+        
+        ParameterChange pc;
+        pc.id_ = queue->getParameterId();
+        if(queue->getPoint(num_points - 1, pc.offset_, pc.value_) != kResultOk) { continue; }
+        
+        controller_update_queue_.TryPush(pc);
+    }
 }
 
 void Vst3Plugin::Impl::PushBackParameterChange(Vst::ParamID id, Vst::ParamValue value, SampleCount offset)
 {
-	auto lock = std::unique_lock(parameter_queue_mutex_);
-	Steinberg::int32 parameter_index = 0;
-	auto *queue = param_changes_queue_.addParameterData(id, parameter_index);
-	Steinberg::int32 ref_point_index = 0;
-	queue->addPoint(offset, value, ref_point_index);
-    (void)ref_point_index; // currently unused.
+    ParameterChange pc;
+    pc.id_ = id;
+    pc.offset_ = (Int32)offset;
+    pc.value_ = value;
+    
+    if(parameter_change_queue_.TryPush(pc) == false) {
+        num_dropped_parameter_changes_.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void Vst3Plugin::Impl::PopFrontParameterChanges(Vst::ParameterChanges &dest)
+UInt64 Vst3Plugin::Impl::GetNumDroppedParameterChanges() const
 {
-	auto lock = std::unique_lock(parameter_queue_mutex_);
+    return num_dropped_parameter_changes_.load(std::memory_order_relaxed);
+}
 
-	for(size_t i = 0; i < param_changes_queue_.getParameterCount(); ++i) {
-		auto *src_queue = param_changes_queue_.getParameterData(i);
-        auto const src_id = src_queue->getParameterId();
-        
-        if(src_id == Vst::kNoParamId || src_queue->getPointCount() == 0) {
-            continue;
+void Vst3Plugin::Impl::ApplyPendingControllerUpdates()
+{
+    //! バックグラウンドスレッドでプラグインに適用したスナップショットを、コントローラに反映する。
+    auto lock = lf_pending_state_.make_lock();
+    auto snapshot = std::move(pending_controller_snapshot_);
+    pending_controller_snapshot_ = nullptr;
+    lock.unlock();
+    
+    if(snapshot) {
+        ApplyComponentStateToController(snapshot->component_state_);
+        if(snapshot->controller_state_) {
+            SetControllerState(*snapshot->controller_state_);
+        }
+    }
+    
+    //! 同じパラメータが複数回変更されていても、EditControllerには順に反映して、最後の値が残るようにする。
+    ParameterChange pc;
+    while(controller_update_queue_.TryPop(pc)) {
+        if(edit_controller_) {
+            edit_controller_->setParamNormalized(pc.id_, pc.value_);
         }
+    }
+}
 
-		Steinberg::int32 ref_queue_index;
-		auto dest_queue = dest.addParameterData(src_queue->getParameterId(), ref_queue_index);
+void Vst3Plugin::Impl::PopFrontParameterChanges()
+{
+    ParameterChange pc;
+    while(parameter_change_queue_.TryPop(pc)) {
+        AddParameterChange(pc.id_, pc.value_, pc.offset_);
+    }
+}
 
-		for(size_t v = 0; v < src_queue->getPointCount(); ++v) {
-			Steinberg::int32 ref_offset;
-			Vst::ParamValue ref_value;
-			tresult result = src_queue->getPoint(v, ref_offset, ref_value);
-            if(result != kResultTrue) { continue; }
-            
-			Steinberg::int32 ref_point_index;
-			dest_queue->addPoint(ref_offset, ref_value, ref_point_index);
-		}
-	}
+void Vst3Plugin::Impl::AddParameterChange(Vst::ParamID id, Vst::ParamValue value, Int32 offset)
+{
+    Steinberg::int32 queue_index = -1;
+    
+    auto const slot = parameter_info_list_.GetIndexByID(id);
+    if(slot != (ParameterInfoList::size_type)-1) {
+        queue_index = parameter_queue_indices_[slot];
+        if(queue_index < 0) {
+            //! この処理フレームで初めて変更されるパラメータ。
+            //! 確保済みのキューの中から一つを割り当てる。
+            input_params_.addParameterData(id, queue_index);
+            parameter_queue_indices_[slot] = queue_index;
+            used_parameter_slots_.push_back(slot);
+        }
+    } else {
+        //! parameter_info_list_に含まれないパラメータ。
+        //! 確保済みのキューが残っている場合だけ、SDKの線形探索で割り当てる。
+        if((size_t)input_params_.getParameterCount() >= parameter_queue_indices_.size()) {
+            num_dropped_parameter_changes_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        input_params_.addParameterData(id, queue_index);
+    }
+    
+    auto *queue = input_params_.getParameterData(queue_index);
+    if(!queue) { return; }
+    
+    Steinberg::int32 ref_point_index = 0;
+    queue->addPoint(offset, value, ref_point_index);
+    (void)ref_point_index; // currently unused.
+}
 
-	param_changes_queue_.clearQueue();
+void Vst3Plugin::Impl::ClearParameterChanges()
+{
+    for(auto slot: used_parameter_slots_) {
+        parameter_queue_indices_[slot] = -1;
+    }
+    used_parameter_slots_.clear();
+    input_params_.clearQueue();
+}
+
+void Vst3Plugin::Impl::PrepareParameterSlots()
+{
+    auto const num = parameter_info_list_.size();
+    
+    parameter_queue_indices_.assign(num, -1);
+    used_parameter_slots_.clear();
+    used_parameter_slots_.reserve(num);
+    
+    //! 全パラメータ分のキューを確保しておくことで、Process()中のメモリ確保を避ける。
+    input_params_.setMaxParameters(num);
+}
+
+void Vst3Plugin::Impl::UpdateMidiControllerTable()
+{
+    std::shared_ptr<MidiControllerTable> table;
+    
+    if(midi_mapping_) {
+        table = std::make_shared<MidiControllerTable>();
+        for(Int32 ch = 0; ch < kNumMidiChannels; ++ch) {
+            for(Int32 cc = 0; cc < Vst::kCountCtrlNumber; ++cc) {
+                Vst::ParamID param_id = Vst::kNoParamId;
+                auto const result = midi_mapping_->getMidiControllerAssignment(0, ch, cc, param_id);
+                (*table)[ch][cc] = (result == kResultOk) ? param_id : Vst::kNoParamId;
+            }
+        }
+    }
+    
+    auto old_table = std::move(midi_controller_table_);
+    midi_controller_table_ = table;
+    published_midi_controller_table_.store(table.get(), std::memory_order_release);
+    
+    RetireObject(std::move(old_table));
 }
 
 void Vst3Plugin::Impl::LoadPlugin(IPluginFactory *factory, ClassInfo const &info, FUnknown *host_context)
@@ -918,6 +1294,12 @@ void Vst3Plugin::Impl::Initialize(vstma_unique_ptr<Vst::IComponentHandler> compo
         for(int i = 0; i < output_buses_info_.GetNumBuses(); ++i) {
             output_buses_info_.SetActive(i);
         }
+        
+        //! アルペジエーターなど、イベントを出力するプラグインのために、最初のイベント出力バスを有効にしておく。
+        num_event_output_buses_ = component_->getBusCount(Vst::MediaTypes::kEvent, Vst::BusDirections::kOutput);
+        if(num_event_output_buses_ > 0) {
+            component_->activateBus(Vst::MediaTypes::kEvent, Vst::BusDirections::kOutput, 0, true);
+        }
        
         auto input_speakers = input_buses_info_.GetSpeakers();
         auto output_speakers = output_buses_info_.GetSpeakers();
@@ -928,18 +1310,16 @@ void Vst3Plugin::Impl::Initialize(vstma_unique_ptr<Vst::IComponentHandler> compo
             hwm::dout << "Failed to set bus arrangement: " << tresult_to_string(result) << std::endl;
         }
 
-        tresult const ret = CreatePlugView();
-        has_editor_ = (ret == kResultOk);
-
 		PrepareParameters();
 		PrepareUnitInfo();
+        PrepareParameterSlots();
+        UpdateMidiControllerTable();
 
-		input_params_.setMaxParameters(parameter_info_list_.size());
 		output_params_.setMaxParameters(parameter_info_list_.size());
 	}
 }
 
-tresult Vst3Plugin::Impl::CreatePlugView()
+tresult Vst3Plugin::Impl::CreatePlugView() const
 {
     assert(edit_controller_);
 
@@ -985,7 +1365,10 @@ void Vst3Plugin::Impl::DeletePlugView()
 
 void Vst3Plugin::Impl::PrepareParameters()
 {
-	for(Steinberg::int32 i = 0; i < edit_controller_->getParameterCount(); ++i) {
+    auto const num = edit_controller_->getParameterCount();
+    parameter_info_list_.reserve(std::max<Steinberg::int32>(num, 0));
+    
+	for(Steinberg::int32 i = 0; i < num; ++i) {
 		Vst::ParameterInfo vpi = {};
 		edit_controller_->getParameterInfo(i, vpi);
         ParameterInfo pi;
@@ -1109,6 +1492,10 @@ void Vst3Plugin::Impl::UnloadPlugin()
     }
     
     edit_controller_->setComponentHandler(nullptr);
+    
+    //! Suspend()した後なので、オーディオスレッドからは参照されていない。
+    published_midi_controller_table_.store(nullptr);
+    midi_controller_table_.reset();
 
 	unit_handler_.reset();
 	plug_view_.reset();
@@ -1,5 +1,6 @@
 #include "Vst3Plugin.hpp"
 
+#include <array>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
@@ -17,15 +18,20 @@
 #include <pluginterfaces/vst/ivstunits.h>
 #include <pluginterfaces/gui/iplugview.h>
 #include <pluginterfaces/vst/ivstevents.h>
+#include <pluginterfaces/vst/ivstmidicontrollers.h>
 #include <pluginterfaces/base/ustring.h>
 #include <pluginterfaces/vst/vstpresetkeys.h>
 
 #include "Vst3Utils.hpp"
 #include "Vst3Plugin.hpp"
 #include "Vst3PluginFactory.hpp"
+#include "Vst3StateSnapshotCache.hpp"
 
 #include "../../misc/Flag.hpp"
+#include "../../misc/Bypassable.hpp"
+#include "../../misc/LockFactory.hpp"
 #include "../../misc/Buffer.hpp"
+#include "../../misc/MPSCQueue.hpp"
 
 NS_HWM_BEGIN
 
@@ -142,6 +148,9 @@ public:
     void    SetProgramIndex(UInt32 index, Vst::UnitID unit_id = 0);
 
 	bool HasEditor() const;
+    
+    //! イベント出力バスを持っているかどうか
+    bool HasEventOutput() const { return num_event_output_buses_ > 0; }
 
 	bool OpenEditor(WindowHandle parent, IPlugFrame *plug_frame);
 
@@ -151,6 +160,8 @@ public:
 
 	ViewRect GetPreferredRect() const;
 
+	void SetupProcessing();
+
 	void Resume();
 
 	void Suspend();
@@ -162,24 +173,79 @@ public:
 	void SetSamplingRate(int sampling_rate);
 
 	void	RestartComponent(Steinberg::int32 flags);
+    
+    std::optional<std::vector<char>> GetComponentState();
+    std::optional<std::vector<char>> GetControllerState();
+    bool SetComponentState(std::vector<char> const &data);
+    bool SetControllerState(std::vector<char> const &data);
+    
+    StateSnapshotPtr TakeStateSnapshot();
+    bool ApplyStateSnapshot(StateSnapshotPtr const &snapshot);
+    std::shared_future<bool> ApplyStateSnapshotAsync(StateSnapshotPtr snapshot);
+    Vst3StateSnapshotCache & GetStateSnapshotCache() { return snapshot_cache_; }
+    
+    bool IsDirty() const;
+    void SetDirty(bool dirty);
 
-	void    Process(ProcessInfo pi);
+	void    Process(ProcessInfo &pi);
 
 //! Parameter Change
 public:
-	//! PopFrontParameterChangesとの呼び出しはスレッドセーフ
+	//! パラメータの変更をキューに追加する。
+    /*! 追加した変更は、次回のProcess()の呼び出し時に取り出されて、AudioProcessorに送信される。
+     *  ロックもメモリ確保も行わないので、任意のスレッドから呼び出せる。
+     *  キューが一杯の場合は変更を破棄して、GetNumDroppedParameterChanges()の値を増やす。
+     */
 	void PushBackParameterChange(Vst::ParamID id, Vst::ParamValue value, SampleCount offset = 0);
     
+    //! キューが一杯だったために破棄したパラメータの変更の数
+    UInt64 GetNumDroppedParameterChanges() const;
+    
+    //! オーディオスレッドから貯めたパラメータの変更を、EditControllerに反映する。
+    //! @pre メインスレッドから呼び出すこと
+    void ApplyPendingControllerUpdates();
+    
 private:
-    //! PushBackParameterChangeとの呼び出しはスレッドセーフ
-    void PopFrontParameterChanges(Vst::ParameterChanges &dest);
+    //! キューに貯まっているパラメータの変更をすべて取り出して、input_params_に追加する。
+    //! @pre オーディオスレッドから呼び出すこと
+    void PopFrontParameterChanges();
+    
+    //! パラメータの変更をinput_params_に追加する。
+    //! @pre オーディオスレッドから呼び出すこと
+    void AddParameterChange(Vst::ParamID id, Vst::ParamValue value, Int32 offset);
+    
+    //! input_params_をクリアして、次の処理フレームのパラメータの変更を受け付ける状態にする。
+    void ClearParameterChanges();
+    
+    //! プラグインが出力したイベントを、MIDIメッセージに変換してdestに追加する。
+    //! @pre オーディオスレッドから呼び出すこと
+    void PopOutputEvents(ProcessInfo::MidiBufferInfo<ProcessInfo::MidiMessage> &dest);
+    
+    //! プラグインが出力したパラメータの変更を、EditControllerに反映するためにキューに追加する。
+    //! @pre オーディオスレッドから呼び出すこと
+    void PopOutputParameterChanges();
+    
+    //! parameter_info_list_上のインデックスをスロットとして、input_params_の各キューを確保する。
+    void PrepareParameterSlots();
+    
+    //! フレームの境界でプラグインの処理を止めてから、IComponent::setState()で状態を適用する。
+    bool ApplyComponentState(std::vector<char> const &data);
+    
+    //! IEditController::setComponentState()で、プラグインの状態をコントローラに反映する。
+    void ApplyComponentStateToController(std::vector<char> const &data);
+    
+    //! IMidiMappingから、MIDIのチャンネルとコントローラ番号に対応するパラメータのテーブルを作成して、
+    //! オーディオスレッドに公開する。
+    //! @pre メインスレッドから呼び出すこと
+    void UpdateMidiControllerTable();
 
 private:
 	void LoadPlugin(IPluginFactory *factory, ClassInfo const &info, FUnknown *host_context);
 	void LoadInterfaces(IPluginFactory *factory, ClassInfo const &info, FUnknown *host_context);
 	void Initialize(vstma_unique_ptr<Vst::IComponentHandler> component_handler);
 
-	tresult CreatePlugView();
+	//! @pre メインスレッドから呼び出すこと
+	tresult CreatePlugView() const;
 	void DeletePlugView();
 
 	void PrepareParameters();
@@ -194,7 +260,8 @@ private:
 	audio_processor_ptr_t	audio_processor_;
 	edit_controller_ptr_t	edit_controller_;
 	edit_controller2_ptr_t	edit_controller2_;
-	plug_view_ptr_t			plug_view_;
+	//! HasEditor()で最初に問い合わせたときに作成する。
+	mutable plug_view_ptr_t	plug_view_;
 	unit_info_ptr_t			unit_handler_;
     UnitInfoList            unit_info_list_;
     ParameterInfoList       parameter_info_list_;
@@ -204,28 +271,79 @@ private:
     
 	Flag					is_processing_started_;
 	Flag					edit_controller_is_created_new_;
-	Flag					has_editor_;
+	//! PlugViewを作成するまでは無効値
+	mutable std::optional<bool> has_editor_;
 	Flag					is_editor_opened_;
 	Flag					param_value_changes_was_specified_;
+    std::atomic<bool>       is_dirty_ = { false };
 
 	int	sampling_rate_;
 	int block_size_;
+    Steinberg::int32 num_event_output_buses_ = 0;
     
     void UpdateBusBuffers();
     
     AudioBusesInfo input_buses_info_;
     AudioBusesInfo output_buses_info_;
     
-    // Vst3Plugin側にバッファを持たせないで、外側にあるバッファを使い回すほうが、コピーの手間が減っていいが、
-    // ちょっと設計がややこしくなるので、いまはここにバッファを持たせるようにしておく。
+    //! 各バスのchannelBuffers32は、以下の配列を指す。
+    //! 配列の各要素は、Process()の呼び出しごとに、呼び出し元から渡されたバッファのチャンネルを指すように更新される。
+    std::vector<float *> input_channels_;
+    std::vector<float *> output_channels_;
+    
+    //! 非アクティブなバスや、呼び出し元のバッファにチャンネルが足りない場合に使用するバッファ
     Buffer<float> input_buffer_;
     Buffer<float> output_buffer_;
     
     Status status_;
     
 private:
-    std::mutex              parameter_queue_mutex_;
-    Vst::ParameterChanges   param_changes_queue_;
+    struct ParameterChange
+    {
+        Vst::ParamID id_ = Vst::kNoParamId;
+        Int32 offset_ = 0;
+        Vst::ParamValue value_ = 0;
+    };
+    
+    static constexpr UInt32 kParameterChangeQueueCapacity = 4096;
+    
+    MPSCQueue<ParameterChange> parameter_change_queue_ { kParameterChangeQueueCapacity };
+    std::atomic<UInt64> num_dropped_parameter_changes_ = { 0 };
+    
+    //! スロット(parameter_info_list_上のインデックス)ごとの、現在の処理フレームでinput_params_に割り当てたキューのインデックス。(未割り当ての場合は-1)
+    std::vector<Int32> parameter_queue_indices_;
+    //! 現在の処理フレームでキューを割り当てたスロットのリスト
+    std::vector<UInt32> used_parameter_slots_;
+    
+    //! オーディオスレッドで発生した、EditControllerに反映するパラメータの変更
+    MPSCQueue<ParameterChange> controller_update_queue_ { kParameterChangeQueueCapacity };
+    
+    static constexpr Int32 kNumMidiChannels = 16;
+    //! [MIDIチャンネル][コントローラ番号] -> パラメータID (対応するパラメータがない場合はkNoParamId)
+    using MidiControllerTable = std::array<std::array<Vst::ParamID, Vst::kCountCtrlNumber>, kNumMidiChannels>;
+    
+    //! IMidiMapping::getMidiControllerAssignment()をオーディオスレッドから呼び出さないように、
+    //! 事前に全チャンネルと全コントローラに対する結果をテーブルにしておく。
+    //! テーブルはポインタを差し替えてアトミックに公開し、古いテーブルはGarbageCollectorで解放する。
+    std::shared_ptr<MidiControllerTable const> midi_controller_table_;
+    std::atomic<MidiControllerTable const *> published_midi_controller_table_ = { nullptr };
+    
+    //! 状態の適用後、古いパラメータの変更を破棄する間だけ、オーディオスレッドでのプラグインの処理を止める。
+    BypassFlag state_bypass_;
+    
+    static constexpr UInt32 kDeferredMidiMessageCapacity = 1024;
+    //! state_bypass_によって処理を止めている間に届いたMIDIメッセージ。(オーディオスレッドからのみ参照する)
+    //! オーディオスレッドでメモリを確保しないように、容量を超えた分は捨てる。
+    std::vector<ProcessInfo::MidiMessage> deferred_midi_messages_;
+    //! IComponent::getState()/setState()の呼び出しを排他する。
+    LockFactory lf_state_;
+    
+    //! ApplyStateSnapshotAsync()で適用中の処理と、コントローラへの反映を待っているスナップショット
+    LockFactory lf_pending_state_;
+    std::shared_future<bool> pending_state_apply_;
+    StateSnapshotPtr pending_controller_snapshot_;
+    
+    Vst3StateSnapshotCache snapshot_cache_;
     
     Vst::ParameterChanges input_params_;
     Vst::ParameterChanges output_params_;
@@ -0,0 +1,332 @@
+#include "Vst3PluginPool.hpp"
+
+#include <deque>
+#include <exception>
+#include <unordered_map>
+#include <vector>
+
+#include "../../misc/LockFactory.hpp"
+
+NS_HWM_BEGIN
+
+struct Vst3PluginPool::Impl
+:   std::enable_shared_from_this<Impl>
+{
+    using PluginPtr = std::unique_ptr<Vst3Plugin>;
+    
+    struct Entry
+    {
+        //! SetPoolSize()で登録し直されたEntryを区別するためのID
+        UInt64 id_ = 0;
+        PluginDescription desc_;
+        UInt32 num_instances_ = 0;
+        //! 作成待ちと作成中のインスタンスの数
+        UInt32 num_creating_ = 0;
+        std::deque<PluginPtr> instances_;
+    };
+    
+    //! 作成待ちのインスタンス
+    struct Request
+    {
+        std::string key_;
+        UInt64 entry_id_ = 0;
+    };
+    
+    LockFactory lf_;
+    Creator creator_;
+    Dispatcher dispatcher_;
+    double sample_rate_ = 44100;
+    SampleCount block_size_ = 0;
+    //! SetProcessSetup()で設定が変わるたびに更新する。
+    //! 古い設定で作成されたインスタンスは、プールに追加せずに破棄する。
+    UInt64 setup_generation_ = 0;
+    UInt64 next_entry_id_ = 0;
+    bool under_pressure_ = false;
+    bool stopped_ = false;
+    //! key: CID
+    std::unordered_map<std::string, Entry> entries_;
+    
+    //! メインスレッドで、先頭から一つずつ作成する。
+    std::deque<Request> requests_;
+    //! dispatcher_に渡したタスクが、まだ実行されていないかどうか
+    bool dispatched_ = false;
+    
+    static
+    std::string GetKey(PluginDescription const &desc)
+    {
+        return desc.vst3info().cid();
+    }
+    
+    //! @pre lf_がロックされていること
+    void Schedule(std::string const &key, Entry &entry)
+    {
+        if(stopped_ || under_pressure_) { return; }
+    
+        while(entry.instances_.size() + entry.num_creating_ < entry.num_instances_) {
+            entry.num_creating_ += 1;
+            requests_.push_back(Request { key, entry.id_ });
+        }
+    
+        Dispatch();
+    }
+    
+    //! @pre lf_がロックされていること
+    void ScheduleAll()
+    {
+        for(auto &kv: entries_) { Schedule(kv.first, kv.second); }
+    }
+    
+    //! 作成待ちのインスタンスがあれば、一つ作成するタスクをメインスレッドに渡す。
+    //! @pre lf_がロックされていること
+    void Dispatch()
+    {
+        if(dispatched_ || requests_.empty() || stopped_ || under_pressure_) { return; }
+    
+        dispatched_ = true;
+        dispatcher_([weak = std::weak_ptr<Impl>(shared_from_this())] {
+            if(auto self = weak.lock()) { self->CreateNextInstance(); }
+        });
+    }
+    
+    //! 作成待ちのインスタンスをすべて取り消す。
+    //! @pre lf_がロックされていること
+    void CancelRequests()
+    {
+        for(auto const &req: requests_) {
+            auto found = entries_.find(req.key_);
+            if(found == entries_.end() || found->second.id_ != req.entry_id_) { continue; }
+            found->second.num_creating_ -= 1;
+        }
+        requests_.clear();
+    }
+    
+    //! @pre lf_がロックされていること
+    //! @return 解放するインスタンス。ロックの外で破棄すること。
+    std::vector<PluginPtr> TakeAllInstances()
+    {
+        std::vector<PluginPtr> released;
+        for(auto &kv: entries_) {
+            for(auto &p: kv.second.instances_) { released.push_back(std::move(p)); }
+            kv.second.instances_.clear();
+        }
+        return released;
+    }
+    
+    //! メインスレッドで実行される
+    void CreateNextInstance()
+    {
+        auto lock = lf_.make_lock();
+        dispatched_ = false;
+    
+        //! 登録し直されたり削除されたりしたEntryへの要求は、読み飛ばす。
+        auto found = entries_.end();
+        Request req;
+        while(requests_.empty() == false) {
+            req = std::move(requests_.front());
+            requests_.pop_front();
+            found = entries_.find(req.key_);
+            if(found != entries_.end() && found->second.id_ == req.entry_id_) { break; }
+            found = entries_.end();
+        }
+    
+        if(found == entries_.end()) { return; }
+    
+        if(stopped_ || under_pressure_) {
+            found->second.num_creating_ -= 1;
+            return;
+        }
+    
+        auto const desc = found->second.desc_;
+        auto const sample_rate = sample_rate_;
+        auto const block_size = block_size_;
+        auto const generation = setup_generation_;
+        lock.unlock();
+    
+        auto plugin = creator_(desc);
+        if(plugin && block_size > 0) {
+            try {
+                plugin->SetSamplingRate(sample_rate);
+                plugin->SetBlockSize(block_size);
+                plugin->SetupProcessing();
+            } catch(std::exception &e) {
+                hwm::dout << "Failed to setup a pooled Vst3Plugin: " << e.what() << std::endl;
+                plugin.reset();
+            }
+        }
+    
+        lock.lock();
+        found = entries_.find(req.key_);
+        if(found == entries_.end() || found->second.id_ != req.entry_id_) {
+            Dispatch();
+            lock.unlock();
+            return;
+        }
+    
+        auto &entry = found->second;
+        entry.num_creating_ -= 1;
+    
+        if(!plugin) {
+            //! 作成に失敗するプラグインを作成し続けないように、補充を止める。
+            hwm::dout << "Failed to create a pooled Vst3Plugin: " << desc.name() << std::endl;
+            entry.num_instances_ = entry.instances_.size() + entry.num_creating_;
+            Dispatch();
+            return;
+        }
+    
+        if(generation == setup_generation_
+           && stopped_ == false
+           && under_pressure_ == false
+           && entry.instances_.size() < entry.num_instances_)
+        {
+            entry.instances_.push_back(std::move(plugin));
+        }
+    
+        //! 古い設定で作成したインスタンスを破棄した場合は、作成し直す。
+        Schedule(req.key_, entry);
+        Dispatch();
+        lock.unlock();
+    }
+};
+
+Vst3PluginPool::Vst3PluginPool(Creator creator, Dispatcher dispatcher)
+:   pimpl_(std::make_shared<Impl>())
+{
+    pimpl_->creator_ = std::move(creator);
+    pimpl_->dispatcher_ = std::move(dispatcher);
+}
+
+Vst3PluginPool::~Vst3PluginPool()
+{
+    assert(wxIsMainThread());
+    
+    auto lock = pimpl_->lf_.make_lock();
+    pimpl_->stopped_ = true;
+    pimpl_->requests_.clear();
+    auto entries = std::move(pimpl_->entries_);
+    lock.unlock();
+}
+
+void Vst3PluginPool::SetProcessSetup(double sample_rate, SampleCount block_size)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    if(pimpl_->sample_rate_ == sample_rate && pimpl_->block_size_ == block_size) { return; }
+    
+    pimpl_->sample_rate_ = sample_rate;
+    pimpl_->block_size_ = block_size;
+    pimpl_->setup_generation_ += 1;
+    
+    auto released = pimpl_->TakeAllInstances();
+    pimpl_->ScheduleAll();
+    lock.unlock();
+}
+
+bool Vst3PluginPool::SetPoolSize(PluginDescription const &desc, UInt32 num_instances)
+{
+    auto const key = Impl::GetKey(desc);
+    if(key.empty()) { return false; }
+    
+    std::deque<Impl::PluginPtr> released;
+    
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->entries_.find(key);
+    
+    if(num_instances == 0) {
+        if(found != pimpl_->entries_.end()) {
+            released = std::move(found->second.instances_);
+            pimpl_->entries_.erase(found);
+        }
+        lock.unlock();
+        return true;
+    }
+    
+    if(found == pimpl_->entries_.end()) {
+        Impl::Entry entry;
+        entry.id_ = pimpl_->next_entry_id_++;
+        entry.desc_ = desc;
+        found = pimpl_->entries_.emplace(key, std::move(entry)).first;
+    }
+    
+    auto &entry = found->second;
+    entry.num_instances_ = num_instances;
+    while(entry.instances_.size() > num_instances) {
+        released.push_back(std::move(entry.instances_.back()));
+        entry.instances_.pop_back();
+    }
+    
+    pimpl_->Schedule(key, entry);
+    lock.unlock();
+    return true;
+}
+
+UInt32 Vst3PluginPool::GetPoolSize(PluginDescription const &desc) const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->entries_.find(Impl::GetKey(desc));
+    if(found == pimpl_->entries_.end()) { return 0; }
+    
+    return found->second.num_instances_;
+}
+
+bool Vst3PluginPool::IsPooled(PluginDescription const &desc) const
+{
+    return GetPoolSize(desc) > 0;
+}
+
+UInt32 Vst3PluginPool::GetNumAvailableInstances(PluginDescription const &desc) const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->entries_.find(Impl::GetKey(desc));
+    if(found == pimpl_->entries_.end()) { return 0; }
+    
+    return found->second.instances_.size();
+}
+
+std::unique_ptr<Vst3Plugin> Vst3PluginPool::Acquire(PluginDescription const &desc)
+{
+    auto const key = Impl::GetKey(desc);
+    
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->entries_.find(key);
+    if(found == pimpl_->entries_.end()) { return nullptr; }
+    
+    auto &entry = found->second;
+    if(entry.instances_.empty()) { return nullptr; }
+    
+    auto plugin = std::move(entry.instances_.front());
+    entry.instances_.pop_front();
+    pimpl_->Schedule(key, entry);
+    return plugin;
+}
+
+void Vst3PluginPool::SetMemoryPressure(bool under_pressure)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    if(pimpl_->under_pressure_ == under_pressure) { return; }
+    
+    pimpl_->under_pressure_ = under_pressure;
+    
+    if(under_pressure) {
+        pimpl_->CancelRequests();
+        auto released = pimpl_->TakeAllInstances();
+        lock.unlock();
+        hwm::dout << "Released " << released.size() << " pooled plugin instances." << std::endl;
+    } else {
+        pimpl_->ScheduleAll();
+    }
+}
+
+bool Vst3PluginPool::IsUnderMemoryPressure() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    return pimpl_->under_pressure_;
+}
+
+void Vst3PluginPool::Clear()
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto entries = std::move(pimpl_->entries_);
+    pimpl_->entries_.clear();
+    lock.unlock();
+}
+
+NS_HWM_END
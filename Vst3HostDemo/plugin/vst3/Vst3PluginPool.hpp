@@ -0,0 +1,86 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "./Vst3Plugin.hpp"
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! 作成と初期化を済ませたプラグインのインスタンスを、CIDごとに指定した数だけ保持しておくプール
+/*! 演奏中に音色を切り替えるときに、コンポーネントの作成、initialize、バスの設定、
+ *  パラメータの列挙、setupProcessingを待たずにプラグインを使い始められるようにするために使用する。
+ *
+ *  プラグインの作成や初期化は、メインスレッドで呼び出されることを前提にしているプラグインが多いので、
+ *  インスタンスの作成と初期化は、Dispatcherでメインスレッドに渡したタスクの中で、一つずつ行う。
+ *  (一つのタスクで作成するのは一つだけにして、その間にGUIのイベントが処理されるようにする)
+ *  Acquire()でインスタンスが取り出されると、設定された数になるまで非同期に補充する。
+ *
+ *  メモリが不足している間(SetMemoryPressure(true))は、保持しているインスタンスを解放し、補充も行わない。
+ *
+ *  すべての関数はスレッドセーフ。ただし、破棄はメインスレッドで行う。
+ */
+class Vst3PluginPool final
+{
+public:
+    //! インスタンスを作成する関数。作成に失敗した場合はnullptrを返す。
+    //! メインスレッドから呼び出される。
+    using Creator = std::function<std::unique_ptr<Vst3Plugin>(PluginDescription const &desc)>;
+    
+    //! 渡されたタスクを、後からメインスレッドで実行する関数。
+    //! 任意のスレッドから呼び出されるので、タスクをその場で実行してはいけない。
+    using Dispatcher = std::function<void(std::function<void()> task)>;
+    
+    Vst3PluginPool(Creator creator, Dispatcher dispatcher);
+    
+    //! メインスレッドで破棄する。まだ実行されていないタスクは、実行されても何もしない。
+    ~Vst3PluginPool();
+    
+    Vst3PluginPool(Vst3PluginPool const &) = delete;
+    Vst3PluginPool & operator=(Vst3PluginPool const &) = delete;
+    
+    //! プールしておくインスタンスに設定する、サンプリングレートとブロックサイズ
+    /*! 設定が変わった場合は、保持しているインスタンスを破棄して作成し直す。
+     */
+    void SetProcessSetup(double sample_rate, SampleCount block_size);
+    
+    //! descのプラグインを、num_instances個保持するように設定する。
+    /*! num_instancesが0の場合は、descのプラグインをプールの対象から外す。
+     *  @return descにCIDが設定されていない場合はfalse
+     */
+    bool SetPoolSize(PluginDescription const &desc, UInt32 num_instances);
+    
+    //! descのプラグインに設定されている数。プールの対象でない場合は0
+    UInt32 GetPoolSize(PluginDescription const &desc) const;
+    
+    //! descのプラグインが、プールの対象になっているかどうか
+    bool IsPooled(PluginDescription const &desc) const;
+    
+    //! 現在すぐに取り出せるインスタンスの数
+    UInt32 GetNumAvailableInstances(PluginDescription const &desc) const;
+    
+    //! 作成済みのインスタンスを一つ取り出す。
+    /*! 取り出したインスタンスは、SetProcessSetup()で設定した値でsetupProcessingが呼び出された状態になっている。
+     *  取り出した後は、非同期にインスタンスを補充する。
+     *  @return 取り出せるインスタンスがない場合はnullptr
+     */
+    std::unique_ptr<Vst3Plugin> Acquire(PluginDescription const &desc);
+    
+    //! メモリが不足しているかどうかを設定する。
+    /*! trueの場合は、保持しているインスタンスをすべて解放して、補充を停止する。
+     *  falseに戻すと、設定された数まで補充を再開する。
+     */
+    void SetMemoryPressure(bool under_pressure);
+    bool IsUnderMemoryPressure() const;
+    
+    //! すべての設定とインスタンスを破棄する。
+    void Clear();
+    
+private:
+    struct Impl;
+    //! メインスレッドに渡したタスクから、破棄されたかどうかを確認できるように、shared_ptrで保持する。
+    std::shared_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
@@ -0,0 +1,180 @@
+#include "Vst3StateSnapshotCache.hpp"
+
+#include <chrono>
+#include <list>
+#include <unordered_map>
+
+#include "../../misc/LockFactory.hpp"
+
+NS_HWM_BEGIN
+
+struct Vst3StateSnapshotCache::Impl
+{
+    struct Entry
+    {
+        String key_;
+        StateSnapshotPtr snapshot_;
+        size_t size_ = 0;
+    };
+    
+    using EntryList = std::list<Entry>;
+    
+    LockFactory lf_;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    //! 先頭ほど最近参照されたもの
+    EntryList entries_;
+    std::unordered_map<String, EntryList::iterator> table_;
+    //! 実行中のPreload()。同じキーのPreload()が重なった場合は、実行中のものを共有する。
+    std::unordered_map<String, std::shared_future<StateSnapshotPtr>> pending_loads_;
+    
+    //! @pre lf_がロックされていること
+    void RemoveEntry(EntryList::iterator it)
+    {
+        size_ -= it->size_;
+        table_.erase(it->key_);
+        entries_.erase(it);
+    }
+    
+    //! @pre lf_がロックされていること
+    void Shrink()
+    {
+        while(size_ > capacity_ && entries_.empty() == false) {
+            RemoveEntry(std::prev(entries_.end()));
+        }
+    }
+    
+    //! @pre lf_がロックされていること
+    void RemoveFinishedLoads()
+    {
+        for(auto it = pending_loads_.begin(); it != pending_loads_.end(); ) {
+            if(it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                it = pending_loads_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+};
+
+Vst3StateSnapshotCache::Vst3StateSnapshotCache(size_t capacity)
+:   pimpl_(std::make_unique<Impl>())
+{
+    pimpl_->capacity_ = capacity;
+}
+
+Vst3StateSnapshotCache::~Vst3StateSnapshotCache()
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto pending_loads = std::move(pimpl_->pending_loads_);
+    lock.unlock();
+    
+    for(auto &entry: pending_loads) { entry.second.wait(); }
+}
+
+void Vst3StateSnapshotCache::SetCapacity(size_t capacity)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    pimpl_->capacity_ = capacity;
+    pimpl_->Shrink();
+}
+
+size_t Vst3StateSnapshotCache::GetCapacity() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    return pimpl_->capacity_;
+}
+
+size_t Vst3StateSnapshotCache::GetSize() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    return pimpl_->size_;
+}
+
+size_t Vst3StateSnapshotCache::GetNumSnapshots() const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    return pimpl_->entries_.size();
+}
+
+void Vst3StateSnapshotCache::Add(String const &key, StateSnapshotPtr snapshot)
+{
+    if(!snapshot) { return; }
+    
+    auto const size = snapshot->GetSize();
+    
+    //! 古いスナップショットは、ロックの外で解放する。
+    StateSnapshotPtr old_snapshot;
+    
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->table_.find(key);
+    if(found != pimpl_->table_.end()) {
+        old_snapshot = found->second->snapshot_;
+        pimpl_->RemoveEntry(found->second);
+    }
+    
+    if(size > pimpl_->capacity_) { return; }
+    
+    pimpl_->entries_.push_front(Impl::Entry { key, std::move(snapshot), size });
+    pimpl_->table_[key] = pimpl_->entries_.begin();
+    pimpl_->size_ += size;
+    pimpl_->Shrink();
+}
+
+Vst3StateSnapshotCache::StateSnapshotPtr Vst3StateSnapshotCache::Find(String const &key)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->table_.find(key);
+    if(found == pimpl_->table_.end()) { return nullptr; }
+    
+    auto &entries = pimpl_->entries_;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->snapshot_;
+}
+
+void Vst3StateSnapshotCache::Remove(String const &key)
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto found = pimpl_->table_.find(key);
+    if(found == pimpl_->table_.end()) { return; }
+    
+    pimpl_->RemoveEntry(found->second);
+}
+
+void Vst3StateSnapshotCache::Clear()
+{
+    auto lock = pimpl_->lf_.make_lock();
+    auto entries = std::move(pimpl_->entries_);
+    pimpl_->entries_.clear();
+    pimpl_->table_.clear();
+    pimpl_->size_ = 0;
+    lock.unlock();
+}
+
+std::shared_future<Vst3StateSnapshotCache::StateSnapshotPtr>
+Vst3StateSnapshotCache::Preload(String const &key, Loader loader)
+{
+    if(auto snapshot = Find(key)) {
+        std::promise<StateSnapshotPtr> p;
+        p.set_value(snapshot);
+        return p.get_future().share();
+    }
+    
+    auto lock = pimpl_->lf_.make_lock();
+    pimpl_->RemoveFinishedLoads();
+    
+    //! 同じキーの読み込みが実行中の場合は、loaderを実行せずにその結果を共有する。
+    auto found = pimpl_->pending_loads_.find(key);
+    if(found != pimpl_->pending_loads_.end()) { return found->second; }
+    
+    auto f = std::async(std::launch::async, [this, key, loader = std::move(loader)] {
+        auto snapshot = loader();
+        Add(key, snapshot);
+        return snapshot;
+    }).share();
+    
+    pimpl_->pending_loads_.emplace(key, f);
+    return f;
+}
+
+NS_HWM_END
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+
+#include "./Vst3Plugin.hpp"
+
+NS_HWM_BEGIN
+
+//! 事前に読み込んだプラグインの状態(Vst3Plugin::StateSnapshot)を保持する、LRUキャッシュ
+/*! プログラムの切り替え時にディスクからプリセットを読み込まなくて済むように、
+ *  切り替え候補のスナップショットをあらかじめメモリ上に読み込んでおくために使用する。
+ *
+ *  スナップショットの合計サイズが容量を超えた場合は、最も長い間参照されていないものから破棄する。
+ *  すべての関数はスレッドセーフ。
+ */
+class Vst3StateSnapshotCache final
+{
+public:
+    using StateSnapshotPtr = Vst3Plugin::StateSnapshotPtr;
+    //! スナップショットを読み込む関数。読み込みに失敗した場合はnullptrを返す。
+    using Loader = std::function<StateSnapshotPtr()>;
+    
+    //! デフォルトの容量(バイト)
+    static constexpr size_t kDefaultCapacity = 64 * 1024 * 1024;
+    
+    explicit Vst3StateSnapshotCache(size_t capacity = kDefaultCapacity);
+    
+    //! 実行中のPreload()の完了を待機してから破棄する。
+    ~Vst3StateSnapshotCache();
+    
+    Vst3StateSnapshotCache(Vst3StateSnapshotCache const &) = delete;
+    Vst3StateSnapshotCache & operator=(Vst3StateSnapshotCache const &) = delete;
+    
+    //! 容量を設定する。現在の合計サイズが容量を超えている場合は、古いものから破棄する。
+    void SetCapacity(size_t capacity);
+    size_t GetCapacity() const;
+    
+    //! 保持しているスナップショットの合計サイズ
+    size_t GetSize() const;
+    size_t GetNumSnapshots() const;
+    
+    //! スナップショットを追加する。同じキーのスナップショットがすでにある場合は置き換える。
+    //! 容量より大きいスナップショットは追加しない。
+    void Add(String const &key, StateSnapshotPtr snapshot);
+    
+    //! スナップショットを検索する。見つかったスナップショットは、最近参照されたものとして扱われる。
+    //! @return 見つからない場合はnullptr
+    StateSnapshotPtr Find(String const &key);
+    
+    void Remove(String const &key);
+    void Clear();
+    
+    //! loaderをバックグラウンドスレッドで実行して、読み込んだスナップショットをキャッシュに追加する。
+    /*! すでに同じキーのスナップショットがある場合は、loaderを実行せずにそれを返す。
+     *  同じキーの読み込みが実行中の場合も、loaderを実行せずに、実行中の読み込みのfutureを返す。
+     *  @return 読み込んだスナップショットを受け取るためのfuture
+     */
+    std::shared_future<StateSnapshotPtr> Preload(String const &key, Loader loader);
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
@@ -0,0 +1,204 @@
+#include "MidiMessageBenchmark.hpp"
+
+#include <string>
+#include <vector>
+
+#include "../misc/Benchmark.hpp"
+#include "./ProcessInfo.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    using namespace MidiDataType;
+
+    //! 8バイトのPODにする前のProcessInfo::MidiMessageと同じ表現。比較用。
+    struct VariantMidiMessage
+    {
+        using DataType = MidiDataType::VariantType;
+
+        SampleCount offset_ = 0;
+        UInt8 channel_ = 0;
+        double ppq_pos_ = 0;
+
+        template<class To>
+        To const * As() const { return mpark::get_if<To>(&data_); }
+
+        DataType data_;
+    };
+
+    //! プラグインに渡すイベント(Vst::Eventやパラメータの変更)に相当するもの
+    struct EventRecord
+    {
+        enum Type : Int16 {
+            kNoteOn,
+            kNoteOff,
+            kPolyPressure,
+            kParameterChange,
+        };
+
+        Int16 type_ = 0;
+        Int16 channel_ = 0;
+        Int32 offset_ = 0;
+        //! ピッチやCC番号
+        Int32 number_ = 0;
+        double value_ = 0;
+
+        bool operator==(EventRecord const &rhs) const
+        {
+            return type_ == rhs.type_ && channel_ == rhs.channel_ && offset_ == rhs.offset_
+            && number_ == rhs.number_ && value_ == rhs.value_;
+        }
+    };
+
+    //! 以前のVst3Plugin::Impl::Process()と同じように、As<>()の連鎖で変換する。
+    void Convert(VariantMidiMessage const &m, std::vector<EventRecord> &dest)
+    {
+        EventRecord e;
+        e.channel_ = m.channel_;
+        e.offset_ = (Int32)m.offset_;
+
+        if(auto note_on = m.As<NoteOn>()) {
+            e.type_ = EventRecord::kNoteOn;
+            e.number_ = note_on->pitch_;
+            e.value_ = note_on->velocity_ / 127.0;
+        } else if(auto note_off = m.As<NoteOff>()) {
+            e.type_ = EventRecord::kNoteOff;
+            e.number_ = note_off->pitch_;
+            e.value_ = note_off->off_velocity_ / 127.0;
+        } else if(auto poly_press = m.As<PolyphonicKeyPressure>()) {
+            e.type_ = EventRecord::kPolyPressure;
+            e.number_ = poly_press->pitch_;
+            e.value_ = poly_press->value_ / 127.0;
+        } else if(auto cc = m.As<ControlChange>()) {
+            e.type_ = EventRecord::kParameterChange;
+            e.number_ = cc->control_number_;
+            e.value_ = cc->data_ / 128.0;
+        } else {
+            return;
+        }
+
+        dest.push_back(e);
+    }
+
+    //! 現在のVst3Plugin::Impl::Process()と同じように、ステータスバイトに対するswitchで変換する。
+    void Convert(ProcessInfo::MidiMessage const &m, std::vector<EventRecord> &dest)
+    {
+        EventRecord e;
+        e.channel_ = m.GetChannel();
+        e.offset_ = m.offset_;
+        e.number_ = m.data1_;
+
+        switch(m.GetMessageType()) {
+            case kNoteOn:
+                e.type_ = EventRecord::kNoteOn;
+                e.value_ = m.data2_ / 127.0;
+                break;
+            case kNoteOff:
+                e.type_ = EventRecord::kNoteOff;
+                e.value_ = m.data2_ / 127.0;
+                break;
+            case kPolyphonicKeyPressure:
+                e.type_ = EventRecord::kPolyPressure;
+                e.value_ = m.data2_ / 127.0;
+                break;
+            case kControlChange:
+                e.type_ = EventRecord::kParameterChange;
+                e.value_ = m.data2_ / 128.0;
+                break;
+            default:
+                return;
+        }
+
+        dest.push_back(e);
+    }
+
+    //! ブロック内に均等に並んだCCイベントを作る。
+    std::vector<VariantMidiMessage> MakeControlChanges(UInt32 num_events, SampleCount block_size)
+    {
+        std::vector<VariantMidiMessage> events(num_events);
+        for(UInt32 i = 0; i < num_events; ++i) {
+            auto &m = events[i];
+            m.offset_ = i * block_size / num_events;
+            m.channel_ = i % 16;
+            m.data_ = ControlChange { (UInt8)(i % 120), (UInt8)(i % 128) };
+        }
+        return events;
+    }
+
+    struct Times
+    {
+        //! ノードの入力バッファへのコピーにかかった時間
+        std::vector<double> copy_;
+        //! イベントへの変換にかかった時間
+        std::vector<double> convert_;
+    };
+
+    //! 1ブロック分の処理として、ノードの入力バッファへのコピーとイベントへの変換を、num_iterations回計測する。
+    template<class Message>
+    Times Measure(std::vector<Message> const &src,
+                  std::vector<EventRecord> &records,
+                  UInt32 num_iterations)
+    {
+        std::vector<Message> input_buffer;
+        input_buffer.reserve(src.size());
+        records.reserve(src.size());
+
+        Times times;
+        for(UInt32 i = 0; i < num_iterations; ++i) {
+            auto const t_begin = BenchmarkClock::now();
+            input_buffer.clear();
+            input_buffer.insert(input_buffer.end(), src.begin(), src.end());
+            auto const t_copied = BenchmarkClock::now();
+            records.clear();
+            for(auto const &m: input_buffer) {
+                Convert(m, records);
+            }
+            auto const t_end = BenchmarkClock::now();
+            times.copy_.push_back(ToMilliseconds(t_copied - t_begin));
+            times.convert_.push_back(ToMilliseconds(t_end - t_copied));
+        }
+
+        return times;
+    }
+
+    template<class Message>
+    std::vector<EventRecord> RunOne(std::string const &label,
+                                    std::vector<Message> const &src,
+                                    UInt32 num_iterations)
+    {
+        std::vector<EventRecord> records;
+        auto const times = Measure(src, records, num_iterations);
+        PrintBenchmarkTimes("Copy {}"_format(label), times.copy_);
+        PrintBenchmarkTimes("Convert {}"_format(label), times.convert_);
+        return records;
+    }
+}
+
+int RunMidiMessageBenchmark(UInt32 num_events, UInt32 num_iterations)
+{
+    if(num_events == 0 || num_iterations == 0) { return 1; }
+
+    SampleCount const kBlockSize = 512;
+
+    auto const variant_messages = MakeControlChanges(num_events, kBlockSize);
+    std::vector<ProcessInfo::MidiMessage> packed_messages;
+    packed_messages.reserve(num_events);
+    for(auto const &m: variant_messages) {
+        packed_messages.push_back(ProcessInfo::MidiMessage::FromData((UInt32)m.offset_, m.channel_, m.data_));
+    }
+
+    auto const variant_records = RunOne("{} CCs ({}-byte variant)"_format(num_events, sizeof(VariantMidiMessage)),
+                                        variant_messages, num_iterations);
+    auto const packed_records = RunOne("{} CCs ({}-byte POD)"_format(num_events, sizeof(ProcessInfo::MidiMessage)),
+                                       packed_messages, num_iterations);
+
+    if(variant_records != packed_records) {
+        hwm::dout << "The two representations were converted to different events." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+NS_HWM_END
@@ -0,0 +1,16 @@
+#pragma once
+
+NS_HWM_BEGIN
+
+//! グラフ内のMIDIメッセージの表現による、1ブロックあたりの処理時間の違いを計測する。
+/*! num_events個のCCイベントを含むブロックについて、
+ *  ノードの入力バッファへのコピーと、プラグインに渡すイベントへの変換にかかる時間を、
+ *  現在の8バイトのProcessInfo::MidiMessageと、以前のvariantによる32バイトの表現とで比較する。
+ *  コピーと変換のそれぞれについて、num_iterations回の所要時間の最小値、中央値、最大値を出力する。
+ *  また、2つの表現から変換したイベントが一致するかどうかも確認する。
+ *
+ *  @return プロセスの終了コード
+ */
+int RunMidiMessageBenchmark(UInt32 num_events, UInt32 num_iterations);
+
+NS_HWM_END
@@ -2,18 +2,45 @@
 
 NS_HWM_BEGIN
 
-ProcessInfo::MidiMessage::MidiMessage()
+using namespace MidiDataType;
+
+ProcessInfo::MidiMessage
+ProcessInfo::MidiMessage::FromData(UInt32 offset, UInt8 channel, DataType const &data)
 {
+    assert(mpark::get_if<std::monostate>(&data) == nullptr);
+    assert(channel <= 15);
     
+    if(auto p = mpark::get_if<NoteOff>(&data)) {
+        return MidiMessage(offset, kNoteOff | channel, p->pitch_, p->off_velocity_);
+    } else if(auto p = mpark::get_if<NoteOn>(&data)) {
+        return MidiMessage(offset, kNoteOn | channel, p->pitch_, p->velocity_);
+    } else if(auto p = mpark::get_if<PolyphonicKeyPressure>(&data)) {
+        return MidiMessage(offset, kPolyphonicKeyPressure | channel, p->pitch_, p->value_);
+    } else if(auto p = mpark::get_if<ControlChange>(&data)) {
+        return MidiMessage(offset, kControlChange | channel, p->control_number_, p->data_);
+    } else if(auto p = mpark::get_if<ProgramChange>(&data)) {
+        return MidiMessage(offset, kProgramChange | channel, p->program_number_);
+    } else if(auto p = mpark::get_if<ChannelPressure>(&data)) {
+        return MidiMessage(offset, kChannelPressure | channel, p->value_);
+    } else if(auto p = mpark::get_if<PitchBendChange>(&data)) {
+        return MidiMessage(offset, kPitchBendChange | channel, p->value_lsb_, p->value_msb_);
+    }
+    
+    return MidiMessage();
 }
 
-ProcessInfo::MidiMessage::MidiMessage(SampleCount offset, UInt8 channel, double ppq_pos, DataType data)
-:   offset_(offset)
-,   channel_(channel)
-,   ppq_pos_(ppq_pos)
-,   data_(data)
+ProcessInfo::MidiMessage::DataType ProcessInfo::MidiMessage::ToData() const
 {
-    assert(mpark::get_if<std::monostate>(&data) == nullptr);
+    switch(GetMessageType()) {
+        case kNoteOff:                  return NoteOff { data1_, data2_ };
+        case kNoteOn:                   return NoteOn { data1_, data2_ };
+        case kPolyphonicKeyPressure:    return PolyphonicKeyPressure { data1_, data2_ };
+        case kControlChange:            return ControlChange { data1_, data2_ };
+        case kProgramChange:            return ProgramChange { data1_ };
+        case kChannelPressure:          return ChannelPressure { data1_ };
+        case kPitchBendChange:          return PitchBendChange { data1_, data2_ };
+        default:                        return std::monostate{};
+    }
 }
 
 NS_HWM_END
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <type_traits>
+
 #include "../data_type/MidiDataType.hpp"
 #include "../misc/Buffer.hpp"
 #include "../misc/ArrayRef.hpp"
@@ -9,28 +11,47 @@ NS_HWM_BEGIN
 
 struct ProcessInfo
 {
+    //! グラフ内でやり取りするMIDIメッセージ
+    /*! ステータスバイトと二つのデータバイトをそのまま保持する、8バイトのPOD。
+     *  多数のメッセージをバッファにコピーしたり走査したりするときのコストを抑えるために、
+     *  メッセージの種類による分岐は、ステータスバイトに対するswitchで行う。
+     *  MidiDataType::VariantTypeとの相互変換は、デバイスとの境界でだけ行う。
+     */
     struct MidiMessage
     {
         using DataType = MidiDataType::VariantType;
         
         //! フレーム先頭からのオフセット位置
-        SampleCount offset_ = 0;
-        UInt8 channel_ = 0;
-        //! プロジェクト中のPPQ位置
-        double ppq_pos_ = 0;
-
-        MidiMessage();
-        MidiMessage(SampleCount offset, UInt8 channel, double ppq_pos, DataType data);
+        UInt32 offset_ = 0;
+        //! チャンネルを含むステータスバイト
+        UInt8 status_ = 0;
+        UInt8 data1_ = 0;
+        UInt8 data2_ = 0;
+        UInt8 reserved_ = 0;
         
-        template<class To>
-        To * As() { return mpark::get_if<To>(&data_); }
+        MidiMessage() = default;
+        MidiMessage(UInt32 offset, UInt8 status, UInt8 data1, UInt8 data2 = 0)
+        :   offset_(offset)
+        ,   status_(status)
+        ,   data1_(data1)
+        ,   data2_(data2)
+        {}
         
-        template<class To>
-        To const * As() const { return mpark::get_if<To>(&data_); }
+        //! MidiDataType::MessageTypeの値
+        UInt8 GetMessageType() const { return status_ & 0xF0; }
+        UInt8 GetChannel() const { return status_ & 0x0F; }
         
-        DataType data_;
+        //! @pre dataは無効値(std::monostate)ではないこと
+        static
+        MidiMessage FromData(UInt32 offset, UInt8 channel, DataType const &data);
+        
+        //! ステータスバイトが不正な場合は、無効値(std::monostate)が返る。
+        DataType ToData() const;
     };
     
+    static_assert(sizeof(MidiMessage) == 8, "MidiMessage must be packed into 8 bytes");
+    static_assert(std::is_trivially_copyable<MidiMessage>::value, "MidiMessage must be trivially copyable");
+    
     template<class T>
     struct MidiBufferInfo
     {
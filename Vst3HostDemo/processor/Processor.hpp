@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./ProcessInfo.hpp"
+#include <plugin_desc.pb.h>
 
 NS_HWM_BEGIN
 
@@ -59,8 +60,10 @@ class Vst3AudioProcessor
 :   public Processor
 {
 public:
-    Vst3AudioProcessor(std::shared_ptr<Vst3Plugin> plugin)
-    :   plugin_(plugin)
+    //! @param desc プロジェクトの保存時に、同じプラグインを再作成するために使用する。
+    Vst3AudioProcessor(PluginDescription const &desc, std::shared_ptr<Vst3Plugin> plugin)
+    :   desc_(desc)
+    ,   plugin_(plugin)
     {}
     
     String GetName() const override { return plugin_->GetEffectName(); }
@@ -97,11 +100,12 @@ public:
     UInt32 GetMidiChannelCount(BusDirection dir) const override
     {
         if(dir == BusDirection::kInputSide) { return 1; }
-        else                                { return 0; }
+        else                                { return plugin_->HasEventOutput() ? 1 : 0; }
     }
     
     bool HasEditor() const override { return plugin_->HasEditor(); }
     
+    PluginDescription desc_;
     std::shared_ptr<Vst3Plugin> plugin_;
 };
 
@@ -0,0 +1,38 @@
+#include "AudioClipProcessor.hpp"
+
+#include <wx/filename.h>
+
+NS_HWM_BEGIN
+
+AudioClipProcessor::AudioClipProcessor(DiskStreamer::StreamPtr stream)
+:   stream_(std::move(stream))
+{
+    assert(stream_);
+}
+
+AudioClipProcessor::~AudioClipProcessor()
+{
+    stream_->Close();
+}
+
+DiskStreamer::StreamPtr AudioClipProcessor::GetStream() const
+{
+    return stream_;
+}
+
+String AudioClipProcessor::GetName() const
+{
+    return wxFileName(stream_->GetPath()).GetName().ToStdWstring();
+}
+
+void AudioClipProcessor::Process(ProcessInfo &pi)
+{
+    stream_->Read(*pi.time_info_, pi.output_audio_buffer_);
+}
+
+UInt32 AudioClipProcessor::GetAudioChannelCount(BusDirection dir) const
+{
+    return (dir == BusDirection::kOutputSide) ? stream_->GetNumChannels() : 0;
+}
+
+NS_HWM_END
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../processor/Processor.hpp"
+#include "./DiskStreamer.hpp"
+
+NS_HWM_BEGIN
+
+//! ディスクからストリーミングしたオーディオファイルを、トランスポートの再生位置に合わせて出力するProcessor
+class AudioClipProcessor
+:   public Processor
+{
+public:
+    AudioClipProcessor(DiskStreamer::StreamPtr stream);
+    ~AudioClipProcessor();
+    
+    DiskStreamer::StreamPtr GetStream() const;
+    
+    String GetName() const override;
+    void Process(ProcessInfo &pi) override;
+    UInt32 GetAudioChannelCount(BusDirection dir) const override;
+    
+private:
+    DiskStreamer::StreamPtr stream_;
+};
+
+NS_HWM_END
@@ -0,0 +1,326 @@
+#include "AudioRecorder.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "../misc/ThreadSafeRingBuffer.hpp"
+#include "../misc/GarbageCollector.hpp"
+#include "../file/WaveFile.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    //! 書き出しスレッドが停滞しても録音を継続できる時間
+    double const kBufferingSeconds = 2.0;
+
+    //! 録音開始時に、ディスク上に事前に確保しておく時間
+    double const kPreallocatedSeconds = 60.0;
+
+    //! 書き出しスレッドが一度にリングバッファから取り出すフレーム数
+    UInt32 const kWriteChunkSize = 16384;
+
+    //! 書き出しスレッドが、リングバッファを確認する間隔
+    std::chrono::milliseconds const kWritingInterval { 10 };
+}
+
+struct AudioRecorder::Take
+{
+    Take(TakeDesc const &desc, double sample_rate, SampleCount latency, bool use_direct_io)
+    :   input_(desc.input_)
+    ,   file_(std::make_unique<WaveFileWriter>(desc.path_,
+                                               desc.num_channels_,
+                                               sample_rate,
+                                               (SampleCount)(sample_rate * kPreallocatedSeconds),
+                                               use_direct_io))
+    ,   ring_(desc.num_channels_, std::max<UInt32>((UInt32)(sample_rate * kBufferingSeconds), kWriteChunkSize))
+    ,   timeline_pos_(-1)
+    ,   num_overruns_(0)
+    ,   num_dropped_frames_(0)
+    ,   num_recorded_frames_(0)
+    ,   has_write_error_(false)
+    ,   rt_channels_(desc.num_channels_)
+    ,   wr_buffer_(desc.num_channels_, kWriteChunkSize)
+    ,   wr_num_to_skip_(std::max<SampleCount>(latency, 0))
+    {}
+
+    GraphProcessor::AudioInput const *input_ = nullptr;
+    std::unique_ptr<WaveFileWriter> file_;
+    MultiChannelThreadSafeRingBuffer<float> ring_;
+
+    std::atomic<SampleCount> timeline_pos_;
+    std::atomic<UInt32> num_overruns_;
+    std::atomic<SampleCount> num_dropped_frames_;
+    std::atomic<SampleCount> num_recorded_frames_;
+    std::atomic<bool> has_write_error_;
+
+    //! 以下はリアルタイムスレッドからのみアクセスする。
+
+    //! Push()でリングバッファに渡すチャンネルのポインタ。メモリ確保を避けるために事前に確保しておく。
+    std::vector<float const *> rt_channels_;
+    //! 次のフレームの開始位置として期待される位置。(負の値は録音が始まっていないことを表す)
+    SampleCount rt_next_pos_ = -1;
+    //! 再生の停止や再生位置の変化によって、録音が終了したかどうか
+    bool rt_finished_ = false;
+    //! リングバッファが溢れたために書き込めなかったフレーム数。
+    //! リングバッファに空きができたら、ファイル上の位置がずれないように、この分の無音を書き込む。
+    SampleCount rt_num_pending_silence_ = 0;
+
+    //! 以下は書き出しスレッドからのみアクセスする。
+
+    Buffer<float> wr_buffer_;
+    //! レイテンシー補正のために、ファイルに書き込まずに捨てるフレーム数
+    SampleCount wr_num_to_skip_ = 0;
+
+    TakeInfo GetTakeInfo() const;
+
+    void Push(TransportInfo const &ti, BufferRef<float const> buf);
+
+    //! 呼び出し時点でリングバッファにあるデータを、ファイルに書き込む。
+    /*! 書き込み中に追加されたデータは、次の呼び出しで処理する。
+     *  これによって、データが頻繁に追加されるテイクがあっても、他のテイクの書き込みが滞らないようにする。
+     */
+    void Drain();
+};
+
+AudioRecorder::TakeInfo AudioRecorder::Take::GetTakeInfo() const
+{
+    TakeInfo info;
+    info.path_ = file_->GetPath();
+    info.num_channels_ = file_->GetNumChannels();
+    info.timeline_pos_ = timeline_pos_.load();
+    info.num_recorded_frames_ = num_recorded_frames_.load();
+    info.num_overruns_ = num_overruns_.load();
+    info.num_dropped_frames_ = num_dropped_frames_.load();
+    info.has_write_error_ = has_write_error_.load();
+    return info;
+}
+
+void AudioRecorder::Take::Push(TransportInfo const &ti, BufferRef<float const> buf)
+{
+    if(rt_finished_) { return; }
+
+    bool const started = (rt_next_pos_ >= 0);
+    if(ti.playing_ == false) {
+        rt_finished_ = started;
+        return;
+    }
+
+    if(started && ti.smp_begin_pos_ != rt_next_pos_) {
+        //! 再生位置が不連続に変化したので、このテイクの録音を終了する。
+        rt_finished_ = true;
+        return;
+    }
+
+    if(!started) {
+        timeline_pos_.store(ti.smp_begin_pos_);
+    }
+    rt_next_pos_ = ti.smp_end_pos_;
+
+    auto const length = ti.GetSmpDuration();
+
+    if(rt_num_pending_silence_ > 0) {
+        auto const n = std::min<SampleCount>(rt_num_pending_silence_, ring_.GetNumPushable());
+        if(n > 0 && ring_.Push((float const * const *)nullptr, 0, n)) {
+            rt_num_pending_silence_ -= n;
+        }
+    }
+
+    auto const num_channels = std::min<UInt32>(buf.channels(), rt_channels_.size());
+    for(UInt32 ch = 0; ch < num_channels; ++ch) {
+        rt_channels_[ch] = buf.data()[buf.channel_from() + ch] + buf.sample_from();
+    }
+
+    if(rt_num_pending_silence_ == 0 && ring_.Push(rt_channels_.data(), num_channels, length)) {
+        return;
+    }
+
+    //! 書き出しが間に合っていない。
+    //! このフレームのデータは捨てて、後で同じ長さの無音を書き込む。
+    if(rt_num_pending_silence_ == 0) {
+        num_overruns_.fetch_add(1);
+    }
+    rt_num_pending_silence_ += length;
+    num_dropped_frames_.fetch_add(length);
+}
+
+void AudioRecorder::Take::Drain()
+{
+    auto const num_channels = wr_buffer_.channels();
+
+    for(UInt32 num_remaining = ring_.GetNumPoppable(); num_remaining > 0; ) {
+        auto const n = std::min<UInt32>(num_remaining, wr_buffer_.samples());
+
+        if(wr_num_to_skip_ > 0) {
+            auto const num_to_skip = (UInt32)std::min<SampleCount>(wr_num_to_skip_, n);
+            ring_.PopOverwrite((float **)nullptr, 0, num_to_skip);
+            wr_num_to_skip_ -= num_to_skip;
+            num_remaining -= num_to_skip;
+            continue;
+        }
+        
+        num_remaining -= n;
+
+        auto result = ring_.PopOverwrite(wr_buffer_.data(), num_channels, n);
+        assert(result);
+
+        //! 書き込みに失敗した場合も、リングバッファが溢れないようにデータの取り出しは続ける。
+        if(file_->Write(wr_buffer_.data(), num_channels, n)) {
+            num_recorded_frames_.fetch_add(n);
+        } else {
+            has_write_error_.store(true);
+        }
+    }
+}
+
+//================================================================================================
+
+struct AudioRecorder::Session
+{
+    //! input_の順にソートされている
+    std::vector<std::unique_ptr<Take>> takes_;
+
+    Take * Find(GraphProcessor::AudioInput const *input) const
+    {
+        auto found = std::lower_bound(takes_.begin(), takes_.end(), input,
+                                      [](auto const &take, auto const *x) { return take->input_ < x; });
+        if(found == takes_.end() || (*found)->input_ != input) { return nullptr; }
+        return found->get();
+    }
+};
+
+struct AudioRecorder::Impl
+{
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread th_;
+
+    //! 録音中のセッション。(mtx_で保護される)
+    std::unique_ptr<Session> session_;
+    //! リアルタイムスレッドに公開されているセッション
+    std::atomic<Session *> published_session_ = { nullptr };
+
+    void Run(Session *session);
+};
+
+void AudioRecorder::Impl::Run(Session *session)
+{
+    for( ; ; ) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait_for(lock, kWritingInterval, [this] { return stop_; });
+            stopping = stop_;
+        }
+
+        for(auto const &take: session->takes_) {
+            take->Drain();
+        }
+
+        //! 停止時は、リアルタイムスレッドがもうPush()しないことが保証されているので、
+        //! 最後に残ったデータを書き込んでから終了する。
+        if(stopping) { break; }
+    }
+}
+
+AudioRecorder::AudioRecorder()
+:   pimpl_(std::make_unique<Impl>())
+{}
+
+AudioRecorder::~AudioRecorder()
+{
+    Stop();
+}
+
+void AudioRecorder::Start(std::vector<TakeDesc> const &takes,
+                          double sample_rate,
+                          SampleCount latency,
+                          bool use_direct_io)
+{
+    assert(IsRecording() == false);
+
+    auto session = std::make_unique<Session>();
+    for(auto const &desc: takes) {
+        session->takes_.push_back(std::make_unique<Take>(desc, sample_rate, latency, use_direct_io));
+    }
+
+    std::sort(session->takes_.begin(), session->takes_.end(),
+              [](auto const &lhs, auto const &rhs) { return lhs->input_ < rhs->input_; });
+
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+    pimpl_->stop_ = false;
+    pimpl_->session_ = std::move(session);
+
+    auto *p = pimpl_->session_.get();
+    pimpl_->th_ = std::thread([this, p] { pimpl_->Run(p); });
+    pimpl_->published_session_.store(p);
+}
+
+std::vector<AudioRecorder::TakeInfo> AudioRecorder::Stop()
+{
+    if(IsRecording() == false) { return {}; }
+
+    //! リアルタイムスレッドからセッションが見えなくなってから、書き出しスレッドを停止する。
+    pimpl_->published_session_.store(nullptr);
+    if(auto gc = GarbageCollector::GetInstance()) {
+        gc->WaitForRealtimeSections();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        pimpl_->stop_ = true;
+    }
+    pimpl_->cv_.notify_one();
+    pimpl_->th_.join();
+
+    std::unique_ptr<Session> session;
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        session = std::move(pimpl_->session_);
+    }
+
+    std::vector<TakeInfo> result;
+    for(auto const &take: session->takes_) {
+        if(take->file_->Close() == false) {
+            take->has_write_error_.store(true);
+        }
+        result.push_back(take->GetTakeInfo());
+    }
+
+    return result;
+}
+
+bool AudioRecorder::IsRecording() const
+{
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+    return pimpl_->session_ != nullptr;
+}
+
+std::vector<AudioRecorder::TakeInfo> AudioRecorder::GetTakeInfo() const
+{
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+
+    std::vector<TakeInfo> result;
+    if(pimpl_->session_) {
+        for(auto const &take: pimpl_->session_->takes_) {
+            result.push_back(take->GetTakeInfo());
+        }
+    }
+    return result;
+}
+
+void AudioRecorder::Push(GraphProcessor::AudioInput const *input, TransportInfo const &ti, BufferRef<float const> buf)
+{
+    auto const session = pimpl_->published_session_.load();
+    if(!session) { return; }
+
+    if(auto take = session->Find(input)) {
+        take->Push(ti, buf);
+    }
+}
+
+NS_HWM_END
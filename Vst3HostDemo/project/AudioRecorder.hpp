@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../misc/Buffer.hpp"
+#include "../transport/TransportInfo.hpp"
+#include "./GraphProcessor.hpp"
+
+NS_HWM_BEGIN
+
+//! GraphProcessor::AudioInputに入力されたデータを、入力ごとにWAV/RF64ファイルへ録音するクラス
+/*! リアルタイムスレッドは、Push()で入力データを入力ごとのリングバッファに書き込むだけで、
+ *  メモリ確保やファイルI/Oは行わない。
+ *  リングバッファのデータは、録音中だけ起動される書き出しスレッドによってファイルに書き込まれる。
+ *
+ *  デバイスの入出力レイテンシーは録音時に補正される。
+ *  再生されたトランスポート上の位置の音が聞こえてから、それに合わせて演奏された音が入力として届くまでには
+ *  出力と入力のレイテンシーを足した分の遅れがあるので、その分だけ録音の先頭を捨てて、
+ *  ファイルの先頭がTakeInfo::timeline_pos_の位置に揃うようにする。
+ */
+class AudioRecorder
+{
+public:
+    struct TakeDesc
+    {
+        GraphProcessor::AudioInput const *input_ = nullptr;
+        UInt32 num_channels_ = 0;
+        String path_;
+    };
+
+    struct TakeInfo
+    {
+        String path_;
+        UInt32 num_channels_ = 0;
+        //! ファイルの先頭に対応するトランスポート上の位置。
+        //! まだ録音が始まっていない場合は-1
+        SampleCount timeline_pos_ = -1;
+        //! ファイルに書き込んだフレーム数
+        SampleCount num_recorded_frames_ = 0;
+        //! リングバッファが溢れた回数
+        UInt32 num_overruns_ = 0;
+        //! リングバッファが溢れたために、無音で置き換えたフレーム数
+        SampleCount num_dropped_frames_ = 0;
+        //! ファイルへの書き込みに失敗したかどうか
+        bool has_write_error_ = false;
+    };
+
+    AudioRecorder();
+    ~AudioRecorder();
+
+    //! 録音を開始する。
+    /*! 録音は、トランスポートが再生中のフレームでだけ行われる。
+     *  録音開始後に、再生が停止したり再生位置が不連続に変化した(ループの折り返しを含む)場合は、
+     *  そのテイクの録音はその時点で終了する。
+     *
+     *  @param latency 補正するレイテンシー(デバイスの入力と出力のレイテンシーの合計)
+     *  @param use_direct_io ページキャッシュを経由せずにファイルに書き込むかどうか
+     *  @pre 録音中でないこと
+     *  @throw std::runtime_error ファイルを作成できなかった場合
+     */
+    void Start(std::vector<TakeDesc> const &takes,
+               double sample_rate,
+               SampleCount latency,
+               bool use_direct_io);
+
+    //! 録音を終了して、すべてのファイルを閉じる。
+    /*! リアルタイムスレッドがPush()を実行中の場合は、その終了を待機する。
+     *  @return 各テイクの録音結果
+     */
+    std::vector<TakeInfo> Stop();
+
+    bool IsRecording() const;
+
+    //! 録音中の各テイクの状態を返す。
+    std::vector<TakeInfo> GetTakeInfo() const;
+
+    //! inputに入力されたデータを録音する。
+    /*! リアルタイムスレッドから呼び出す。
+     *  録音中でない場合や、inputが録音対象でない場合は何もしない。
+     *  bufのチャンネル数がテイクのチャンネル数より少ない場合、足りないチャンネルは無音として録音される。
+     */
+    void Push(GraphProcessor::AudioInput const *input, TransportInfo const &ti, BufferRef<float const> buf);
+
+private:
+    struct Take;
+    struct Session;
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
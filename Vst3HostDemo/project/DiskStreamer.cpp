@@ -0,0 +1,366 @@
+#include "DiskStreamer.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iterator>
+
+NS_HWM_BEGIN
+
+namespace {
+    
+    //! 各ストリームで先読みしておく時間
+    double const kReadAheadSeconds = 2.0;
+    
+    //! 一度にファイルから読み込むフレーム数
+    UInt32 const kChunkSize = 8192;
+    
+    //! 先読みスレッドが、通知を待たずに起床する間隔
+    std::chrono::milliseconds const kStreamingInterval { 10 };
+    
+    UInt32 const kGenerationShift = 48;
+    UInt64 const kPositionMask = (UInt64(1) << kGenerationShift) - 1;
+    UInt32 const kGenerationMask = 0xFFFF;
+    
+    //! まだどのリクエストにも対応していないことを表す世代番号
+    UInt32 const kInvalidGeneration = 0xFFFFFFFF;
+    
+    UInt64 pack_request(UInt32 generation, SampleCount pos)
+    {
+        return ((UInt64)(generation & kGenerationMask) << kGenerationShift)
+        | ((UInt64)std::max<SampleCount>(pos, 0) & kPositionMask);
+    }
+    
+    UInt32 get_generation(UInt64 request) { return (UInt32)(request >> kGenerationShift); }
+    SampleCount get_position(UInt64 request) { return (SampleCount)(request & kPositionMask); }
+    
+    //! ループの終端に達した場合は、ループの先頭に折り返した位置を返す。
+    SampleCount advance(TransportInfo const &ti, SampleCount pos, SampleCount length)
+    {
+        bool const wrap = ti.IsLooping() && pos < ti.loop_end_ && pos + length == ti.loop_end_;
+        return wrap ? ti.loop_begin_ : pos + length;
+    }
+}
+
+//================================================================================================
+
+DiskStreamer::Stream::Stream(std::unique_ptr<WaveFileReader> file, SampleCount timeline_pos, UInt32 capacity)
+:   file_(std::move(file))
+,   timeline_pos_(timeline_pos)
+,   ring_(file_->GetNumChannels(), capacity)
+,   request_(pack_request(0, 0))
+,   filled_generation_(kInvalidGeneration)
+,   reset_generation_(kInvalidGeneration)
+,   reset_ack_(kInvalidGeneration)
+,   closed_(false)
+,   num_underruns_(0)
+,   rt_reset_ack_(kInvalidGeneration)
+,   st_generation_(kInvalidGeneration)
+{
+    rt_channels_.resize(file_->GetNumChannels());
+    st_buffer_.resize(file_->GetNumChannels(), kChunkSize);
+}
+
+DiskStreamer::Stream::~Stream()
+{}
+
+String DiskStreamer::Stream::GetPath() const
+{
+    return file_->GetPath();
+}
+
+UInt32 DiskStreamer::Stream::GetNumChannels() const
+{
+    return file_->GetNumChannels();
+}
+
+SampleCount DiskStreamer::Stream::GetTimelinePos() const
+{
+    return timeline_pos_;
+}
+
+SampleCount DiskStreamer::Stream::GetNumFrames() const
+{
+    return file_->GetNumFrames();
+}
+
+UInt32 DiskStreamer::Stream::GetNumUnderruns() const
+{
+    return num_underruns_.load();
+}
+
+void DiskStreamer::Stream::Close()
+{
+    closed_.store(true);
+}
+
+bool DiskStreamer::Stream::IsClosed() const
+{
+    return closed_.load();
+}
+
+void DiskStreamer::Stream::PostRequest(SampleCount pos)
+{
+    auto request = request_.load();
+    while(request_.compare_exchange_weak(request, pack_request(get_generation(request) + 1, pos)) == false)
+    {}
+}
+
+void DiskStreamer::Stream::Read(TransportInfo const &ti, BufferRef<float> dest)
+{
+    auto const length = ti.GetSmpDuration();
+    auto const num_channels = std::min<UInt32>(dest.channels(), GetNumChannels());
+    
+    auto output_silence = [&] { dest.fill(0); };
+    
+    //! 新しいリクエストの処理のためにクリアが要求されていれば、ring_をクリアする。
+    //! このあとで読み込むrequest_は、必ずクリアを要求されたリクエスト以降のものになる。
+    auto const reset = reset_generation_.load();
+    if(reset != rt_reset_ack_) {
+        ring_.Clear();
+        rt_reset_ack_ = reset;
+        reset_ack_.store(reset);
+    }
+    
+    if(ti.playing_ == false) {
+        output_silence();
+        return;
+    }
+    
+    auto const pos = ti.smp_begin_pos_;
+    
+    auto request = request_.load();
+    if(get_generation(request) != rt_generation_) {
+        //! 再生位置の変更によって、新しい位置からの先読みがすでにリクエストされている。
+        rt_generation_ = get_generation(request);
+        rt_pos_ = get_position(request);
+    }
+    
+    //! 先読みの位置から再生位置までの距離。
+    //! 先読みの完了を待っている間に進んだ分は、データを読み捨てて追いつく。
+    auto distance = pos - rt_pos_;
+    if(distance < 0 || distance > ring_.GetCapacity() / 2) {
+        PostRequest(pos);
+        rt_generation_ = get_generation(request_.load());
+        rt_pos_ = pos;
+        distance = 0;
+    }
+    
+    if(filled_generation_.load() != rt_generation_) {
+        output_silence();
+        return;
+    }
+    
+    if(distance > 0) {
+        if(!ring_.PopOverwrite((float **)nullptr, 0, distance)) {
+            output_silence();
+            return;
+        }
+        rt_pos_ += distance;
+    }
+    
+    for(UInt32 ch = 0; ch < num_channels; ++ch) {
+        rt_channels_[ch] = dest.get_channel_data(ch);
+    }
+    
+    if(ring_.PopOverwrite(rt_channels_.data(), num_channels, length)) {
+        rt_pos_ = advance(ti, rt_pos_, length);
+        for(UInt32 ch = num_channels; ch < dest.channels(); ++ch) {
+            std::fill_n(dest.get_channel_data(ch), length, 0.0f);
+        }
+    } else {
+        num_underruns_.fetch_add(1);
+        output_silence();
+    }
+}
+
+//================================================================================================
+
+struct DiskStreamer::Impl
+{
+    Transporter *tp_ = nullptr;
+    
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    bool notified_ = false;
+    std::vector<StreamPtr> streams_;
+    std::thread th_;
+    
+    void Run();
+    
+    //! 新しいリクエストがあれば、リングバッファをクリアしてその位置から読み込みを開始する。
+    //! @return リアルタイムスレッドによるリングバッファのクリアを待っている場合はfalse
+    bool ServiceRequest(Stream &s, TransportInfo const &ti);
+    
+    //! リングバッファに空きがあれば、一つのチャンク分のデータを読み込む。
+    //! @return データを読み込んだかどうか
+    bool FillChunk(Stream &s, TransportInfo const &ti);
+};
+
+bool DiskStreamer::Impl::ServiceRequest(Stream &s, TransportInfo const &ti)
+{
+    auto const request = s.request_.load();
+    auto const generation = get_generation(request);
+    
+    if(generation != s.st_generation_) {
+        //! 古いデータの書き込みを止めて、リアルタイムスレッドにリングバッファのクリアを要求する。
+        s.st_generation_ = generation;
+        s.st_pos_ = get_position(request);
+        s.st_ready_ = false;
+        if(s.st_has_pushed_) {
+            s.reset_generation_.store(generation);
+        }
+    }
+    
+    if(s.st_ready_) { return true; }
+    if(s.st_has_pushed_ && s.reset_ack_.load() != generation) { return false; }
+    
+    //! データが用意されてから、リアルタイムスレッドに取り出しを許可する。
+    FillChunk(s, ti);
+    s.filled_generation_.store(generation);
+    s.st_ready_ = true;
+    return true;
+}
+
+bool DiskStreamer::Impl::FillChunk(Stream &s, TransportInfo const &ti)
+{
+    if(s.ring_.GetNumPushable() < kChunkSize) { return false; }
+    
+    SampleCount length = kChunkSize;
+    if(ti.IsLooping() && s.st_pos_ < ti.loop_end_) {
+        length = std::min<SampleCount>(length, ti.loop_end_ - s.st_pos_);
+    }
+    
+    auto &buf = s.st_buffer_;
+    auto const num_channels = buf.channels();
+    for(UInt32 ch = 0; ch < num_channels; ++ch) {
+        std::fill_n(buf.data()[ch], length, 0.0f);
+    }
+    
+    //! クリップの範囲外は無音になる。
+    auto const file_pos = s.st_pos_ - s.timeline_pos_;
+    auto const offset = std::max<SampleCount>(0, -file_pos);
+    if(offset < length) {
+        float *dest[256];
+        assert(num_channels <= std::size(dest));
+        for(UInt32 ch = 0; ch < num_channels; ++ch) {
+            dest[ch] = buf.data()[ch] + offset;
+        }
+        s.file_->Read(file_pos + offset, dest, num_channels, length - offset);
+    }
+    
+    auto result = s.ring_.Push(buf.data(), num_channels, length);
+    assert(result);
+    s.st_has_pushed_ = true;
+    
+    s.st_pos_ = advance(ti, s.st_pos_, length);
+    return true;
+}
+
+void DiskStreamer::Impl::Run()
+{
+    std::vector<StreamPtr> streams;
+    
+    for( ; ; ) {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait_for(lock, kStreamingInterval, [this] { return stop_ || notified_; });
+            if(stop_) { break; }
+            notified_ = false;
+            
+            streams_.erase(std::remove_if(streams_.begin(), streams_.end(),
+                                          [](auto const &s) { return s->IsClosed(); }),
+                           streams_.end());
+            streams = streams_;
+        }
+        
+        auto const ti = tp_->GetCurrentState();
+        
+        //! 再生位置が変更されたストリームを優先して処理する。
+        for(auto const &s: streams) {
+            ServiceRequest(*s, ti);
+        }
+        
+        //! 先読みされたデータが少ないストリームから順に、一つのチャンクずつ読み込む。
+        //! これによって、大量のストリームがあっても特定のストリームだけが枯渇することを避ける。
+        for(bool filled = true; filled; ) {
+            std::sort(streams.begin(), streams.end(), [](auto const &lhs, auto const &rhs) {
+                return lhs->ring_.GetNumPoppable() < rhs->ring_.GetNumPoppable();
+            });
+            
+            filled = false;
+            for(auto const &s: streams) {
+                if(ServiceRequest(*s, ti) == false) { continue; }
+                filled |= FillChunk(*s, ti);
+            }
+            
+            std::unique_lock<std::mutex> lock(mtx_);
+            if(stop_ || notified_) { break; }
+        }
+        
+        streams.clear();
+    }
+}
+
+DiskStreamer::DiskStreamer(Transporter *tp)
+:   pimpl_(std::make_unique<Impl>())
+{
+    pimpl_->tp_ = tp;
+    pimpl_->tp_->AddListener(this);
+    pimpl_->th_ = std::thread([this] { pimpl_->Run(); });
+}
+
+DiskStreamer::~DiskStreamer()
+{
+    pimpl_->tp_->RemoveListener(this);
+    
+    {
+        std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+        pimpl_->stop_ = true;
+    }
+    pimpl_->cv_.notify_one();
+    pimpl_->th_.join();
+}
+
+DiskStreamer::StreamPtr DiskStreamer::OpenStream(String path, SampleCount timeline_pos)
+{
+    auto file = std::make_unique<WaveFileReader>(path);
+    auto const capacity = (UInt32)(file->GetSampleRate() * kReadAheadSeconds);
+    
+    auto const ti = pimpl_->tp_->GetCurrentState();
+    if(file->GetSampleRate() != ti.sample_rate_) {
+        hwm::wdout << L"sample rate conversion is not supported yet: {}"_format(path) << std::endl;
+    }
+    
+    auto s = std::make_shared<Stream>(std::move(file), timeline_pos, std::max(capacity, kChunkSize * 2));
+    
+    //! 現在の再生位置からの先読みを開始する。
+    s->PostRequest(ti.smp_begin_pos_);
+    
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+    pimpl_->streams_.push_back(s);
+    pimpl_->notified_ = true;
+    lock.unlock();
+    pimpl_->cv_.notify_one();
+    
+    return s;
+}
+
+void DiskStreamer::OnChanged(TransportInfo const &old_state,
+                             TransportInfo const &new_state)
+{
+    if(old_state.smp_begin_pos_ == new_state.smp_begin_pos_) { return; }
+    
+    //! リアルタイムスレッドが新しい位置を処理するより前に、その位置からの先読みを開始する。
+    std::unique_lock<std::mutex> lock(pimpl_->mtx_);
+    for(auto const &s: pimpl_->streams_) {
+        s->PostRequest(new_state.smp_begin_pos_);
+    }
+    pimpl_->notified_ = true;
+    lock.unlock();
+    pimpl_->cv_.notify_one();
+}
+
+NS_HWM_END
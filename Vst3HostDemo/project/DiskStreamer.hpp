@@ -0,0 +1,114 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <vector>
+
+#include "../misc/Buffer.hpp"
+#include "../misc/ThreadSafeRingBuffer.hpp"
+#include "../file/WaveFile.hpp"
+#include "../transport/Transporter.hpp"
+
+NS_HWM_BEGIN
+
+//! オーディオファイルをバックグラウンドスレッドで先読みし、
+//! リアルタイムスレッドへリングバッファ経由で供給するクラス
+/*! 先読みはトランスポートの再生位置に沿って行われる。
+ *  ループ再生中はループの終端で先頭に折り返して読み込むので、ループの折り返しでデータが途切れない。
+ *  また、Transporter::MoveTo()などで再生位置が変更されたときには、
+ *  リアルタイムスレッドがその位置を処理するより前に、新しい位置からの先読みを開始する。
+ */
+class DiskStreamer
+:   public Transporter::ITransportStateListener
+{
+public:
+    class Stream;
+    using StreamPtr = std::shared_ptr<Stream>;
+    
+    DiskStreamer(Transporter *tp);
+    ~DiskStreamer();
+    
+    //! ファイルを開いて、ストリーミングを開始する。
+    /*! @param timeline_pos ファイルの先頭を配置するトランスポート上の位置
+     *  @throw std::runtime_error ファイルを開けなかった場合
+     */
+    StreamPtr OpenStream(String path, SampleCount timeline_pos);
+    
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+    
+    void OnChanged(TransportInfo const &old_state,
+                   TransportInfo const &new_state) override;
+};
+
+//! 一つのオーディオファイルに対応するストリーム
+class DiskStreamer::Stream
+{
+public:
+    Stream(std::unique_ptr<WaveFileReader> file, SampleCount timeline_pos, UInt32 capacity);
+    ~Stream();
+    
+    String GetPath() const;
+    UInt32 GetNumChannels() const;
+    SampleCount GetTimelinePos() const;
+    SampleCount GetNumFrames() const;
+    
+    //! 先読みが間に合わずに無音を出力した回数
+    UInt32 GetNumUnderruns() const;
+    
+    //! ストリーミングを終了する。
+    //! これ以降、DiskStreamerはこのストリームの先読みを行わない。
+    void Close();
+    bool IsClosed() const;
+    
+    //! tiの区間のデータをdestに書き込む。
+    /*! リアルタイムスレッドから呼び出す。
+     *  先読みしたデータが用意できていない場合は無音を書き込む。
+     */
+    void Read(TransportInfo const &ti, BufferRef<float> dest);
+    
+private:
+    friend DiskStreamer;
+    
+    std::unique_ptr<WaveFileReader> file_;
+    SampleCount timeline_pos_ = 0;
+    MultiChannelThreadSafeRingBuffer<float> ring_;
+    
+    //! 先読みのリクエスト。上位16bitが世代番号、下位48bitが読み込みを開始するトランスポート上の位置を表す。
+    //! リアルタイムスレッドと、再生位置の変更を通知されたスレッドの両方から書き換えられる。
+    std::atomic<UInt64> request_;
+    //! ring_に格納されているデータが、どの世代のリクエストに対応しているか
+    std::atomic<UInt32> filled_generation_;
+    //! DiskStreamerのスレッドが、リアルタイムスレッドにring_のクリアを要求するときに書き換える。
+    //! (ring_からデータを取り出すのはリアルタイムスレッドだけなので、クリアもリアルタイムスレッドで行う)
+    std::atomic<UInt32> reset_generation_;
+    //! リアルタイムスレッドがring_をクリアしたときに、reset_generation_の値が書き込まれる。
+    std::atomic<UInt32> reset_ack_;
+    std::atomic<bool> closed_;
+    std::atomic<UInt32> num_underruns_;
+    
+    //! 以下はリアルタイムスレッドからのみアクセスする。
+    
+    //! 追従しているリクエストの世代番号
+    UInt32 rt_generation_ = 0;
+    UInt32 rt_reset_ack_;
+    //! ring_から次に取り出されるデータの、トランスポート上の位置
+    SampleCount rt_pos_ = 0;
+    std::vector<float *> rt_channels_;
+    
+    //! 以下はDiskStreamerのスレッドからのみアクセスする。
+    
+    UInt32 st_generation_;
+    //! st_generation_のリクエストに対応するデータを、ring_に書き込み始めたかどうか
+    bool st_ready_ = false;
+    //! 一度でもring_にデータを書き込んだかどうか
+    bool st_has_pushed_ = false;
+    //! ring_に次に書き込むデータの、トランスポート上の位置
+    SampleCount st_pos_ = 0;
+    Buffer<float> st_buffer_;
+    
+    void PostRequest(SampleCount pos);
+};
+
+NS_HWM_END
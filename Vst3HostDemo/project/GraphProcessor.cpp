@@ -1,4 +1,5 @@
 #include "./GraphProcessor.hpp"
+#include "../misc/GarbageCollector.hpp"
 
 NS_HWM_BEGIN
 
@@ -127,9 +128,9 @@ public:
         
         auto &dest = pi.output_midi_buffer_;
 
-        assert(ref_.size() <= dest.buffer_.size());
-        std::copy_n(ref_.data(), ref_.size(), dest.buffer_.begin());
-        dest.num_used_ = ref_.size();
+        auto const num = std::min<size_t>(ref_.size(), dest.buffer_.size());
+        std::copy_n(ref_.data(), num, dest.buffer_.begin());
+        dest.num_used_ = num;
     }
     
     void OnStopProcessing() override
@@ -168,9 +169,10 @@ public:
     
     void Process(ProcessInfo &pi) override
     {
+        //! 上流から受け取ったメッセージを、コールバック経由でデバイスへ渡す。
         ref_ = BufferType {
-            pi.output_midi_buffer_.buffer_.begin(),
-            pi.output_midi_buffer_.buffer_.begin() + pi.output_midi_buffer_.num_used_
+            pi.input_midi_buffer_.buffer_.begin(),
+            pi.input_midi_buffer_.buffer_.begin() + pi.input_midi_buffer_.num_used_
         };
         callback_(this, pi);
     }
@@ -285,6 +287,11 @@ bool GraphProcessor::Node::HasPathTo(Node const *downstream) const
     return HasAudioPathTo(downstream) || HasMidiPathTo(downstream);
 }
 
+namespace {
+    //! 各ノードのMIDIバッファの最小の容量
+    SampleCount const kMinMidiBufferCapacity = 16384;
+}
+
 class NodeImpl : public GraphProcessor::Node
 {
 public:
@@ -295,7 +302,9 @@ public:
     {}
     
     ~NodeImpl()
-    {}
+    {
+        HWM_ASSERT_NOT_IN_REALTIME_SECTION();
+    }
     
     void AddConnection(GraphProcessor::AudioConnectionPtr conn, BusDirection dir)
     {
@@ -329,8 +338,13 @@ public:
         
         input_audio_buffer_.resize(num_inputs, block_size);
         output_audio_buffer_.resize(num_outputs, block_size);
-        input_midi_buffer_.reserve(block_size);
-        output_midi_buffer_.reserve(block_size);
+        //! 密なCCのストリームなど、1サンプルに複数のイベントがある場合も扱えるように、
+        //! ブロックサイズより多めに確保しておく。
+        auto const midi_buffer_capacity = std::max<SampleCount>(block_size, kMinMidiBufferCapacity);
+        input_midi_buffer_.reserve(midi_buffer_capacity);
+        //! 出力側は、ブロックごとにサイズを変更しないように、ここで全体を確保しておく。
+        output_midi_buffer_.resize(midi_buffer_capacity);
+        num_output_midi_messages_ = 0;
         
         processor_->OnStartProcessing(sample_rate, block_size);
     }
@@ -358,11 +372,11 @@ public:
         };
         
         pi.input_midi_buffer_ = { input_midi_buffer_, (UInt32)input_midi_buffer_.size() };
-        output_midi_buffer_.resize(output_midi_buffer_.capacity());
         pi.output_midi_buffer_ = { output_midi_buffer_, 0 };
         
         processor_->Process(pi);
         
+        num_output_midi_messages_ = std::min<UInt32>(pi.output_midi_buffer_.num_used_, output_midi_buffer_.size());
         input_midi_buffer_.clear();
     }
     
@@ -373,6 +387,7 @@ public:
         output_audio_buffer_ = Buffer<float>();
         input_midi_buffer_ = MidiMessageList();
         output_midi_buffer_ = MidiMessageList();
+        num_output_midi_messages_ = 0;
     }
     
     void Clear()
@@ -382,7 +397,7 @@ public:
         input_audio_buffer_.fill(0);
         output_audio_buffer_.fill(0);
         input_midi_buffer_.clear();
-        output_midi_buffer_.clear();
+        num_output_midi_messages_ = 0;
         processed_ = false;
     }
     
@@ -402,10 +417,19 @@ public:
         }
     }
     
+    //! 前回のProcessOnce()で、実際に書き込まれた分の出力MIDIメッセージ
+    ArrayRef<ProcessInfo::MidiMessage> GetOutputMidi()
+    {
+        return ArrayRef<ProcessInfo::MidiMessage>(output_midi_buffer_.data(),
+                                                  output_midi_buffer_.data() + num_output_midi_messages_);
+    }
+    
     void AddMidi(ArrayRef<ProcessInfo::MidiMessage> const &src)
     {
+        //! メモリ確保が発生しないように、確保済みの容量を超える分は捨てる。
         auto &dest = input_midi_buffer_;
-        std::copy(src.begin(), src.end(), std::back_inserter(dest));
+        auto const num = std::min<size_t>(src.size(), dest.capacity() - dest.size());
+        dest.insert(dest.end(), src.begin(), src.begin() + num);
     }
     
     std::vector<RingBuffer> channel_delays_;
@@ -414,6 +438,7 @@ public:
     using MidiMessageList = std::vector<ProcessInfo::MidiMessage>;
     MidiMessageList input_midi_buffer_;
     MidiMessageList output_midi_buffer_;
+    UInt32 num_output_midi_messages_ = 0;
     bool processed_ = false;
 };
 
@@ -458,14 +483,26 @@ struct GraphProcessor::Impl
     bool prepared_ = false;
     
     LockFactory lf_;
+    ListenerService<Listener> listeners_;
     
     using FrameProcedure = std::vector<ConnectionPtr>;
+    //! lf_で保護される。
     std::shared_ptr<FrameProcedure> frame_procedure_;
+    //! リアルタイムスレッドに公開されているframe_procedure_。
+    //! 差し替え前のFrameProcedureはGarbageCollectorで解放される。
+    std::atomic<FrameProcedure const *> published_frame_procedure_ = { nullptr };
     
     std::shared_ptr<FrameProcedure> DuplicateFrameProcedure() const;
     void ReplaceFrameProcedure(std::shared_ptr<FrameProcedure> p);
     std::shared_ptr<FrameProcedure> CreateFrameProcedure() const;
     
+    //! 接続の追加をフレーム処理に反映する。
+    //! バッチ更新中は、EndBatchUpdate()まで反映を遅らせる。
+    void UpdateFrameProcedure();
+    
+    UInt32 batch_update_depth_ = 0;
+    bool needs_to_update_frame_procedure_ = false;
+    
 private:
     template<class List, class T>
     void AddIONodeImpl(List &list, T x) {
@@ -496,7 +533,12 @@ void GraphProcessor::Impl::ReplaceFrameProcedure(std::shared_ptr<FrameProcedure>
 {
     auto lock = lf_.make_lock();
     std::swap(frame_procedure_, p);
+    published_frame_procedure_.store(frame_procedure_.get());
     lock.unlock();
+    
+    //! 差し替え前のFrameProcedureはフレーム処理中に参照されている可能性があるので、
+    //! リアルタイムスレッドから参照されなくなってから解放する。
+    RetireObject(std::move(p));
 }
 
 std::shared_ptr<GraphProcessor::Impl::FrameProcedure> GraphProcessor::Impl::CreateFrameProcedure() const
@@ -523,6 +565,17 @@ std::shared_ptr<GraphProcessor::Impl::FrameProcedure> GraphProcessor::Impl::Crea
     return procedure;
 }
 
+void GraphProcessor::Impl::UpdateFrameProcedure()
+{
+    if(batch_update_depth_ > 0) {
+        needs_to_update_frame_procedure_ = true;
+        return;
+    }
+    
+    needs_to_update_frame_procedure_ = false;
+    ReplaceFrameProcedure(CreateFrameProcedure());
+}
+
 GraphProcessor::GraphProcessor()
 :   pimpl_(std::make_unique<Impl>())
 {}
@@ -530,6 +583,16 @@ GraphProcessor::GraphProcessor()
 GraphProcessor::~GraphProcessor()
 {}
 
+void GraphProcessor::AddListener(Listener *li)
+{
+    pimpl_->listeners_.AddListener(li);
+}
+
+void GraphProcessor::RemoveListener(Listener const *li)
+{
+    pimpl_->listeners_.RemoveListener(li);
+}
+
 GraphProcessor::AudioInput *
 GraphProcessor::AddAudioInput(String name, UInt32 num_channels,
                               std::function<void(AudioInput *, ProcessInfo const &)> callback)
@@ -669,16 +732,15 @@ void GraphProcessor::StartProcessing(double sample_rate, SampleCount block_size)
 
 void GraphProcessor::Process(TransportInfo const &ti)
 {
-    auto lock = pimpl_->lf_.make_lock();
-    
-    if(!pimpl_->frame_procedure_) { return; }
+    auto const procedure = pimpl_->published_frame_procedure_.load();
+    if(!procedure) { return; }
     
-    for(auto const &conn: *pimpl_->frame_procedure_) {
+    for(auto const &conn: *procedure) {
         ToNodeImpl(conn->upstream_)->Clear();
         ToNodeImpl(conn->downstream_)->Clear();
     }
     
-    for(auto const &conn: *pimpl_->frame_procedure_) {
+    for(auto const &conn: *procedure) {
         auto up = ToNodeImpl(conn->upstream_);
         auto down = ToNodeImpl(conn->downstream_);
         
@@ -694,14 +756,14 @@ void GraphProcessor::Process(TransportInfo const &ti)
             };
             down->AddAudio(ref, ac->downstream_channel_index_);
         } else if(auto mc = dynamic_cast<MidiConnection const *>(conn.get())) {
-            down->AddMidi(up->output_midi_buffer_);
+            down->AddMidi(up->GetOutputMidi());
         } else {
             assert(false);
         }
     }
 
     //! 下流に接続していないNodeはProcessが呼ばれないので、ここで呼び出すようにする。
-    for(auto const &conn: *pimpl_->frame_procedure_) {
+    for(auto const &conn: *procedure) {
         ToNodeImpl(conn->downstream_)->ProcessOnce(ti);
     }
 }
@@ -735,6 +797,8 @@ GraphProcessor::NodePtr GraphProcessor::AddNode(std::shared_ptr<Processor> proce
         node->OnStartProcessing(pimpl_->sample_rate_, pimpl_->block_size_);
     }
     
+    pimpl_->listeners_.Invoke([node](auto li) { li->OnAfterNodeIsAdded(node.get()); });
+    
     return node;
 }
 
@@ -746,10 +810,19 @@ std::shared_ptr<Processor> GraphProcessor::RemoveNode(Processor const *processor
     
     bool const should_stop_processing = pimpl_->prepared_;
     
-    auto const found = std::find_if(pimpl_->nodes_.begin(), pimpl_->nodes_.end(),
-                                    [p = processor](auto const &x) { return x->GetProcessor().get() == p; }
-                                    );
+    auto find_node = [this, processor] {
+        return std::find_if(pimpl_->nodes_.begin(), pimpl_->nodes_.end(),
+                            [p = processor](auto const &x) { return x->GetProcessor().get() == p; }
+                            );
+    };
     
+    auto found = find_node();
+    if(found == pimpl_->nodes_.end()) { return nullptr; }
+    
+    pimpl_->listeners_.Invoke([node = found->get()](auto li) { li->OnBeforeNodeIsRemoved(node); });
+    
+    //! リスナーの中でノードが追加/削除されている可能性があるので、探し直す。
+    found = find_node();
     if(found == pimpl_->nodes_.end()) { return nullptr; }
     
     Disconnect(found->get());
@@ -757,11 +830,20 @@ std::shared_ptr<Processor> GraphProcessor::RemoveNode(Processor const *processor
     auto node = *found;
     pimpl_->nodes_.erase(found);
     
+    //! Disconnect()で差し替えられる前のFrameProcedureを使用して、
+    //! まだフレーム処理が行われている可能性があるので、その処理が終わるのを待つ。
+    if(auto gc = GarbageCollector::GetInstance()) {
+        gc->WaitForRealtimeSections();
+    }
+    
     if(should_stop_processing) {
         ToNodeImpl(node.get())->OnStopProcessing();
     }
     
-    return node->GetProcessor();
+    auto processor = node->GetProcessor();
+    RetireObject(std::move(node));
+    
+    return processor;
 }
 
 GraphProcessor::NodePtr GraphProcessor::GetNodeOf(Processor const *processor) const
@@ -833,8 +915,7 @@ bool GraphProcessor::ConnectAudio(Node *upstream,
     ToNodeImpl(upstream)->AddConnection(c, BusDirection::kOutputSide);
     ToNodeImpl(downstream)->AddConnection(c, BusDirection::kInputSide);
     
-    auto new_procedure = pimpl_->CreateFrameProcedure();
-    pimpl_->ReplaceFrameProcedure(new_procedure);
+    pimpl_->UpdateFrameProcedure();
     return true;
 }
 
@@ -868,11 +949,25 @@ bool GraphProcessor::ConnectMidi(Node *upstream, Node *downstream,
     ToNodeImpl(upstream)->AddConnection(c, BusDirection::kOutputSide);
     ToNodeImpl(downstream)->AddConnection(c, BusDirection::kInputSide);
     
-    auto new_procedure = pimpl_->CreateFrameProcedure();
-    pimpl_->ReplaceFrameProcedure(new_procedure);
+    pimpl_->UpdateFrameProcedure();
     return true;
 }
 
+void GraphProcessor::BeginBatchUpdate()
+{
+    pimpl_->batch_update_depth_ += 1;
+}
+
+void GraphProcessor::EndBatchUpdate()
+{
+    assert(pimpl_->batch_update_depth_ > 0);
+    pimpl_->batch_update_depth_ -= 1;
+    
+    if(pimpl_->batch_update_depth_ == 0 && pimpl_->needs_to_update_frame_procedure_) {
+        pimpl_->UpdateFrameProcedure();
+    }
+}
+
 void RemoveConnection(GraphProcessor::ConnectionPtr conn)
 {
     auto nup = dynamic_cast<NodeImpl *>(conn->upstream_);
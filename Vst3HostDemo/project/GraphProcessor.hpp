@@ -37,6 +37,9 @@ public:
     GraphProcessor();
     ~GraphProcessor();
     
+    void AddListener(Listener *li);
+    void RemoveListener(Listener const *li);
+    
     class AudioInput : public Processor {
     public:
         virtual void SetData(BufferRef<float const> buf) = 0;
@@ -195,6 +198,17 @@ public:
     /*! @return 接続を切断した場合はtrueが帰る。接続が一つも見つからないために何もしなかった場合はfalseが帰る。
      */
     bool Disconnect(ConnectionPtr conn);
+    
+    //! グラフの変更をまとめて行う。
+    /*! BeginBatchUpdate()からEndBatchUpdate()までの間にConnectAudio()/ConnectMidi()で追加した接続は、
+     *  接続ごとにフレーム処理の手順を作り直さずに、EndBatchUpdate()の呼び出し時に一度にフレーム処理に反映される。
+     *  (それまでの間は、変更前の手順でフレーム処理が行われる。)
+     *  接続の切断は、バッチ更新中であってもすぐに反映される。
+     *  BeginBatchUpdate()/EndBatchUpdate()は入れ子にできる。
+     *  don't call these functions on the realtime thread.
+     */
+    void BeginBatchUpdate();
+    void EndBatchUpdate();
 
 private:
     struct Impl;
@@ -3,8 +3,13 @@
 #include "../device/MidiDeviceManager.hpp"
 #include "../device/AudioDeviceManager.hpp"
 #include "./GraphProcessor.hpp"
+#include "./DiskStreamer.hpp"
+#include "./AudioClipProcessor.hpp"
 #include "../App.hpp"
+#include "../misc/GarbageCollector.hpp"
 #include <map>
+#include <chrono>
+#include <wx/filename.h>
 
 NS_HWM_BEGIN
 
@@ -25,7 +30,7 @@ namespace {
     };
     
     VirtualMidiInDevice kSoftwareKeyboardMidiInput = { L"Software Keyboard" };
-    VirtualMidiInDevice kSequencerMidiInput = { L"Sequencer" };
+    String const kDefaultSequenceTrackName = L"Sequencer";
 }
 
 struct InternalPlayingNoteInfo
@@ -134,22 +139,57 @@ private:
     container list_;
 };
 
+//! 一つのシーケンスを、専用の仮想MIDI入力デバイスを通じてグラフに送るトラック
+struct SequenceTrack
+{
+    SequenceTrack(String name)
+    :   device_(name)
+    {
+        playing_notes_.Clear();
+    }
+    
+    VirtualMidiInDevice device_;
+    
+    //! 非リアルタイムスレッド側が所有するシーケンス。(Project::Impl::lf_で保護される)
+    std::shared_ptr<Sequence const> sequence_;
+    //! リアルタイムスレッドに公開されているシーケンス。
+    //! sequence_の差し替え時に、アトミックに書き換えられる。
+    std::atomic<Sequence const *> published_sequence_ = { nullptr };
+    PlayingNoteList playing_notes_;
+    
+    //! 以下はリアルタイムスレッドからのみアクセスする。
+    
+    //! cursor_が指しているシーケンス
+    Sequence const *playing_sequence_ = nullptr;
+    
+    //! playing_notes_のうち、ノートオン状態のものの数。
+    //! ゼロの場合は、停止時のノートオフ送出処理をスキップできる。
+    UInt32 num_playing_notes_ = 0;
+    //! 次に処理するSequence::Eventのインデックス
+    size_t cursor_ = 0;
+    //! cursor_に対応する再生位置。
+    //! 次のフレームの開始位置がこれと異なる場合は、cursor_を探し直す。
+    //! (負の値はカーソルが無効であることを表す)
+    SampleCount cursor_pos_ = -1;
+};
+
 struct Project::Impl
 {
     LockFactory lf_;
     Transporter tp_;
+    DiskStreamer disk_streamer_ { &tp_ };
     bool is_active_ = false;
     double sample_rate_ = 0;
     SampleCount block_size_ = 0;
     BypassFlag bypass_;
     int num_device_inputs_ = 0;
     int num_device_outputs_ = 0;
-    std::shared_ptr<Sequence> sequence_;
-    PlayingNoteList playing_sequence_notes_;
+    std::vector<std::unique_ptr<SequenceTrack>> sequence_tracks_;
     PlayingNoteList requested_sample_notes_;
     PlayingNoteList playing_sample_notes_;
-    SampleCount smp_last_pos_ = 0;
     GraphProcessor graph_;
+    AudioRecorder recorder_;
+    UInt32 recording_take_number_ = 0;
     
     //! input from device
     BufferRef<float const> input_;
@@ -157,18 +197,48 @@ struct Project::Impl
     BufferRef<float> output_;
     
     std::vector<DeviceMidiMessage> device_midi_input_buffer_;
+    
+    //! デバイス上のサンプル位置を割り当てられ、まだグラフに渡していないMIDI入力
+    struct PendingMidiInput
+    {
+        SampleCount device_pos_ = 0;
+        DeviceMidiMessage message_;
+    };
+    std::vector<PendingMidiInput> pending_midi_inputs_;
+    //! MIDI入力のタイムスタンプに加えるレイテンシー。
+    //! 直前のコールバックの周期内に届いたメッセージが、このコールバックの中に収まるように、ブロックサイズと同じにする。
+    SampleCount midi_input_latency_ = 0;
+    std::atomic<UInt64> num_midi_inputs_ = { 0 };
+    std::atomic<UInt64> num_late_midi_inputs_ = { 0 };
+    std::atomic<UInt64> num_dropped_midi_inputs_ = { 0 };
+    
+    //! このブロックでデバイスに送信するMIDIメッセージ。
+    //! time_stamp_は、MidiDeviceManager::GetMessages()と同じ時間軸の絶対時刻
+    std::vector<DeviceMidiMessage> device_midi_output_buffer_;
+    //! 出力デバイスのレイテンシー。MIDI出力をオーディオ出力と同じタイミングで鳴らすために使用する。
+    SampleCount output_latency_ = 0;
+    
+    //! steady_clockの時刻とデバイス上のサンプル位置との対応
+    AudioClock clock_;
+    //! このブロックの先頭のデバイス上のサンプル位置
+    SampleCount device_pos_ = 0;
+    
     std::map<MidiDevice const *, std::vector<ProcessInfo::MidiMessage>> midi_input_table_;
+    
+    //! MidiDeviceManagerから受け取ったMIDI入力を、pending_midi_inputs_に追加する。
+    void FetchMidiInputs();
 };
 
 Project::Project()
 :   pimpl_(std::make_unique<Impl>())
 {
-    pimpl_->playing_sequence_notes_.Clear();
     pimpl_->requested_sample_notes_.Clear();
     pimpl_->playing_sample_notes_.Clear();
-    pimpl_->device_midi_input_buffer_.reserve(2048);
+    pimpl_->device_midi_input_buffer_.resize(2048);
+    pimpl_->pending_midi_inputs_.reserve(2048);
+    pimpl_->device_midi_output_buffer_.reserve(2048);
     AddMidiInput(&kSoftwareKeyboardMidiInput);
-    AddMidiInput(&kSequencerMidiInput);
+    AddSequenceTrack(kDefaultSequenceTrackName);
 }
 
 Project::~Project()
@@ -212,28 +282,134 @@ void Project::AddMidiInput(MidiDevice *device)
 
 void Project::AddMidiOutput(MidiDevice *device)
 {
-//    pimpl_->graph_.AddMidiOutput(name,
-//                                 [device, this](GraphProcessor::MidiOutput *out,
-//                                                ProcessInfo const &pi)
-//                                 {
-//                                     OnGetMidi(out, pi, device);
-//                                 });
+    pimpl_->graph_.AddMidiOutput(device->GetDeviceInfo().name_id_,
+                                 [device, this](GraphProcessor::MidiOutput *out,
+                                                ProcessInfo const &pi)
+                                 {
+                                     OnGetMidi(out, pi, device);
+                                 });
 }
 
-std::shared_ptr<Sequence> Project::GetSequence() const
+UInt32 Project::AddSequenceTrack(String name, std::shared_ptr<Sequence const> seq)
 {
+    auto track = std::make_unique<SequenceTrack>(name);
+    track->sequence_ = seq;
+    track->published_sequence_.store(seq.get());
+    
+    //! フレーム処理中は実行しない。
+    //! (トラックのリストとmidi_input_table_がフレーム処理中に変更されるのを防ぐため)
+    auto bypass = MakeScopedBypassRequest(pimpl_->bypass_, true);
+    
+    AddMidiInput(&track->device_);
+    
     auto lock = pimpl_->lf_.make_lock();
-    return pimpl_->sequence_;
+    pimpl_->sequence_tracks_.push_back(std::move(track));
+    return (UInt32)(pimpl_->sequence_tracks_.size() - 1);
 }
 
-void Project::SetSequence(std::shared_ptr<Sequence> seq)
+UInt32 Project::GetNumSequenceTracks() const
 {
-    //! フレーム処理中は実行しない。
-    //! (seqがフレーム処理の中だけで参照されて、リアルタイムスレッド上でdeleteされてしまうのを防ぐため)
-    auto bypass = MakeScopedBypassRequest(pimpl_->bypass_, true);
-    
     auto lock = pimpl_->lf_.make_lock();
-    pimpl_->sequence_ = seq;
+    return (UInt32)pimpl_->sequence_tracks_.size();
+}
+
+String Project::GetSequenceTrackName(UInt32 track_index) const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    assert(track_index < pimpl_->sequence_tracks_.size());
+    return pimpl_->sequence_tracks_[track_index]->device_.GetDeviceInfo().name_id_;
+}
+
+std::shared_ptr<Sequence const> Project::GetSequence(UInt32 track_index) const
+{
+    auto lock = pimpl_->lf_.make_lock();
+    assert(track_index < pimpl_->sequence_tracks_.size());
+    return pimpl_->sequence_tracks_[track_index]->sequence_;
+}
+
+void Project::SetSequence(UInt32 track_index, std::shared_ptr<Sequence const> seq)
+{
+    //! フレーム処理を止めずに、シーケンスのポインタをアトミックに差し替える。
+    //! 差し替え前のシーケンスは、リアルタイムスレッドから参照されなくなってから
+    //! GarbageCollectorによって解放される。
+    auto lock = pimpl_->lf_.make_lock();
+    assert(track_index < pimpl_->sequence_tracks_.size());
+    auto &track = *pimpl_->sequence_tracks_[track_index];
+    
+    auto old_seq = std::move(track.sequence_);
+    track.sequence_ = seq;
+    track.published_sequence_.store(seq.get());
+    lock.unlock();
+    
+    RetireObject(std::move(old_seq));
+}
+
+std::shared_ptr<Sequence const> Project::GetSequence() const
+{
+    return GetSequence(0);
+}
+
+void Project::SetSequence(std::shared_ptr<Sequence const> seq)
+{
+    SetSequence(0, seq);
+}
+
+std::shared_ptr<AudioClipProcessor> Project::AddAudioClip(String path, SampleCount timeline_pos)
+{
+    auto stream = pimpl_->disk_streamer_.OpenStream(path, timeline_pos);
+    auto clip = std::make_shared<AudioClipProcessor>(stream);
+    pimpl_->graph_.AddNode(clip);
+    return clip;
+}
+
+void Project::StartRecording(String directory, bool use_direct_io)
+{
+    assert(IsRecording() == false);
+    
+    if(pimpl_->sample_rate_ <= 0) {
+        throw std::runtime_error("audio processing is not started");
+    }
+    
+    //! 再生された音を聞いてから演奏した音が入力として届くまでの遅れを補正する。
+    SampleCount latency = 0;
+    if(auto adm = AudioDeviceManager::GetInstance()) {
+        if(auto dev = adm->GetDevice()) {
+            latency = dev->GetLatency(DeviceIOType::kInput) + dev->GetLatency(DeviceIOType::kOutput);
+        }
+    }
+    
+    auto const take_number = ++pimpl_->recording_take_number_;
+    
+    std::vector<AudioRecorder::TakeDesc> takes;
+    auto &graph = pimpl_->graph_;
+    for(UInt32 i = 0; i < graph.GetNumAudioInputs(); ++i) {
+        auto input = graph.GetAudioInput(i);
+        AudioRecorder::TakeDesc desc;
+        desc.input_ = input;
+        desc.num_channels_ = input->GetAudioChannelCount(BusDirection::kOutputSide);
+        desc.path_ = wxFileName(directory, L"{}-{:03d}.wav"_format(input->GetName(), take_number))
+        .GetFullPath().ToStdWstring();
+        if(desc.num_channels_ > 0) {
+            takes.push_back(desc);
+        }
+    }
+    
+    pimpl_->recorder_.Start(takes, pimpl_->sample_rate_, latency, use_direct_io);
+}
+
+std::vector<AudioRecorder::TakeInfo> Project::StopRecording()
+{
+    return pimpl_->recorder_.Stop();
+}
+
+bool Project::IsRecording() const
+{
+    return pimpl_->recorder_.IsRecording();
+}
+
+std::vector<AudioRecorder::TakeInfo> Project::GetRecordingTakeInfo() const
+{
+    return pimpl_->recorder_.GetTakeInfo();
 }
 
 Transporter & Project::GetTransporter()
@@ -253,7 +429,14 @@ GraphProcessor & Project::GetGraph()
 
 std::vector<Project::PlayingNoteInfo> Project::GetPlayingSequenceNotes() const
 {
-    return pimpl_->playing_sequence_notes_.GetPlayingNotes();
+    auto lock = pimpl_->lf_.make_lock();
+    
+    std::vector<PlayingNoteInfo> tmp;
+    for(auto const &track: pimpl_->sequence_tracks_) {
+        auto notes = track->playing_notes_.GetPlayingNotes();
+        tmp.insert(tmp.end(), notes.begin(), notes.end());
+    }
+    return tmp;
 }
 
 std::vector<Project::PlayingNoteInfo> Project::GetPlayingSampleNotes() const
@@ -358,7 +541,24 @@ void Project::StartProcessing(double sample_rate,
     pimpl_->block_size_ = max_block_size;
     pimpl_->num_device_inputs_ = num_input_channels;
     pimpl_->num_device_outputs_ = num_output_channels;
+    
+    pimpl_->output_latency_ = 0;
+    if(auto adm = AudioDeviceManager::GetInstance()) {
+        if(auto dev = adm->GetDevice()) {
+            pimpl_->output_latency_ = dev->GetLatency(DeviceIOType::kOutput);
+        }
+    }
+    
+    pimpl_->midi_input_latency_ = max_block_size;
+    pimpl_->pending_midi_inputs_.clear();
+    pimpl_->clock_.Reset(sample_rate, max_block_size);
+    
     pimpl_->graph_.StartProcessing(sample_rate, max_block_size);
+    pimpl_->tp_.StartRealtimeProcessing();
+}
+
+namespace {
+    std::vector<Sequence::Event> const kEmptySequenceEvents;
 }
 
 template<class F>
@@ -384,6 +584,13 @@ TraversalCallback<F> MakeTraversalCallback(F f)
 
 void Project::Process(SampleCount block_size, float const * const * input, float **output)
 {
+    //! バイパス中でもデバイスのクロックは進むので、AudioClockは毎回更新する。
+    auto const now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    pimpl_->device_pos_ = pimpl_->clock_.Update(now, block_size);
+    
+    //! この区間の中で参照されるオブジェクトは、GarbageCollectorによって区間の外で解放される。
+    ScopedRealtimeSection rt_section;
+    
     ScopedBypassGuard guard;
     
     for(int i = 0; i < 50; ++i) {
@@ -393,6 +600,9 @@ void Project::Process(SampleCount block_size, float const * const * input, float
     
     if(!guard) { return; }
     
+    pimpl_->FetchMidiInputs();
+    pimpl_->device_midi_output_buffer_.clear();
+    
     SampleCount num_processed = 0;
     
     auto cb = MakeTraversalCallback([&, this](TransportInfo const &ti) {
@@ -403,18 +613,39 @@ void Project::Process(SampleCount block_size, float const * const * input, float
             entry.second.clear();
         }
         
-        if(auto mdm = MidiDeviceManager::GetInstance()) {
-            auto const timestamp = mdm->GetMessages(pimpl_->device_midi_input_buffer_);
-            auto frame_length = ti.GetSmpDuration() / pimpl_->sample_rate_;
-            auto frame_begin_time = timestamp - frame_length;
-            for(auto dm: pimpl_->device_midi_input_buffer_) {
-                auto const pos = std::max<double>(0, dm.time_stamp_ - frame_begin_time);
-                ProcessInfo::MidiMessage pm((SampleCount)std::round(pos * pimpl_->sample_rate_),
-                                            dm.channel_,
-                                            0,
-                                            dm.data_);
-                pimpl_->midi_input_table_[dm.device_].push_back(pm);
+        {
+            //! デバイス上の位置がこのフレームより前のMIDI入力をグラフに渡す。
+            //! 届くのが遅れて、すでにフレームを過ぎてしまったものは、フレームの先頭に配置する。
+            auto const device_frame_begin = pimpl_->device_pos_ + num_processed;
+            auto const device_frame_end = device_frame_begin + ti.GetSmpDuration();
+            
+            auto &pending = pimpl_->pending_midi_inputs_;
+            auto remaining = pending.begin();
+            for(auto it = pending.begin(); it != pending.end(); ++it) {
+                if(it->device_pos_ >= device_frame_end) {
+                    *remaining++ = *it;
+                    continue;
+                }
+                
+                auto offset = it->device_pos_ - device_frame_begin;
+                if(offset < 0) {
+                    pimpl_->num_late_midi_inputs_.fetch_add(1);
+                    offset = 0;
+                }
+                
+                auto const &dm = it->message_;
+                //! map::operator[]は、未登録のデバイスに対してメモリ確保を行ってしまうので、find()を使う。
+                auto found = pimpl_->midi_input_table_.find(dm.device_);
+                if(found == pimpl_->midi_input_table_.end()) { continue; }
+                if(found->second.size() == found->second.capacity()) {
+                    pimpl_->num_dropped_midi_inputs_.fetch_add(1);
+                    continue;
+                }
+                
+                auto const pm = ProcessInfo::MidiMessage::FromData((UInt32)offset, dm.channel_, dm.data_);
+                found->second.push_back(pm);
             }
+            pending.erase(remaining, pending.end());
         }
         
         auto in_this_frame = [&](auto pos) { return frame_begin <= pos && pos < frame_end; };
@@ -423,51 +654,76 @@ void Project::Process(SampleCount block_size, float const * const * input, float
                                   UInt8 channel, UInt8 pitch, UInt8 velocity, bool is_note_on,
                                   MidiDevice *device)
         {
-            ProcessInfo::MidiMessage mm;
-            mm.offset_ = sample_pos - ti.smp_begin_pos_;
-            mm.channel_ = channel;
-            mm.ppq_pos_ = SampleToPPQ(sample_pos);
-            if(is_note_on) {
-                mm.data_ = MidiDataType::NoteOn { pitch, velocity };
-            } else {
-                mm.data_ = MidiDataType::NoteOff { pitch, velocity };
-            }
-            pimpl_->midi_input_table_[device].push_back(mm);
+            UInt8 const status = (is_note_on ? MidiDataType::kNoteOn : MidiDataType::kNoteOff) | channel;
+            ProcessInfo::MidiMessage mm((UInt32)(sample_pos - ti.smp_begin_pos_), status, pitch, velocity);
+            auto found = pimpl_->midi_input_table_.find(device);
+            if(found == pimpl_->midi_input_table_.end()) { return; }
+            if(found->second.size() == found->second.capacity()) { return; }
+            found->second.push_back(mm);
         };
         
-        std::shared_ptr<Sequence> seq = GetSequence();
-        
-        bool const need_stop_all_sequence_notes
-        = (ti.playing_ == false)
-        || (ti.playing_ && ti.smp_begin_pos_ != pimpl_->smp_last_pos_);
-        
-        pimpl_->smp_last_pos_ = ti.smp_end_pos_;
-
-        if(need_stop_all_sequence_notes) {
-            int x = 0;
-            x = 1;
+        auto stop_all_track_notes = [&](SequenceTrack &track) {
+            if(track.num_playing_notes_ == 0) { return; }
             
-            pimpl_->playing_sequence_notes_.Traverse([&](auto ch, auto pi, auto &x) {
+            track.playing_notes_.Traverse([&](auto ch, auto pi, auto &x) {
                 auto note = x.load();
                 if(note) {
                     assert(note.IsNoteOn());
-                    add_note(ti.smp_begin_pos_, ch, pi, 0, false, &kSequencerMidiInput);
+                    add_note(ti.smp_begin_pos_, ch, pi, 0, false, &track.device_);
                     x.store(InternalPlayingNoteInfo());
                 }
             });
-        }
+            track.num_playing_notes_ = 0;
+        };
         
-        if(ti.playing_) {
-            std::for_each(seq->notes_.begin(), seq->notes_.end(), [&](Sequence::Note const &note) {
-                if(in_this_frame(note.pos_)) {
-                    add_note(note.pos_, note.channel_, note.pitch_, note.velocity_, true, &kSequencerMidiInput);
-                    pimpl_->playing_sequence_notes_.SetNoteOn(note.channel_, note.pitch_, note.velocity_);
-                }
-                if(in_this_frame(note.GetEndPos()-1)) {
-                    add_note(note.GetEndPos(), note.channel_, note.pitch_, note.off_velocity_, false, &kSequencerMidiInput);
-                    pimpl_->playing_sequence_notes_.ClearNote(note.channel_, note.pitch_);
+        //! 各トラックはカーソルを持ち、このフレームに含まれるイベントだけを処理する。
+        //! このフレームにイベントがないトラックは、カーソル位置の比較だけで処理を終える。
+        for(auto &track_ptr: pimpl_->sequence_tracks_) {
+            auto &track = *track_ptr;
+            
+            if(ti.playing_ == false) {
+                stop_all_track_notes(track);
+                track.cursor_pos_ = -1;
+                continue;
+            }
+            
+            auto const seq = track.published_sequence_.load();
+            if(seq != track.playing_sequence_) {
+                //! シーケンスが差し替えられたので、カーソルを探し直す。
+                track.playing_sequence_ = seq;
+                track.cursor_pos_ = -1;
+            }
+            
+            auto const &events = seq ? seq->GetEvents() : kEmptySequenceEvents;
+            
+            if(ti.smp_begin_pos_ != track.cursor_pos_) {
+                //! 再生位置がジャンプした（あるいは再生が開始された）ので、
+                //! 鳴っているノートを止めて、カーソルを探し直す。
+                stop_all_track_notes(track);
+                auto found = std::lower_bound(events.begin(), events.end(), frame_begin,
+                                              [](Sequence::Event const &ev, SampleCount pos) {
+                                                  return ev.pos_ < pos;
+                                              });
+                track.cursor_ = found - events.begin();
+            }
+            
+            for( ; track.cursor_ < events.size(); ++track.cursor_) {
+                auto const &ev = events[track.cursor_];
+                if(in_this_frame(ev.pos_) == false) { break; }
+                
+                add_note(ev.pos_, ev.channel_, ev.pitch_, ev.velocity_, ev.is_note_on_, &track.device_);
+                
+                auto const was_playing = (bool)track.playing_notes_.Get(ev.channel_, ev.pitch_);
+                if(ev.is_note_on_) {
+                    track.playing_notes_.SetNoteOn(ev.channel_, ev.pitch_, ev.velocity_);
+                    if(!was_playing) { track.num_playing_notes_ += 1; }
+                } else {
+                    track.playing_notes_.ClearNote(ev.channel_, ev.pitch_);
+                    if(was_playing) { track.num_playing_notes_ -= 1; }
                 }
-            });
+            }
+            
+            track.cursor_pos_ = frame_end;
         }
         
         pimpl_->requested_sample_notes_.Traverse([&](auto ch, auto pi, auto &x) {
@@ -511,10 +767,65 @@ void Project::Process(SampleCount block_size, float const * const * input, float
     
     Transporter::Traverser tv;
     tv.Traverse(&pimpl_->tp_, block_size, &cb);
+    
+    //! 送信するメッセージがなくても、スケジューラスレッドへの通知をやり直せるように毎回呼び出す。
+    if(auto mdm = MidiDeviceManager::GetInstance()) {
+        mdm->SendMessages(pimpl_->device_midi_output_buffer_);
+    }
+}
+
+void Project::Impl::FetchMidiInputs()
+{
+    auto mdm = MidiDeviceManager::GetInstance();
+    if(!mdm) { return; }
+    
+    auto const num = mdm->GetMessages(device_midi_input_buffer_);
+    
+    //! 各メッセージのタイムスタンプを、AudioClockでデバイス上のサンプル位置に変換して、
+    //! 一定のレイテンシーを加えた位置に配置する。
+    //! これによって、コールバックの呼び出しタイミングが揺らいでも、メッセージの間隔が保たれる。
+    for(size_t i = 0; i < num; ++i) {
+        auto const &dm = device_midi_input_buffer_[i];
+        num_midi_inputs_.fetch_add(1);
+        
+        //! メモリ確保が発生しないように、確保済みの容量を超える分は捨てる。
+        if(pending_midi_inputs_.size() == pending_midi_inputs_.capacity()) {
+            num_dropped_midi_inputs_.fetch_add(1);
+            continue;
+        }
+        
+        PendingMidiInput pm;
+        pm.device_pos_ = (SampleCount)std::llround(clock_.TimeToSample(dm.time_stamp_)) + midi_input_latency_;
+        pm.message_ = dm;
+        pending_midi_inputs_.push_back(pm);
+    }
+}
+
+Project::MidiTimingStatistics Project::GetMidiTimingStatistics() const
+{
+    MidiTimingStatistics stat;
+    stat.clock_ = pimpl_->clock_.GetStatistics();
+    stat.input_latency_ = pimpl_->midi_input_latency_;
+    stat.num_inputs_ = pimpl_->num_midi_inputs_.load();
+    stat.num_late_inputs_ = pimpl_->num_late_midi_inputs_.load();
+    stat.num_dropped_inputs_ = pimpl_->num_dropped_midi_inputs_.load();
+    if(auto mdm = MidiDeviceManager::GetInstance()) {
+        stat.num_dropped_inputs_ += mdm->GetNumDroppedInputMessages();
+    }
+    return stat;
+}
+
+void Project::ResetMidiTimingStatistics()
+{
+    pimpl_->clock_.ResetStatistics();
+    pimpl_->num_midi_inputs_.store(0);
+    pimpl_->num_late_midi_inputs_.store(0);
+    pimpl_->num_dropped_midi_inputs_.store(0);
 }
 
 void Project::StopProcessing()
 {
+    pimpl_->tp_.StopRealtimeProcessing();
     pimpl_->graph_.StopProcessing();
 }
 
@@ -526,6 +837,8 @@ void Project::OnSetAudio(GraphProcessor::AudioInput *input, ProcessInfo const &p
     auto const num_desired_channels = input->GetAudioChannelCount(BusDirection::kOutputSide);
     
     if(channel_index >= num_src_channels) {
+        //! 録音中のテイクには、このフレームを無音として記録する。
+        pimpl_->recorder_.Push(input, *pi.time_info_, BufferRef<float const>{});
         return;
     }
     
@@ -538,11 +851,12 @@ void Project::OnSetAudio(GraphProcessor::AudioInput *input, ProcessInfo const &p
         pimpl_->input_.data(),
         channel_index,
         num_available_channels,
-        0,
+        pimpl_->input_.sample_from(),
         pimpl_->input_.samples()
     };
     
     input->SetData(ref);
+    pimpl_->recorder_.Push(input, *pi.time_info_, ref);
 }
 
 void Project::OnGetAudio(GraphProcessor::AudioOutput *output, ProcessInfo const &pi, UInt32 channel_index)
@@ -575,11 +889,28 @@ void Project::OnGetAudio(GraphProcessor::AudioOutput *output, ProcessInfo const
 
 void Project::OnSetMidi(GraphProcessor::MidiInput *input, ProcessInfo const &pi, MidiDevice *device)
 {
-    input->SetData(pimpl_->midi_input_table_[device]);
+    auto found = pimpl_->midi_input_table_.find(device);
+    if(found == pimpl_->midi_input_table_.end()) { return; }
+    input->SetData(found->second);
 }
 
 void Project::OnGetMidi(GraphProcessor::MidiOutput *output, ProcessInfo const &pi, MidiDevice *device)
 {
+    auto &dest = pimpl_->device_midi_output_buffer_;
+    auto const device_frame_pos = pimpl_->device_pos_ + pimpl_->output_.sample_from() + pimpl_->output_latency_;
+    
+    for(auto const &mm: output->GetData()) {
+        //! メモリ確保が発生しないように、確保済みの容量を超える分は捨てる。
+        if(dest.size() == dest.capacity()) { break; }
+        
+        DeviceMidiMessage dm;
+        dm.device_ = device;
+        dm.time_stamp_ = pimpl_->clock_.SampleToTime(device_frame_pos + mm.offset_);
+        dm.channel_ = mm.GetChannel();
+        dm.data_ = mm.ToData();
+        if(dm.As<std::monostate>()) { continue; }
+        dest.push_back(dm);
+    }
 }
 
 NS_HWM_END
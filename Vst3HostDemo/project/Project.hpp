@@ -10,13 +10,17 @@
 #include "../misc/LockFactory.hpp"
 #include "../device/AudioDeviceManager.hpp"
 #include "../device/MidiDevice.hpp"
+#include "../device/AudioClock.hpp"
 #include "../plugin/vst3/Vst3Plugin.hpp"
 #include "../transport/Transporter.hpp"
 #include "./Sequence.hpp"
 #include "./GraphProcessor.hpp"
+#include "./AudioRecorder.hpp"
 
 NS_HWM_BEGIN
 
+class AudioClipProcessor;
+
 class Project final
 :   public IAudioDeviceCallback
 {
@@ -47,8 +51,53 @@ public:
 //    std::shared_ptr<Vst3Plugin> RemoveInstrument();
 //    std::shared_ptr<Vst3Plugin> GetInstrument() const;
     
-    std::shared_ptr<Sequence> GetSequence() const;
-    void SetSequence(std::shared_ptr<Sequence> seq);
+    //! シーケンストラックを追加する。
+    /*! トラックごとに専用の仮想MIDI入力デバイスが作成され、
+     *  グラフにはそのデバイスに対応するMidiInputが追加される。
+     *  @return 追加したトラックのインデックス
+     */
+    UInt32 AddSequenceTrack(String name, std::shared_ptr<Sequence const> seq = nullptr);
+    UInt32 GetNumSequenceTracks() const;
+    String GetSequenceTrackName(UInt32 track_index) const;
+    
+    std::shared_ptr<Sequence const> GetSequence(UInt32 track_index) const;
+    
+    //! シーケンスを差し替える。
+    /*! シーケンスはイミュータブルなスナップショットとして扱われ、
+     *  フレーム処理を止めずにアトミックに差し替えられる。
+     *  差し替え前のシーケンスは、リアルタイムスレッドから参照されなくなった後で、
+     *  GarbageCollectorのスレッド上で解放される。
+     */
+    void SetSequence(UInt32 track_index, std::shared_ptr<Sequence const> seq);
+    
+    //! 先頭のシーケンストラックに対するGetSequence/SetSequence
+    std::shared_ptr<Sequence const> GetSequence() const;
+    void SetSequence(std::shared_ptr<Sequence const> seq);
+    
+    //! オーディオファイルをディスクからストリーミング再生するクリップを作成し、グラフに追加する。
+    /*! 追加されたクリップは、グラフの他のノードと接続して使用する。
+     *  @param timeline_pos ファイルの先頭を配置するトランスポート上の位置
+     *  @throw std::runtime_error ファイルを開けなかった場合
+     */
+    std::shared_ptr<AudioClipProcessor> AddAudioClip(String path, SampleCount timeline_pos);
+    
+    //! グラフの各AudioInputへの入力を、入力ごとにdirectory以下のWAVファイルへ録音する。
+    /*! 録音はトランスポートの再生中にだけ行われ、デバイスの入出力レイテンシーは自動的に補正される。
+     *  ファイル名は、AudioInputの名前とテイク番号から作られる。
+     *  @param use_direct_io ページキャッシュを経由せずにファイルに書き込むかどうか
+     *  @throw std::runtime_error フレーム処理が開始されていない場合や、ファイルを作成できなかった場合
+     */
+    void StartRecording(String directory, bool use_direct_io = false);
+    
+    //! 録音を終了する。
+    //! @return 各テイクの録音結果
+    std::vector<AudioRecorder::TakeInfo> StopRecording();
+    
+    bool IsRecording() const;
+    
+    //! 録音中の各テイクの状態を返す。
+    //! オーバーランの発生状況の確認に使用する。
+    std::vector<AudioRecorder::TakeInfo> GetRecordingTakeInfo() const;
     
     Transporter & GetTransporter();
     Transporter const & GetTransporter() const;
@@ -63,6 +112,22 @@ public:
     void SendSampleNoteOn(UInt8 channel, UInt8 pitch, UInt8 velocity = 64);
     void SendSampleNoteOff(UInt8 channel, UInt8 pitch, UInt8 off_velocity = 0);
     
+    //! MIDI入出力のタイミングの統計
+    struct MidiTimingStatistics
+    {
+        //! オーディオコールバックの呼び出しタイミングの揺らぎ
+        AudioClock::Statistics clock_;
+        //! MIDI入力に加えているレイテンシー(サンプル数)
+        SampleCount input_latency_ = 0;
+        UInt64 num_inputs_ = 0;
+        //! input_latency_以上遅れて届いたために、フレームの先頭に配置されたMIDI入力の数
+        UInt64 num_late_inputs_ = 0;
+        UInt64 num_dropped_inputs_ = 0;
+    };
+    
+    MidiTimingStatistics GetMidiTimingStatistics() const;
+    void ResetMidiTimingStatistics();
+    
     double SampleToPPQ(SampleCount sample_pos) const;
     SampleCount PPQToSample(double ppq_pos) const;
     
@@ -0,0 +1,84 @@
+#include "ProjectLoadBenchmark.hpp"
+
+#include <algorithm>
+
+#include <wx/filefn.h>
+#include <wx/filename.h>
+
+#include "../App.hpp"
+#include "../misc/Benchmark.hpp"
+#include "../misc/ScopeExit.hpp"
+#include "../processor/Processor.hpp"
+#include "./Project.hpp"
+#include "./ProjectSerializer.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    //! @return 作成できたプラグインの数
+    UInt32 AddPlugins(Project &pj, std::vector<PluginDescription> const &descs, UInt32 num_plugins)
+    {
+        auto app = MyApp::GetInstance();
+        auto &graph = pj.GetGraph();
+
+        graph.BeginBatchUpdate();
+        HWM_SCOPE_EXIT([&graph] { graph.EndBatchUpdate(); });
+
+        UInt32 num_created = 0;
+        for(UInt32 i = 0; i < num_plugins; ++i) {
+            auto const &desc = descs[i % descs.size()];
+            std::shared_ptr<Vst3Plugin> plugin = app->CreateVst3Plugin(desc);
+            if(!plugin) {
+                hwm::dout << "Failed to create a plugin: " << desc.name() << std::endl;
+                continue;
+            }
+
+            graph.AddNode(std::make_shared<Vst3AudioProcessor>(desc, std::move(plugin)));
+            num_created += 1;
+        }
+
+        return num_created;
+    }
+}
+
+int RunProjectLoadBenchmark(std::vector<PluginDescription> const &descs,
+                            UInt32 num_plugins,
+                            UInt32 num_iterations)
+{
+    if(descs.empty() || num_plugins == 0 || num_iterations == 0) {
+        hwm::dout << "No plugins to benchmark." << std::endl;
+        return 1;
+    }
+
+    auto const path = wxFileName::CreateTempFileName("hwm-project-bench").ToStdWstring();
+    if(path.empty()) {
+        hwm::dout << "Failed to create a temporary file." << std::endl;
+        return 1;
+    }
+    HWM_SCOPE_EXIT([&path] { wxRemoveFile(path); });
+
+    {
+        Project pj;
+        auto const num_created = AddPlugins(pj, descs, num_plugins);
+        ProjectSerializer().Save(pj, path);
+        hwm::dout << "Saved a project with {} plugins ({} kinds)."_format(num_created,
+                                                                        std::min<size_t>(descs.size(), num_plugins))
+        << std::endl;
+    }
+
+    std::vector<double> times;
+    for(UInt32 i = 0; i < num_iterations; ++i) {
+        Project pj;
+        auto const t_begin = BenchmarkClock::now();
+        ProjectSerializer().Load(pj, path);
+        times.push_back(ToMilliseconds(BenchmarkClock::now() - t_begin));
+        hwm::dout << "Load #{}: {:.1f}ms"_format(i + 1, times.back()) << std::endl;
+    }
+
+    PrintBenchmarkTimes("Load project", times);
+
+    return 0;
+}
+
+NS_HWM_END
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include <plugin_desc.pb.h>
+
+NS_HWM_BEGIN
+
+//! プロジェクトの読み込みにかかる時間を計測する。
+/*! descsのプラグインを順に使って、num_plugins個のプラグインを含むプロジェクトを作成して一時ファイルに保存し、
+ *  そのファイルをnum_iterations回読み込んで、各回の所要時間と中央値を出力する。
+ *  (読み込みの内訳は、ProjectSerializer::Load()が出力する)
+ *
+ *  メインスレッドから呼び出す。
+ *  @return プロセスの終了コード
+ */
+int RunProjectLoadBenchmark(std::vector<PluginDescription> const &descs,
+                            UInt32 num_plugins,
+                            UInt32 num_iterations);
+
+NS_HWM_END
@@ -0,0 +1,587 @@
+#include "ProjectSerializer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <wx/filefn.h>
+#include <project.pb.h>
+
+#include "../App.hpp"
+#include "../misc/StrCnv.hpp"
+#include "../misc/ScopeExit.hpp"
+#include "./AudioClipProcessor.hpp"
+
+NS_HWM_BEGIN
+
+namespace {
+
+    //! ファイル形式のバージョン。互換性のない変更をしたときに更新する。
+    UInt32 const kProjectDataVersion = 1;
+
+    using NodeData = ProjectData::Node;
+    using ConnectionData = ProjectData::Connection;
+    using Clock = std::chrono::steady_clock;
+
+    double ToMilliseconds(Clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    //! GraphProcessorの入出力ノードの種類と、同じ種類の入出力ノードの中でのインデックスを返す。
+    //! 入出力ノードでない場合は無効値が返る。
+    std::optional<std::pair<NodeData::NodeType, UInt32>>
+    FindIONode(GraphProcessor const &graph, Processor const *proc)
+    {
+        for(UInt32 i = 0; i < graph.GetNumAudioInputs(); ++i) {
+            if(graph.GetAudioInput(i) == proc) { return std::make_pair(NodeData::AUDIO_INPUT, i); }
+        }
+        for(UInt32 i = 0; i < graph.GetNumAudioOutputs(); ++i) {
+            if(graph.GetAudioOutput(i) == proc) { return std::make_pair(NodeData::AUDIO_OUTPUT, i); }
+        }
+        for(UInt32 i = 0; i < graph.GetNumMidiInputs(); ++i) {
+            if(graph.GetMidiInput(i) == proc) { return std::make_pair(NodeData::MIDI_INPUT, i); }
+        }
+        for(UInt32 i = 0; i < graph.GetNumMidiOutputs(); ++i) {
+            if(graph.GetMidiOutput(i) == proc) { return std::make_pair(NodeData::MIDI_OUTPUT, i); }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<Processor *> GetIOProcessors(GraphProcessor &graph, NodeData::NodeType type)
+    {
+        std::vector<Processor *> list;
+        switch(type) {
+            case NodeData::AUDIO_INPUT:
+                for(UInt32 i = 0; i < graph.GetNumAudioInputs(); ++i) { list.push_back(graph.GetAudioInput(i)); }
+                break;
+            case NodeData::AUDIO_OUTPUT:
+                for(UInt32 i = 0; i < graph.GetNumAudioOutputs(); ++i) { list.push_back(graph.GetAudioOutput(i)); }
+                break;
+            case NodeData::MIDI_INPUT:
+                for(UInt32 i = 0; i < graph.GetNumMidiInputs(); ++i) { list.push_back(graph.GetMidiInput(i)); }
+                break;
+            case NodeData::MIDI_OUTPUT:
+                for(UInt32 i = 0; i < graph.GetNumMidiOutputs(); ++i) { list.push_back(graph.GetMidiOutput(i)); }
+                break;
+            default:
+                break;
+        }
+        return list;
+    }
+
+    std::string ReadFile(String const &path)
+    {
+        std::ifstream ifs(to_utf8(path), std::ios::binary);
+        if(!ifs) {
+            throw std::runtime_error("failed to open the project file: " + to_utf8(path));
+        }
+
+        std::string data;
+        std::copy(std::istreambuf_iterator<char>(ifs),
+                  std::istreambuf_iterator<char>(),
+                  std::back_inserter(data));
+        return data;
+    }
+
+    //! 書き込み中にアプリケーションが終了しても以前のファイルが壊れないように、
+    //! 一時ファイルに書き込んでから置き換える。
+    void WriteFile(String const &path, std::string const &data)
+    {
+        String const tmp_path = path + L".tmp";
+
+        {
+            std::ofstream ofs(to_utf8(tmp_path), std::ios::binary | std::ios::trunc);
+            ofs.write(data.data(), data.size());
+            ofs.close();
+            if(!ofs) {
+                throw std::runtime_error("failed to write the project file: " + to_utf8(tmp_path));
+            }
+        }
+
+        if(wxRenameFile(tmp_path, path, true) == false) {
+            throw std::runtime_error("failed to replace the project file: " + to_utf8(path));
+        }
+    }
+
+    std::shared_ptr<Sequence const> ToSequence(ProjectData::SequenceTrack const &track)
+    {
+        auto to_u8 = [](UInt32 value, UInt32 max) { return (UInt8)std::min(value, max); };
+
+        std::vector<Sequence::Note> notes;
+        notes.reserve(track.notes_size());
+        for(auto const &n: track.notes()) {
+            notes.emplace_back(n.pos(),
+                               n.length(),
+                               to_u8(n.channel(), 15),
+                               to_u8(n.pitch(), 127),
+                               to_u8(n.velocity(), 127),
+                               to_u8(n.off_velocity(), 127));
+        }
+
+        std::stable_sort(notes.begin(), notes.end(),
+                         [](auto const &lhs, auto const &rhs) { return lhs.pos_ < rhs.pos_; });
+
+        return std::make_shared<Sequence>(std::move(notes));
+    }
+}
+
+struct ProjectSerializer::Impl
+{
+    struct PluginState
+    {
+        //! 同じアドレスに別のプラグインが作成された場合に、キャッシュを誤用しないようにするため
+        std::weak_ptr<Vst3Plugin> plugin_;
+        std::string component_state_;
+        std::string controller_state_;
+        bool has_controller_state_ = false;
+    };
+
+    std::unordered_map<Vst3Plugin const *, PluginState> plugin_states_;
+
+    PluginState const & GetPluginState(std::shared_ptr<Vst3Plugin> const &plugin, bool incremental);
+    void Serialize(Project &pj, ProjectData &data, bool incremental);
+    void Save(Project &pj, String const &path, bool incremental);
+
+    //! プラグインを並列に作成して、状態を復元する。
+    //! procsには、nodesの各要素に対応するプラグインが返る。(プラグインでないノードと、作成に失敗したノードはnullptr)
+    void CreatePlugins(google::protobuf::RepeatedPtrField<NodeData> const &nodes,
+                       std::vector<std::shared_ptr<Vst3AudioProcessor>> &procs);
+
+    void RestoreSequenceTracks(Project &pj, ProjectData const &data);
+    void RestoreTransport(Project &pj, ProjectData const &data);
+    void CommitGraph(Project &pj,
+                     ProjectData::Graph const &data,
+                     std::vector<std::shared_ptr<Vst3AudioProcessor>> const &procs);
+};
+
+ProjectSerializer::Impl::PluginState const &
+ProjectSerializer::Impl::GetPluginState(std::shared_ptr<Vst3Plugin> const &plugin, bool incremental)
+{
+    auto found = plugin_states_.find(plugin.get());
+    if(incremental
+       && found != plugin_states_.end()
+       && found->second.plugin_.lock() == plugin
+       && plugin->IsDirty() == false)
+    {
+        return found->second;
+    }
+
+    //! 状態の取得中に変更された場合は次回の保存で取得し直すように、取得する前にフラグを下ろす。
+    plugin->SetDirty(false);
+
+    PluginState state;
+    state.plugin_ = plugin;
+
+    if(auto data = plugin->GetComponentState()) {
+        state.component_state_.assign(data->begin(), data->end());
+    } else {
+        plugin->SetDirty(true);
+    }
+
+    if(auto data = plugin->GetControllerState()) {
+        state.controller_state_.assign(data->begin(), data->end());
+        state.has_controller_state_ = true;
+    }
+
+    auto &entry = plugin_states_[plugin.get()];
+    entry = std::move(state);
+    return entry;
+}
+
+void ProjectSerializer::Impl::Serialize(Project &pj, ProjectData &data, bool incremental)
+{
+    data.set_version(kProjectDataVersion);
+
+    auto &graph = pj.GetGraph();
+    auto const nodes = graph.GetNodes();
+
+    std::unordered_map<GraphProcessor::Node const *, UInt32> node_to_id;
+    std::unordered_set<Vst3Plugin const *> saved_plugins;
+
+    auto *graph_data = data.mutable_graph();
+    for(auto const &node: nodes) {
+        auto proc = node->GetProcessor();
+
+        NodeData nd;
+        if(auto vst3 = std::dynamic_pointer_cast<Vst3AudioProcessor>(proc)) {
+            if(!vst3->plugin_) { continue; }
+
+            auto const &state = GetPluginState(vst3->plugin_, incremental);
+            saved_plugins.insert(vst3->plugin_.get());
+
+            nd.set_type(NodeData::PLUGIN);
+            auto *plugin_data = nd.mutable_plugin();
+            *plugin_data->mutable_desc() = vst3->desc_;
+            plugin_data->set_component_state(state.component_state_);
+            plugin_data->set_controller_state(state.controller_state_);
+            plugin_data->set_has_controller_state(state.has_controller_state_);
+        } else if(auto clip = std::dynamic_pointer_cast<AudioClipProcessor>(proc)) {
+            auto stream = clip->GetStream();
+            nd.set_type(NodeData::AUDIO_CLIP);
+            nd.mutable_audio_clip()->set_path(to_utf8(stream->GetPath()));
+            nd.mutable_audio_clip()->set_timeline_pos(stream->GetTimelinePos());
+        } else if(auto io = FindIONode(graph, proc.get())) {
+            nd.set_type(io->first);
+            nd.set_io_index(io->second);
+        } else {
+            //! 保存方法が定義されていないノード
+            continue;
+        }
+
+        UInt32 const id = graph_data->nodes_size();
+        nd.set_id(id);
+        nd.set_name(to_utf8(proc->GetName()));
+        node_to_id[node.get()] = id;
+        *graph_data->add_nodes() = std::move(nd);
+    }
+
+    //! 削除されたプラグインのキャッシュを破棄する
+    for(auto it = plugin_states_.begin(); it != plugin_states_.end(); ) {
+        if(saved_plugins.count(it->first) == 0) {
+            it = plugin_states_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto add_connection = [&](auto const &conn, ConnectionData::ConnectionType type) -> ConnectionData * {
+        auto up = node_to_id.find(conn->upstream_);
+        auto down = node_to_id.find(conn->downstream_);
+        if(up == node_to_id.end() || down == node_to_id.end()) { return nullptr; }
+
+        auto *cd = graph_data->add_connections();
+        cd->set_type(type);
+        cd->set_upstream_id(up->second);
+        cd->set_downstream_id(down->second);
+        cd->set_upstream_channel_index(conn->upstream_channel_index_);
+        cd->set_downstream_channel_index(conn->downstream_channel_index_);
+        return cd;
+    };
+
+    for(auto const &node: nodes) {
+        for(auto const &conn: node->GetAudioConnections(BusDirection::kOutputSide)) {
+            if(auto cd = add_connection(conn, ConnectionData::AUDIO)) {
+                cd->set_num_channels(conn->num_channels_);
+            }
+        }
+
+        for(auto const &conn: node->GetMidiConnections(BusDirection::kOutputSide)) {
+            add_connection(conn, ConnectionData::MIDI);
+        }
+    }
+
+    for(UInt32 i = 0; i < pj.GetNumSequenceTracks(); ++i) {
+        auto *track = data.add_sequence_tracks();
+        track->set_name(to_utf8(pj.GetSequenceTrackName(i)));
+
+        auto seq = pj.GetSequence(i);
+        if(!seq) { continue; }
+
+        for(auto const &note: seq->notes_) {
+            auto *nd = track->add_notes();
+            nd->set_pos(note.pos_);
+            nd->set_length(note.length_);
+            nd->set_channel(note.channel_);
+            nd->set_pitch(note.pitch_);
+            nd->set_velocity(note.velocity_);
+            nd->set_off_velocity(note.off_velocity_);
+        }
+    }
+
+    auto const &tp = pj.GetTransporter();
+    auto const ti = tp.GetCurrentState();
+    auto *transport = data.mutable_transport();
+    transport->set_pos(ti.smp_begin_pos_);
+    transport->set_loop_enabled(ti.loop_enabled_);
+    transport->set_loop_begin(ti.loop_begin_);
+    transport->set_loop_end(ti.loop_end_);
+}
+
+void ProjectSerializer::Impl::Save(Project &pj, String const &path, bool incremental)
+{
+    auto const t_begin = Clock::now();
+
+    ProjectData data;
+    Serialize(pj, data, incremental);
+
+    std::string str;
+    if(data.SerializeToString(&str) == false) {
+        throw std::runtime_error("failed to serialize the project");
+    }
+
+    auto const t_serialized = Clock::now();
+
+    WriteFile(path, str);
+
+    auto const t_end = Clock::now();
+    hwm::dout << "Save project ({} nodes, {} bytes): serialize {:.1f}ms, write {:.1f}ms"_format(data.graph().nodes_size(),
+                                                                                                  str.size(),
+                                                                                                  ToMilliseconds(t_serialized - t_begin),
+                                                                                                  ToMilliseconds(t_end - t_serialized))
+    << std::endl;
+}
+
+void ProjectSerializer::Impl::CreatePlugins(google::protobuf::RepeatedPtrField<NodeData> const &nodes,
+                                            std::vector<std::shared_ptr<Vst3AudioProcessor>> &procs)
+{
+    procs.clear();
+    procs.resize(nodes.size());
+
+    std::vector<int> plugin_indices;
+    for(int i = 0; i < nodes.size(); ++i) {
+        if(nodes[i].type() == NodeData::PLUGIN) { plugin_indices.push_back(i); }
+    }
+
+    if(plugin_indices.empty()) { return; }
+
+    auto app = MyApp::GetInstance();
+
+    //! VST3では、setState()やsetComponentState()はメインスレッドから呼び出すことになっているので、
+    //! 状態の復元は、作成を待つループの中で、ノードの順にメインスレッドで行う。
+    auto restore_state = [](NodeData::PluginData const &pd, Vst3Plugin &plugin) {
+        auto const &cs = pd.component_state();
+        if(cs.empty() == false) {
+            plugin.SetComponentState(std::vector<char>(cs.begin(), cs.end()));
+        }
+
+        if(pd.has_controller_state()) {
+            auto const &es = pd.controller_state();
+            plugin.SetControllerState(std::vector<char>(es.begin(), es.end()));
+        }
+
+        //! 読み込んだ直後の状態は、ファイルに保存されている状態と同じ。
+        plugin.SetDirty(false);
+    };
+
+    //! プラグインの作成は、プラグインごとに独立しているので、MyAppのスレッドプール上で並列に行う。
+    //! (この関数はメインスレッドから呼び出すので、メインスレッドでの作成が必要なプラグインは、
+    //!  CreateVst3PluginAsync()の中でその場で作成される)
+    assert(wxIsMainThread());
+    std::vector<std::future<std::unique_ptr<Vst3Plugin>>> futures(nodes.size());
+    for(auto index: plugin_indices) {
+        futures[index] = app->CreateVst3PluginAsync(nodes[index].plugin().desc());
+    }
+
+    for(auto index: plugin_indices) {
+        auto const &pd = nodes[index].plugin();
+        std::shared_ptr<Vst3Plugin> plugin = futures[index].get();
+        if(!plugin) {
+            hwm::dout << "Failed to restore a plugin: " << pd.desc().name() << std::endl;
+            continue;
+        }
+
+        restore_state(pd, *plugin);
+        procs[index] = std::make_shared<Vst3AudioProcessor>(pd.desc(), std::move(plugin));
+    }
+}
+
+void ProjectSerializer::Impl::RestoreSequenceTracks(Project &pj, ProjectData const &data)
+{
+    UInt32 const num_saved_tracks = data.sequence_tracks_size();
+
+    for(UInt32 i = 0; i < num_saved_tracks; ++i) {
+        auto const &track = data.sequence_tracks(i);
+        auto seq = ToSequence(track);
+
+        if(i < pj.GetNumSequenceTracks()) {
+            pj.SetSequence(i, seq);
+        } else {
+            pj.AddSequenceTrack(to_wstr(track.name()), seq);
+        }
+    }
+
+    //! トラックを削除する方法はないので、ファイルにないトラックは空にする。
+    for(UInt32 i = num_saved_tracks; i < pj.GetNumSequenceTracks(); ++i) {
+        pj.SetSequence(i, nullptr);
+    }
+}
+
+void ProjectSerializer::Impl::RestoreTransport(Project &pj, ProjectData const &data)
+{
+    auto const &transport = data.transport();
+    auto &tp = pj.GetTransporter();
+
+    tp.SetLoopRange(transport.loop_begin(), transport.loop_end());
+    tp.SetLoopEnabled(transport.loop_enabled());
+    tp.MoveTo(transport.pos());
+}
+
+void ProjectSerializer::Impl::CommitGraph(Project &pj,
+                                          ProjectData::Graph const &data,
+                                          std::vector<std::shared_ptr<Vst3AudioProcessor>> const &procs)
+{
+    auto &graph = pj.GetGraph();
+
+    graph.BeginBatchUpdate();
+    HWM_SCOPE_EXIT([&graph] { graph.EndBatchUpdate(); });
+
+    //! 入出力ノード以外のノードを削除して、入出力ノードの接続を解除する。
+    for(auto const &node: graph.GetNodes()) {
+        auto proc = node->GetProcessor();
+        if(FindIONode(graph, proc.get())) {
+            graph.Disconnect(node.get());
+        } else {
+            graph.RemoveNode(proc.get());
+        }
+    }
+    plugin_states_.clear();
+
+    std::vector<GraphProcessor::Node *> id_to_node(data.nodes_size());
+    std::unordered_set<Processor const *> used_io_nodes;
+
+    for(int i = 0; i < data.nodes_size(); ++i) {
+        auto const &nd = data.nodes(i);
+
+        switch(nd.type()) {
+            case NodeData::PLUGIN: {
+                auto const &proc = procs[i];
+                if(!proc) {
+                    hwm::dout << "Skip the plugin which could not be loaded: " << nd.name() << std::endl;
+                    break;
+                }
+
+                id_to_node[i] = graph.AddNode(proc).get();
+
+                auto const &pd = nd.plugin();
+                auto &state = plugin_states_[proc->plugin_.get()];
+                state.plugin_ = proc->plugin_;
+                state.component_state_ = pd.component_state();
+                state.controller_state_ = pd.controller_state();
+                state.has_controller_state_ = pd.has_controller_state();
+                break;
+            }
+            case NodeData::AUDIO_CLIP: {
+                try {
+                    auto clip = pj.AddAudioClip(to_wstr(nd.audio_clip().path()), nd.audio_clip().timeline_pos());
+                    id_to_node[i] = graph.GetNodeOf(clip.get()).get();
+                } catch(std::exception &e) {
+                    hwm::dout << "Failed to load an audio clip: " << e.what() << std::endl;
+                }
+                break;
+            }
+            default: {
+                auto const candidates = GetIOProcessors(graph, nd.type());
+                auto is_available = [&](Processor const *p) { return used_io_nodes.count(p) == 0; };
+
+                auto found = std::find_if(candidates.begin(), candidates.end(), [&](Processor const *p) {
+                    return is_available(p) && to_utf8(p->GetName()) == nd.name();
+                });
+
+                Processor const *io = nullptr;
+                if(found != candidates.end()) {
+                    io = *found;
+                } else if(nd.io_index() < candidates.size() && is_available(candidates[nd.io_index()])) {
+                    io = candidates[nd.io_index()];
+                }
+
+                if(!io) {
+                    hwm::dout << "No matching io node is found: " << nd.name() << std::endl;
+                    break;
+                }
+
+                used_io_nodes.insert(io);
+                id_to_node[i] = graph.GetNodeOf(io).get();
+                break;
+            }
+        }
+    }
+
+    for(auto const &cd: data.connections()) {
+        if(cd.upstream_id() >= id_to_node.size() || cd.downstream_id() >= id_to_node.size()) { continue; }
+
+        auto up = id_to_node[cd.upstream_id()];
+        auto down = id_to_node[cd.downstream_id()];
+        if(!up || !down) { continue; }
+
+        auto const up_ch = cd.upstream_channel_index();
+        auto const down_ch = cd.downstream_channel_index();
+
+        bool connected = false;
+        if(cd.type() == ConnectionData::AUDIO) {
+            auto const num = cd.num_channels();
+            //! デバイスやプラグインのチャンネル数が保存時と異なる場合は接続できない。
+            if(num >= 1
+               && up_ch + num <= up->GetProcessor()->GetAudioChannelCount(BusDirection::kOutputSide)
+               && down_ch + num <= down->GetProcessor()->GetAudioChannelCount(BusDirection::kInputSide))
+            {
+                connected = graph.ConnectAudio(up, down, up_ch, down_ch, num);
+            }
+        } else {
+            if(up_ch < up->GetProcessor()->GetMidiChannelCount(BusDirection::kOutputSide)
+               && down_ch < down->GetProcessor()->GetMidiChannelCount(BusDirection::kInputSide))
+            {
+                connected = graph.ConnectMidi(up, down, up_ch, down_ch);
+            }
+        }
+
+        if(!connected) {
+            hwm::dout << "Failed to restore a connection: {} -> {}"_format(cd.upstream_id(), cd.downstream_id()) << std::endl;
+        }
+    }
+}
+
+ProjectSerializer::ProjectSerializer()
+:   pimpl_(std::make_unique<Impl>())
+{}
+
+ProjectSerializer::~ProjectSerializer()
+{}
+
+void ProjectSerializer::Save(Project &pj, String path)
+{
+    pimpl_->Save(pj, path, false);
+}
+
+void ProjectSerializer::SaveIncrementally(Project &pj, String path)
+{
+    pimpl_->Save(pj, path, true);
+}
+
+void ProjectSerializer::Load(Project &pj, String path)
+{
+    auto const t_begin = Clock::now();
+
+    ProjectData data;
+    if(data.ParseFromString(ReadFile(path)) == false) {
+        throw std::runtime_error("invalid project file: " + to_utf8(path));
+    }
+
+    if(data.version() > kProjectDataVersion) {
+        throw std::runtime_error("unsupported project file version: {}"_format(data.version()));
+    }
+
+    auto const t_parsed = Clock::now();
+
+    std::vector<std::shared_ptr<Vst3AudioProcessor>> procs;
+    pimpl_->CreatePlugins(data.graph().nodes(), procs);
+
+    auto const t_created = Clock::now();
+
+    //! シーケンストラックの入力ノードを接続できるように、グラフより先に復元する。
+    pimpl_->RestoreSequenceTracks(pj, data);
+    pimpl_->CommitGraph(pj, data.graph(), procs);
+    pimpl_->RestoreTransport(pj, data);
+
+    auto const t_end = Clock::now();
+
+    auto const num_plugins = std::count_if(procs.begin(), procs.end(), [](auto const &p) { return p != nullptr; });
+    hwm::dout << "Load project ({} plugins): parse {:.1f}ms, create plugins {:.1f}ms, commit {:.1f}ms, total {:.1f}ms"_format(num_plugins,
+                                                                                                                                 ToMilliseconds(t_parsed - t_begin),
+                                                                                                                                 ToMilliseconds(t_created - t_parsed),
+                                                                                                                                 ToMilliseconds(t_end - t_created),
+                                                                                                                                 ToMilliseconds(t_end - t_begin))
+    << std::endl;
+}
+
+void ProjectSerializer::ClearCache()
+{
+    pimpl_->plugin_states_.clear();
+}
+
+NS_HWM_END
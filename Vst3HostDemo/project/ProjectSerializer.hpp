@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+
+#include "./Project.hpp"
+
+NS_HWM_BEGIN
+
+//! プロジェクトの内容を、protobuf形式(schema/project.proto)のファイルに保存/復元するクラス
+/*! 保存されるのは、グラフのトポロジー(ノードと接続)、プラグインの状態(IComponent/IEditControllerのgetState())、
+ *  オーディオクリップ、シーケンストラック、トランスポートの状態。
+ *
+ *  プラグインの状態は、プラグインごとにキャッシュされる。
+ *  SaveIncrementally()では、前回の保存以降にVst3Plugin::IsDirty()がtrueになったプラグインの状態だけを取得し直すので、
+ *  多数のプラグインを含むプロジェクトでも、自動保存を短時間で行える。
+ *
+ *  すべての関数は、メインスレッドから呼び出す。
+ */
+class ProjectSerializer
+{
+public:
+    ProjectSerializer();
+    ~ProjectSerializer();
+
+    //! すべてのプラグインの状態を取得し直して、プロジェクトを保存する。
+    //! @throw std::runtime_error ファイルに書き込めなかった場合
+    void Save(Project &pj, String path);
+
+    //! 状態が変化したプラグインの状態だけを取得し直して、プロジェクトを保存する。
+    //! @throw std::runtime_error ファイルに書き込めなかった場合
+    void SaveIncrementally(Project &pj, String path);
+
+    //! ファイルからプロジェクトを読み込み、pjの内容を置き換える。
+    /*! プラグインは複数のスレッドで並列に作成され、メインスレッドで作成の完了を待ちながら、ノードの順に状態が復元される。
+     *  すべてのプラグインの準備ができてから、グラフへのノードの追加と接続を
+     *  GraphProcessor::BeginBatchUpdate()/EndBatchUpdate()の間でまとめて行う。
+     *
+     *  入出力ノードは、プロジェクトに追加されているものを、種類と名前(見つからない場合は順番)で対応付けて使用する。
+     *  作成できなかったプラグインや、対応する入出力ノードが見つからなかったノードは読み込まれない。
+     *  @throw std::runtime_error ファイルを読み込めなかった場合や、ファイルの形式が正しくない場合
+     */
+    void Load(Project &pj, String path);
+
+    //! プラグインの状態のキャッシュを破棄する。
+    void ClearCache();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+NS_HWM_END
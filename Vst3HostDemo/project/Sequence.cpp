@@ -1 +1,42 @@
 #include "Sequence.hpp"
+#include "../misc/GarbageCollector.hpp"
+
+#include <algorithm>
+
+NS_HWM_BEGIN
+
+Sequence::Sequence(std::vector<Note> notes)
+:   notes_(std::move(notes))
+{
+    events_.reserve(notes_.size() * 2);
+    for(auto const &note: notes_) {
+        Event on;
+        on.pos_ = note.pos_;
+        on.channel_ = note.channel_;
+        on.pitch_ = note.pitch_;
+        on.velocity_ = note.velocity_;
+        on.is_note_on_ = true;
+        events_.push_back(on);
+        
+        //! ノートオフは、ノートの終端位置で送出する。
+        //! (長さが0のノートも、ノートオンより後に並ぶように、1サンプル後ろにずらす)
+        Event off = on;
+        off.pos_ = std::max(note.pos_ + 1, note.GetEndPos());
+        off.velocity_ = note.off_velocity_;
+        off.is_note_on_ = false;
+        events_.push_back(off);
+    }
+    
+    std::stable_sort(events_.begin(), events_.end(), [](Event const &lhs, Event const &rhs) {
+        if(lhs.pos_ != rhs.pos_) { return lhs.pos_ < rhs.pos_; }
+        //! 同じ音程のノートが連続している場合に、前のノートのノートオフで後のノートが止まらないようにする。
+        return !lhs.is_note_on_ && rhs.is_note_on_;
+    });
+}
+
+Sequence::~Sequence()
+{
+    HWM_ASSERT_NOT_IN_REALTIME_SECTION();
+}
+
+NS_HWM_END
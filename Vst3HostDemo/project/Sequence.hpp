@@ -31,11 +31,26 @@ struct Sequence
         SampleCount GetEndPos() const { return pos_ + length_; }
     };
     
-    Sequence(std::vector<Note> notes)
-    : notes_(std::move(notes))
-    {}
+    //! 再生時にカーソルで先頭から順に辿るための、ノートオン/ノートオフのイベント
+    struct Event {
+        SampleCount pos_ = 0;
+        UInt8 channel_ = 0;
+        UInt8 pitch_ = 0;
+        UInt8 velocity_ = 0; // may be an note off velocity.
+        bool is_note_on_ = false;
+    };
+    
+    Sequence(std::vector<Note> notes);
+    ~Sequence();
     
     std::vector<Note> notes_;
+    
+    //! notes_から作成された、pos_の昇順に並んだイベントのリスト
+    //! (同じ位置のイベントはノートオフがノートオンより先に並ぶ)
+    std::vector<Event> const & GetEvents() const { return events_; }
+    
+private:
+    std::vector<Event> events_;
 };
 
 NS_HWM_END
@@ -2,23 +2,6 @@
 
 NS_HWM_BEGIN
 
-template<class F>
-void Transporter::AlterTransportInfo(F f)
-{
-    TransportInfo old_info;
-    TransportInfo new_info;
-    
-    auto lock = lf_.make_lock();
-    old_info = transport_info_;
-    f(transport_info_);
-    new_info = transport_info_;
-    lock.unlock();
-    
-    listeners_.Invoke([&](auto *li) {
-        li->OnChanged(old_info, new_info);
-    });
-}
-
 double GetPPQPos(TransportInfo const &info)
 {
     double sec_pos = info.smp_begin_pos_ / info.sample_rate_;
@@ -45,6 +28,7 @@ std::pair<UInt8, UInt8> GetTimeSignatureAt(double ppq_pos)
 }
 
 Transporter::Transporter()
+:   commands_(kCommandQueueCapacity)
 {}
 
 Transporter::~Transporter()
@@ -62,86 +46,198 @@ void Transporter::RemoveListener(ITransportStateListener const *li)
 
 TransportInfo Transporter::GetCurrentState() const
 {
-    auto lock = lf_.make_lock();
-    return transport_info_;
+    return published_.Load().info_;
 }
 
-void Transporter::MoveTo(SampleCount pos)
+void Transporter::ApplyCommand(State &state, Command const &cmd)
 {
-    AlterTransportInfo([pos, this](TransportInfo &info) {
-        info.smp_begin_pos_ = info.smp_end_pos_ = pos;
-        info.ppq_begin_pos_ = info.ppq_end_pos_ = GetPPQPos(info);
-        smp_last_moved_pos_ = pos;
+    auto &info = state.info_;
+    
+    switch(cmd.type_) {
+        case Command::Type::kMoveTo:
+            info.smp_begin_pos_ = info.smp_end_pos_ = cmd.pos1_;
+            info.ppq_begin_pos_ = info.ppq_end_pos_ = GetPPQPos(info);
+            state.last_moved_pos_ = cmd.pos1_;
+            break;
+        case Command::Type::kRewind: {
+            auto const measure = 4.0 * info.time_sig_numer_ / info.time_sig_denom_;
+            info.ppq_begin_pos_ = info.ppq_end_pos_ = std::max<double>(0, info.ppq_begin_pos_ - measure);
+            info.smp_begin_pos_ = info.smp_end_pos_ = GetSamplePos(info);
+            break;
+        }
+        case Command::Type::kFastForward: {
+            auto const measure = 4.0 * info.time_sig_numer_ / info.time_sig_denom_;
+            info.ppq_begin_pos_ = info.ppq_end_pos_ = info.ppq_begin_pos_ + measure;
+            info.smp_begin_pos_ = info.smp_end_pos_ = GetSamplePos(info);
+            break;
+        }
+        case Command::Type::kSetPlaying:
+            info.playing_ = cmd.flag_;
+            break;
+        case Command::Type::kStop:
+            info.playing_ = false;
+            info.smp_begin_pos_ = info.smp_end_pos_ = state.last_moved_pos_;
+            info.ppq_begin_pos_ = info.ppq_end_pos_ = GetPPQPos(info);
+            break;
+        case Command::Type::kSetLoopRange:
+            info.loop_begin_ = cmd.pos1_;
+            info.loop_end_ = cmd.pos2_;
+            break;
+        case Command::Type::kSetLoopEnabled:
+            info.loop_enabled_ = cmd.flag_;
+            break;
+    }
+}
+
+bool Transporter::PostCommand(Command const &cmd)
+{
+    State old_state;
+    State new_state;
+    
+    {
+        auto lock = lf_.make_lock();
+        
+        if(realtime_ == false) {
+            old_state = state_;
+            new_state = old_state;
+            ApplyCommand(new_state, cmd);
+            new_state.num_applied_commands_ += 1;
+            num_posted_commands_ += 1;
+            
+            state_ = new_state;
+            published_.Store(state_);
+        } else {
+            //! 公開されている状態には、リアルタイムスレッドがまだ適用していないコマンドが含まれていないので、
+            //! それらを適用し直して、先に送信したコマンドを含めた状態を求める。
+            old_state = published_.Load();
+            while(pending_commands_.empty() == false
+                  && pending_commands_.front().first <= old_state.num_applied_commands_)
+            {
+                pending_commands_.pop_front();
+            }
+            for(auto const &pending: pending_commands_) {
+                ApplyCommand(old_state, pending.second);
+            }
+            
+            new_state = old_state;
+            ApplyCommand(new_state, cmd);
+            
+            if(commands_.TryPush(cmd) == false) {
+                hwm::dout << "transport command queue is full." << std::endl;
+                return false;
+            }
+            num_posted_commands_ += 1;
+            pending_commands_.emplace_back(num_posted_commands_, cmd);
+        }
+    }
+    
+    listeners_.Invoke([&](auto *li) {
+        li->OnChanged(old_state.info_, new_state.info_);
     });
+    
+    return true;
 }
 
-void Transporter::Rewind()
+bool Transporter::ApplyQueuedCommands()
 {
-    AlterTransportInfo([](TransportInfo &info) {
-        auto const measure = 4.0 * info.time_sig_numer_ / info.time_sig_denom_;
-        info.ppq_begin_pos_ = info.ppq_end_pos_ = std::max<double>(0, info.ppq_begin_pos_ - measure);
-        info.smp_begin_pos_ = info.smp_end_pos_ = GetSamplePos(info);
-    });
+    bool applied = false;
+    Command cmd;
+    while(commands_.TryPop(cmd)) {
+        ApplyCommand(state_, cmd);
+        state_.num_applied_commands_ += 1;
+        applied = true;
+    }
+    return applied;
 }
 
-void Transporter::FastForward()
+void Transporter::StartRealtimeProcessing()
 {
-    AlterTransportInfo([](TransportInfo &info) {
-        auto const measure = 4.0 * info.time_sig_numer_ / info.time_sig_denom_;
-        info.ppq_begin_pos_ = info.ppq_end_pos_ = info.ppq_begin_pos_ + measure;
-        info.smp_begin_pos_ = info.smp_end_pos_ = GetSamplePos(info);
-    });
+    auto lock = lf_.make_lock();
+    realtime_ = true;
 }
 
-bool Transporter::IsPlaying() const {
+void Transporter::StopRealtimeProcessing()
+{
     auto lock = lf_.make_lock();
-    return transport_info_.playing_;
+    realtime_ = false;
+    
+    //! リアルタイムスレッドが適用しないまま残ったコマンドを、ここで適用する。
+    if(ApplyQueuedCommands()) {
+        published_.Store(state_);
+    }
+    pending_commands_.clear();
 }
 
-void Transporter::SetStop()
+bool Transporter::MoveTo(SampleCount pos)
 {
-    AlterTransportInfo([this](TransportInfo &info) {
-        info.playing_ = false;
-        info.smp_begin_pos_ = info.smp_end_pos_ = smp_last_moved_pos_;
-        info.ppq_begin_pos_ = info.ppq_end_pos_ = GetPPQPos(info);
-    });
+    Command cmd;
+    cmd.type_ = Command::Type::kMoveTo;
+    cmd.pos1_ = pos;
+    return PostCommand(cmd);
 }
 
-void Transporter::SetPlaying(bool is_playing)
+bool Transporter::Rewind()
 {
-    AlterTransportInfo([is_playing](TransportInfo &info) {
-        info.playing_ = is_playing;
-    });
+    Command cmd;
+    cmd.type_ = Command::Type::kRewind;
+    return PostCommand(cmd);
+}
+
+bool Transporter::FastForward()
+{
+    Command cmd;
+    cmd.type_ = Command::Type::kFastForward;
+    return PostCommand(cmd);
 }
 
-void Transporter::SetLoopRange(SampleCount begin, SampleCount end)
+bool Transporter::IsPlaying() const {
+    return GetCurrentState().playing_;
+}
+
+bool Transporter::SetStop()
+{
+    Command cmd;
+    cmd.type_ = Command::Type::kStop;
+    return PostCommand(cmd);
+}
+
+bool Transporter::SetPlaying(bool is_playing)
+{
+    Command cmd;
+    cmd.type_ = Command::Type::kSetPlaying;
+    cmd.flag_ = is_playing;
+    return PostCommand(cmd);
+}
+
+bool Transporter::SetLoopRange(SampleCount begin, SampleCount end)
 {
     assert(0 <= begin);
     assert(begin <= end);
     
-    AlterTransportInfo([begin, end](TransportInfo &info) {
-        info.loop_begin_ = begin;
-        info.loop_end_ = end;
-    });
+    Command cmd;
+    cmd.type_ = Command::Type::kSetLoopRange;
+    cmd.pos1_ = begin;
+    cmd.pos2_ = end;
+    return PostCommand(cmd);
 }
 
-void Transporter::SetLoopEnabled(bool enabled)
+bool Transporter::SetLoopEnabled(bool enabled)
 {
-    AlterTransportInfo([enabled](TransportInfo &info) {
-        info.loop_enabled_ = enabled;
-    });
+    Command cmd;
+    cmd.type_ = Command::Type::kSetLoopEnabled;
+    cmd.flag_ = enabled;
+    return PostCommand(cmd);
 }
 
 std::pair<SampleCount, SampleCount> Transporter::GetLoopRange() const
 {
-    auto lock = lf_.make_lock();
-    return std::pair{ transport_info_.loop_begin_, transport_info_.loop_end_ };
+    auto const info = GetCurrentState();
+    return std::pair{ info.loop_begin_, info.loop_end_ };
 }
 
 bool Transporter::IsLoopEnabled() const
 {
-    auto lock = lf_.make_lock();
-    return transport_info_.loop_enabled_;
+    return GetCurrentState().loop_enabled_;
 }
 
 NS_HWM_END
@@ -1,13 +1,33 @@
 #pragma once
 
+#include <deque>
 #include <utility>
 #include <mutex>
+#include <type_traits>
 #include "../misc/LockFactory.hpp"
 #include "TransportInfo.hpp"
 #include "../misc/ListenerService.hpp"
+#include "../misc/SeqLock.hpp"
+#include "../misc/MPSCQueue.hpp"
 
 NS_HWM_BEGIN
 
+//! トランスポートの状態を管理するクラス
+/*! 状態はシーケンスロックで公開され、GetCurrentState()などの読み込みはリアルタイムスレッドと競合しない。
+ *
+ *  リアルタイム処理中(StartRealtimeProcessing()からStopRealtimeProcessing()までの間)は、
+ *  MoveTo()などの状態を変更する操作はPOD形式のコマンドとしてキューに追加され、
+ *  Traverserがブロックの先頭でまとめて適用する。
+ *  これによって、リアルタイムスレッドは状態の取得と更新をロックせずに行える。
+ *  リアルタイム処理中でない場合は、呼び出したスレッド上ですぐに適用される。
+ *
+ *  ITransportStateListener::OnChanged()は、操作を呼び出したスレッド上で、
+ *  コマンドを適用した結果として予想される状態を渡して呼び出される。
+ *  予想される状態は、公開されている状態に、まだ適用されていない送信済みのコマンドと今回のコマンドを適用して求める。
+ *
+ *  状態を変更する操作は、コマンドのキューが一杯で操作を受け付けられなかった場合にfalseを返す。
+ *  (その場合、状態は変更されず、リスナーも呼び出されない)
+ */
 class Transporter
 {
 public:
@@ -35,27 +55,81 @@ public:
     void AddListener(ITransportStateListener *li);
     void RemoveListener(ITransportStateListener const *li);
     
-    void MoveTo(SampleCount pos);
+    bool MoveTo(SampleCount pos);
     //! jump 1 measure before
-    void Rewind();
+    bool Rewind();
     //! jump 1 measure after
-    void FastForward();
+    bool FastForward();
     bool IsPlaying() const;
-    void SetPlaying(bool is_playing);
-    void SetStop();
-    void SetLoopRange(SampleCount begin, SampleCount end);
-    void SetLoopEnabled(bool enabled);
+    bool SetPlaying(bool is_playing);
+    bool SetStop();
+    bool SetLoopRange(SampleCount begin, SampleCount end);
+    bool SetLoopEnabled(bool enabled);
     std::pair<SampleCount, SampleCount> GetLoopRange() const;
     bool IsLoopEnabled() const;
+    
+    //! リアルタイム処理の開始と終了を通知する。
+    /*! StartRealtimeProcessing()からStopRealtimeProcessing()までの間は、
+     *  状態の更新はTraverserだけが行い、他のスレッドからの操作はキューを経由して適用される。
+     *  Traverser::Traverse()は、この間だけ呼び出すこと。
+     */
+    void StartRealtimeProcessing();
+    void StopRealtimeProcessing();
 
 private:
-    LockFactory lf_;    
-    TransportInfo transport_info_;
+    struct State
+    {
+        TransportInfo info_;
+        SampleCount last_moved_pos_ = 0;
+        //! この状態に適用済みのコマンドの数
+        UInt64 num_applied_commands_ = 0;
+    };
+    
+    //! SeqLockで公開するために、トリビアルにコピー可能でなければならない。
+    static_assert(std::is_trivially_copyable<State>::value, "State must be trivially copyable");
+    
+    //! 状態を変更する操作を表すPOD
+    struct Command
+    {
+        enum class Type : UInt8 {
+            kMoveTo,
+            kRewind,
+            kFastForward,
+            kSetPlaying,
+            kStop,
+            kSetLoopRange,
+            kSetLoopEnabled,
+        };
+        
+        Type type_ = Type::kMoveTo;
+        bool flag_ = false;
+        SampleCount pos1_ = 0;
+        SampleCount pos2_ = 0;
+    };
+    
+    static constexpr UInt32 kCommandQueueCapacity = 256;
+    
+    //! 状態を書き込めるスレッドを一つに限定するためのロック。リアルタイムスレッドは使用しない。
+    LockFactory lf_;
+    //! lf_で保護される
+    bool realtime_ = false;
+    //! 最新の状態。
+    //! リアルタイム処理中はTraverserだけが、そうでない場合はlf_をロックしたスレッドだけがアクセスする。
+    State state_;
+    SeqLock<State> published_;
+    MPSCQueue<Command> commands_;
+    //! lf_で保護される。これまでに送信したコマンドの数
+    UInt64 num_posted_commands_ = 0;
+    //! lf_で保護される。リアルタイム処理中に送信したコマンドと、その通し番号(1から始まる)。
+    //! 公開されている状態に適用済みのものは、次のPostCommand()で取り除く。
+    std::deque<std::pair<UInt64, Command>> pending_commands_;
     ListenerService<ITransportStateListener> listeners_;
-    SampleCount smp_last_moved_pos_ = 0;
-
-    template<class F>
-    void AlterTransportInfo(F f);
+    
+    //! @return キューが一杯でコマンドを追加できなかった場合はfalse
+    bool PostCommand(Command const &cmd);
+    static void ApplyCommand(State &state, Command const &cmd);
+    //! キューに溜まったコマンドを適用する。適用したコマンドがあればtrueを返す。
+    bool ApplyQueuedCommands();
 };
 
 NS_HWM_END
@@ -11,15 +11,17 @@ Transporter::Traverser::Traverser()
 
 void Transporter::Traverser::Traverse(Transporter *tp, SampleCount length, ITraversalCallback *cb)
 {
+    //! 他のスレッドからの操作は、ブロックの先頭でまとめて適用する。
+    //! tp->state_はリアルタイム処理中はこのスレッドだけがアクセスするので、ロックは不要。
+    auto &current = tp->state_.info_;
+    if(tp->ApplyQueuedCommands()) {
+        tp->published_.Store(tp->state_);
+    }
+    
     SampleCount remain = length;
     
     for( ; remain > 0 ; ) {
-        TransportInfo ti;
-        {
-            auto lock = tp->lf_.make_lock();
-            ti = tp->transport_info_;
-        }
-        TransportInfo const orig = ti;
+        TransportInfo ti = current;
         
         bool need_jump_to_begin = false;
         
@@ -46,25 +48,19 @@ void Transporter::Traverser::Traverse(Transporter *tp, SampleCount length, ITrav
         
         cb->Process(ti);
         
-        auto lock = tp->lf_.make_lock();
-        auto &current = tp->transport_info_;
-        if(current.smp_begin_pos_ == orig.smp_begin_pos_ &&
-           current.ppq_begin_pos_ == orig.ppq_begin_pos_)
-        {
-            if(need_jump_to_begin) {
-                current.smp_begin_pos_ = current.smp_end_pos_ = ti.loop_begin_;
-                current.ppq_begin_pos_ = current.ppq_begin_pos_ = GetPPQPos(current);
-            } else if(current.playing_) {
-                current.smp_begin_pos_ = current.smp_end_pos_ = ti.smp_end_pos_;
-                current.ppq_begin_pos_ = current.ppq_end_pos_ = ti.ppq_end_pos_;
-            } else {
-                current.smp_begin_pos_ = ti.smp_begin_pos_;
-                current.smp_end_pos_ = ti.smp_end_pos_;
-                current.ppq_begin_pos_ = ti.ppq_begin_pos_;
-                current.ppq_end_pos_ = ti.ppq_end_pos_;
-            }
-        } // 再生位置が変わったときは、currentの状態をそのまま次回の再生に使用する
-        lock.unlock();
+        if(need_jump_to_begin) {
+            current.smp_begin_pos_ = current.smp_end_pos_ = ti.loop_begin_;
+            current.ppq_begin_pos_ = current.ppq_end_pos_ = GetPPQPos(current);
+        } else if(current.playing_) {
+            current.smp_begin_pos_ = current.smp_end_pos_ = ti.smp_end_pos_;
+            current.ppq_begin_pos_ = current.ppq_end_pos_ = ti.ppq_end_pos_;
+        } else {
+            current.smp_begin_pos_ = ti.smp_begin_pos_;
+            current.smp_end_pos_ = ti.smp_end_pos_;
+            current.ppq_begin_pos_ = ti.ppq_begin_pos_;
+            current.ppq_end_pos_ = ti.ppq_end_pos_;
+        }
+        tp->published_.Store(tp->state_);
         
         remain -= (ti.smp_end_pos_ - ti.smp_begin_pos_);
     }